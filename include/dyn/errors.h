@@ -30,17 +30,33 @@
 namespace dyn {
 
 constexpr DyneErr kDyneErrBaseFrames = -48000;  // Frames errors
+constexpr DyneErr kDyneErrBaseInterpreter = -48800;  // Interpreter errors
 
 // ---- Object system errors...
 
+constexpr DyneErr kDyneErrOutOfRange        { kDyneErrBaseFrames - 205 };  // Value out of range
 constexpr DyneErr kDyneErrObjectReadOnly    { kDyneErrBaseFrames - 214 };  // Object is read-only
 
 // ----  Bad type errors...
 
 constexpr DyneErr kDyneErrNotAFrame         { kDyneErrBaseFrames - 400 };  // Expected a frame
 constexpr DyneErr kDyneErrNotAnArray        { kDyneErrBaseFrames - 401 };  // Expected an array
+constexpr DyneErr kDyneErrNotANumber        { kDyneErrBaseFrames - 404 };  // Expected a number
+constexpr DyneErr kDyneErrNotAnInteger      { kDyneErrBaseFrames - 406 };  // Expected an integer
+constexpr DyneErr kDyneErrNotAPathExpr      { kDyneErrBaseFrames - 409 };  // Expected a path expression
 constexpr DyneErr kDyneErrNotASymbol        { kDyneErrBaseFrames - 410 };  // Expected a symbol
 
+// ---- Interpreter errors...
+
+constexpr DyneErr kDyneErrNotAFunction      { kDyneErrBaseInterpreter - 2 };   // Expected a function
+constexpr DyneErr kDyneErrWrongNumberOfArgs { kDyneErrBaseInterpreter - 3 };   // Wrong number of arguments
+constexpr DyneErr kDyneErrInvalidBytecode   { kDyneErrBaseInterpreter - 4 };   // Invalid or unsupported bytecode
+constexpr DyneErr kDyneErrUndefinedVariable { kDyneErrBaseInterpreter - 7 };   // Undefined variable
+constexpr DyneErr kDyneErrUndefinedGlobalFunction { kDyneErrBaseInterpreter - 8 };  // Undefined global function
+constexpr DyneErr kDyneErrUndefinedMethod   { kDyneErrBaseInterpreter - 9 };   // Undefined method
+constexpr DyneErr kDyneErrStackOverflow     { kDyneErrBaseInterpreter - 11 };  // Interpreter stack overflow
+constexpr DyneErr kDyneErrDivideByZero      { kDyneErrBaseInterpreter - 12 };  // Division by zero
+
 } // namespace dyn
 
 #endif // DYN_ERRORS_H
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_IO_CXX_H
+#define DYN_IO_CXX_H
+
+#include <dyn/ref.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dyn {
+
+class Object;
+
+namespace io {
+
+class CxxWriter
+{
+  std::string name_;
+  std::unordered_map<const dyn::Object*, uint32_t> id_ { };
+  std::unordered_map<std::string, uint32_t> symbols_ { };
+  std::vector<const dyn::Object*> objects_ { };
+  std::vector<bool> is_map_ { };
+
+  uint32_t id_of_(const dyn::Object *obj, bool is_map = false);
+  std::string ref_(Ref r);
+  void write_object_(std::ostream &out, uint32_t id);
+
+public:
+  CxxWriter(const std::string &name);
+  int write(RefArg root, std::ostream &header, std::ostream &source, const std::string &header_name);
+  int write(RefArg root, const std::string &header_file, const std::string &source_file);
+};
+
+} // namespace io
+
+} // namespace dyn
+
+#endif // DYN_IO_CXX_H
@@ -0,0 +1,86 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_IO_EXPORT_H
+#define DYN_IO_EXPORT_H
+
+#include <dyn/ref.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dyn {
+
+class Object;
+
+namespace io {
+
+class Exporter
+{
+public:
+  enum class Format: uint8_t { JsonLines, Binary };
+  static constexpr size_t kBufferSize = 64 * 1024;
+
+private:
+  Format format_;
+  std::FILE *out_ { nullptr };
+  std::string buffer_ { };
+  std::unordered_map<const dyn::Object*, uint32_t> id_ { };
+  std::vector<const dyn::Object*> todo_ { };
+  size_t next_todo_ { 0 };
+  uint64_t records_ { 0 };
+
+  uint32_t id_of_(const dyn::Object *obj);
+  bool is_inline_(const dyn::Object *obj) const;
+  void put_(char c) { buffer_.push_back(c); }
+  void put_(const char *s, size_t n) { buffer_.append(s, n); }
+  template<size_t N> void put_(const char (&s)[N]) { buffer_.append(s, N-1); }
+  void put_(const std::string &s) { buffer_.append(s); }
+  void put_varint_(uint64_t v);
+  void put_json_string_(const char *s, size_t n);
+  void put_value_(const dyn::Ref &ref);
+  void put_record_(const dyn::Object *obj);
+  void maybe_flush_();
+
+public:
+  Exporter(std::FILE *out, Format format = Format::JsonLines);
+  ~Exporter();
+  Exporter(Exporter const& rhs) = delete;
+  Exporter& operator=(Exporter const& rhs) = delete;
+
+  void write(const dyn::Ref &root);
+  void flush();
+  uint64_t records() const { return records_; }
+};
+
+int Export(const dyn::Ref &root, const std::string &filename, Exporter::Format format);
+
+} // namespace io
+
+} // namespace dyn
+
+#endif // DYN_IO_EXPORT_H
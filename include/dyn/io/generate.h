@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_IO_GENERATE_H
+#define DYN_IO_GENERATE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dyn::io {
+
+class Generator
+{
+public:
+  struct Options {
+    uint32_t seed { 1 };
+    uint32_t num_objects { 1000 };  // frames, arrays, strings, and binaries per part
+    uint32_t frame_width { 8 };
+    uint32_t depth { 4 };
+    uint32_t symbol_reuse { 90 };   // percent of frames that use the slot names of an earlier frame
+    uint32_t binary_size { 64 };    // maximum size of a binary object in bytes
+    uint32_t num_parts { 1 };
+    bool package1 { true };
+    bool relocation { false };
+  };
+
+private:
+  struct Node {
+    enum class Kind: uint8_t { Int, Frame, Array, String, Binary };
+    Kind kind;
+    int32_t value;                 // Int: the value, Frame: the shape
+    uint32_t size;                 // String: characters, Binary: bytes
+    std::vector<uint32_t> slots;   // child nodes of a Frame or Array
+  };
+
+  Options opt_;
+  uint32_t random_state_ { 1 };
+  std::vector<Node> nodes_ { };
+  std::vector<std::vector<uint32_t>> shapes_ { };
+  std::vector<std::string> symbols_ { };
+
+  uint32_t random_(uint32_t n);
+  void build_(uint32_t part);
+  uint32_t node_(uint32_t depth, uint32_t &budget);
+  std::vector<uint8_t> payload_(const Node &node);
+  std::vector<uint8_t> part_(uint32_t start, std::vector<uint32_t> &pointers);
+
+public:
+  Generator(const Options &options);
+  std::vector<uint8_t> package();
+  std::vector<uint8_t> nsof();
+  int write_package(const std::string &filename);
+  int write_nsof(const std::string &filename);
+};
+
+} // namespace dyn::io
+
+#endif // DYN_IO_GENERATE_H
@@ -27,6 +27,14 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <unordered_map>
+
+namespace dyn {
+
+class Object;
+class Ref;
+
+} // namespace dyn
 
 namespace dyn::io {
 
@@ -40,6 +48,8 @@ public:
   uint32_t current_depth_{ 0 };
   std::FILE *out_{ nullptr };
   bool sym_next_{ false };
+  std::unordered_map<const dyn::Object*, uint32_t> label_{ };
+  uint32_t next_label_{ 0 };
 public:
   PrintState(std::FILE *fout);
   ~PrintState();
@@ -49,6 +59,8 @@ public:
   void decr_depth();
   void expect_symbol(bool s) { sym_next_ = s; }
   bool symbol_expected() { return sym_next_; }
+  void scan(const dyn::Ref &root);
+  bool label(const dyn::Object *obj);
 };
 
 } // namespace dyn::io
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_IO_SNAPSHOT_H
+#define DYN_IO_SNAPSHOT_H
+
+#include <dyn/ref.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dyn {
+
+struct LargeBinaryInfo;
+
+namespace io {
+
+class Snapshot
+{
+  struct Writer;
+  uint8_t *image_ { nullptr };
+  size_t size_ { 0 };
+  bool mapped_ { false };
+  Ref root_ { RefNIL };
+  std::vector<LargeBinaryInfo*> infos_ { };
+  int relocate_();
+
+public:
+  Snapshot() = default;
+  ~Snapshot();
+  Snapshot(Snapshot const& rhs) = delete;
+  Snapshot& operator=(Snapshot const& rhs) = delete;
+
+  static int write(RefArg root, std::vector<uint8_t> &image);
+  static int write(RefArg root, const std::string &file_name);
+  static void use_as_magic_pointers(int table, const std::string &file_name);
+  int load(const std::string &file_name);
+  int load(const uint8_t *data, size_t size);
+  void close();
+  Ref root() const { return root_; }
+  size_t size() const { return size_; }
+};
+
+} // namespace io
+
+} // namespace dyn
+
+#endif // DYN_IO_SNAPSHOT_H
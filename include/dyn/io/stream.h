@@ -25,25 +25,44 @@
 #ifndef DYN_IO_STREAM_H
 #define DYN_IO_STREAM_H
 
-#include <dyn/io/package/package_bytes.h>
+#include <dyn/ref.h>
 
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace dyn {
 
-class Ref;
-
 namespace io {
 
+class StreamSource;
+class StreamParser;
+class StreamEvent;
+
 class StreamReader
 {
-  std::shared_ptr<PackageBytes> bytes_ { nullptr };
-  dyn::Ref read_next_();
-  std::vector<dyn::Ref> precedent_;
+  struct Open {
+    dyn::Ref obj;
+    uint32_t precedent;
+    uint8_t role;
+    uint32_t index;
+    std::string text;
+  };
+  std::unique_ptr<StreamSource> source_ { };
+  std::unique_ptr<StreamParser> parser_ { };
+  std::vector<dyn::Ref> precedent_ { };
+  std::vector<Open> open_ { };
+  dyn::Ref root_ { dyn::RefNIL };
+  void place_(const StreamEvent &ev, dyn::Ref value);
+  void place_(uint8_t role, uint32_t index, dyn::Ref value);
+  void set_precedent_(uint32_t id, dyn::Ref value);
 public:
   StreamReader();
   ~StreamReader();
   int open(const std::string &filename);
+  int open(int fd, bool owns_fd = false);
+  int open(const uint8_t *data, size_t size);
+  int open(std::unique_ptr<StreamSource> source);
   dyn::Ref read();
   void close();
   static dyn::Ref read(const std::string &filename);
@@ -0,0 +1,114 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_IO_STREAM_STREAM_PARSER_H
+#define DYN_IO_STREAM_STREAM_PARSER_H
+
+#include <dyn/ref.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dyn::io {
+
+class StreamSource;
+
+class StreamEvent
+{
+public:
+  enum class Type: uint8_t {
+    Immediate, Precedent, Symbol,
+    BeginBinary, BinaryData, EndBinary,
+    BeginString, StringData, EndString,
+    BeginArray, EndArray, BeginFrame, EndFrame,
+    SmallRect, BeginLargeBinary, LargeBinaryHeader,
+    EndOfStream, Error
+  };
+  enum class Role: uint8_t {
+    Root, Class, Tag, Slot
+  };
+  Type type { Type::Error };
+  Role role { Role::Root };
+  uint32_t index { 0 };
+  uint32_t length { 0 };
+  uint32_t precedent { 0 };
+  dyn::Ref ref { dyn::RefNIL };
+  const uint8_t *data { nullptr };
+  size_t size { 0 };
+  const uint8_t *extra { nullptr };
+  size_t extra_size { 0 };
+  bool compressed { false };
+};
+
+class StreamParser
+{
+  enum class Ctx: uint8_t {
+    Root, Binary, LargeBinary, Array, PlainArray, FrameTags, FrameValues, String
+  };
+  struct Context {
+    Ctx ctx;
+    bool class_pending;
+    uint32_t length;
+    uint32_t index;
+  };
+
+  StreamSource *source_ { nullptr };
+  const uint8_t *cur_ { nullptr };
+  const uint8_t *end_ { nullptr };
+  uint64_t pos_ { 0 };
+  uint32_t next_precedent_ { 0 };
+  std::vector<Context> stack_ { };
+  std::vector<uint8_t> scratch_ { };
+  std::string error_ { };
+
+  bool ensure_();
+  bool get_ubyte_(uint8_t &v);
+  bool get_ushort_(uint16_t &v);
+  bool get_uint_(uint32_t &v);
+  bool get_xlong_(uint32_t &v);
+  bool get_bytes_(uint8_t *dst, size_t n);
+  bool fail_(const std::string &msg, StreamEvent &ev);
+  void child_done_();
+  void set_role_(StreamEvent &ev);
+  bool begin_object_(StreamEvent &ev);
+  bool large_binary_header_(StreamEvent &ev);
+
+public:
+  StreamParser(StreamSource &source);
+  ~StreamParser() = default;
+  StreamParser(StreamParser const& rhs) = delete;
+  StreamParser& operator=(StreamParser const& rhs) = delete;
+
+  bool next(StreamEvent &ev);
+  bool skip();
+  size_t depth() const { return stack_.size(); }
+  uint64_t tell() const { return pos_; }
+  const std::string &error() const { return error_; }
+};
+
+} // namespace dyn::io
+
+#endif // DYN_IO_STREAM_STREAM_PARSER_H
+
@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_IO_STREAM_STREAM_SOURCE_H
+#define DYN_IO_STREAM_STREAM_SOURCE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dyn::io {
+
+class StreamSource
+{
+public:
+  StreamSource() = default;
+  virtual ~StreamSource() = default;
+  StreamSource(StreamSource const& rhs) = delete;
+  StreamSource& operator=(StreamSource const& rhs) = delete;
+  virtual bool fill(const uint8_t *&data, size_t &size) = 0;
+  virtual bool persistent() const { return false; }
+  virtual std::shared_ptr<const void> retain() { return nullptr; }
+};
+
+class MemorySource : public StreamSource
+{
+  std::vector<std::pair<const uint8_t*, size_t>> chain_ { };
+  size_t next_ { 0 };
+  bool persistent_ { false };
+public:
+  MemorySource() = default;
+  MemorySource(const uint8_t *data, size_t size, bool persistent = false);
+  ~MemorySource() override = default;
+  void append(const uint8_t *data, size_t size);
+  bool fill(const uint8_t *&data, size_t &size) override;
+  bool persistent() const override { return persistent_; }
+};
+
+class FileSource : public StreamSource
+{
+  int fd_ { -1 };
+  bool owns_fd_ { false };
+  std::vector<uint8_t> buffer_;
+public:
+  static constexpr size_t kDefaultChunkSize = 64 * 1024;
+  FileSource(int fd, bool owns_fd = false, size_t chunk_size = kDefaultChunkSize);
+  ~FileSource() override;
+  bool fill(const uint8_t *&data, size_t &size) override;
+};
+
+class MappedSource : public StreamSource
+{
+  int fd_ { -1 };
+  size_t file_size_ { 0 };
+  size_t window_size_ { 0 };
+  size_t offset_ { 0 };
+  std::shared_ptr<void> window_ { };
+public:
+  static constexpr size_t kDefaultWindowSize = 16 * 1024 * 1024;
+  MappedSource(const std::string &filename, size_t window_size = kDefaultWindowSize);
+  ~MappedSource() override;
+  bool is_mapped() const { return fd_ != -1; }
+  bool fill(const uint8_t *&data, size_t &size) override;
+  bool persistent() const override { return true; }
+  std::shared_ptr<const void> retain() override { return window_; }
+};
+
+} // namespace dyn::io
+
+#endif // DYN_IO_STREAM_STREAM_SOURCE_H
+
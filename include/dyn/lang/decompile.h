@@ -26,6 +26,9 @@
 #define DYN_LANG_DECOMPILE_H
 
 #include <dyn/ref.h>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
 #include <vector>
 
 namespace dyn {
@@ -41,8 +44,10 @@ constexpr PC kInvalidPC = (PC)-1;
 
 /**
  Enum of all available Dyne bytecodes.
+ The last row are superinstructions that only the interpreter's optimizer
+ creates, see dyn::vm::optimize().
  */
-enum class BC {
+enum class BC : uint8_t {
   EndOfFile,       Pop,             Dup,             Return,
   PushSelf,        SetLexScope,     IterNext,        IterDone,
   PopHandlers,     Push,            PushConst,       Call,
@@ -57,22 +62,65 @@ enum class BC {
   GreaterThan,     GreaterOrEqual,  LessOrEqual,     BitAnd,
   BitOr,           BitNot,          NewIter,         Length,
   Clone,           SetClass,        AddArraySlot,    Stringer,
-  HasPath,         ClassOf,         NewHandler,      Unknown
+  HasPath,         ClassOf,         NewHandler,
+  ReturnConst,     ReturnVar,       GetVar2,         SetVarConst,
+  AddVarConst,     CompareBranch,   Unknown
 };
 
 /**
  Verbose version of a Dyne bytecode instruction including labels.
+ The opcode, the number of branches to this instruction, and the argument
+ fit into 8 bytes. The PC of an instruction is its index in the
+ instruction array.
  */
 typedef struct {
   BC bc;
-  int arg;
-  PC pc;
-  int references;
+  uint16_t references;
+  int32_t arg;
 } Bytecode;
 
+static_assert(sizeof(Bytecode) == 8, "Bytecode must stay compact");
+
 void print_bytecode(std::vector<Bytecode> &func);
+
+const char *bc_name(BC bc);
+
+/**
+ Decompile a NewtonScript function.
+ \param[in] func a function frame with an 'instructions binary
+ \return the source code as a string, or NIL
+ */
 Ref decompile(RefArg func);
 
+/**
+ Decompile a NewtonScript function without debug output.
+ This version can be called from multiple threads at the same time.
+ \param[in] func a function frame with an 'instructions binary
+ \param[out] log receives errors and warnings
+ \return the source code as a string, or NIL
+ */
+Ref decompile(RefArg func, std::ostream &log);
+
+/**
+ Decompile a NewtonScript function and find the source line of every
+ instruction.
+ \param[in] func a function frame with an 'instructions binary
+ \param[out] log receives errors and warnings
+ \param[out] line_of_pc for every PC of the transcoded function, the line
+    of the innermost statement that contains it, starting at 1, or 0
+ \return the source code as a string, or NIL
+ */
+Ref decompile(RefArg func, std::ostream &log, std::vector<int> &line_of_pc);
+
+/**
+ Decompile all functions in a package in parallel.
+ \param[in] pkg a package as returned by dyn::io::Package::toNOS()
+ \param[in] out_dir write one source file per part into this directory
+ \param[in] num_threads number of worker threads, 0 for one per core
+ \return number of functions, or -1 if a file could not be written
+ */
+int decompile_package(RefArg pkg, const std::string &out_dir, unsigned num_threads = 0);
+
 } // lang
 
 } // dyn
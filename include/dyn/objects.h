@@ -27,6 +27,9 @@
 
 #include <dyn/ref.h>
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <stdexcept>
@@ -39,16 +42,22 @@ class Array;
 class Frame;
 class Map;
 class Symbol;
+class LargeBinaryObject;
+class CompactHeap;
+struct LargeBinaryInfo;
 
 namespace io {
 
 class PrintState;
+class Snapshot;
 
 } // namespace io
 
 class alignas(uintptr_t) Object
 {
   friend class Ref;
+  friend class io::Snapshot;
+  friend class CompactHeap;
 
 protected:
   enum class Tag: uint8_t {
@@ -62,7 +71,7 @@ protected:
     uint8_t type1_:1;
     uint8_t type2_:1;
     uint8_t marked_:1;
-    uint8_t locked_:1;
+    uint8_t compact_:1;
     uint8_t forward_:1;
     uint8_t read_only_:1;
     uint8_t dirty_:1;
@@ -83,14 +92,15 @@ protected:
 
   typedef struct {
     Ref    class_;
-//    const  IndirectBinaryProcs * procs;
     char   *data_;
+    LargeBinaryInfo *info_;
   } LargeBinary_;
 
   typedef struct {
     Ref    class_;
     Ref    *slot_;
     uint32_t reserve_;
+    uint32_t version_;        // number of tags added in place, if this is a map
   } Array_;
 
   typedef struct {
@@ -147,21 +157,25 @@ protected:
   static constexpr uint32_t _hash(const char* str) {
     return _hash1(str) * 0x9E3779B9;
   }
+  // Objects that are compiled into the program can also be read-only.
+  static constexpr uint8_t _flags(bool read_only) {
+    return read_only ? 0x18 : 0x10;
+  }
 
-  constexpr Object(const Binary_ a, uint32_t size)
-  : t { Tag::binary, 0x10 },
+  constexpr Object(const Binary_ a, uint32_t size, bool read_only = false)
+  : t { Tag::binary, _flags(read_only) },
   size_ { size },
   binary { a }
   { }
 
-  constexpr Object(const Array_ a, uint32_t num_slots)
-  : t { Tag::array, 0x10 },
+  constexpr Object(const Array_ a, uint32_t num_slots, bool read_only = false)
+  : t { Tag::array, _flags(read_only) },
     size_ { static_cast<uint32_t>(num_slots*sizeof(Ref)) },
     array { a }
   { }
 
-  constexpr Object(const Frame_ f, uint32_t num_slots)
-  : t { Tag::frame, 0x10 },
+  constexpr Object(const Frame_ f, uint32_t num_slots, bool read_only = false)
+  : t { Tag::frame, _flags(read_only) },
     size_ { static_cast<uint32_t>(num_slots*sizeof(Ref)) },
     frame { f }
   { }
@@ -172,17 +186,26 @@ protected:
   frame { f }
   { }
 
-  constexpr Object(const Symbol_ sym_arg)
-  : t { Tag::symbol, 0x10 },
+  Object(const LargeBinary_ a, uint32_t size)
+  : t { Tag::large_binary, 0x10 },
+  size_ { size },
+  lbo { a }
+  { }
+
+  constexpr Object(const Symbol_ sym_arg, bool read_only = false)
+  : t { Tag::symbol, _flags(read_only) },
     size_ { static_cast<uint32_t>(_strlen(sym_arg.string_)+1) },
     symbol { sym_arg }
   { }
 
 public:
 
-  constexpr Object(const char *str);
+  constexpr Object(const char *str, bool read_only = false);
   Object(const std::string &str);
-  constexpr Object(Real value);
+  constexpr Object(Real value, bool read_only = false);
+  constexpr Object(Ref obj_class, Real value, bool read_only = false)
+  : t { Tag::real, _flags(read_only) }, size_{ 0 }, real { obj_class, value }
+  { }
 
   Index size() const { return size_; }
   uint32_t gc() const { return gc_; }
@@ -191,9 +214,15 @@ public:
   constexpr bool IsArray() const { return (t.tag_ == Tag::array); }
   constexpr bool IsFrame() const { return (t.tag_ == Tag::frame); }
   constexpr bool IsSymbol() const { return (t.tag_ == Tag::symbol); }
+  constexpr bool IsLargeBinary() const { return (t.tag_ == Tag::large_binary); }
+  constexpr bool IsReal() const { return (t.tag_ == Tag::real); }
+  Real GetReal() const { return real.value_; }
   constexpr bool IsReadOnly() const { return (f.read_only_ == 1); }
+  constexpr bool IsCompact() const { return (f.compact_ == 1); }
 
   int SymbolCompare(const Object *other) const;
+  Ref GetClass() const;
+  void SetClass(RefArg theClass);
 
   int Print(dyn::io::PrintState &ps) const;
   std::string ToString() const;
@@ -204,40 +233,78 @@ class BinaryObject: public Object
 public:
   BinaryObject(RefArg theClass, Index size, void *data)
   : Object( Binary_{ theClass, (char*)data }, (uint32_t)size ) { }
+  constexpr BinaryObject(Ref theClass, uint32_t size, const char *data, bool read_only = false)
+  : Object( Binary_{ theClass, const_cast<char*>(data) }, size, read_only ) { }
   void *Data() { return (void*)binary.data_; }
 };
 
+struct LargeBinaryInfo
+{
+  size_t size_ { 0 };
+  bool owned_ { false };
+  Ref compander_ { RefNIL };
+  std::vector<uint8_t> params_ { };
+  std::shared_ptr<const void> owner_ { };
+};
+
+class LargeBinaryObject: public Object
+{
+public:
+  LargeBinaryObject(RefArg theClass);
+  size_t Length() const { return lbo.info_->size_; }
+  void *Data() { return (void*)lbo.data_; }
+  bool IsView() const { return lbo.data_ && !lbo.info_->owned_; }
+  bool IsCompressed() const { return lbo.info_->compander_.IsNotNIL(); }
+  Ref Compander() const { return lbo.info_->compander_; }
+  const std::vector<uint8_t> &CompanderParams() const { return lbo.info_->params_; }
+  void SetView(const void *data, size_t size, std::shared_ptr<const void> owner = nullptr);
+  void *Allocate(size_t size);
+  void SetCompander(RefArg name, const uint8_t *params, size_t params_size);
+};
+
 class SlottedObject: public Object
 {
 public:
-  constexpr SlottedObject(const Array_ a, uint32_t num_slots)
-  : Object { a, num_slots } { }
-  constexpr SlottedObject(const Frame_ f, uint32_t num_slots)
-  : Object { f, num_slots } { }
+  constexpr SlottedObject(const Array_ a, uint32_t num_slots, bool read_only = false)
+  : Object { a, num_slots, read_only } { }
+  constexpr SlottedObject(const Frame_ f, uint32_t num_slots, bool read_only = false)
+  : Object { f, num_slots, read_only } { }
   Index Length() const;
   void SetLength(Index new_length);
   Ref GetSlot(Index i) const;
   void SetSlot(Index ix, RefArg value);
+  void Widen();
+  Ref *Slots() { if (f.compact_) Widen(); return array.slot_; }
 };
 
 class Array: public SlottedObject
 {
 public:
-  constexpr Array(Ref obj_class, uint32_t num_slots, const Ref *values)
-  : SlottedObject( Array_{ obj_class, const_cast<Ref*>(values), 0 }, num_slots) { }
+  constexpr Array(Ref obj_class, uint32_t num_slots, const Ref *values, bool read_only = false)
+  : SlottedObject( Array_{ obj_class, const_cast<Ref*>(values), 0, 0 }, num_slots, read_only) { }
   Array(RefArg theClass);
   Array(RefArg theClass, Index length);
   int Print(dyn::io::PrintState &ps) const;
   Index AddSlot(RefArg value);
+  Ref Clone() const;
 };
 
+constexpr int kMapSorted = 1;
+constexpr int kMapShared = 2;
+constexpr int kMapProto = 4;
+
 class Map: public Array
 {
+  static std::atomic<uint32_t> epoch_;
 public:
-  constexpr Map(Ref obj_class, uint32_t num_slots, const Ref *values)
-  : Array{obj_class, num_slots, values } { }
+  constexpr Map(Ref obj_class, uint32_t num_slots, const Ref *values, bool read_only = false)
+  : Array{obj_class, num_slots, values, read_only } { }
   Map(RefArg theClass);
   Map(RefArg theClass, Index length);
+  uint32_t Version() const { return array.version_; }
+  void Changed() { ++array.version_; }
+  static uint32_t Epoch() { return epoch_.load(std::memory_order_relaxed); }
+  static void InheritanceChanged() { epoch_.fetch_add(1, std::memory_order_relaxed); }
 };
 
 class Frame: public SlottedObject
@@ -245,19 +312,26 @@ class Frame: public SlottedObject
 public:
   constexpr Frame(Map *map, uint32_t num_slots, const Ref *values)
   : SlottedObject( Frame_{ map, const_cast<Ref*>(values), 0 }, num_slots) { }
+  constexpr Frame(const Map &map, uint32_t num_slots, const Ref *values, bool read_only = false)
+  : SlottedObject( Frame_{ const_cast<Map*>(&map), const_cast<Ref*>(values), 0 }, num_slots, read_only) { }
   Frame();
   int Print(dyn::io::PrintState &ps) const;
   void SetSlot(RefArg tag, RefArg value);
   Ref GetSlot(Index i) const { return SlottedObject::GetSlot(i); }
   Ref GetSlot(RefArg tag) const;
+  Ref GetTag(Index i) const { return frame.map_->GetSlot(i+1); }
+  Map *GetMap() const { return frame.map_; }
   Index AddSlot(RefArg tag);
+  Ref Clone() const;
+  static void MarkMapShared(Map *map);
 };
 
 class Symbol: public Object
 {
 public:
-  constexpr Symbol(const char *symbol)
-  : Object( Symbol_{ RefSymbolClass, const_cast<char*>(symbol), _hash(symbol) } ) { }
+  constexpr Symbol(const char *symbol, bool read_only = false)
+  : Object( Symbol_{ RefSymbolClass, const_cast<char*>(symbol), _hash(symbol) }, read_only ) { }
+  const char *Name() const { return symbol.string_; }
   int Print(dyn::io::PrintState &ps) const;
 };
 
@@ -274,16 +348,23 @@ constexpr Ref gSymInstructions { gSymObjInstructions };
 constexpr Symbol gSymObjReal { "real" };
 constexpr Ref gSymReal { gSymObjReal };
 
-constexpr Object::Object(const char *str)
-: t { Tag::binary, 0x10 }, size_{ _strlen(str)+1 }, binary{ gSymString, const_cast<char*>(str) }
+constexpr Symbol gSymObjProto { "_proto" };
+constexpr Ref gSymProto { gSymObjProto };
+
+constexpr Symbol gSymObjParent { "_parent" };
+constexpr Ref gSymParent { gSymObjParent };
+
+constexpr Object::Object(const char *str, bool read_only)
+: t { Tag::binary, _flags(read_only) }, size_{ _strlen(str)+1 }, binary{ gSymString, const_cast<char*>(str) }
 { }
 
-constexpr Object::Object(Real value)
-: t { Tag::real, 0x10 }, size_{ 0 }, real { gSymReal, value }
+constexpr Object::Object(Real value, bool read_only)
+: t { Tag::real, _flags(read_only) }, size_{ 0 }, real { gSymReal, value }
 { }
 
 
 Ref AllocateFrame();
+Ref AllocateFrameWithMap(RefArg map);
 void SetFrameSlot(RefArg obj, RefArg slot, RefArg value);
 Ref GetFrameSlot(RefArg obj, RefArg slot);
 Ref AllocateArray(RefArg obj_class, Index length);
@@ -299,9 +380,119 @@ Ref Sym(const char *name);
 inline Ref Sym(const std::string &name) { return Sym(name.c_str()); }
 
 Ref AllocateBinary(RefArg theClass, Index length);
+void SetClass(RefArg obj, RefArg theClass);
 Ptr BinaryData(Ref r);
+Ref MakeSmallRect(int top, int left, int bottom, int right);
 
 Ref MakeReal(double d);
+Ref Clone(RefArg obj);
+
+class CopyOnWrite
+{
+  static constexpr size_t kFilterBits = 1 << 16;
+  struct Filter {
+    std::atomic<uint64_t> bits[kFilterBits / 64];
+  };
+  static inline std::atomic<size_t> num_copies_ { 0 };
+  static Filter initial_filter_;
+  static std::atomic<Filter*> filter_;
+  static size_t FilterBit(const Object *obj) {
+    return (((uintptr_t)obj >> 3) * 0x9E3779B97F4A7C15ull) >> (64 - 16);
+  }
+  static void SetFilterBit(Filter *filter, const Object *obj);
+  static void ReplaceFilter();
+  static Object *Find(const Object *obj);
+public:
+  static Ref Writable(RefArg obj);
+  static size_t Count() { return num_copies_.load(std::memory_order_relaxed); }
+  static void Clear();
+  static void Forget(const void *begin, const void *end);
+  // Read-only objects may be in read-only memory, so the bit that tells if
+  // an object has a copy is kept in a table, indexed by the address.
+  static bool HasCopy(const Object *obj) {
+    size_t bit = FilterBit(obj);
+    const Filter *filter = filter_.load(std::memory_order_acquire);
+    return (filter->bits[bit / 64].load(std::memory_order_acquire) >> (bit % 64)) & 1;
+  }
+  // Most read-only objects are never written, so this is a bit test.
+  static Object *Follow(Object *obj) {
+    if (obj && obj->IsReadOnly() && HasCopy(obj)) {
+      Object *copy = Find(obj);
+      if (copy)
+        return copy;
+    }
+    return obj;
+  }
+  static Ref Follow(RefArg obj) { return obj.IsPtr() ? Ref(Follow(obj.GetObject())) : obj; }
+};
+
+class MagicPointers
+{
+public:
+  static constexpr int kNumTables = 16;
+  using Source = std::function<Ref()>;
+private:
+  enum State: uint8_t { kEmpty, kPending, kLoaded };
+  struct Table {
+    std::atomic<uint8_t> state { kEmpty };
+    std::atomic<const Ref*> slots { nullptr };
+    std::atomic<size_t> size { 0 };
+    Source source { };
+    std::vector<Ref> storage { };
+  };
+  static Table tables_[kNumTables];
+  static void Fill(Table &t, RefArg array);
+  static Ref Lookup(RefArg ref);
+public:
+  static void SetTable(int table, RefArg array);
+  static void SetSource(int table, Source source);
+  static void Clear();
+  static Ref Get(int table, int index);
+  // Anything that is not a magic pointer is returned as it is.
+  static Ref Resolve(RefArg ref) { return ref.IsMagicPtr() ? Lookup(ref) : ref; }
+};
+
+class CompactHeap
+{
+  static uint8_t *base_;
+  static size_t reserved_;
+  static std::atomic<size_t> used_;
+public:
+  static constexpr size_t kDefaultReserve = (size_t)1 << 30;
+  static constexpr size_t kMaxReserve = (size_t)1 << 32;
+  static bool Enable(size_t reserve = kDefaultReserve);
+  static bool Enabled() { return base_ != nullptr; }
+  static size_t Used() { return used_.load(std::memory_order_relaxed); }
+  static void *Allocate(size_t size);
+  static Ref Compact(RefArg root);
+  static bool Contains(const void *p) {
+    return (uintptr_t)p - (uintptr_t)base_ < reserved_;
+  }
+  // Pointers become offsets from the heap base, the tag bits stay the same.
+  static bool Encode(RefArg ref, uint32_t &compact) {
+    uintptr_t r = ref.GetVerbatim();
+    if (ref.IsPtr()) {
+      if (!Contains(ref.GetObject()))
+        return false;
+      r -= (uintptr_t)base_;
+    } else if (ref.IsInt()) {
+      if ((intptr_t)r != (intptr_t)(int32_t)(uint32_t)r)
+        return false;
+      r &= 0xffffffff;
+    } else if (r > 0xffffffff) {
+      return false;
+    }
+    compact = (uint32_t)r;
+    return true;
+  }
+  static Ref Decode(uint32_t compact) {
+    switch (compact & 0x03) {
+      case 0x00: return Ref(reinterpret_cast<Object*>(base_ + compact));
+      case 0x01: return Ref((Ref::Verbatim_)(intptr_t)(int32_t)compact);
+      default: return Ref((Ref::Verbatim_)compact);
+    }
+  }
+};
 
 //#define  MAKECHAR(c)        MAKEIMMED(kImmedChar, (unsigned) c)
 //#define  MAKEMAGICPTR(index)  ((Ref) (((long) (index)) << kRefTagBits) | kTagMagicPtr)
@@ -326,6 +517,7 @@ protected:
 public:
   RuntimeError(DyneErr err, const std::string& msg = "")
   : std::runtime_error(msg), err_(err) {}
+  DyneErr err() const { return err_; }
 };
 
 class BadTypeWithFrameData : public RuntimeError
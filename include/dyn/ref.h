@@ -90,6 +90,11 @@ public:
   constexpr bool IsNotNIL() const     { return !IsNIL(); }
   constexpr bool IsChar() const       { return (r_&0x0f)==0x06; }
   constexpr bool IsMagicPtr() const   { return (r_&0x03)==0x03; }
+  constexpr int MagicTable() const    { return static_cast<int>(r_ >> 14); }
+  constexpr int MagicIndex() const    { return static_cast<int>((r_ >> kTagShift) & 0x0fff); }
+  Integer GetInt() const              { return (Integer)tag_value_(); }
+  UniChar GetChar() const             { return (UniChar)immed_value_(); }
+  Verbatim_ GetVerbatim() const       { return r_; }
 
   bool IsBinary() const;
   bool IsArray() const;
@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_TOOLS_CENSUS_H
+#define DYN_TOOLS_CENSUS_H
+
+#include <dyn/ref.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace dyn::tools {
+
+class Census
+{
+public:
+  enum Kind {
+    kBinary, kLargeBinary, kArray, kFrame, kMap, kSymbol, kReal, kOther,
+    kNumKinds
+  };
+  struct Entry {
+    uint64_t count { 0 };
+    uint64_t bytes { 0 };
+  };
+  static constexpr int kNumSlotBuckets = 8;
+
+  void add(RefArg root);
+  const Entry &kind(Kind k) const { return kinds_[k]; }
+  const std::map<std::string, Entry> &classes() const { return classes_; }
+  const Entry &duplicate_binaries() const { return duplicate_binaries_; }
+  const Entry &duplicate_maps() const { return duplicate_maps_; }
+  const Entry &duplicate_symbols() const { return duplicate_symbols_; }
+  uint64_t frames_with_slots(int bucket) const { return slot_buckets_[bucket]; }
+  Entry total() const;
+  void write_table(std::ostream &out) const;
+  void write_json(std::ostream &out) const;
+
+private:
+  std::unordered_set<const Object*> visited_ { };
+  // Binaries by size and hash of their data, compared byte by byte on a match.
+  std::map<std::pair<uint64_t, size_t>, std::vector<const Object*>> binary_contents_ { };
+  std::unordered_set<std::string> map_contents_ { };
+  std::unordered_set<std::string> symbol_names_ { };
+  Entry kinds_[kNumKinds] { };
+  std::map<std::string, Entry> classes_ { };
+  Entry duplicate_binaries_ { };
+  Entry duplicate_maps_ { };
+  Entry duplicate_symbols_ { };
+  uint64_t slot_buckets_[kNumSlotBuckets] { };
+};
+
+} // namespace dyn::tools
+
+#endif // DYN_TOOLS_CENSUS_H
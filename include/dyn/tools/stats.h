@@ -0,0 +1,95 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_TOOLS_STATS_H
+#define DYN_TOOLS_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+
+namespace dyn::tools {
+
+class Stats
+{
+public:
+  enum Counter {
+    kBytesRead,
+    kBinariesDecoded, kSymbolsDecoded, kArraysDecoded, kMapsDecoded, kFramesDecoded,
+    kFramesAllocated, kArraysAllocated, kBinariesAllocated, kSymbolsCreated,
+    kNumCounters
+  };
+  enum Phase {
+    kLoad, kToNOS, kWriteAsm, kCompare, kDecompile,
+    kNumPhases
+  };
+
+  static void enable(bool on = true) { enabled_.store(on, std::memory_order_relaxed); }
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  static void count(Counter c, uint64_t n = 1) {
+    if (enabled())
+      counters_[c].fetch_add(n, std::memory_order_relaxed);
+  }
+  static void add_time(Phase p, uint64_t ns) {
+    calls_[p].fetch_add(1, std::memory_order_relaxed);
+    nanoseconds_[p].fetch_add(ns, std::memory_order_relaxed);
+  }
+  static uint64_t counter(Counter c) { return counters_[c].load(std::memory_order_relaxed); }
+  static uint64_t calls(Phase p) { return calls_[p].load(std::memory_order_relaxed); }
+  static uint64_t nanoseconds(Phase p) { return nanoseconds_[p].load(std::memory_order_relaxed); }
+  static void reset();
+  static void write_table(std::ostream &out);
+  static void write_json(std::ostream &out);
+
+private:
+  static inline std::atomic<bool> enabled_ { false };
+  static inline std::atomic<uint64_t> counters_[kNumCounters] { };
+  static inline std::atomic<uint64_t> calls_[kNumPhases] { };
+  static inline std::atomic<uint64_t> nanoseconds_[kNumPhases] { };
+};
+
+class ScopedTimer
+{
+  Stats::Phase phase_;
+  bool running_;
+  std::chrono::steady_clock::time_point start_ { };
+public:
+  ScopedTimer(Stats::Phase phase) : phase_(phase), running_(Stats::enabled()) {
+    if (running_)
+      start_ = std::chrono::steady_clock::now();
+  }
+  ~ScopedTimer() {
+    if (running_) {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+      Stats::add_time(phase_, (uint64_t)ns.count());
+    }
+  }
+  ScopedTimer(ScopedTimer const&) = delete;
+  ScopedTimer& operator=(ScopedTimer const&) = delete;
+};
+
+} // namespace dyn::tools
+
+#endif // DYN_TOOLS_STATS_H
@@ -0,0 +1,87 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_TOOLS_TRACE_H
+#define DYN_TOOLS_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace dyn::tools {
+
+class Trace
+{
+  struct Event {
+    const char *name;
+    const char *cat;
+    uint32_t tid;
+    double ts;
+    double dur;
+    std::string args;
+  };
+  static inline std::atomic<bool> enabled_ { false };
+  static inline std::atomic<uint32_t> next_tid_ { 1 };
+  static inline std::mutex mutex_ { };
+  static inline std::vector<Event> events_ { };
+  static inline std::chrono::steady_clock::time_point start_ { };
+  static inline std::string file_name_ { };
+
+public:
+  static void start(const std::string &file_name);
+  static int stop();
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  static double now();
+  static uint32_t thread_id();
+  static void add(const char *name, const char *cat, double ts, double dur, std::string args);
+};
+
+class TraceSpan
+{
+  const char *name_;
+  const char *cat_;
+  bool active_;
+  double start_ { 0.0 };
+  std::string args_ { };
+public:
+  TraceSpan(const char *name, const char *cat) : name_(name), cat_(cat), active_(Trace::enabled()) {
+    if (active_)
+      start_ = Trace::now();
+  }
+  ~TraceSpan() {
+    if (active_)
+      Trace::add(name_, cat_, start_, Trace::now() - start_, std::move(args_));
+  }
+  TraceSpan(TraceSpan const&) = delete;
+  TraceSpan& operator=(TraceSpan const&) = delete;
+  void arg(const char *key, int64_t value);
+  void arg(const char *key, const std::string &value);
+};
+
+} // namespace dyn::tools
+
+#endif // DYN_TOOLS_TRACE_H
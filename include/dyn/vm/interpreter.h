@@ -0,0 +1,145 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_VM_INTERPRETER_H
+#define DYN_VM_INTERPRETER_H
+
+#include <dyn/ref.h>
+#include <dyn/objects.h>
+#include <dyn/lang/decompile.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dyn {
+
+namespace vm {
+
+struct InlineCache;
+struct JitContext;
+class Profile;
+
+/**
+ A NewtonScript exception with a name like 'evt.ex.msg and optional data.
+ */
+class Exception : public RuntimeError
+{
+  Ref name_;
+  Ref data_;
+public:
+  Exception(RefArg name, RefArg data, DyneErr err = 0, const std::string& msg = "")
+  : RuntimeError(err, msg), name_(name), data_(data) {}
+  Ref name() const { return name_; }
+  Ref data() const { return data_; }
+};
+
+class Interpreter
+{
+public:
+  using NativeFunction = Ref (*)(Interpreter &vm, RefArg self, const Ref *args, int num_args);
+
+private:
+  struct Op;
+  struct Code;
+  struct Activation;
+  struct JitFrame;
+  struct Handler {
+    Ref symbol;
+    lang::PC pc;
+    size_t depth;
+    bool active;
+  };
+
+  static constexpr size_t kStackSize = 64 * 1024;
+  static constexpr int kMaxCallDepth = 2048;
+  static constexpr uint32_t kJitThreshold = 8;
+
+  std::vector<Ref> stack_;
+  Ref *top_ { nullptr };
+  std::vector<Handler> handlers_ { };
+  std::vector<size_t> groups_ { };
+  int call_depth_ { 0 };
+  bool optimize_ { true };
+  bool jit_ { true };
+  size_t num_compiled_ { 0 };
+  Profile *profile_ { nullptr };
+  Ref profile_msg_ { RefNIL };
+  Ref exception_ { RefNIL };
+  std::unordered_map<const Object*, std::unique_ptr<Code>> code_cache_;
+  std::unordered_map<std::string, Ref> globals_ { };
+  std::unordered_map<std::string, Ref> functions_ { };
+  std::unordered_map<std::string, NativeFunction> natives_ { };
+
+  static std::string key_(RefArg sym);
+  Code &code_for_(RefArg func);
+  Ref invoke_(RefArg func, RefArg self, RefArg impl, Ref *args, int num_args);
+  Ref call_global_(RefArg name, Ref *args, int num_args);
+  Ref send_(RefArg receiver, RefArg start, RefArg msg, Ref *args, int num_args,
+            bool if_defined, InlineCache *cache = nullptr);
+  void prepare_(Code &code, const void *const *labels, const void *const *int_labels,
+                const void *profile_label);
+  Ref run_(Activation &act);
+  Ref dispatch_(Activation &act, Ref *sp, lang::PC pc);
+  bool catch_(Activation &act, const RuntimeError &err, Ref *&sp, lang::PC &pc);
+  Ref find_var_(Activation &act, RefArg tag, InlineCache *cache);
+  void find_and_set_var_(Activation &act, RefArg tag, RefArg value);
+  Ref set_lex_scope_(Activation &act, RefArg func);
+  void compile_(Code &code);
+  Ref run_compiled_(Activation &act);
+  void drop_int_facts_(Code &code);
+  Ref *jit_op_(Activation &act, lang::BC bc, Ref *sp, int32_t arg, InlineCache *cache, int &taken);
+  static Ref *jit_helper_(JitContext *ctx, Ref *sp, int bc, int32_t arg, InlineCache *cache);
+
+public:
+  Interpreter();
+  ~Interpreter();
+  Interpreter(Interpreter const&) = delete;
+  Interpreter& operator=(Interpreter const&) = delete;
+
+  Ref call(RefArg func, const std::vector<Ref> &args, RefArg self = RefNIL);
+  Ref call_global(RefArg name, const std::vector<Ref> &args);
+  Ref send(RefArg receiver, RefArg message, const std::vector<Ref> &args);
+
+  void define_global(RefArg name, RefArg value);
+  Ref global(RefArg name) const;
+  void define_function(RefArg name, RefArg func);
+  void define_native(const std::string &name, NativeFunction func);
+  Ref current_exception() const { return exception_; }
+  void set_optimize(bool on) { optimize_ = on; }
+  void set_jit(bool on) { jit_ = on; }
+  size_t compiled_functions() const { return num_compiled_; }
+  const std::vector<lang::Bytecode> &bytecode(RefArg func);
+  void set_profile(Profile *profile);
+
+  static bool lookup(RefArg frame, RefArg tag, Ref &value, Ref *where = nullptr);
+};
+
+} // namespace vm
+
+} // namespace dyn
+
+#endif // DYN_VM_INTERPRETER_H
+
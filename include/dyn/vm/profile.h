@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_VM_PROFILE_H
+#define DYN_VM_PROFILE_H
+
+#include <dyn/ref.h>
+#include <dyn/lang/decompile.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dyn {
+
+class Object;
+
+namespace vm {
+
+class Profile {
+public:
+  struct Function {
+    Ref func { RefNIL };
+    std::string name { };
+    uint64_t calls { 0 };
+    uint64_t samples { 0 };
+    double seconds { 0.0 };
+    std::vector<uint64_t> counts { };
+    std::vector<lang::BC> code { };
+    std::vector<lang::PC> offsets { };
+    uint64_t executed() const;
+  };
+
+  static constexpr uint32_t kSampleInterval = 1024;
+
+  Profile();
+  void clear();
+  Function &function(const Object *key, RefArg func, const std::vector<lang::Bytecode> &code,
+                     const std::vector<lang::PC> &offsets);
+  void resume() { last_ = std::chrono::steady_clock::now(); }
+  void count(Function &f, lang::PC pc, lang::BC bc) {
+    op_counts_[(size_t)bc]++;
+    f.counts[pc]++;
+    if (--countdown_ == 0)
+      sample_(f);
+  }
+  uint64_t op_count(lang::BC bc) const { return op_counts_[(size_t)bc]; }
+  uint64_t total() const;
+  const std::unordered_map<const Object*, Function> &functions() const { return functions_; }
+  void write_report(std::ostream &dest, size_t max_functions = 10) const;
+
+private:
+  uint64_t op_counts_[(size_t)lang::BC::Unknown + 1] { };
+  std::unordered_map<const Object*, Function> functions_ { };
+  uint32_t countdown_ { kSampleInterval };
+  std::chrono::steady_clock::time_point last_ { };
+  void sample_(Function &f);
+};
+
+} // namespace vm
+
+} // namespace dyn
+
+#endif // DYN_VM_PROFILE_H
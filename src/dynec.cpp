@@ -24,9 +24,16 @@
 
 #include <dyn/ref.h>
 #include <dyn/objects.h>
+#include <dyn/io/cxx.h>
+#include <dyn/io/export.h>
+#include <dyn/io/generate.h>
 #include <dyn/io/package.h>
+#include <dyn/io/snapshot.h>
 #include <dyn/io/stream.h>
+#include <dyn/tools/census.h>
+#include <dyn/tools/stats.h>
 #include <dyn/tools/tools.h>
+#include <dyn/tools/trace.h>
 #include <dyn/lang/decompile.h>
 
 #include <iostream>
@@ -35,6 +42,8 @@
 #include <cstdlib>
 #include <locale>
 #include <codecvt>
+#include <functional>
+#include <vector>
 
 
 // TODO: move the code below into some functional validator file and offer
@@ -154,6 +163,269 @@ int main_01(int argc, const char * argv[])
   return 0;
 }
 
+/**
+ Arguments of the subcommands that read the object tree of a package or
+ of a Newton Stream file.
+ */
+struct InputArgs {
+  bool nsof { false };
+  bool has_output { true };
+  std::string output { };
+  std::string input { };
+};
+
+/**
+ Read the arguments that all subcommands working on an object tree share.
+ \param[in] argc, argv arguments after the subcommand name
+ \param[inout] args the defaults, and the result
+ \param[in] option called first for every argument to read the options of
+      the subcommand, returns true if it used the argument at argv[i]
+ \return true if exactly one input file was given
+ */
+bool parse_input_args(int argc, const char * argv[], InputArgs &args,
+                      const std::function<bool(int &i)> &option = nullptr)
+{
+  for (int i=1; i<argc; ++i) {
+    std::string arg { argv[i] };
+    if (option && option(i)) {
+      continue;
+    } else if (arg == "--nsof") {
+      args.nsof = true;
+    } else if (args.has_output && arg == "-o" && i+1 < argc) {
+      args.output = argv[++i];
+    } else if (args.input.empty() && arg[0] != '-') {
+      args.input = arg;
+    } else {
+      args.input.clear();
+      break;
+    }
+  }
+  return !args.input.empty();
+}
+
+/**
+ Read the object tree of a package or Newton Stream file.
+ \param[in] args the input file and its format
+ \param[out] root the object tree
+ \return 0 if successful
+ */
+int load_input(const InputArgs &args, dyn::Ref &root)
+{
+  if (args.nsof) {
+    dyn::io::StreamReader in;
+    if (in.open(args.input) < 0) {
+      std::cout << "ERROR reading stream file \"" << args.input << "\"." << std::endl;
+      return -1;
+    }
+    root = in.read();
+  } else {
+    dyn::io::Package pkg;
+    if (pkg.load(args.input) < 0) {
+      std::cout << "ERROR reading package file \"" << args.input << "\"." << std::endl;
+      return -1;
+    }
+    root = pkg.toNOS();
+  }
+  return 0;
+}
+
+/**
+ Export the contents of a package or NSOF file for other tools.
+ \param[in] argc, argv arguments after the subcommand name
+ \note Usage: dynec export [--binary] [--nsof] [-o output] input
+      Without `-o`, the result is written to stdout. `--nsof` reads a
+      Newton Stream file instead of a package.
+ */
+int main_export(int argc, const char * argv[])
+{
+  auto format = dyn::io::Exporter::Format::JsonLines;
+  InputArgs args;
+  args.output = "-";
+  bool ok = parse_input_args(argc, argv, args, [&](int &i) {
+    if (std::string(argv[i]) != "--binary")
+      return false;
+    format = dyn::io::Exporter::Format::Binary;
+    return true;
+  });
+  if (!ok) {
+    std::cout << "Usage: dynec export [--binary] [--nsof] [-o output] input" << std::endl;
+    return 1;
+  }
+  dyn::Ref root = dyn::RefNIL;
+  if (load_input(args, root) < 0)
+    return 1;
+  return (dyn::io::Export(root, args.output, format) < 0) ? 1 : 0;
+}
+
+/**
+ Decompile all functions in a package.
+ \param[in] argc, argv arguments after the subcommand name
+ \note Usage: dynec decompile [-j threads] [-o directory] package
+      Writes one source file per part, named part_0.ns, part_1.ns, etc.
+ */
+int main_decompile(int argc, const char * argv[])
+{
+  unsigned num_threads = 0;
+  InputArgs args;
+  args.output = ".";
+  bool ok = parse_input_args(argc, argv, args, [&](int &i) {
+    if (std::string(argv[i]) != "-j" || i+1 >= argc)
+      return false;
+    num_threads = (unsigned)std::atoi(argv[++i]);
+    return true;
+  });
+  // Functions are written per part, so this needs a package.
+  if (!ok || args.nsof) {
+    std::cout << "Usage: dynec decompile [-j threads] [-o directory] package" << std::endl;
+    return 1;
+  }
+  dyn::Ref root = dyn::RefNIL;
+  if (load_input(args, root) < 0)
+    return 1;
+  int n = dyn::lang::decompile_package(root, args.output, num_threads);
+  if (n < 0) return 1;
+  std::cout << "Decompiled " << n << " functions." << std::endl;
+  return 0;
+}
+
+/**
+ Report the objects and memory used by the object tree of a package.
+ \param[in] argc, argv arguments after the subcommand name
+ \note Usage: dynec census [--json] [--nsof] input
+ */
+int main_census(int argc, const char * argv[])
+{
+  bool json = false;
+  InputArgs args;
+  args.has_output = false;
+  bool ok = parse_input_args(argc, argv, args, [&](int &i) {
+    if (std::string(argv[i]) != "--json")
+      return false;
+    json = true;
+    return true;
+  });
+  if (!ok) {
+    std::cout << "Usage: dynec census [--json] [--nsof] input" << std::endl;
+    return 1;
+  }
+  dyn::Ref root = dyn::RefNIL;
+  if (load_input(args, root) < 0)
+    return 1;
+  dyn::tools::Census census;
+  census.add(root);
+  if (json)
+    census.write_json(std::cout);
+  else
+    census.write_table(std::cout);
+  return 0;
+}
+
+/**
+ Write the object tree of a package into a snapshot that loads in one step.
+ \param[in] argc, argv arguments after the subcommand name
+ \note Usage: dynec snapshot [--nsof] -o output input
+ */
+int main_snapshot(int argc, const char * argv[])
+{
+  InputArgs args;
+  if (!parse_input_args(argc, argv, args) || args.output.empty()) {
+    std::cout << "Usage: dynec snapshot [--nsof] -o output input" << std::endl;
+    return 1;
+  }
+  dyn::Ref root = dyn::RefNIL;
+  if (load_input(args, root) < 0)
+    return 1;
+  return (dyn::io::Snapshot::write(root, args.output) < 0) ? 1 : 0;
+}
+
+/**
+ Write the object tree of a package as C++ source code with constant objects.
+ \param[in] argc, argv arguments after the subcommand name
+ \note Usage: dynec cxx [--nsof] [--name identifier] -o output input
+      Writes output.h and output.cpp. The header declares a `dyn::Ref` with
+      the given name, default `package_root`.
+ */
+int main_cxx(int argc, const char * argv[])
+{
+  std::string name { "package_root" };
+  InputArgs args;
+  bool ok = parse_input_args(argc, argv, args, [&](int &i) {
+    if (std::string(argv[i]) != "--name" || i+1 >= argc)
+      return false;
+    name = argv[++i];
+    return true;
+  });
+  if (!ok || args.output.empty()) {
+    std::cout << "Usage: dynec cxx [--nsof] [--name identifier] -o output input" << std::endl;
+    return 1;
+  }
+  dyn::Ref root = dyn::RefNIL;
+  if (load_input(args, root) < 0)
+    return 1;
+  dyn::io::CxxWriter writer(name);
+  return (writer.write(root, args.output + ".h", args.output + ".cpp") < 0) ? 1 : 0;
+}
+
+/**
+ Generate a package or a Newton Stream file for tests and benchmarks.
+ \param[in] argc, argv arguments after the subcommand name
+ \note Usage: dynec generate [--nsof] [--package0] [--relocation] [--seed n]
+      [--objects n] [--width n] [--depth n] [--reuse percent]
+      [--binary-size n] [--parts n] -o output
+ */
+int main_generate(int argc, const char * argv[])
+{
+  dyn::io::Generator::Options opt;
+  bool nsof = false;
+  std::string output { };
+  for (int i=1; i<argc; ++i) {
+    std::string arg { argv[i] };
+    uint32_t *value = nullptr;
+    if (arg == "--nsof") {
+      nsof = true;
+    } else if (arg == "--package0") {
+      opt.package1 = false;
+    } else if (arg == "--relocation") {
+      opt.relocation = true;
+    } else if (arg == "-o" && i+1 < argc) {
+      output = argv[++i];
+    } else if (arg == "--seed") {
+      value = &opt.seed;
+    } else if (arg == "--objects") {
+      value = &opt.num_objects;
+    } else if (arg == "--width") {
+      value = &opt.frame_width;
+    } else if (arg == "--depth") {
+      value = &opt.depth;
+    } else if (arg == "--reuse") {
+      value = &opt.symbol_reuse;
+    } else if (arg == "--binary-size") {
+      value = &opt.binary_size;
+    } else if (arg == "--parts") {
+      value = &opt.num_parts;
+    } else {
+      output.clear();
+      break;
+    }
+    if (value) {
+      if (i+1 >= argc) {
+        output.clear();
+        break;
+      }
+      *value = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+    }
+  }
+  if (output.empty()) {
+    std::cout << "Usage: dynec generate [--nsof] [--package0] [--relocation] [--seed n]" << std::endl
+              << "         [--objects n] [--width n] [--depth n] [--reuse percent]" << std::endl
+              << "         [--binary-size n] [--parts n] -o output" << std::endl;
+    return 1;
+  }
+  dyn::io::Generator gen(opt);
+  int err = nsof ? gen.write_nsof(output) : gen.write_package(output);
+  return (err < 0) ? 1 : 0;
+}
+
 /**
  Read a Dyne Stream file that contains a function and decompile it.
  \param[in] argc, argv
@@ -166,7 +438,7 @@ int main_01(int argc, const char * argv[])
       from known packages, recompile them, and ideally generate the exact same
       bytecode. Functional equality is sufficient though.
  */
-int main(int argc, const char * argv[])
+int main_02(int argc, const char * argv[])
 {
   (void)argc;
   (void)argv;
@@ -189,4 +461,63 @@ int main(int argc, const char * argv[])
   return 0;
 }
 
+/**
+ Run a subcommand.
+ \param[in] argc, argv
+ \note Usage: dynec [--stats | --stats=json] [--trace file.json]
+      [export | decompile | census | snapshot | cxx | generate] ...
+      `--stats` prints the time spent in each phase and counters of bytes,
+      objects, and allocations when the command is done. The report goes to
+      stderr, so it does not mix with output on stdout.
+      `--trace` writes a Chrome trace-event file with a span for every
+      package, part, and stage, that can be opened in Perfetto.
+ */
+int main(int argc, const char * argv[])
+{
+  enum { kNoStats, kTable, kJson } stats = kNoStats;
+  std::string trace_file { };
+  std::vector<const char*> args;
+  for (int i=0; i<argc; ++i) {
+    std::string arg { argv[i] };
+    if (i > 0 && arg == "--stats")
+      stats = kTable;
+    else if (i > 0 && arg == "--stats=json")
+      stats = kJson;
+    else if (i > 0 && arg == "--trace" && i+1 < argc)
+      trace_file = argv[++i];
+    else
+      args.push_back(argv[i]);
+  }
+  if (stats != kNoStats)
+    dyn::tools::Stats::enable();
+  if (!trace_file.empty())
+    dyn::tools::Trace::start(trace_file);
+
+  int ret;
+  int n = (int)args.size();
+  std::string cmd { (n >= 2) ? args[1] : "" };
+  if (cmd == "export")
+    ret = main_export(n-1, args.data()+1);
+  else if (cmd == "decompile")
+    ret = main_decompile(n-1, args.data()+1);
+  else if (cmd == "census")
+    ret = main_census(n-1, args.data()+1);
+  else if (cmd == "snapshot")
+    ret = main_snapshot(n-1, args.data()+1);
+  else if (cmd == "cxx")
+    ret = main_cxx(n-1, args.data()+1);
+  else if (cmd == "generate")
+    ret = main_generate(n-1, args.data()+1);
+  else
+    ret = main_02(n, args.data());
+
+  if (!trace_file.empty() && dyn::tools::Trace::stop() != 0 && ret == 0)
+    ret = -1;
+  if (stats == kTable)
+    dyn::tools::Stats::write_table(std::cerr);
+  else if (stats == kJson)
+    dyn::tools::Stats::write_json(std::cerr);
+  return ret;
+}
+
 // Test me: dyn::lang::decompile(dyn::RefNIL);
@@ -0,0 +1,307 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/io/cxx.h>
+#include <dyn/objects.h>
+
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace dyn;
+using namespace dyn::io;
+
+
+/** \class dyn::io::CxxWriter
+ Write an object tree as C++ source code that compiles into constant objects.
+
+ Every object becomes a `constexpr` variable that is marked read-only, so
+ the compiler places the whole tree in read-only data. A program that
+ links the generated source has the objects available without loading,
+ parsing, or allocating anything at run time.
+
+ All objects are declared first and defined afterwards, so objects can
+ refer to each other in any order. This keeps shared objects shared and
+ allows cycles. Symbols with the same name are written once.
+
+ Large binaries are written as plain binaries with the same class and
+ data. Native pointers can not be written.
+ */
+
+
+/**
+ Create a writer.
+ \param[in] name the C++ name of the root Ref
+ */
+CxxWriter::CxxWriter(const std::string &name)
+: name_(name)
+{ }
+
+
+static std::string LowerCase(const char *s)
+{
+  std::string lower;
+  for ( ; *s; ++s)
+    lower.push_back((char)std::tolower((unsigned char)*s));
+  return lower;
+}
+
+// Write bytes as a C++ string literal. Octal escapes always have three
+// digits, so a digit that follows can't be taken as part of the escape.
+static void WriteLiteral(std::ostream &out, const uint8_t *data, size_t size, const char *indent)
+{
+  char buf[8];
+  out << "\"";
+  for (size_t i=0; i<size; ++i) {
+    if (i && (i % 32) == 0)
+      out << "\"\n" << indent << "\"";
+    uint8_t c = data[i];
+    if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\' || c == '?') {
+      ::snprintf(buf, sizeof(buf), "\\%03o", c);
+      out << buf;
+    } else {
+      out << (char)c;
+    }
+  }
+  out << "\"";
+}
+
+
+/**
+ Return the number of an object, and give it a number if it has none yet.
+ \param[in] obj the object
+ \param[in] is_map set if the object is used as the map of a frame
+ */
+uint32_t CxxWriter::id_of_(const Object *obj, bool is_map)
+{
+  auto it = id_.find(obj);
+  if (it != id_.end()) {
+    if (is_map)
+      is_map_[it->second] = true;
+    return it->second;
+  }
+  if (obj->IsSymbol()) {
+    std::string name = LowerCase(static_cast<const Symbol*>(obj)->Name());
+    auto sym = symbols_.find(name);
+    if (sym != symbols_.end()) {
+      id_[obj] = sym->second;
+      return sym->second;
+    }
+    symbols_[name] = (uint32_t)objects_.size();
+  }
+  uint32_t id = (uint32_t)objects_.size();
+  id_[obj] = id;
+  objects_.push_back(obj);
+  is_map_.push_back(is_map);
+  return id;
+}
+
+
+/**
+ Return a constant expression for a Ref.
+ */
+std::string CxxWriter::ref_(Ref r)
+{
+  if (r.IsPtr())
+    return "dyn::Ref(o" + std::to_string(id_of_(r.GetObject())) + ")";
+  if (r.IsNIL())
+    return "dyn::RefNIL";
+  if (r.IsTrue())
+    return "dyn::RefTRUE";
+  if (r.IsInt() && r.GetInt() >= INT_MIN && r.GetInt() <= INT_MAX)
+    return "dyn::Ref(" + std::to_string(r.GetInt()) + ")";
+  char buf[64];
+  ::snprintf(buf, sizeof(buf), "dyn::Ref((dyn::Ref::Verbatim_)0x%llx)", (unsigned long long)r.GetVerbatim());
+  return buf;
+}
+
+
+/**
+ Write the definition of one object, and the data and slots that it uses.
+ */
+void CxxWriter::write_object_(std::ostream &out, uint32_t id)
+{
+  const Object *o = objects_[id];
+  std::string name = "o" + std::to_string(id);
+  if (o->IsSymbol()) {
+    const char *sym = static_cast<const Symbol*>(o)->Name();
+    out << "constexpr dyn::Symbol " << name << " { ";
+    WriteLiteral(out, (const uint8_t*)sym, ::strlen(sym), "  ");
+    out << ", true };\n";
+  } else if (o->IsBinary() || o->IsLargeBinary()) {
+    Ref ref(const_cast<Object*>(o));
+    const uint8_t *data = nullptr;
+    size_t size = o->size();
+    if (o->IsLargeBinary()) {
+      auto lbo = const_cast<LargeBinaryObject*>(static_cast<const LargeBinaryObject*>(o));
+      data = (const uint8_t*)lbo->Data();
+      size = data ? lbo->Length() : 0;
+      out << "// large binary, stored as a binary\n";
+    } else if (size) {
+      data = (const uint8_t*)BinaryData(ref);
+    }
+    out << "constexpr char " << name << "_data[] =\n  ";
+    WriteLiteral(out, data, size, "  ");
+    out << ";\n";
+    out << "constexpr dyn::BinaryObject " << name << " { " << ref_(o->GetClass())
+        << ", " << size << ", " << name << "_data, true };\n";
+  } else if (o->IsArray() || o->IsFrame()) {
+    auto slotted = static_cast<const SlottedObject*>(o);
+    Index n = slotted->Length();
+    if (n > 0) {
+      out << "constexpr dyn::Ref " << name << "_slots[] = {\n";
+      for (Index i=0; i<n; ++i)
+        out << "  " << ref_(slotted->GetSlot(i)) << ((i+1 < n) ? ",\n" : "\n");
+      out << "};\n";
+    }
+    std::string slots = (n > 0) ? name + "_slots" : "nullptr";
+    if (o->IsFrame()) {
+      uint32_t map = id_of_(static_cast<const Frame*>(o)->GetMap(), true);
+      out << "constexpr dyn::Frame " << name << " { o" << map << ", " << n << ", " << slots << ", true };\n";
+    } else {
+      out << "constexpr dyn::" << (is_map_[id] ? "Map " : "Array ") << name << " { "
+          << ref_(o->GetClass()) << ", " << n << ", " << slots << ", true };\n";
+    }
+  } else if (o->IsReal()) {
+    double v = o->GetReal();
+    char buf[48];
+    if (std::isnan(v))
+      ::snprintf(buf, sizeof(buf), "std::numeric_limits<double>::quiet_NaN()");
+    else if (std::isinf(v))
+      ::snprintf(buf, sizeof(buf), "%sstd::numeric_limits<double>::infinity()", v < 0 ? "-" : "");
+    else
+      ::snprintf(buf, sizeof(buf), "%a", v);
+    // Reals of class 'real use the short form, any other class is kept.
+    Ref cls = o->GetClass();
+    out << "constexpr dyn::Object " << name << " { ";
+    if (!cls.IsSymbol() || (SymbolCompare(cls, gSymReal) != 0))
+      out << ref_(cls) << ", ";
+    out << buf << ", true };\n";
+  }
+}
+
+
+/**
+ Write an object tree as a C++ header and source file.
+ \param[in] root the object tree
+ \param[in] header receives the declaration of the root
+ \param[in] source receives all objects
+ \param[in] header_name file name of the header as it is included by the source
+ \return 0 if succeeded
+ */
+int CxxWriter::write(RefArg root, std::ostream &header, std::ostream &source, const std::string &header_name)
+{
+  id_.clear();
+  symbols_.clear();
+  objects_.clear();
+  is_map_.clear();
+
+  // Number all objects first. Frames also number their maps, which must be
+  // known before the declarations are written.
+  std::string root_expr = ref_(root);
+  for (size_t i=0; i<objects_.size(); ++i) {
+    const Object *o = objects_[i];
+    if (o->IsFrame() || o->IsArray()) {
+      auto slotted = static_cast<const SlottedObject*>(o);
+      for (Index j=0; j<slotted->Length(); ++j)
+        ref_(slotted->GetSlot(j));
+      if (o->IsFrame())
+        id_of_(static_cast<const Frame*>(o)->GetMap(), true);
+      else
+        ref_(o->GetClass());
+    } else if (o->IsLargeBinary() && static_cast<const LargeBinaryObject*>(o)->Length() > 0x00ffffff) {
+      std::cout << "ERROR: CxxWriter: large binary is too big." << std::endl;
+      return -1;
+    } else if (o->IsBinary() || o->IsLargeBinary() || o->IsReal()) {
+      ref_(o->GetClass());
+    } else if (!o->IsSymbol()) {
+      std::cout << "ERROR: CxxWriter: can't write native pointers." << std::endl;
+      return -1;
+    }
+  }
+
+  std::string guard;
+  for (char c: name_)
+    guard.push_back(std::isalnum((unsigned char)c) ? (char)std::toupper((unsigned char)c) : '_');
+  guard += "_H";
+  header << "// Generated by dynec. Do not edit.\n\n"
+         << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+         << "#include <dyn/ref.h>\n\n"
+         << "extern const dyn::Ref " << name_ << ";\n\n"
+         << "#endif // " << guard << "\n";
+
+  source << "// Generated by dynec. Do not edit.\n\n"
+         << "#include \"" << header_name << "\"\n\n"
+         << "#include <dyn/objects.h>\n\n"
+         << "#include <limits>\n\n"
+         << "namespace {\n\n";
+  for (uint32_t i=0; i<objects_.size(); ++i) {
+    const Object *o = objects_[i];
+    const char *type = "Object";
+    if (o->IsSymbol()) type = "Symbol";
+    else if (o->IsBinary() || o->IsLargeBinary()) type = "BinaryObject";
+    else if (o->IsFrame()) type = "Frame";
+    else if (o->IsArray()) type = is_map_[i] ? "Map" : "Array";
+    source << "extern const dyn::" << type << " o" << i << ";\n";
+  }
+  source << "\n";
+  for (uint32_t i=0; i<objects_.size(); ++i)
+    write_object_(source, i);
+  source << "\n} // namespace\n\n"
+         << "constexpr dyn::Ref " << name_ << " { " << root_expr << " };\n";
+  return 0;
+}
+
+
+/**
+ Write an object tree as a C++ header and source file.
+ \param[in] root the object tree
+ \param[in] header_file, source_file path and name; the source includes the
+      header by its file name
+ \return 0 if succeeded
+ */
+int CxxWriter::write(RefArg root, const std::string &header_file, const std::string &source_file)
+{
+  std::ofstream header(header_file);
+  std::ofstream source(source_file);
+  if (!header || !source) {
+    std::cout << "ERROR: CxxWriter: can't create \"" << header_file << "\" or \"" << source_file << "\"." << std::endl;
+    return -1;
+  }
+  size_t slash = header_file.find_last_of('/');
+  std::string header_name = (slash == std::string::npos) ? header_file : header_file.substr(slash+1);
+  if (write(root, header, source, header_name) < 0)
+    return -1;
+  header.flush();
+  source.flush();
+  if (!header || !source) {
+    std::cout << "ERROR: CxxWriter: can't write \"" << header_file << "\" or \"" << source_file << "\"." << std::endl;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,371 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/io/export.h>
+#include <dyn/objects.h>
+#include <dyn/tools/tools.h>
+
+#include <cstring>
+#include <iostream>
+
+using namespace dyn;
+using namespace dyn::io;
+
+/*
+ Binary export format, all numbers are unsigned LEB128 varints unless noted:
+
+ file    "DYNX" version=1 (byte) value(root) record* kEnd (byte)
+ record  kArray id value(class) count value*
+         kFrame id count (symbol-name value)*
+         kBinary id value(class) size bytes
+         kLargeBinary id value(class) value(compander) size bytes
+ value   kNil | kTrue | kInt zigzag | kChar code | kSymbol length bytes
+         | kString length utf8 | kReal 8 bytes little endian | kRef id
+         | kImmediate raw
+ */
+
+namespace {
+
+enum : uint8_t {
+  kNil = 0, kTrue, kInt, kChar, kSymbol, kString, kReal, kRef, kImmediate
+};
+
+enum : uint8_t {
+  kArray = 1, kFrame, kBinary, kLargeBinary, kEnd = 0xff
+};
+
+bool IsString(const dyn::Object *obj)
+{
+  if (!obj->IsBinary())
+    return false;
+  Ref cls = obj->GetClass();
+  return cls.IsSymbol() && dyn::SymbolCompare(cls, gSymString) == 0;
+}
+
+} // anonymous namespace
+
+/** \class dyn::io::Exporter
+ Write an object graph as JSON Lines or in a compact binary format.
+
+ The first record describes the root value. Every array, frame, and binary
+ then gets its own record, and all references between them use object IDs.
+ IDs are assigned in breadth first order starting at the root, so the same
+ graph always gets the same IDs, and shared objects are written once.
+ Symbols, strings, reals, and immediates are written inline.
+
+ The graph is walked with a work list instead of recursion, and output is
+ collected in a buffer that is written in large blocks.
+ */
+
+/**
+ Create an exporter.
+ \param[in] out an open file, the exporter does not close it
+ \param[in] format JSON Lines or binary
+ */
+Exporter::Exporter(std::FILE *out, Format format)
+: format_(format), out_(out)
+{
+  buffer_.reserve(kBufferSize + 256);
+}
+
+Exporter::~Exporter()
+{
+  flush();
+}
+
+/**
+ Write all buffered output to the file.
+ */
+void Exporter::flush()
+{
+  if (!buffer_.empty()) {
+    std::fwrite(buffer_.data(), 1, buffer_.size(), out_);
+    buffer_.clear();
+  }
+}
+
+void Exporter::maybe_flush_()
+{
+  if (buffer_.size() >= kBufferSize)
+    flush();
+}
+
+/**
+ Return the ID of an object and queue it for export if it is new.
+ */
+uint32_t Exporter::id_of_(const dyn::Object *obj)
+{
+  auto it = id_.find(obj);
+  if (it != id_.end())
+    return it->second;
+  uint32_t id = (uint32_t)todo_.size();
+  id_.emplace(obj, id);
+  todo_.push_back(obj);
+  return id;
+}
+
+bool Exporter::is_inline_(const dyn::Object *obj) const
+{
+  return obj->IsSymbol() || obj->IsReal() || IsString(obj);
+}
+
+void Exporter::put_varint_(uint64_t v)
+{
+  while (v >= 0x80) {
+    put_((char)(v | 0x80));
+    v >>= 7;
+  }
+  put_((char)v);
+}
+
+void Exporter::put_json_string_(const char *s, size_t n)
+{
+  static const char hex[] = "0123456789abcdef";
+  put_('"');
+  for (size_t i=0; i<n; ++i) {
+    uint8_t c = (uint8_t)s[i];
+    switch (c) {
+      case '"': put_("\\\""); break;
+      case '\\': put_("\\\\"); break;
+      case '\n': put_("\\n"); break;
+      case '\r': put_("\\r"); break;
+      case '\t': put_("\\t"); break;
+      default:
+        if (c < 0x20) {
+          put_("\\u00");
+          put_(hex[c>>4]);
+          put_(hex[c&15]);
+        } else {
+          put_((char)c);
+        }
+    }
+  }
+  put_('"');
+}
+
+/**
+ Write a value inline, or a reference to the record of an object.
+ */
+void Exporter::put_value_(const dyn::Ref &ref)
+{
+  bool json = (format_ == Format::JsonLines);
+  // Read-only objects that were written are exported as their copy.
+  dyn::Ref r = CopyOnWrite::Follow(ref);
+  const dyn::Object *obj = r.GetObject();
+  if (obj) {
+    if (obj->IsSymbol()) {
+      const char *name = static_cast<const Symbol*>(obj)->Name();
+      size_t n = ::strlen(name);
+      if (json) {
+        put_("{\"sym\":"); put_json_string_(name, n); put_('}');
+      } else {
+        put_((char)kSymbol); put_varint_(n); put_(name, n);
+      }
+    } else if (obj->IsReal()) {
+      Real v = obj->GetReal();
+      if (json) {
+        char buf[40];
+        int n = snprintf(buf, sizeof(buf), "{\"real\":%.17g}", v);
+        put_(buf, (size_t)n);
+      } else {
+        uint64_t bits;
+        ::memcpy(&bits, &v, sizeof(bits));
+        put_((char)kReal);
+        for (int i=0; i<8; ++i) put_((char)(bits >> (8*i)));
+      }
+    } else if (IsString(obj)) {
+      const char *str = (const char*)BinaryData(r);
+      size_t n = str ? ::strnlen(str, (size_t)obj->size()) : 0;
+      if (json) {
+        put_json_string_(str, n);
+      } else {
+        put_((char)kString); put_varint_(n); put_(str, n);
+      }
+    } else {
+      uint32_t id = id_of_(obj);
+      if (json) {
+        put_("{\"ref\":"); put_(std::to_string(id)); put_('}');
+      } else {
+        put_((char)kRef); put_varint_(id);
+      }
+    }
+  } else if (r.IsInt()) {
+    Integer v = r.GetInt();
+    if (json) {
+      put_(std::to_string(v));
+    } else {
+      put_((char)kInt); put_varint_(((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+    }
+  } else if (r.IsNIL()) {
+    if (json) put_("null"); else put_((char)kNil);
+  } else if (r.IsTrue()) {
+    if (json) put_("true"); else put_((char)kTrue);
+  } else if (r.IsChar()) {
+    if (json) {
+      std::string c = unicode_to_utf8(r.GetChar());
+      put_("{\"char\":"); put_json_string_(c.data(), c.size()); put_('}');
+    } else {
+      put_((char)kChar); put_varint_(r.GetChar());
+    }
+  } else {
+    if (json) {
+      put_("{\"imm\":"); put_(std::to_string(r.GetVerbatim())); put_('}');
+    } else {
+      put_((char)kImmediate); put_varint_(r.GetVerbatim());
+    }
+  }
+}
+
+/**
+ Write the record for one array, frame, or binary object.
+ */
+void Exporter::put_record_(const dyn::Object *obj)
+{
+  bool json = (format_ == Format::JsonLines);
+  uint32_t id = id_.at(obj);
+  if (obj->IsArray()) {
+    auto array = static_cast<const Array*>(obj);
+    Index n = array->Length();
+    if (json) {
+      put_("{\"id\":"); put_(std::to_string(id));
+      put_(",\"type\":\"array\",\"class\":"); put_value_(obj->GetClass());
+      put_(",\"slots\":[");
+    } else {
+      put_((char)kArray); put_varint_(id); put_value_(obj->GetClass()); put_varint_((uint64_t)n);
+    }
+    for (Index i=0; i<n; ++i) {
+      if (json && i) put_(',');
+      put_value_(array->GetSlot(i));
+    }
+    if (json) put_("]}\n");
+  } else if (obj->IsFrame()) {
+    auto frame = static_cast<const Frame*>(obj);
+    Index n = frame->Length();
+    if (json) {
+      put_("{\"id\":"); put_(std::to_string(id));
+      put_(",\"type\":\"frame\",\"slots\":{");
+    } else {
+      put_((char)kFrame); put_varint_(id); put_varint_((uint64_t)n);
+    }
+    for (Index i=0; i<n; ++i) {
+      Ref tag = frame->GetTag(i);
+      const char *name = tag.IsSymbol() ? static_cast<const Symbol*>(tag.GetObject())->Name() : "";
+      size_t len = ::strlen(name);
+      if (json) {
+        if (i) put_(',');
+        put_json_string_(name, len); put_(':');
+      } else {
+        put_varint_(len); put_(name, len);
+      }
+      put_value_(frame->GetSlot(i));
+    }
+    if (json) put_("}}\n");
+  } else {
+    bool large = obj->IsLargeBinary();
+    Ref self = Ref(const_cast<dyn::Object*>(obj));
+    size_t size = large ? static_cast<const LargeBinaryObject*>(obj)->Length() : (size_t)obj->size();
+    const uint8_t *data = (const uint8_t*)BinaryData(self);
+    Ref compander = large ? static_cast<const LargeBinaryObject*>(obj)->Compander() : RefNIL;
+    if (json) {
+      static const char hex[] = "0123456789abcdef";
+      put_("{\"id\":"); put_(std::to_string(id));
+      if (large)
+        put_(",\"type\":\"large_binary\",\"class\":");
+      else
+        put_(",\"type\":\"binary\",\"class\":");
+      put_value_(obj->GetClass());
+      if (compander.IsNotNIL()) {
+        put_(",\"compander\":"); put_value_(compander);
+      }
+      put_(",\"size\":"); put_(std::to_string(size));
+      put_(",\"data\":\"");
+      for (size_t i=0; data && i<size; ++i) {
+        put_(hex[data[i]>>4]);
+        put_(hex[data[i]&15]);
+        if ((i & 0xfff) == 0xfff) maybe_flush_();
+      }
+      put_("\"}\n");
+    } else {
+      put_((char)(large ? kLargeBinary : kBinary)); put_varint_(id);
+      put_value_(obj->GetClass());
+      if (large) put_value_(compander);
+      put_varint_(size);
+      if (data) {
+        flush();
+        std::fwrite(data, 1, size, out_);
+      }
+    }
+  }
+  records_++;
+}
+
+/**
+ Export the object graph that starts at `root`.
+ \param[in] root any Ref
+ */
+void Exporter::write(const dyn::Ref &root)
+{
+  id_.clear();
+  todo_.clear();
+  next_todo_ = 0;
+  if (format_ == Format::JsonLines) {
+    put_("{\"format\":\"dyne\",\"version\":1,\"root\":");
+    put_value_(root);
+    put_("}\n");
+  } else {
+    put_("DYNX\x01");
+    put_value_(root);
+  }
+  while (next_todo_ < todo_.size()) {
+    put_record_(todo_[next_todo_++]);
+    maybe_flush_();
+  }
+  if (format_ == Format::Binary)
+    put_((char)kEnd);
+  flush();
+}
+
+/**
+ Export an object graph into a file.
+ \param[in] root any Ref
+ \param[in] filename path of the new file, or "-" for stdout
+ \param[in] format JSON Lines or binary
+ \return 0 if successful, -1 if the file could not be created
+ */
+int dyn::io::Export(const dyn::Ref &root, const std::string &filename, Exporter::Format format)
+{
+  bool use_stdout = (filename == "-");
+  std::FILE *f = use_stdout ? stdout : std::fopen(filename.c_str(), "wb");
+  if (!f) {
+    std::cout << "ERROR: Export: Can't create file \"" << filename << "\"." << std::endl;
+    return -1;
+  }
+  {
+    Exporter exporter(f, format);
+    exporter.write(root);
+  }
+  if (!use_stdout)
+    std::fclose(f);
+  return 0;
+}
@@ -0,0 +1,580 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/io/generate.h>
+
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+
+using namespace dyn::io;
+
+
+/** \class dyn::io::Generator
+ Generate Newton packages and Newton Streams of any size.
+
+ Real packages are rare and small, so tests and benchmarks use generated
+ ones. Each part holds a tree of frames, arrays, strings, binary objects,
+ and integers. The root is an array of frames, so any number of objects
+ fits under the depth limit. The same options and seed always generate
+ the same bytes on every platform.
+
+ Frames that reuse the slot names of an earlier frame share its map and
+ its symbols in a package, and refer to the earlier symbols with
+ precedents in a stream. `symbol_reuse` controls how often that happens.
+ */
+
+
+namespace {
+
+constexpr uint32_t kSymString = 0;
+constexpr uint32_t kSymBinary = 1;
+constexpr uint32_t kSymArray = 2;
+constexpr uint32_t kNumClassSymbols = 3;
+constexpr uint32_t kRefNIL = 0x00000002;
+constexpr uint32_t kSymbolClass = 0x00055552;
+constexpr uint32_t kObjReadOnly = 0x40;
+constexpr uint32_t kNoCompressionFlag = 0x10000000;
+constexpr uint32_t kRelocationFlag = 0x04000000;
+constexpr uint32_t kNOSPart = 0x00000001;
+constexpr uint32_t kNotifyFlag = 0x00000080;
+constexpr uint32_t kPageSize = 1024;
+
+void put_ushort(std::vector<uint8_t> &out, uint32_t v)
+{
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)v);
+}
+
+void put_uint(std::vector<uint8_t> &out, uint32_t v)
+{
+  out.push_back((uint8_t)(v >> 24));
+  out.push_back((uint8_t)(v >> 16));
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)v);
+}
+
+void set_uint(std::vector<uint8_t> &out, size_t at, uint32_t v)
+{
+  out[at] = (uint8_t)(v >> 24);
+  out[at+1] = (uint8_t)(v >> 16);
+  out[at+2] = (uint8_t)(v >> 8);
+  out[at+3] = (uint8_t)v;
+}
+
+uint32_t get_uint(const std::vector<uint8_t> &in, size_t at)
+{
+  return ((uint32_t)in[at] << 24) | ((uint32_t)in[at+1] << 16) | ((uint32_t)in[at+2] << 8) | in[at+3];
+}
+
+void put_xlong(std::vector<uint8_t> &out, uint32_t v)
+{
+  if (v < 0xff) {
+    out.push_back((uint8_t)v);
+  } else {
+    out.push_back(0xff);
+    put_uint(out, v);
+  }
+}
+
+// ASCII text as a UTF-16 string with a trailing NUL.
+void put_utf16(std::vector<uint8_t> &out, const std::string &text)
+{
+  for (char c: text)
+    put_ushort(out, (uint8_t)c);
+  put_ushort(out, 0);
+}
+
+void pad(std::vector<uint8_t> &out, size_t align, uint8_t fill)
+{
+  while (out.size() % align)
+    out.push_back(fill);
+}
+
+uint32_t symbol_hash(const std::string &name)
+{
+  uint32_t sum = 0;
+  for (char c: name)
+    sum += (uint32_t)std::toupper((unsigned char)c);
+  return sum * 0x9E3779B9;
+}
+
+} // anonymous namespace
+
+
+/**
+ Create a generator.
+ \param[in] options sizes and shapes of the generated objects
+ */
+Generator::Generator(const Options &options)
+: opt_(options)
+{
+  if (opt_.frame_width < 1) opt_.frame_width = 1;
+  if (opt_.depth < 1) opt_.depth = 1;
+  if (opt_.num_parts < 1) opt_.num_parts = 1;
+}
+
+
+/**
+ A pseudo random number that does not depend on the standard library.
+ \param[in] n upper limit
+ \return a number in [0, n), or 0 if n is 0
+ */
+uint32_t Generator::random_(uint32_t n)
+{
+  uint32_t x = random_state_;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  random_state_ = x;
+  return n ? (x % n) : 0;
+}
+
+
+/**
+ Generate the object tree of a part.
+ \param[in] part every part has a different tree
+ */
+void Generator::build_(uint32_t part)
+{
+  random_state_ = opt_.seed * 2654435761u + part * 40503u + 1;
+  if (random_state_ == 0)
+    random_state_ = 1;
+  nodes_.clear();
+  shapes_.clear();
+  symbols_ = { "string", "binary", "array" };
+  nodes_.push_back( { Node::Kind::Array, 0, 0, { } } );
+  uint32_t budget = opt_.num_objects ? opt_.num_objects - 1 : 0;
+  while (budget > 0) {
+    uint32_t child = node_(1, budget);
+    nodes_[0].slots.push_back(child);
+  }
+}
+
+
+/**
+ Generate a node and its children.
+ \param[in] depth nesting depth of the node, the root is 0
+ \param[inout] budget number of objects that may still be created
+ \return index of the new node
+ */
+uint32_t Generator::node_(uint32_t depth, uint32_t &budget)
+{
+  Node::Kind kind = Node::Kind::Int;
+  if (budget > 0) {
+    uint32_t r = random_(100);
+    bool inner = (depth < opt_.depth);
+    if ((depth == 1) || (inner && r < 35))
+      kind = Node::Kind::Frame;
+    else if (inner && r < 50)
+      kind = Node::Kind::Array;
+    else if (r < 65)
+      kind = Node::Kind::String;
+    else if (r < 75)
+      kind = Node::Kind::Binary;
+    if (kind != Node::Kind::Int)
+      budget--;
+  }
+  uint32_t ix = (uint32_t)nodes_.size();
+  nodes_.push_back( { kind, 0, 0, { } } );
+  uint32_t width = 0;
+  switch (kind) {
+    case Node::Kind::Int:
+      nodes_[ix].value = (int32_t)random_(2000001) - 1000000;
+      break;
+    case Node::Kind::String:
+      nodes_[ix].size = 1 + random_(32);
+      break;
+    case Node::Kind::Binary:
+      nodes_[ix].size = random_(opt_.binary_size + 1);
+      break;
+    case Node::Kind::Frame:
+      if (!shapes_.empty() && random_(100) < opt_.symbol_reuse) {
+        nodes_[ix].value = (int32_t)random_((uint32_t)shapes_.size());
+      } else {
+        std::vector<uint32_t> tags;
+        for (uint32_t i=0; i<opt_.frame_width; ++i) {
+          tags.push_back((uint32_t)symbols_.size());
+          symbols_.push_back("slot" + std::to_string(symbols_.size() - kNumClassSymbols));
+        }
+        nodes_[ix].value = (int32_t)shapes_.size();
+        shapes_.push_back(std::move(tags));
+      }
+      width = (uint32_t)shapes_[nodes_[ix].value].size();
+      break;
+    case Node::Kind::Array:
+      width = 1 + random_(opt_.frame_width);
+      break;
+  }
+  for (uint32_t i=0; i<width; ++i) {
+    uint32_t child = node_(depth + 1, budget);
+    nodes_[ix].slots.push_back(child);
+  }
+  return ix;
+}
+
+
+/**
+ The bytes of a string or binary node.
+ They depend on the node only, so packages and streams hold the same data.
+ */
+std::vector<uint8_t> Generator::payload_(const Node &node)
+{
+  std::vector<uint8_t> data;
+  uint32_t ix = (uint32_t)(&node - nodes_.data());
+  if (node.kind == Node::Kind::String) {
+    std::string text;
+    for (uint32_t i=0; i<node.size; ++i)
+      text.push_back((char)('a' + (ix * 7 + i) % 26));
+    put_utf16(data, text);
+  } else {
+    for (uint32_t i=0; i<node.size; ++i)
+      data.push_back((uint8_t)(ix + i * 31));
+  }
+  return data;
+}
+
+
+/**
+ Write the objects of the current tree as the data of a NOS part.
+ The first object is an array that holds the root. Every symbol and every
+ map is written once.
+ \param[in] start position of the part in the package
+ \param[out] pointers positions of all references to objects, relative to start
+ \return the part data
+ */
+std::vector<uint8_t> Generator::part_(uint32_t start, std::vector<uint32_t> &pointers)
+{
+  // Newton OS 2 aligns objects to 4 bytes, Newton OS 1 to 8 bytes.
+  uint32_t align = opt_.package1 ? 4 : 8;
+  auto aligned = [align](uint32_t size) { return (size + align - 1) & ~(align - 1); };
+
+  // Lay out the wrapper, the nodes, the symbols, and the maps, in that order.
+  uint32_t pos = start + aligned(16);
+  std::vector<uint32_t> node_at(nodes_.size(), 0);
+  for (size_t i=0; i<nodes_.size(); ++i) {
+    const Node &n = nodes_[i];
+    uint32_t size = 0;
+    switch (n.kind) {
+      case Node::Kind::Int: continue;
+      case Node::Kind::Frame:
+      case Node::Kind::Array: size = 12 + 4 * (uint32_t)n.slots.size(); break;
+      case Node::Kind::String: size = 12 + 2 * (n.size + 1); break;
+      case Node::Kind::Binary: size = 12 + n.size; break;
+    }
+    node_at[i] = pos;
+    pos += aligned(size);
+  }
+  std::vector<uint32_t> symbol_at(symbols_.size(), 0);
+  for (size_t i=0; i<symbols_.size(); ++i) {
+    symbol_at[i] = pos;
+    pos += aligned(17 + (uint32_t)symbols_[i].size());
+  }
+  std::vector<uint32_t> map_at(shapes_.size(), 0);
+  for (size_t i=0; i<shapes_.size(); ++i) {
+    map_at[i] = pos;
+    pos += aligned(16 + 4 * (uint32_t)shapes_[i].size());
+  }
+
+  std::vector<uint8_t> out;
+  out.reserve(pos - start);
+  auto ref_of = [&](uint32_t ix) {
+    const Node &n = nodes_[ix];
+    if (n.kind == Node::Kind::Int)
+      return (uint32_t)n.value << 2;
+    return node_at[ix] | 1;
+  };
+  auto put_ref = [&](uint32_t ref) {
+    if ((ref & 3) == 1)
+      pointers.push_back((uint32_t)out.size());
+    put_uint(out, ref);
+  };
+  // The loader finds the alignment in the second word of the first object.
+  auto put_header = [&](uint32_t size, uint32_t type) {
+    put_uint(out, (size << 8) | kObjReadOnly | type);
+    put_uint(out, (out.size() == 4 && opt_.package1) ? 1 : 0);
+  };
+
+  put_header(16, 1);
+  put_uint(out, kRefNIL);
+  put_ref(ref_of(0));
+  pad(out, align, 0xbf);
+  for (size_t i=0; i<nodes_.size(); ++i) {
+    const Node &n = nodes_[i];
+    switch (n.kind) {
+      case Node::Kind::Int:
+        continue;
+      case Node::Kind::Frame:
+        put_header(12 + 4 * (uint32_t)n.slots.size(), 3);
+        put_ref(map_at[n.value] | 1);
+        for (uint32_t s: n.slots)
+          put_ref(ref_of(s));
+        break;
+      case Node::Kind::Array:
+        put_header(12 + 4 * (uint32_t)n.slots.size(), 1);
+        put_ref(symbol_at[kSymArray] | 1);
+        for (uint32_t s: n.slots)
+          put_ref(ref_of(s));
+        break;
+      case Node::Kind::String:
+      case Node::Kind::Binary: {
+        std::vector<uint8_t> data = payload_(n);
+        put_header(12 + (uint32_t)data.size(), 0);
+        put_ref(symbol_at[(n.kind == Node::Kind::String) ? kSymString : kSymBinary] | 1);
+        out.insert(out.end(), data.begin(), data.end());
+        break; }
+    }
+    pad(out, align, 0xbf);
+  }
+  for (const std::string &name: symbols_) {
+    put_header(17 + (uint32_t)name.size(), 0);
+    put_uint(out, kSymbolClass);
+    put_uint(out, symbol_hash(name));
+    out.insert(out.end(), name.begin(), name.end());
+    out.push_back(0);
+    pad(out, align, 0xbf);
+  }
+  for (const auto &shape: shapes_) {
+    put_header(16 + 4 * (uint32_t)shape.size(), 1);
+    put_uint(out, 0);  // map flags as an integer
+    put_uint(out, kRefNIL);  // no supermap
+    for (uint32_t tag: shape)
+      put_ref(symbol_at[tag] | 1);
+    pad(out, align, 0xbf);
+  }
+  return out;
+}
+
+
+/**
+ Generate a package file.
+ \return the bytes of the package
+ */
+std::vector<uint8_t> Generator::package()
+{
+  static const std::string kCopyright { "Generated by Dyne" };
+  static const std::string kInfo { "A generated package" };
+  std::string name = "Generated" + std::to_string(opt_.seed);
+  uint32_t num_parts = opt_.num_parts;
+
+  // Part references are relative to the package, so parts are generated
+  // with references relative to the part data area first.
+  std::vector<std::vector<uint8_t>> parts;
+  std::vector<uint32_t> pointers;
+  uint32_t part_data_size = 0;
+  for (uint32_t i=0; i<num_parts; ++i) {
+    build_(i);
+    std::vector<uint32_t> part_pointers;
+    parts.push_back(part_(part_data_size, part_pointers));
+    for (uint32_t p: part_pointers)
+      pointers.push_back(part_data_size + p);
+    part_data_size += (uint32_t)parts.back().size();
+  }
+
+  std::vector<uint8_t> vdata;
+  put_utf16(vdata, kCopyright);
+  uint32_t copyright_length = (uint32_t)vdata.size();
+  put_utf16(vdata, name);
+  uint32_t name_length = (uint32_t)vdata.size() - copyright_length;
+  uint32_t info_start = (uint32_t)vdata.size();
+  for (uint32_t i=0; i<num_parts; ++i)
+    vdata.insert(vdata.end(), kInfo.begin(), kInfo.end());
+  uint32_t directory_size = (52 + 32 * num_parts + (uint32_t)vdata.size() + 3) & ~3u;
+
+  // Relocation sets list the words in every page of the part data that
+  // refer to objects.
+  std::vector<uint8_t> relocation;
+  if (opt_.relocation) {
+    std::vector<uint8_t> sets;
+    uint32_t num_sets = 0;
+    for (size_t i=0; i<pointers.size(); ) {
+      uint32_t page = pointers[i] / kPageSize;
+      size_t j = i;
+      while ((j < pointers.size()) && (pointers[j] / kPageSize == page))
+        ++j;
+      put_ushort(sets, page);
+      put_ushort(sets, (uint32_t)(j - i));
+      for ( ; i<j; ++i)
+        sets.push_back((uint8_t)((pointers[i] % kPageSize) / 4));
+      pad(sets, 4, 0);
+      num_sets++;
+    }
+    put_uint(relocation, 0);
+    put_uint(relocation, 20 + (uint32_t)sets.size());
+    put_uint(relocation, kPageSize);
+    put_uint(relocation, num_sets);
+    put_uint(relocation, 0);  // base address
+    relocation.insert(relocation.end(), sets.begin(), sets.end());
+  }
+  uint32_t part_data_start = directory_size + (uint32_t)relocation.size();
+
+  std::vector<uint8_t> out;
+  out.reserve(part_data_start + part_data_size);
+  const char *signature = opt_.package1 ? "package1" : "package0";
+  out.insert(out.end(), signature, signature + 8);
+  out.insert(out.end(), { 'x', 'x', 'x', 'x' });
+  put_uint(out, kNoCompressionFlag | (opt_.relocation ? kRelocationFlag : 0));
+  put_uint(out, 1);  // version
+  put_ushort(out, 0);
+  put_ushort(out, copyright_length);
+  put_ushort(out, copyright_length);
+  put_ushort(out, name_length);
+  put_uint(out, part_data_start + part_data_size);
+  put_uint(out, 0xB5E0F4A0);  // date
+  put_uint(out, 0);
+  put_uint(out, 0);
+  put_uint(out, directory_size);
+  put_uint(out, num_parts);
+  uint32_t offset = 0;
+  for (uint32_t i=0; i<num_parts; ++i) {
+    uint32_t size = (uint32_t)parts[i].size();
+    put_uint(out, offset);
+    put_uint(out, size);
+    put_uint(out, size);
+    out.insert(out.end(), { 'f', 'o', 'r', 'm' });
+    put_uint(out, 0);
+    put_uint(out, kNOSPart | kNotifyFlag);
+    put_ushort(out, info_start + i * (uint32_t)kInfo.size());
+    put_ushort(out, (uint32_t)kInfo.size());
+    put_ushort(out, 0);
+    put_ushort(out, 0);
+    offset += size;
+  }
+  out.insert(out.end(), vdata.begin(), vdata.end());
+  pad(out, 4, 0);
+  out.insert(out.end(), relocation.begin(), relocation.end());
+  for (auto &part: parts)
+    out.insert(out.end(), part.begin(), part.end());
+  for (uint32_t p: pointers) {
+    size_t at = part_data_start + p;
+    set_uint(out, at, get_uint(out, at) + part_data_start);
+  }
+  return out;
+}
+
+
+/**
+ Generate a Newton Stream with the objects of the first part.
+ \return the bytes of the stream
+ */
+std::vector<uint8_t> Generator::nsof()
+{
+  build_(0);
+  std::vector<uint8_t> out { 0x02 };
+  std::vector<uint32_t> symbol_id(symbols_.size(), (uint32_t)-1);
+  uint32_t next_id = 0;
+  auto put_symbol = [&](uint32_t sym) {
+    if (symbol_id[sym] != (uint32_t)-1) {
+      out.push_back(0x09);
+      put_xlong(out, symbol_id[sym]);
+    } else {
+      symbol_id[sym] = next_id++;
+      out.push_back(0x07);
+      put_xlong(out, (uint32_t)symbols_[sym].size());
+      out.insert(out.end(), symbols_[sym].begin(), symbols_[sym].end());
+    }
+  };
+  // Trees are only as deep as the options allow, so recursion is fine.
+  auto put_node = [&](auto &self, uint32_t ix) -> void {
+    const Node &n = nodes_[ix];
+    switch (n.kind) {
+      case Node::Kind::Int:
+        out.push_back(0x00);
+        put_xlong(out, (uint32_t)n.value << 2);
+        return;
+      case Node::Kind::Frame:
+        out.push_back(0x06);
+        put_xlong(out, (uint32_t)n.slots.size());
+        next_id++;
+        for (uint32_t tag: shapes_[n.value])
+          put_symbol(tag);
+        for (uint32_t s: n.slots)
+          self(self, s);
+        return;
+      case Node::Kind::Array:
+        out.push_back(0x04);
+        put_xlong(out, (uint32_t)n.slots.size());
+        next_id++;
+        put_symbol(kSymArray);
+        for (uint32_t s: n.slots)
+          self(self, s);
+        return;
+      case Node::Kind::String: {
+        std::vector<uint8_t> data = payload_(n);
+        out.push_back(0x08);
+        put_xlong(out, (uint32_t)data.size());
+        next_id++;
+        out.insert(out.end(), data.begin(), data.end());
+        return; }
+      case Node::Kind::Binary: {
+        std::vector<uint8_t> data = payload_(n);
+        out.push_back(0x03);
+        put_xlong(out, (uint32_t)data.size());
+        next_id++;
+        put_symbol(kSymBinary);
+        out.insert(out.end(), data.begin(), data.end());
+        return; }
+    }
+  };
+  put_node(put_node, 0);
+  return out;
+}
+
+
+static int write_file(const std::string &filename, const std::vector<uint8_t> &data)
+{
+  std::FILE *f = std::fopen(filename.c_str(), "wb");
+  if (!f) {
+    std::cout << "ERROR: can't create file \"" << filename << "\"." << std::endl;
+    return -1;
+  }
+  size_t n = std::fwrite(data.data(), 1, data.size(), f);
+  if (std::fclose(f) != 0 || n != data.size()) {
+    std::cout << "ERROR: can't write file \"" << filename << "\"." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ Generate a package and write it to a file.
+ \param[in] filename path and name of the new package file
+ \return 0 if succeeded
+ */
+int Generator::write_package(const std::string &filename)
+{
+  return write_file(filename, package());
+}
+
+
+/**
+ Generate a Newton Stream and write it to a file.
+ \param[in] filename path and name of the new stream file
+ \return 0 if succeeded
+ */
+int Generator::write_nsof(const std::string &filename)
+{
+  return write_file(filename, nsof());
+}
@@ -24,9 +24,12 @@
 
 #include <dyn/io/package.h>
 #include <dyn/objects.h>
+#include <dyn/tools/stats.h>
 #include <dyn/tools/tools.h>
+#include <dyn/tools/trace.h>
 
 #include <cassert>
+#include <iomanip>
 
 using namespace dyn::io;
 
@@ -339,11 +342,15 @@ int Package::compare(Package &other) {
  */
 int Package::load(const std::string &package_file_name)
 {
+  dyn::tools::ScopedTimer timer(dyn::tools::Stats::kLoad);
+  dyn::tools::TraceSpan span("Package::load", "package");
+  span.arg("file", package_file_name);
   file_name_ = package_file_name;
   std::ifstream source_file { package_file_name, std::ios::binary };
   if (source_file) {
     pkg_bytes_ = std::make_shared<PackageBytes>();
     pkg_bytes_->assign(std::istreambuf_iterator<char>{source_file}, {});
+    dyn::tools::Stats::count(dyn::tools::Stats::kBytesRead, pkg_bytes_->size());
     file_name_ = package_file_name;
 //    std::cout << "readPackage: \"" << file_name_ << "\" package read (" << pkg_bytes_->size() << " bytes)." << std::endl;
     return load();
@@ -360,6 +367,9 @@ int Package::load(const std::string &package_file_name)
  */
 int Package::writeAsm(const std::string &assembler_file_name)
 {
+  dyn::tools::ScopedTimer timer(dyn::tools::Stats::kWriteAsm);
+  dyn::tools::TraceSpan span("Package::writeAsm", "package");
+  span.arg("file", assembler_file_name);
   std::ofstream asm_file { assembler_file_name };
   if (asm_file.fail()) {
     std::cout << "writeAsm: Unable to write assembler file \"" << assembler_file_name << "\"." << std::endl;
@@ -440,10 +450,12 @@ int Package::writeAsm(const std::string &assembler_file_name)
  \return 0 if file content creates the same binary representation
  */
 int Package::compareFile(const std::string &other_package_file) {
+  dyn::tools::ScopedTimer timer(dyn::tools::Stats::kCompare);
   std::vector<uint8_t> new_pkg;
   std::ifstream new_file { other_package_file, std::ios::binary };
   if (new_file) {
     new_pkg.assign(std::istreambuf_iterator<char>{new_file}, {});
+    dyn::tools::Stats::count(dyn::tools::Stats::kBytesRead, new_pkg.size());
     if (new_pkg == *pkg_bytes_) {
       //      std::cout << "compareBinaries: Packages are identical." << std::endl;
       //      std::cout << "OK." << std::endl;
@@ -473,6 +485,7 @@ int Package::compareFile(const std::string &other_package_file) {
  \return 0 if file content creates the same binary representation
  */
 int Package::compareContents(const std::string &other_package_file) {
+  dyn::tools::ScopedTimer timer(dyn::tools::Stats::kCompare);
   Package other;
   if (other.load(other_package_file)==-1) {
     std::cout << "ERROR: compareContents: Can'r read package \"" << other_package_file << "\"." << std::endl;
@@ -487,6 +500,9 @@ int Package::compareContents(const std::string &other_package_file) {
  \return the object tree or an error code as an integer
  */
 dyn::Ref Package::toNOS() {
+  dyn::tools::ScopedTimer timer(dyn::tools::Stats::kToNOS);
+  dyn::tools::TraceSpan span("Package::toNOS", "package");
+  span.arg("file", file_name_);
   dyn::Ref pkg = dyn::AllocateFrame();
   dyn::SetFrameSlot(pkg, dyn::Sym("signature"), dyn::MakeString(signature_));
   dyn::SetFrameSlot(pkg, dyn::Sym("type"), dyn::MakeString(type_));
@@ -23,16 +23,26 @@
  */
 
 #include <dyn/io/package.h>
+#include <dyn/tools/stats.h>
 #include <dyn/tools/tools.h>
+#include <dyn/tools/trace.h>
 #include <dyn/objects.h>
 
 #include <iostream>
 #include <fstream>
 #include <ios>
 #include <cassert>
+#include <cstring>
+#include <iomanip>
 #include <memory>
 
+#ifndef htonll
+#include <endian.h>
+#define htonll(x) htobe64(x)
+#endif
+
 using namespace dyn::io;
+using dyn::tools::Stats;
 
 
 /** \class pkg::PartData
@@ -119,22 +129,32 @@ std::shared_ptr<Object> Object::peek(PackageBytes &p, uint32_t offset)
     case 0:
       // TODO: use the symbol to get information and find Reals and ByteCode
       // There are also machine code block, bitmaps, sounds etc. .
-      if (class_ == 0x00055552)
+      if (class_ == 0x00055552) {
+        Stats::count(Stats::kSymbolsDecoded);
         return std::make_shared<ObjectSymbol>(offset); // Symbol
-      else
+      } else {
+        Stats::count(Stats::kBinariesDecoded);
         return std::make_shared<ObjectBinary>(offset); // Binary
+      }
     case 1:
       // If the class is an integer, the array is used to store a map
       // for a Frame. Check what flags are set (sorted(1), _proto(4)),
       // and if any map has a supermap.
-      if ((class_ & 0x00000003) == 0)
+      if ((class_ & 0x00000003) == 0) {
+        Stats::count(Stats::kMapsDecoded);
         return std::make_shared<ObjectMap>(offset); // Map
-      else
+      } else {
+        Stats::count(Stats::kArraysDecoded);
         return std::make_shared<ObjectSlotted>(offset); // Array
+      }
       // TODO: what other special class values are there?
     default:
-    case 2: return std::make_shared<ObjectBinary>(offset); // Unknown
-    case 3: return std::make_shared<ObjectSlotted>(offset); // Frame
+    case 2:
+      Stats::count(Stats::kBinariesDecoded);
+      return std::make_shared<ObjectBinary>(offset); // Unknown
+    case 3:
+      Stats::count(Stats::kFramesDecoded);
+      return std::make_shared<ObjectSlotted>(offset); // Frame
   }
 }
 
@@ -165,10 +185,11 @@ int Object::load(PackageBytes &p)
     std::cout << "WARNING: NS Object flags should be 0x40, but it's 0x"
     << std::setw(2) << std::setfill('0') << std::hex << (header & 0x000000fc) << std::dec
     << "." << std::endl;
-  size_  = ((header >> 8) - 8);
-  if (size_ < 0) {
+  if ((header >> 8) < 8) {
     std::cout << "ERROR: NS Object size <0 found." << std::endl;
     size_ = 0;
+  } else {
+    size_  = ((header >> 8) - 8);
   }
   ref_cnt_ = p.get_uint();
   class_ = p.get_ref();
@@ -538,7 +559,7 @@ void ObjectSymbol::makeAsmLabel(PartDataNOS &p) {
     strncpy(buf, label_.c_str(), sizeof(buf)-7);
     int ins = (int)strlen(buf);
     for (int i=2; ; i++) {
-      snprintf(buf+ins, 6, "_%d", i);
+      snprintf(buf+ins, sizeof(buf)-ins, "_%d", i);
       label_ = buf;
       if (p.addLabel(label_, this)) break;
     }
@@ -939,6 +960,8 @@ Object *PartDataNOS::object_at(uint32_t offset)
  */
 dyn::Ref PartDataNOS::toNOS()
 {
+  dyn::tools::TraceSpan span("PartDataNOS::toNOS", "part");
+  span.arg("part", part_entry_.index());
   // Mark all objects as not yet written.
   for (auto &obj: object_list_)
     obj.second->mark(false);
@@ -1017,8 +1040,9 @@ dyn::Ref PartDataNOS::refToNOS(uint32_t ref) {
           << "." << std::endl;
           return dyn::Ref(dyn::Ref::Verbatim_(ref));
       }
+      break;
     case 3: // Make Magic Pointer
-      return dyn::Ref(ref>>14, (ref>>4)&0xfff);
+      return dyn::Ref(ref>>14, (ref>>2)&0xfff);
   }
   return dyn::RefUNREF;
 }
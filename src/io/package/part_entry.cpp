@@ -24,6 +24,7 @@
 
 #include <dyn/io/package.h>
 #include <dyn/objects.h>
+#include <dyn/tools/trace.h>
 
 #include <cassert>
 #include <iomanip>
@@ -163,6 +164,8 @@ int PartEntry::loadInfo(PackageBytes &p) {
  \return 0 if succeeded
  */
 int PartEntry::loadPartData(PackageBytes &p) {
+  dyn::tools::TraceSpan span("PartEntry::loadPartData", "part");
+  span.arg("part", index_);
   return part_data_->load(p);
 }
 
@@ -25,6 +25,10 @@
 #include <dyn/io/print.h>
 
 #include <dyn/ref.h>
+#include <dyn/objects.h>
+
+#include <unordered_set>
+#include <vector>
 
 
 using namespace dyn::io;
@@ -61,12 +65,73 @@ void PrintState::decr_depth() {
     current_depth_--;
 }
 
+/**
+ Find all objects that are referenced more than once.
+
+ Arrays, frames, and binaries that can be reached on more than one path
+ from `root` are printed in full the first time they appear, prefixed with
+ a label `#n=`. Later appearances print only `#n#`. This also stops the
+ printer from going around in circles.
+
+ \param[in] root the object that will be printed
+ */
+void PrintState::scan(const dyn::Ref &root)
+{
+  std::unordered_set<const dyn::Object*> seen;
+  std::vector<dyn::Ref> todo { root };
+  label_.clear();
+  next_label_ = 0;
+  while (!todo.empty()) {
+    dyn::Ref r = todo.back();
+    todo.pop_back();
+    const dyn::Object *obj = dyn::CopyOnWrite::Follow(r).GetObject();
+    if (!obj || obj->IsSymbol())
+      continue;
+    if (!seen.insert(obj).second) {
+      label_.emplace(obj, 0);
+      continue;
+    }
+    if (obj->IsArray() || obj->IsFrame()) {
+      auto slotted = static_cast<const dyn::SlottedObject*>(obj);
+      for (Index i=slotted->Length(); i>0; --i)
+        todo.push_back(slotted->GetSlot(i-1));
+    }
+    if (!obj->IsFrame())
+      todo.push_back(obj->GetClass());
+  }
+}
+
+/**
+ Print the label for a shared object, if it has one.
+ \param[in] obj the object that is about to be printed
+ \return true if the object was printed before and only a reference
+ was written, false if the object must be printed in full
+ */
+bool PrintState::label(const dyn::Object *obj)
+{
+  if (label_.empty())
+    return false;
+  auto it = label_.find(obj);
+  if (it == label_.end())
+    return false;
+  if (it->second) {
+    fprintf(out_, "#%u#", it->second);
+    return true;
+  }
+  it->second = ++next_label_;
+  fprintf(out_, "#%u=", it->second);
+  return false;
+}
+
 /**
  Print any Ref.
+ Objects that are used more than once are printed once and then referred
+ to by label.
  */
 void dyn::Print(RefArg p)
 {
   dyn::io::PrintState state(stdout);
+  state.scan(p);
   p.Print(state);
   fprintf(state.out_, "\n");
 }
@@ -0,0 +1,482 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/io/snapshot.h>
+#include <dyn/objects.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace dyn;
+using namespace dyn::io;
+
+
+/** \class dyn::io::Snapshot
+ Write an object tree into an image file, and map it back in one step.
+
+ The image holds the objects in the same memory layout that the runtime
+ uses, so loading a snapshot does not parse or allocate anything per
+ object. Every pointer in the image, in Refs as well as to the data of
+ binaries, slots, maps, and symbol names, is stored as an offset from the
+ start of the image. A table at the end lists all these words; after
+ mapping the file, load() adds the address of the mapping to each of them.
+ That is the only pass over the data.
+
+ Objects that are referenced more than once are stored once, so shared
+ maps stay shared and cycles are kept. Symbols with the same name are
+ stored once as well. All objects in a snapshot are marked read-only,
+ because their slots and data can not grow in place.
+
+ The image uses the native byte order and object layout, and is only
+ meant to be read by the same build of the runtime that wrote it.
+ Objects stay valid until the snapshot is closed or destroyed.
+ */
+
+
+namespace {
+
+constexpr char kMagic[8] = { 'D', 'Y', 'N', 'S', 'N', 'A', 'P', 0 };
+constexpr uint32_t kVersion = 1;
+
+// A relocation entry is the offset of a word in the image. The word holds
+// an offset from the start of the image that must be turned into a pointer.
+// Offsets are 8 byte aligned, so the lower bits tell what kind of word it is.
+constexpr uint64_t kRelocPointer = 0;
+constexpr uint64_t kRelocLargeBinaryInfo = 1;
+constexpr uint64_t kRelocKindMask = 7;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t object_size;
+  uint64_t image_size;
+  uint64_t root;
+  uint64_t num_objects;
+  uint64_t relocs;
+  uint64_t num_relocs;
+};
+
+// Large binaries keep their attributes in a LargeBinaryInfo on the heap.
+// The image stores this record instead, and load() creates the info.
+struct LargeBinaryRecord {
+  uint64_t size;
+  uint64_t compander;
+  uint64_t params_size;
+};
+
+} // namespace
+
+
+struct Snapshot::Writer
+{
+  std::vector<uint8_t> &image;
+  std::vector<uint64_t> relocs { };
+  std::unordered_map<const Object*, uint64_t> offset { };
+  std::unordered_map<std::string, uint64_t> symbols { };
+  std::vector<const Object*> todo { };
+  uint64_t num_objects { 0 };
+  bool ok { true };
+
+  Writer(std::vector<uint8_t> &img) : image(img) { }
+
+  uint64_t alloc(size_t n) {
+    uint64_t at = image.size();
+    image.resize(at + ((n + 7) & ~(size_t)7), 0);
+    return at;
+  }
+
+  void put_word(uint64_t at, uint64_t value, uint64_t reloc) {
+    ::memcpy(&image[at], &value, sizeof(value));
+    if (reloc != ~(uint64_t)0)
+      relocs.push_back(at | reloc);
+  }
+
+  void put_ref(uint64_t at, Ref r) {
+    if (r.IsPtr())
+      put_word(at, place(r.GetObject()), kRelocPointer);
+    else
+      put_word(at, r.GetVerbatim(), ~(uint64_t)0);
+  }
+
+  void put_data(uint64_t at, const void *data, size_t n) {
+    if (n)
+      ::memcpy(&image[at], data, n);
+  }
+
+  uint64_t place(const Object *o);
+  void fill(const Object *o);
+};
+
+
+/**
+ Return the offset of an object in the image, and reserve space for it and
+ its data when it is seen for the first time.
+ */
+uint64_t Snapshot::Writer::place(const Object *o)
+{
+  auto it = offset.find(o);
+  if (it != offset.end())
+    return it->second;
+
+  std::string name;
+  if (o->IsSymbol()) {
+    for (const char *s = o->symbol.string_; *s; ++s)
+      name.push_back((char)std::tolower((unsigned char)*s));
+    auto sym = symbols.find(name);
+    if (sym != symbols.end()) {
+      offset[o] = sym->second;
+      return sym->second;
+    }
+  }
+
+  size_t payload = 0;
+  switch (o->t.tag_) {
+    case Object::Tag::binary: payload = o->size_; break;
+    case Object::Tag::symbol: payload = ::strlen(o->symbol.string_) + 1; break;
+    case Object::Tag::array:
+    case Object::Tag::frame: payload = o->size_; break;
+    case Object::Tag::large_binary: {
+      auto lbo = static_cast<const LargeBinaryObject*>(o);
+      payload = sizeof(LargeBinaryRecord) + ((lbo->CompanderParams().size() + 7) & ~(size_t)7)
+              + (lbo->lbo.data_ ? lbo->Length() : 0);
+      break; }
+    case Object::Tag::real: break;
+    default:
+      std::cout << "ERROR: Snapshot: can't write native pointers." << std::endl;
+      ok = false;
+      break;
+  }
+  uint64_t at = alloc(sizeof(Object));
+  alloc(payload);
+  offset[o] = at;
+  if (o->IsSymbol())
+    symbols[name] = at;
+  todo.push_back(o);
+  num_objects++;
+  return at;
+}
+
+
+/**
+ Copy an object into the space that place() reserved for it.
+ */
+void Snapshot::Writer::fill(const Object *o)
+{
+  uint64_t at = offset[o];
+  uint64_t payload = at + sizeof(Object);
+  Object copy = *o;
+  copy.f.read_only_ = 1;
+  copy.f.compact_ = 0;
+  copy.gc_ = 0;
+  auto field = [at, &copy](const void *p) {
+    return at + (uint64_t)((const uint8_t*)p - (const uint8_t*)&copy);
+  };
+  put_data(at, &copy, sizeof(Object));
+
+  switch (o->t.tag_) {
+    case Object::Tag::binary:
+      put_data(payload, o->binary.data_, o->size_);
+      put_word(field(&copy.binary.data_), payload, kRelocPointer);
+      put_ref(field(&copy.binary.class_), o->binary.class_);
+      break;
+    case Object::Tag::symbol:
+      put_data(payload, o->symbol.string_, ::strlen(o->symbol.string_) + 1);
+      put_word(field(&copy.symbol.string_), payload, kRelocPointer);
+      put_ref(field(&copy.symbol.class_), o->symbol.class_);
+      break;
+    case Object::Tag::array: {
+      put_word(field(&copy.array.slot_), payload, kRelocPointer);
+      put_word(field(&copy.array.reserve_), 0, ~(uint64_t)0);
+      put_ref(field(&copy.array.class_), o->array.class_);
+      Index n = (Index)(o->size_ / sizeof(Ref));
+      for (Index i=0; i<n; ++i)
+        put_ref(payload + i*sizeof(Ref), static_cast<const SlottedObject*>(o)->GetSlot(i));
+      break; }
+    case Object::Tag::frame: {
+      put_word(field(&copy.frame.slot_), payload, kRelocPointer);
+      put_word(field(&copy.frame.reserve_), 0, ~(uint64_t)0);
+      put_word(field(&copy.frame.map_), place(o->frame.map_), kRelocPointer);
+      Index n = (Index)(o->size_ / sizeof(Ref));
+      for (Index i=0; i<n; ++i)
+        put_ref(payload + i*sizeof(Ref), static_cast<const SlottedObject*>(o)->GetSlot(i));
+      break; }
+    case Object::Tag::large_binary: {
+      auto lbo = static_cast<const LargeBinaryObject*>(o);
+      const std::vector<uint8_t> &params = lbo->CompanderParams();
+      uint64_t data = payload + sizeof(LargeBinaryRecord) + ((params.size() + 7) & ~(size_t)7);
+      put_word(payload + offsetof(LargeBinaryRecord, size), lbo->Length(), ~(uint64_t)0);
+      put_word(payload + offsetof(LargeBinaryRecord, params_size), params.size(), ~(uint64_t)0);
+      put_data(payload + sizeof(LargeBinaryRecord), params.data(), params.size());
+      if (o->lbo.data_) {
+        put_data(data, o->lbo.data_, lbo->Length());
+        put_word(field(&copy.lbo.data_), data, kRelocPointer);
+      }
+      put_ref(field(&copy.lbo.class_), o->lbo.class_);
+      // The compander must be relocated before the info is created from the record.
+      put_ref(payload + offsetof(LargeBinaryRecord, compander), lbo->Compander());
+      put_word(field(&copy.lbo.info_), payload, kRelocLargeBinaryInfo);
+      break; }
+    case Object::Tag::real:
+      put_ref(field(&copy.real.class_), o->real.class_);
+      break;
+    default:
+      break;
+  }
+}
+
+
+/**
+ Write an object tree into a memory image.
+ \param[in] root the object tree
+ \param[out] image the snapshot
+ \return 0 if succeeded
+ */
+int Snapshot::write(RefArg root, std::vector<uint8_t> &image)
+{
+  image.clear();
+  Writer w(image);
+  w.alloc(sizeof(Header));
+  Header h { };
+  ::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kVersion;
+  h.object_size = (uint32_t)sizeof(Object);
+  h.root = root.IsPtr() ? w.place(root.GetObject()) : root.GetVerbatim();
+  while (!w.todo.empty()) {
+    const Object *o = w.todo.back();
+    w.todo.pop_back();
+    w.fill(o);
+  }
+  h.num_objects = w.num_objects;
+  h.relocs = image.size();
+  h.num_relocs = w.relocs.size();
+  uint64_t at = w.alloc(w.relocs.size() * sizeof(uint64_t));
+  w.put_data(at, w.relocs.data(), w.relocs.size() * sizeof(uint64_t));
+  h.image_size = image.size();
+  ::memcpy(image.data(), &h, sizeof(h));
+  return w.ok ? 0 : -1;
+}
+
+
+/**
+ Write an object tree into a snapshot file.
+ \param[in] root the object tree
+ \param[in] file_name path and name
+ \return 0 if succeeded
+ */
+int Snapshot::write(RefArg root, const std::string &file_name)
+{
+  std::vector<uint8_t> image;
+  if (write(root, image) < 0)
+    return -1;
+  std::FILE *f = std::fopen(file_name.c_str(), "wb");
+  if (!f) {
+    std::cout << "ERROR: Snapshot: can't create \"" << file_name << "\"." << std::endl;
+    return -1;
+  }
+  size_t n = std::fwrite(image.data(), 1, image.size(), f);
+  if (std::fclose(f) != 0 || n != image.size()) {
+    std::cout << "ERROR: Snapshot: can't write \"" << file_name << "\"." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ Map a snapshot file into memory and make its objects usable.
+ The pages are mapped privately, so changes are never written back.
+ \param[in] file_name path and name
+ \return 0 if succeeded
+ */
+int Snapshot::load(const std::string &file_name)
+{
+  close();
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::cout << "ERROR: Snapshot: can't open \"" << file_name << "\"." << std::endl;
+    return -1;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= sizeof(Header)) {
+    void *map = ::mmap(nullptr, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      image_ = (uint8_t*)map;
+      size_ = (size_t)st.st_size;
+      mapped_ = true;
+    }
+  }
+  ::close(fd);
+  if (!image_) {
+    std::cout << "ERROR: Snapshot: can't map \"" << file_name << "\"." << std::endl;
+    return -1;
+  }
+  return relocate_();
+}
+
+
+/**
+ Load a snapshot from memory.
+ The image is copied, so the caller can release it right away.
+ \param[in] data, size the snapshot
+ \return 0 if succeeded
+ */
+int Snapshot::load(const uint8_t *data, size_t size)
+{
+  close();
+  if (size < sizeof(Header)) {
+    std::cout << "ERROR: Snapshot: image too small." << std::endl;
+    return -1;
+  }
+  image_ = (uint8_t*)::malloc(size);
+  if (!image_)
+    return -1;
+  ::memcpy(image_, data, size);
+  size_ = size;
+  mapped_ = false;
+  return relocate_();
+}
+
+
+/**
+ Check the header and turn all offsets in the image into pointers.
+ */
+int Snapshot::relocate_()
+{
+  Header h;
+  ::memcpy(&h, image_, sizeof(h));
+  if (::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion
+      || h.object_size != sizeof(Object) || h.image_size != size_
+      || h.relocs > size_ || h.num_relocs > (size_ - h.relocs) / sizeof(uint64_t)) {
+    std::cout << "ERROR: Snapshot: not a snapshot of this runtime." << std::endl;
+    close();
+    return -1;
+  }
+  uintptr_t base = (uintptr_t)image_;
+  const uint8_t *relocs = image_ + h.relocs;
+  for (uint64_t i=0; i<h.num_relocs; ++i) {
+    uint64_t r;
+    ::memcpy(&r, relocs + i*sizeof(uint64_t), sizeof(r));
+    uint64_t at = r & ~kRelocKindMask;
+    uint64_t value;
+    if (at > h.relocs - sizeof(value)) {
+      std::cout << "ERROR: Snapshot: relocation outside of the image." << std::endl;
+      close();
+      return -1;
+    }
+    ::memcpy(&value, image_ + at, sizeof(value));
+    if (value > h.relocs) {
+      std::cout << "ERROR: Snapshot: pointer outside of the image." << std::endl;
+      close();
+      return -1;
+    }
+    if ((r & kRelocKindMask) == kRelocLargeBinaryInfo) {
+      LargeBinaryRecord rec;
+      if (value > h.relocs - sizeof(rec)) {
+        std::cout << "ERROR: Snapshot: large binary outside of the image." << std::endl;
+        close();
+        return -1;
+      }
+      ::memcpy(&rec, image_ + value, sizeof(rec));
+      if (rec.params_size > h.relocs - value - sizeof(rec)) {
+        std::cout << "ERROR: Snapshot: large binary outside of the image." << std::endl;
+        close();
+        return -1;
+      }
+      auto info = new LargeBinaryInfo();
+      info->size_ = (size_t)rec.size;
+      info->owned_ = false;
+      info->compander_ = Ref((Ref::Verbatim_)rec.compander);
+      const uint8_t *params = image_ + value + sizeof(rec);
+      info->params_.assign(params, params + rec.params_size);
+      infos_.push_back(info);
+      value = (uint64_t)(uintptr_t)info;
+    } else {
+      value += base;
+    }
+    ::memcpy(image_ + at, &value, sizeof(value));
+  }
+  Ref root((Ref::Verbatim_)h.root);
+  if (root.IsPtr() && h.root >= h.relocs) {
+    std::cout << "ERROR: Snapshot: root outside of the image." << std::endl;
+    close();
+    return -1;
+  }
+  root_ = root.IsPtr() ? Ref((Ref::Verbatim_)(h.root + base)) : root;
+  return 0;
+}
+
+
+/**
+ Release the image. All objects in the snapshot become invalid.
+ */
+void Snapshot::close()
+{
+  for (auto info: infos_)
+    delete info;
+  infos_.clear();
+  if (image_) {
+    CopyOnWrite::Forget(image_, image_ + size_);
+    if (mapped_)
+      ::munmap(image_, size_);
+    else
+      ::free(image_);
+  }
+  image_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+  root_ = RefNIL;
+}
+
+
+/**
+ Resolve the magic pointers of a table from a snapshot file.
+ The file is mapped on the first access to the table and stays mapped.
+ Its root must be an array of the objects in the table.
+ \param[in] table number of the magic pointer table, usually 0
+ \param[in] file_name path and name of the snapshot
+ */
+void Snapshot::use_as_magic_pointers(int table, const std::string &file_name)
+{
+  auto snap = std::make_shared<Snapshot>();
+  MagicPointers::SetSource(table, [snap, file_name]() {
+    if (snap->root().IsNIL())
+      snap->load(file_name);
+    return snap->root();
+  });
+}
+
+
+Snapshot::~Snapshot()
+{
+  close();
+}
@@ -90,17 +90,28 @@
  */
 
 #include <dyn/io/stream.h>
+#include <dyn/io/stream/stream_parser.h>
+#include <dyn/io/stream/stream_source.h>
 #include <dyn/objects.h>
-#include <dyn/io/package/package_bytes.h>
+#include <dyn/tools/tools.h>
 
 #include <iostream>
-#include <fstream>
-#include <iomanip>
+#include <cstring>
+#include <fcntl.h>
 
 using namespace dyn;
 
 using namespace dyn::io;
 
+/** \class dyn::io::StreamReader
+ Build an object tree from an NSOF stream.
+
+ The reader is driven by the events of a StreamParser. Containers are
+ allocated and linked into their parent as soon as they begin, so precedent
+ references back to an object that is still being read resolve correctly,
+ even for cyclic structures.
+ */
+
 StreamReader::StreamReader()
 {
 }
@@ -110,116 +121,225 @@ StreamReader::~StreamReader()
   close();
 }
 
+/**
+ Open an NSOF file for reading.
+
+ Regular files are mapped into memory one window at a time, so that large
+ binaries can use their data in place. Anything else is read in chunks.
+
+ \param[in] filename path to the file
+ \return 0 if the file was opened, -1 on error
+ */
 int StreamReader::open(const std::string &filename)
 {
-  std::ifstream source_file { filename, std::ios::binary };
-  if (source_file) {
-    bytes_ = std::make_shared<PackageBytes>();
-    bytes_->assign(std::istreambuf_iterator<char>{source_file}, {});
-    bytes_->rewind();
-    return 0;
-  } else {
+  auto mapped = std::make_unique<MappedSource>(filename);
+  if (mapped->is_mapped())
+    return open(std::move(mapped));
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
     return -1;
-  }
+  return open(fd, true);
 }
 
-dyn::Ref StreamReader::read_next_()
+/**
+ Read an NSOF stream from a file descriptor, pipe, or socket.
+ \param[in] fd an open file descriptor
+ \param[in] owns_fd if set, the descriptor is closed with the reader
+ \return 0
+ */
+int StreamReader::open(int fd, bool owns_fd)
 {
-  dyn::Ref ret = dyn::RefNIL;
-  auto pos = bytes_->tell();
-  auto prec_ix = precedent_.size();
-  uint8_t tag = bytes_->get_ubyte();
-  switch (tag) {
-    case 0: { // immediate
-      uint32_t imm = bytes_->get_xlong();
-      if ((imm & 0x02)==0) imm ^= 0x01; // Newton to Dyne
-      ret = dyn::Ref((dyn::Ref::Verbatim_)imm);
-      break; }
-    case 1: ret = dyn::Ref((UniChar)bytes_->get_ubyte()); break; // char
-    case 2: ret = dyn::Ref((UniChar)bytes_->get_ushort()); break; // uniChar
-    case 3: { // binary: xlong bytes, object class, raw bytes
-      // TODO: recognize Real, String, maybe more
-      precedent_.push_back(RefNIL);
-      uint32_t size = bytes_->get_xlong(); // Number of slots (xlong)
-      Ref klass = read_next_();
-      auto bin = bytes_->get_data(size);
-      void *data = ::calloc(1, size);
-      ::memcpy(data, &bin[0], size);
-      Ref binary = ret = new BinaryObject(klass, size, data);
-      precedent_[prec_ix] = binary;
-      break; }
-    case 4: { // array
-      precedent_.push_back(RefNIL);
-      uint32_t length = bytes_->get_xlong(); // Number of slots (xlong)
-      Ref klass = read_next_();
-      Ref array = ret = AllocateArray(klass, length);
-      precedent_[prec_ix] = array;
-      for (uint32_t i=0; i<length; ++i) {
-        dyn::SetArraySlot(array, i, read_next_());
-      }
-      break; }
-    case 5: { // plainArray
-      precedent_.push_back(RefNIL);
-      uint32_t length = bytes_->get_xlong(); // Number of slots (xlong)
-      Ref array = ret = AllocateArray(length);
-      precedent_[prec_ix] = array;
-      for (uint32_t i=0; i<length; ++i) {
-        dyn::SetArraySlot(array, i, read_next_());
-      }
-      break; }
-    case 6: { // frame
-      precedent_.push_back(RefNIL);
-      uint32_t length = bytes_->get_xlong(); // Number of slots (xlong)
-      Ref frame = ret = AllocateFrame();
-      SlottedObject *fobj = static_cast<SlottedObject*>(frame.GetObject());
-      precedent_[prec_ix] = frame;
-      for (uint32_t i=0; i<length; ++i) {
-        dyn::SetFrameSlot(frame, read_next_(), dyn::RefNIL);
-      }
-      for (uint32_t i=0; i<length; ++i) {
-        fobj->SetSlot(i, read_next_());
-      }
-      break; }
-    case 7: { // symbol
-      precedent_.push_back(RefNIL);
-      uint32_t length = bytes_->get_xlong();
-      dyn::Ref sym = ret = dyn::Sym(bytes_->get_cstring(length, false));
-      precedent_[prec_ix] = sym;
-      break; }
-    case 8: { // string
-      precedent_.push_back(RefNIL);
-      uint32_t length = bytes_->get_xlong();
-      dyn::Ref str = ret = dyn::MakeString(bytes_->get_ustring(length/2, false));
-      precedent_[prec_ix] = str;
+  return open(std::make_unique<FileSource>(fd, owns_fd));
+}
+
+/**
+ Read an NSOF stream from memory.
+ \param[in] data start of the stream, must stay valid while reading
+ \param[in] size size of the stream in bytes
+ \return 0
+ */
+int StreamReader::open(const uint8_t *data, size_t size)
+{
+  return open(std::make_unique<MemorySource>(data, size));
+}
+
+/**
+ Read an NSOF stream from any source.
+ \param[in] source the reader takes ownership of the source
+ \return 0
+ */
+int StreamReader::open(std::unique_ptr<StreamSource> source)
+{
+  close();
+  source_ = std::move(source);
+  parser_ = std::make_unique<StreamParser>(*source_);
+  return 0;
+}
+
+void StreamReader::set_precedent_(uint32_t id, dyn::Ref value)
+{
+  if (id >= precedent_.size())
+    precedent_.resize(id + 1, RefNIL);
+  precedent_[id] = value;
+}
+
+void StreamReader::place_(const StreamEvent &ev, dyn::Ref value)
+{
+  place_((uint8_t)ev.role, ev.index, value);
+}
+
+/**
+ Store an object in the innermost open container.
+ \param[in] role one of the StreamEvent::Role values
+ \param[in] index slot or tag index in the container
+ \param[in] value the object
+ */
+void StreamReader::place_(uint8_t role, uint32_t index, dyn::Ref value)
+{
+  switch ((StreamEvent::Role)role) {
+    case StreamEvent::Role::Root:
+      root_ = value;
+      break;
+    case StreamEvent::Role::Class:
+      dyn::SetClass(open_.back().obj, value);
+      break;
+    case StreamEvent::Role::Tag:
+      dyn::SetFrameSlot(open_.back().obj, value, dyn::RefNIL);
+      break;
+    case StreamEvent::Role::Slot: {
+      Ref parent = open_.back().obj;
+      if (parent.IsFrame())
+        static_cast<SlottedObject*>(parent.GetObject())->SetSlot(index, value);
+      else
+        dyn::SetArraySlot(parent, index, value);
       break; }
-    case 9: ret = precedent_[bytes_->get_xlong()]; break; // precedent
-    case 10: ret = dyn::RefNIL; break; // nil
-    case 11: // smallRect
-    case 12: // largeBinary
-    default: // unsupported
-      std::cout << "ERROR: StreamReader: Unsupported tag " << (int)tag << " at " << pos << "." << std::endl;
-      return ret;
   }
-//  printf("%d: ", pos); dyn::Print(ret);
-  return ret;
 }
 
+/**
+ Read the next object from the stream.
+ \return the object, or NIL on error
+ */
 dyn::Ref StreamReader::read()
 {
-  uint16_t version = bytes_->get_ubyte();
-  if (version==2) {
-    dyn::Ref r = read_next_();
-    return r;
-  } else {
-    std::cout << "ERROR: StreamReader: Unknown stream version " << (int)version << "." << std::endl;
+  if (!parser_)
     return dyn::RefNIL;
+  root_ = dyn::RefNIL;
+  open_.clear();
+  precedent_.clear();
+  StreamEvent ev;
+  while (parser_->next(ev)) {
+    switch (ev.type) {
+      case StreamEvent::Type::Immediate:
+        place_(ev, ev.ref);
+        break;
+      case StreamEvent::Type::Precedent:
+        place_(ev, ev.precedent < precedent_.size() ? precedent_[ev.precedent] : RefNIL);
+        break;
+      case StreamEvent::Type::Symbol: {
+        Ref sym = dyn::Sym((const char*)ev.data);
+        set_precedent_(ev.precedent, sym);
+        place_(ev, sym);
+        break; }
+      case StreamEvent::Type::BeginBinary: {
+        // TODO: recognize Real, maybe more
+        Ref bin = dyn::AllocateBinary(RefNIL, ev.length);
+        set_precedent_(ev.precedent, bin);
+        place_(ev, bin);
+        open_.push_back({ bin, ev.precedent, (uint8_t)ev.role, ev.index, { } });
+        break; }
+      case StreamEvent::Type::BinaryData: {
+        Object *obj = open_.back().obj.GetObject();
+        if (obj->IsLargeBinary()) {
+          auto lbo = static_cast<LargeBinaryObject*>(obj);
+          if (ev.index == 0 && ev.size == ev.length && source_->persistent()) {
+            // The whole payload is in one persistent chunk, use it in place.
+            lbo->SetView(ev.data, ev.size, source_->retain());
+            break;
+          }
+          if (ev.index == 0)
+            lbo->Allocate(ev.length);
+          ::memcpy((uint8_t*)lbo->Data() + ev.index, ev.data, ev.size);
+        } else {
+          ::memcpy((uint8_t*)dyn::BinaryData(open_.back().obj) + ev.index, ev.data, ev.size);
+        }
+        break; }
+      case StreamEvent::Type::BeginLargeBinary: {
+        Ref lbo = Ref(new LargeBinaryObject(RefNIL));
+        set_precedent_(ev.precedent, lbo);
+        place_(ev, lbo);
+        open_.push_back({ lbo, ev.precedent, (uint8_t)ev.role, ev.index, { } });
+        break; }
+      case StreamEvent::Type::LargeBinaryHeader: {
+        // Companders are not implemented, compressed data is kept as it is.
+        auto lbo = static_cast<LargeBinaryObject*>(open_.back().obj.GetObject());
+        if (ev.compressed)
+          lbo->SetCompander(dyn::Sym((const char*)ev.data), ev.extra, ev.extra_size);
+        if (ev.length == 0)
+          lbo->Allocate(0);
+        break; }
+      case StreamEvent::Type::SmallRect: {
+        Ref rect = dyn::MakeSmallRect(ev.data[0], ev.data[1], ev.data[2], ev.data[3]);
+        set_precedent_(ev.precedent, rect);
+        place_(ev, rect);
+        break; }
+      case StreamEvent::Type::BeginString:
+        // The string is created when all its characters are known.
+        set_precedent_(ev.precedent, RefNIL);
+        open_.push_back({ RefNIL, ev.precedent, (uint8_t)ev.role, ev.index, { } });
+        open_.back().text.reserve(ev.length);
+        break;
+      case StreamEvent::Type::StringData:
+        open_.back().text.append((const char*)ev.data, ev.size);
+        break;
+      case StreamEvent::Type::EndString: {
+        Open s = std::move(open_.back());
+        open_.pop_back();
+        std::u16string u16;
+        u16.reserve(s.text.size()/2);
+        for (size_t i=0; i+1<s.text.size(); i+=2) {
+          char16_t c = (char16_t)(((uint8_t)s.text[i]<<8) | (uint8_t)s.text[i+1]);
+          if (c == 0) break;
+          u16 += c;
+        }
+        Ref str = dyn::MakeString(utf16_to_utf8(u16));
+        set_precedent_(s.precedent, str);
+        place_(s.role, s.index, str);
+        break; }
+      case StreamEvent::Type::BeginArray: {
+        Ref array = dyn::AllocateArray(ev.length);
+        set_precedent_(ev.precedent, array);
+        place_(ev, array);
+        open_.push_back({ array, ev.precedent, (uint8_t)ev.role, ev.index, { } });
+        break; }
+      case StreamEvent::Type::BeginFrame: {
+        Ref frame = dyn::AllocateFrame();
+        set_precedent_(ev.precedent, frame);
+        place_(ev, frame);
+        open_.push_back({ frame, ev.precedent, (uint8_t)ev.role, ev.index, { } });
+        break; }
+      case StreamEvent::Type::EndBinary:
+      case StreamEvent::Type::EndArray:
+      case StreamEvent::Type::EndFrame:
+        open_.pop_back();
+        break;
+      case StreamEvent::Type::EndOfStream:
+        return root_;
+      case StreamEvent::Type::Error:
+        break;
+    }
   }
-
+  if (ev.type == StreamEvent::Type::Error)
+    std::cout << "ERROR: StreamReader: " << parser_->error() << std::endl;
+  return dyn::RefNIL;
 }
 
 void StreamReader::close()
 {
-  bytes_.reset();
+  parser_.reset();
+  source_.reset();
+  open_.clear();
+  precedent_.clear();
 }
 
 dyn::Ref StreamReader::read(const std::string &filename)
@@ -0,0 +1,431 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/io/stream/stream_parser.h>
+#include <dyn/io/stream/stream_source.h>
+#include <dyn/tools/stats.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace dyn::io;
+
+/** \class dyn::io::StreamEvent
+ One step in the flattened NSOF object tree, as returned by StreamParser::next().
+
+ `role` and `index` describe where the object goes in its parent: the root
+ of the stream, the class of a binary or array, a frame tag, or a slot.
+ `precedent` is set for every event that creates a precedent ID and for
+ references to earlier objects. `data` and `size` point into the parser's
+ current chunk and are only valid until the next call to next().
+ */
+
+/** \class dyn::io::StreamParser
+ Iterative pull parser for NewtonScript Object Format (NSOF) streams.
+
+ The parser reads its input chunk by chunk from a StreamSource and turns it
+ into a sequence of StreamEvents. It keeps an explicit stack of open
+ containers instead of recursing, so deeply nested streams can not overflow
+ the native stack, and it never holds more than one input chunk. Binary and
+ string contents are delivered in slices that point directly into the input
+ chunk.
+
+ After the root object of a stream, the parser returns an EndOfStream event.
+ If the source has more data, the next call starts a new, concatenated
+ stream with its own version byte and precedent IDs.
+ */
+
+/**
+ Create a parser that pulls its data from the given source.
+ \param[in] source must outlive the parser
+ */
+StreamParser::StreamParser(StreamSource &source)
+: source_(&source)
+{
+}
+
+/**
+ Make sure that at least one byte is available in the current chunk.
+ \return false if the source is exhausted
+ */
+bool StreamParser::ensure_()
+{
+  while (cur_ == end_) {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    if (!source_->fill(data, size))
+      return false;
+    dyn::tools::Stats::count(dyn::tools::Stats::kBytesRead, size);
+    cur_ = data;
+    end_ = data + size;
+  }
+  return true;
+}
+
+bool StreamParser::get_ubyte_(uint8_t &v)
+{
+  if (!ensure_()) return false;
+  v = *cur_++;
+  pos_++;
+  return true;
+}
+
+bool StreamParser::get_ushort_(uint16_t &v)
+{
+  uint8_t hi, lo;
+  if (!get_ubyte_(hi) || !get_ubyte_(lo)) return false;
+  v = (uint16_t)((hi<<8) | lo);
+  return true;
+}
+
+bool StreamParser::get_uint_(uint32_t &v)
+{
+  uint16_t hi, lo;
+  if (!get_ushort_(hi) || !get_ushort_(lo)) return false;
+  v = ((uint32_t)hi<<16) | lo;
+  return true;
+}
+
+bool StreamParser::get_xlong_(uint32_t &v)
+{
+  uint8_t b;
+  if (!get_ubyte_(b)) return false;
+  if (b < 0xff) {
+    v = b;
+    return true;
+  }
+  return get_uint_(v);
+}
+
+bool StreamParser::get_bytes_(uint8_t *dst, size_t n)
+{
+  while (n > 0) {
+    if (!ensure_()) return false;
+    size_t k = std::min(n, (size_t)(end_ - cur_));
+    ::memcpy(dst, cur_, k);
+    dst += k; cur_ += k; pos_ += k; n -= k;
+  }
+  return true;
+}
+
+/**
+ Put the parser into the error state and generate an Error event.
+ \param[in] msg a description of the problem
+ \param[out] ev the event
+ \return always false
+ */
+bool StreamParser::fail_(const std::string &msg, StreamEvent &ev)
+{
+  error_ = msg + " at " + std::to_string(pos_) + ".";
+  stack_.clear();
+  ev = StreamEvent();
+  ev.type = StreamEvent::Type::Error;
+  return false;
+}
+
+/**
+ Tell the innermost container that one of its children is complete.
+ */
+void StreamParser::child_done_()
+{
+  if (stack_.empty())
+    return;
+  Context &top = stack_.back();
+  if (top.class_pending)
+    top.class_pending = false;
+  else
+    top.index++;
+}
+
+/**
+ Set the role and index of the next object from the innermost container.
+ */
+void StreamParser::set_role_(StreamEvent &ev)
+{
+  Context &top = stack_.back();
+  ev.index = top.index;
+  if (top.class_pending)
+    ev.role = StreamEvent::Role::Class;
+  else if (top.ctx == Ctx::Root)
+    ev.role = StreamEvent::Role::Root;
+  else if (top.ctx == Ctx::FrameTags)
+    ev.role = StreamEvent::Role::Tag;
+  else
+    ev.role = StreamEvent::Role::Slot;
+}
+
+/**
+ Read the type byte of the next object and generate the matching event.
+ \param[out] ev the event
+ \return false on error
+ */
+bool StreamParser::begin_object_(StreamEvent &ev)
+{
+  set_role_(ev);
+  uint8_t type;
+  uint32_t v;
+  if (!get_ubyte_(type))
+    return fail_("Unexpected end of stream", ev);
+  switch (type) {
+    case 0: // immediate
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::Immediate;
+      if ((v & 0x03)==0) // integers are signed
+        ev.ref = dyn::Ref((dyn::Integer)((int32_t)v >> 2));
+      else
+        ev.ref = dyn::Ref::NSRef(v);
+      child_done_();
+      return true;
+    case 1: { // character
+      uint8_t c;
+      if (!get_ubyte_(c)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::Immediate;
+      ev.ref = dyn::Ref((UniChar)c);
+      child_done_();
+      return true; }
+    case 2: { // uniChar
+      uint16_t c;
+      if (!get_ushort_(c)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::Immediate;
+      ev.ref = dyn::Ref((UniChar)c);
+      child_done_();
+      return true; }
+    case 3: // binary: xlong bytes, object class, raw bytes
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::BeginBinary;
+      ev.length = v;
+      ev.precedent = next_precedent_++;
+      stack_.push_back({ Ctx::Binary, true, v, 0 });
+      return true;
+    case 4: // array: xlong slots, object class, slots
+    case 5: // plainArray: xlong slots, slots
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::BeginArray;
+      ev.length = v;
+      ev.precedent = next_precedent_++;
+      if (type == 4) // a Class event follows
+        stack_.push_back({ Ctx::Array, true, v, 0 });
+      else
+        stack_.push_back({ Ctx::PlainArray, false, v, 0 });
+      return true;
+    case 6: // frame: xlong slots, tags, values
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::BeginFrame;
+      ev.length = v;
+      ev.precedent = next_precedent_++;
+      stack_.push_back({ Ctx::FrameTags, false, v, 0 });
+      return true;
+    case 7: // symbol: xlong length, name
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      scratch_.resize((size_t)v + 1);
+      if (!get_bytes_(scratch_.data(), v)) return fail_("Unexpected end of stream", ev);
+      scratch_[v] = 0;
+      ev.type = StreamEvent::Type::Symbol;
+      ev.length = v;
+      ev.precedent = next_precedent_++;
+      ev.data = scratch_.data();
+      ev.size = v;
+      child_done_();
+      return true;
+    case 8: // string: xlong bytes, UTF-16 characters
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::BeginString;
+      ev.length = v;
+      ev.precedent = next_precedent_++;
+      stack_.push_back({ Ctx::String, false, v, 0 });
+      return true;
+    case 9: // precedent
+      if (!get_xlong_(v)) return fail_("Unexpected end of stream", ev);
+      if (v >= next_precedent_) return fail_("Precedent " + std::to_string(v) + " out of range", ev);
+      ev.type = StreamEvent::Type::Precedent;
+      ev.precedent = v;
+      child_done_();
+      return true;
+    case 10: // nil
+      ev.type = StreamEvent::Type::Immediate;
+      ev.ref = dyn::RefNIL;
+      child_done_();
+      return true;
+    case 11: // smallRect: top, left, bottom, right
+      scratch_.resize(4);
+      if (!get_bytes_(scratch_.data(), 4)) return fail_("Unexpected end of stream", ev);
+      ev.type = StreamEvent::Type::SmallRect;
+      ev.precedent = next_precedent_++;
+      ev.data = scratch_.data();
+      ev.size = 4;
+      child_done_();
+      return true;
+    case 12: // largeBinary: object class, header, compander, data
+      ev.type = StreamEvent::Type::BeginLargeBinary;
+      ev.precedent = next_precedent_++;
+      stack_.push_back({ Ctx::LargeBinary, true, 0, 0 });
+      return true;
+    default: // unsupported
+      return fail_("Unsupported tag " + std::to_string(type), ev);
+  }
+}
+
+/**
+ Read the header of a largeBinary that follows its class.
+
+ The compander name and parameters are returned in `data` and `extra`.
+ The context turns into a regular binary context for the payload.
+
+ \param[out] ev the event
+ \return false on error
+ */
+bool StreamParser::large_binary_header_(StreamEvent &ev)
+{
+  uint8_t compressed;
+  uint32_t length, name_length, params_length, reserved;
+  if (!get_ubyte_(compressed) || !get_uint_(length) || !get_uint_(name_length)
+      || !get_uint_(params_length) || !get_uint_(reserved))
+    return fail_("Unexpected end of stream", ev);
+  scratch_.resize((size_t)name_length + 1 + params_length);
+  if (!get_bytes_(scratch_.data(), name_length)
+      || !get_bytes_(scratch_.data() + name_length + 1, params_length))
+    return fail_("Unexpected end of stream", ev);
+  scratch_[name_length] = 0;
+  Context &top = stack_.back();
+  top.ctx = Ctx::Binary;
+  top.length = length;
+  top.index = 0;
+  ev.type = StreamEvent::Type::LargeBinaryHeader;
+  ev.length = length;
+  ev.compressed = (compressed != 0);
+  ev.data = scratch_.data();
+  ev.size = name_length;
+  ev.extra = scratch_.data() + name_length + 1;
+  ev.extra_size = params_length;
+  return true;
+}
+
+/**
+ Generate the next event in the stream.
+
+ At the end of every stream in the source, next() returns an EndOfStream
+ event. When the source is exhausted, it returns false with an EndOfStream
+ event. On any error, it returns false with an Error event, and error()
+ describes the problem.
+
+ \param[out] ev the next event
+ \return true if the event is valid and more events may follow
+ */
+bool StreamParser::next(StreamEvent &ev)
+{
+  ev = StreamEvent();
+  if (!error_.empty()) {
+    ev.type = StreamEvent::Type::Error;
+    return false;
+  }
+  if (stack_.empty()) {
+    uint8_t version;
+    if (!get_ubyte_(version)) {
+      ev.type = StreamEvent::Type::EndOfStream;
+      return false;
+    }
+    if (version != 2)
+      return fail_("Unknown stream version " + std::to_string((int)version), ev);
+    next_precedent_ = 0;
+    stack_.push_back({ Ctx::Root, false, 1, 0 });
+  }
+  for (;;) {
+    Context &top = stack_.back();
+    if (top.class_pending)
+      return begin_object_(ev);
+    switch (top.ctx) {
+      case Ctx::Root:
+        if (top.index < top.length)
+          return begin_object_(ev);
+        stack_.pop_back();
+        ev.type = StreamEvent::Type::EndOfStream;
+        return true;
+      case Ctx::Binary:
+      case Ctx::String: {
+        bool is_binary = (top.ctx == Ctx::Binary);
+        if (top.index == top.length) {
+          stack_.pop_back();
+          ev.type = is_binary ? StreamEvent::Type::EndBinary : StreamEvent::Type::EndString;
+          child_done_();
+          return true;
+        }
+        if (!ensure_())
+          return fail_("Unexpected end of stream", ev);
+        size_t n = std::min((size_t)(top.length - top.index), (size_t)(end_ - cur_));
+        ev.type = is_binary ? StreamEvent::Type::BinaryData : StreamEvent::Type::StringData;
+        ev.index = top.index;
+        ev.length = top.length;
+        ev.data = cur_;
+        ev.size = n;
+        cur_ += n;
+        pos_ += n;
+        top.index += (uint32_t)n;
+        return true; }
+      case Ctx::LargeBinary:
+        return large_binary_header_(ev);
+      case Ctx::Array:
+      case Ctx::PlainArray:
+        if (top.index < top.length)
+          return begin_object_(ev);
+        stack_.pop_back();
+        ev.type = StreamEvent::Type::EndArray;
+        child_done_();
+        return true;
+      case Ctx::FrameTags:
+        if (top.index < top.length)
+          return begin_object_(ev);
+        top.ctx = Ctx::FrameValues;
+        top.index = 0;
+        continue;
+      case Ctx::FrameValues:
+        if (top.index < top.length)
+          return begin_object_(ev);
+        stack_.pop_back();
+        ev.type = StreamEvent::Type::EndFrame;
+        child_done_();
+        return true;
+    }
+  }
+}
+
+/**
+ Skip the rest of the object that was started by the last Begin event.
+
+ Nested objects are still parsed to keep precedent IDs in sync, but no
+ events are returned for them.
+
+ \return false on error or if no object is open
+ */
+bool StreamParser::skip()
+{
+  size_t d = stack_.size();
+  if (d <= 1)
+    return false;
+  StreamEvent ev;
+  while (stack_.size() >= d) {
+    if (!next(ev))
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,196 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/io/stream/stream_source.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace dyn::io;
+
+/** \class dyn::io::StreamSource
+ Deliver the bytes of an NSOF stream in chunks of arbitrary size.
+
+ The parser never looks at more than one chunk at a time, so the memory
+ needed to read a stream is bounded by the chunk size and the nesting
+ depth, not by the size of the stream.
+ */
+
+/** \class dyn::io::MemorySource
+ Deliver a chain of memory buffers, one buffer per fill() call.
+
+ The buffers are not copied and must stay valid while the parser runs. If
+ the source is persistent, the buffers must stay valid for as long as the
+ objects that were read from them, because large binaries refer to them
+ directly.
+ */
+
+/**
+ Create a source for a single buffer.
+ \param[in] data start of the buffer
+ \param[in] size size of the buffer in bytes
+ \param[in] persistent the buffer outlives all objects read from it
+ */
+MemorySource::MemorySource(const uint8_t *data, size_t size, bool persistent)
+: persistent_(persistent)
+{
+  append(data, size);
+}
+
+/**
+ Add another buffer at the end of the chain.
+ \param[in] data start of the buffer
+ \param[in] size size of the buffer in bytes
+ */
+void MemorySource::append(const uint8_t *data, size_t size)
+{
+  if (size > 0)
+    chain_.push_back(std::make_pair(data, size));
+}
+
+/**
+ Return the next buffer in the chain.
+ \param[out] data start of the next chunk
+ \param[out] size number of bytes in the chunk
+ \return false if there are no more buffers
+ */
+bool MemorySource::fill(const uint8_t *&data, size_t &size)
+{
+  if (next_ >= chain_.size())
+    return false;
+  data = chain_[next_].first;
+  size = chain_[next_].second;
+  ++next_;
+  return true;
+}
+
+/** \class dyn::io::FileSource
+ Read an NSOF stream from a file descriptor in fixed size chunks.
+ */
+
+/**
+ Create a source that reads from a file descriptor.
+ \param[in] fd an open file descriptor, may be a pipe or a socket
+ \param[in] owns_fd if set, close the descriptor when the source is destroyed
+ \param[in] chunk_size the size of the read buffer
+ */
+FileSource::FileSource(int fd, bool owns_fd, size_t chunk_size)
+: fd_(fd), owns_fd_(owns_fd), buffer_(chunk_size ? chunk_size : kDefaultChunkSize)
+{
+}
+
+FileSource::~FileSource()
+{
+  if (owns_fd_ && fd_ != -1)
+    ::close(fd_);
+}
+
+/**
+ Read the next chunk from the file.
+ \param[out] data start of the next chunk, valid until the next call
+ \param[out] size number of bytes read
+ \return false at the end of the file or on a read error
+ */
+bool FileSource::fill(const uint8_t *&data, size_t &size)
+{
+  if (fd_ == -1)
+    return false;
+  for (;;) {
+    ssize_t n = ::read(fd_, buffer_.data(), buffer_.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data = buffer_.data();
+    size = (size_t)n;
+    return true;
+  }
+}
+
+/** \class dyn::io::MappedSource
+ Map a regular file into memory, one window at a time.
+
+ Only the current window is mapped, so reading a file of any size needs
+ no more memory than one window. The payload of large binaries that fit
+ into a window is not copied, but used in place. The reader calls retain()
+ for such a view, and the object keeps the window mapped as long as it
+ needs it. All other windows are unmapped when the next one is mapped, or
+ when the source is destroyed. The mapping is private, so writing to a
+ view does not change the file.
+ */
+
+/**
+ Open a file for mapping.
+ \param[in] filename path to the file; use is_mapped() to check for success
+ \param[in] window_size the most bytes mapped at a time, rounded to pages
+ */
+MappedSource::MappedSource(const std::string &filename, size_t window_size)
+{
+  size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+  window_size_ = std::max((window_size + page - 1) / page * page, page);
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    fd_ = fd;
+    file_size_ = (size_t)st.st_size;
+  } else {
+    ::close(fd);
+  }
+}
+
+MappedSource::~MappedSource()
+{
+  window_.reset();
+  if (fd_ != -1)
+    ::close(fd_);
+}
+
+/**
+ Map the next window of the file.
+ The previous window is unmapped, unless an object retained it.
+ \param[out] data start of the window
+ \param[out] size size of the window
+ \return false at the end of the file or if the window can't be mapped
+ */
+bool MappedSource::fill(const uint8_t *&data, size_t &size)
+{
+  window_.reset();
+  if (fd_ == -1 || offset_ >= file_size_)
+    return false;
+  size_t n = std::min(window_size_, file_size_ - offset_);
+  void *map = ::mmap(nullptr, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd_, (off_t)offset_);
+  if (map == MAP_FAILED)
+    return false;
+  window_ = std::shared_ptr<void>(map, [n](void *p) { ::munmap(p, n); });
+  offset_ += n;
+  data = (const uint8_t*)map;
+  size = n;
+  return true;
+}
@@ -40,6 +40,147 @@ using namespace dyn;
 
 using namespace dyn::lang;
 
+/** \class dyn::lang::CodeWriter
+ Buffered sink for decompiled source code.
+
+ Nodes write their text piece by piece into the writer, which keeps track
+ of the indentation and the line number. Statements can leave a mark with
+ their line and range of instructions, see set_marks(). Nothing is
+ concatenated on the way, so the whole tree is printed in a single pass that
+ is linear in the size of the output.
+ */
+
+void dyn::lang::CodeWriter::start_line_()
+{
+  if (line_start_) {
+    line_start_ = false;
+    for (int i=0; i<indent_; ++i)
+      buf_ += "  ";
+  }
+}
+
+void dyn::lang::CodeWriter::put(char c)
+{
+  start_line_();
+  buf_ += c;
+}
+
+void dyn::lang::CodeWriter::put(const char *s)
+{
+  start_line_();
+  buf_ += s;
+}
+
+void dyn::lang::CodeWriter::newline()
+{
+  buf_ += '\n';
+  line_start_ = true;
+  line_++;
+  if (out_ && buf_.size() >= kFlushSize)
+    flush();
+}
+
+/**
+ Write the buffer to the file, if there is one.
+ Writers without a file keep collecting text for str().
+ */
+void dyn::lang::CodeWriter::flush()
+{
+  if (out_ && !buf_.empty()) {
+    fwrite(buf_.data(), 1, buf_.size(), out_);
+    buf_.clear();
+  }
+}
+
+/** \class dyn::lang::NodeArena
+ Allocate all nodes of one function from a few large blocks.
+
+ The decompiler creates many small nodes and drops all of them when the
+ function is done. Allocating them from an arena and passing plain
+ pointers around avoids a heap allocation and reference counting for every
+ node. Nodes live until clear() is called or the arena is destroyed.
+ */
+
+void *dyn::lang::NodeArena::allocate_(size_t size, size_t align)
+{
+  size_t pad = (align - ((uintptr_t)cur_ & (align - 1))) & (align - 1);
+  if (!cur_ || pad + size > left_) {
+    size_t block_size = std::max(size + align, kBlockSize);
+    blocks_.push_back(std::unique_ptr<char[]>(new char[block_size]));
+    cur_ = blocks_.back().get();
+    left_ = block_size;
+    pad = (align - ((uintptr_t)cur_ & (align - 1))) & (align - 1);
+  }
+  void *mem = cur_ + pad;
+  cur_ += pad + size;
+  left_ -= pad + size;
+  return mem;
+}
+
+/**
+ Destroy all nodes and release the memory.
+ */
+void dyn::lang::NodeArena::clear()
+{
+  for (auto it = nodes_.rbegin(); it != nodes_.rend(); ++it)
+    (*it)->~Node();
+  nodes_.clear();
+  blocks_.clear();
+  cur_ = nullptr;
+  left_ = 0;
+}
+
+/**
+ Write an operand, and add brackets if it binds weaker than its operator.
+
+ Lower precedence values bind tighter. Operators are left associative, so
+ the right operand also needs brackets if it has the same precedence.
+ */
+static void write_operand(CodeWriter &w, const Node *operand, int precedence, bool right)
+{
+  bool brackets = right ? (precedence <= operand->arg) : (precedence < operand->arg);
+  if (brackets) w.put('(');
+  operand->write(w);
+  if (brackets) w.put(')');
+}
+
+static void write_args(CodeWriter &w, const std::vector<NodeRef> &args)
+{
+  w.put('(');
+  for (size_t i=0; i<args.size(); ++i) {
+    if (i) w.put(", ");
+    args[i]->write(w);
+  }
+  w.put(')');
+}
+
+/**
+ Write a list of statements, one per line.
+ Statements that already ended their line, like an 'if' without 'begin' and
+ 'end', get no extra semicolon.
+ */
+void dyn::lang::write_statements(CodeWriter &w, const std::vector<NodeRef> &list)
+{
+  for (auto &stmt: list) {
+    w.mark(stmt->pc_first, stmt->pc_last);
+    stmt->write(w);
+    if (!w.at_line_start()) {
+      w.put(';');
+      w.newline();
+    }
+  }
+}
+
+static void write_block(CodeWriter &w, const std::vector<NodeRef> &block, bool begin_end)
+{
+  if (begin_end) w.put(" begin");
+  w.newline();
+  w.indent();
+  write_statements(w, block);
+  w.outdent();
+  if (begin_end) w.put("end");
+}
+
 dyn::lang::Node::Node(ND a_type, PC a_pc_first, PC a_pc_last, int a_arg, const std::string &a_text, int a_info)
 : type(a_type), pc_first(a_pc_first), pc_last(a_pc_last), arg(a_arg), text(a_text), info(a_info)
 {
@@ -49,13 +190,22 @@ dyn::lang::Node::~Node()
 {
 }
 
-std::string dyn::lang::Node::ToString() {
-  return text;
+void dyn::lang::Node::write(CodeWriter &w) const
+{
+  w.put(text);
 }
 
-int dyn::lang::Node::print(dyn::io::PrintState &ps)
+std::string dyn::lang::Node::ToString() const
 {
-  fprintf(ps.out_, "%s", ToString().c_str());
+  CodeWriter w;
+  write(w);
+  return w.str();
+}
+
+int dyn::lang::Node::print(dyn::io::PrintState &ps) const
+{
+  CodeWriter w(ps.out_);
+  write(w);
   return 0;
 }
 
@@ -65,9 +215,151 @@ dyn::lang::NodeImmediate::NodeImmediate(ND a_type, PC a_pc_first, PC a_pc_last,
 {
 }
 
-std::string dyn::lang::NodeImmediate::ToString()
+void dyn::lang::NodeImmediate::write(CodeWriter &w) const
+{
+  w.put(imm.ToString());
+}
+
+dyn::lang::NodeBinaryOp::NodeBinaryOp(PC a_pc_first, PC a_pc_last, int precedence, const char *op, NodeRef left, NodeRef right)
+: Node(ND::Expr, a_pc_first, a_pc_last, precedence, op), op_(op), left_(left), right_(right)
+{
+}
+
+void dyn::lang::NodeBinaryOp::write(CodeWriter &w) const
+{
+  write_operand(w, left_, arg, false);
+  w.put(' ');
+  w.put(op_);
+  w.put(' ');
+  write_operand(w, right_, arg, true);
+}
+
+/**
+ Slot access 'object.name', 'object.(path)', or array access 'object[key]'.
+ If a value is given, the access is the target of an assignment. Accessors
+ bind tighter than any operator, so they get precedence 1, and assignments
+ get precedence 12.
+ */
+dyn::lang::NodeAccess::NodeAccess(PC a_pc_first, PC a_pc_last, bool index, const std::string &name, NodeRef object, NodeRef key, NodeRef value)
+: Node(ND::Expr, a_pc_first, a_pc_last, value ? 12 : 1, name, index ? 1 : 0), object_(object), key_(key), value_(value)
+{
+}
+
+void dyn::lang::NodeAccess::write(CodeWriter &w) const
+{
+  write_operand(w, object_, 1, false);
+  if (info == 1) {
+    w.put('[');
+    key_->write(w);
+    w.put(']');
+  } else if (!text.empty()) {
+    w.put('.');
+    w.put(text);
+  } else {
+    w.put(".(");
+    key_->write(w);
+    w.put(')');
+  }
+  if (value_) {
+    w.put(" := ");
+    value_->write(w);
+  }
+}
+
+dyn::lang::NodeFrame::NodeFrame(PC a_pc_first, PC a_pc_last, std::vector<std::string> tags, std::vector<NodeRef> values)
+: Node(ND::Expr, a_pc_first, a_pc_last, 0, "frame"), tags_(std::move(tags)), values_(std::move(values))
+{
+}
+
+void dyn::lang::NodeFrame::write(CodeWriter &w) const
 {
-  return imm.ToString();
+  w.put('{');
+  for (size_t i=0; i<values_.size(); ++i) {
+    w.put(i ? ", " : " ");
+    w.put(tags_[i]);
+    w.put(": ");
+    values_[i]->write(w);
+  }
+  w.put(values_.empty() ? "}" : " }");
+}
+
+/**
+ Array literal. The class is only written if it is not 'array.
+ */
+dyn::lang::NodeArray::NodeArray(PC a_pc_first, PC a_pc_last, const std::string &cls, std::vector<NodeRef> elements)
+: Node(ND::Expr, a_pc_first, a_pc_last, 0, cls), elements_(std::move(elements))
+{
+}
+
+void dyn::lang::NodeArray::write(CodeWriter &w) const
+{
+  w.put('[');
+  if (!text.empty()) {
+    w.put(text);
+    w.put(':');
+    if (!elements_.empty()) w.put(' ');
+  }
+  for (size_t i=0; i<elements_.size(); ++i) {
+    if (i) w.put(", ");
+    elements_[i]->write(w);
+  }
+  w.put(']');
+}
+
+dyn::lang::NodeCall::NodeCall(PC a_pc_first, PC a_pc_last, bool invoke, NodeRef function, std::vector<NodeRef> args)
+: Node(ND::Expr, a_pc_first, a_pc_last, 0, invoke ? "invoke" : "call", invoke ? 1 : 0), function_(function), args_(std::move(args))
+{
+}
+
+void dyn::lang::NodeCall::write(CodeWriter &w) const
+{
+  if (info == 1) { // invoke
+    w.put("call ");
+    function_->write(w);
+    w.put(" with ");
+  } else {
+    function_->write(w);
+  }
+  write_args(w, args_);
+}
+
+dyn::lang::NodeSend::NodeSend(PC a_pc_first, PC a_pc_last, const char *op, NodeRef receiver, NodeRef message, std::vector<NodeRef> args)
+: Node(ND::Expr, a_pc_first, a_pc_last, 0, op), op_(op), receiver_(receiver), message_(message), args_(std::move(args))
+{
+}
+
+void dyn::lang::NodeSend::write(CodeWriter &w) const
+{
+  if (receiver_)
+    receiver_->write(w);
+  else
+    w.put("inherited");
+  w.put(op_);
+  message_->write(w);
+  write_args(w, args_);
+}
+
+dyn::lang::NodeAssign::NodeAssign(PC a_pc_first, PC a_pc_last, const std::string &name, NodeRef value)
+: Node(ND::Statement, a_pc_first, a_pc_last, 12, name), value_(value)
+{
+}
+
+void dyn::lang::NodeAssign::write(CodeWriter &w) const
+{
+  w.put(text);
+  w.put(" := ");
+  value_->write(w);
+}
+
+dyn::lang::NodeReturn::NodeReturn(PC a_pc_first, PC a_pc_last, NodeRef value)
+: Node(ND::Statement, a_pc_first, a_pc_last, 0, "return"), value_(value)
+{
+}
+
+void dyn::lang::NodeReturn::write(CodeWriter &w) const
+{
+  w.put("return ");
+  value_->write(w);
 }
 
 dyn::lang::NodeControlFlow::NodeControlFlow(ND a_type, PC a_pc_first, PC a_pc_last, int a_arg, const std::string &a_text, int a_info)
@@ -75,71 +367,175 @@ dyn::lang::NodeControlFlow::NodeControlFlow(ND a_type, PC a_pc_first, PC a_pc_la
 {
 }
 
-void dyn::lang::NodeControlFlow::set_condition(std::shared_ptr<Node> condition)
+void dyn::lang::NodeControlFlow::set_condition(NodeRef condition)
 {
   condition_ = condition;
 }
 
-void dyn::lang::NodeControlFlow::add_statement_a(std::shared_ptr<Node> stmt)
+void dyn::lang::NodeControlFlow::add_statement_a(NodeRef stmt)
 {
   statements_a_.push_back(stmt);
 }
 
-void dyn::lang::NodeControlFlow::add_statement_b(std::shared_ptr<Node> stmt)
+void dyn::lang::NodeControlFlow::add_statement_b(NodeRef stmt)
 {
   statements_b_.push_back(stmt);
 }
 
-std::string dyn::lang::NodeControlFlow::ToString()
+void dyn::lang::NodeControlFlow::write(CodeWriter &w) const
 {
-  // Write the expression
-  std::string out { };
+  bool add_begin_end = (statements_a_.size()>1) || (statements_b_.size()>1);
   switch (info) {
-    case 0: out = "if " + condition_->ToString() + " then"; break;
-    case 1: out = "while " + condition_->ToString() + " do"; break;
-    case 2: out = "repeat"; break; // TODO: not yet implemented
+    case 0: // if ... then ... else ...
+      w.put("if ");
+      condition_->write(w);
+      w.put(" then");
+      write_block(w, statements_a_, add_begin_end);
+      if (!statements_b_.empty()) {
+        w.put(add_begin_end ? " else" : "else");
+        write_block(w, statements_b_, add_begin_end);
+      }
+      break;
+    case 1: // while ... do ...
+      w.put("while ");
+      condition_->write(w);
+      w.put(" do");
+      write_block(w, statements_a_, add_begin_end);
+      break;
+    case 2: // repeat ... until ...
+      w.put("repeat");
+      w.newline();
+      w.indent();
+      write_statements(w, statements_a_);
+      w.outdent();
+      w.put("until ");
+      condition_->write(w);
+      break;
+    case 3: // loop ...
+      w.put("loop");
+      write_block(w, statements_a_, add_begin_end);
+      break;
   }
-  bool add_begin_end = (statements_a_.size()>1) || (statements_b_.size()>1);
-  // Write the statements in block a
-  std::string stat_a { };
-  if (add_begin_end) stat_a += " begin";
-  stat_a += "\n";
-  for (size_t i=0; i<statements_a_.size(); ++i)
-    stat_a += "  " + statements_a_[i]->ToString() + ";\n";
-  if (add_begin_end) stat_a += "end ";
-  // Write the statements in block b
-  if (statements_b_.empty()) {
-    return out + stat_a;
-  } else {
-    std::string stat_b { };
-    if (add_begin_end) stat_b += " begin";
-    stat_b += "\n";
-    for (size_t i=0; i<statements_b_.size(); ++i)
-      stat_b += "  " + statements_b_[i]->ToString() + ";\n";
-    if (add_begin_end) stat_b += "end ";
-    // Write and if...then...else... statement
-    return out + stat_a + "else" + stat_b;
+}
+
+dyn::lang::NodeUnaryOp::NodeUnaryOp(PC a_pc_first, PC a_pc_last, int precedence, const char *op, NodeRef operand, bool postfix)
+: Node(ND::Expr, a_pc_first, a_pc_last, precedence, op, postfix ? 1 : 0), op_(op), operand_(operand)
+{
+}
+
+void dyn::lang::NodeUnaryOp::write(CodeWriter &w) const
+{
+  if (info == 1) { // postfix, 'exists'
+    write_operand(w, operand_, arg, false);
+    w.put(' ');
+    w.put(op_);
+    return;
+  }
+  w.put(op_);
+  w.put(' ');
+  write_operand(w, operand_, arg, false);
+}
+
+dyn::lang::NodeBreak::NodeBreak(PC a_pc_first, PC a_pc_last, NodeRef value)
+: Node(ND::Statement, a_pc_first, a_pc_last, 0, "break"), value_(value)
+{
+}
+
+void dyn::lang::NodeBreak::write(CodeWriter &w) const
+{
+  w.put("break");
+  if (value_ && (value_->info != 1)) { // 'break' is the same as 'break nil'
+    w.put(' ');
+    value_->write(w);
+  }
+}
+
+dyn::lang::NodeFor::NodeFor(ND a_type, PC a_pc_first, PC a_pc_last, const std::string &var, NodeRef from, NodeRef to, NodeRef by, std::vector<NodeRef> body)
+: Node(a_type, a_pc_first, a_pc_last, 0, var), from_(from), to_(to), by_(by), body_(std::move(body))
+{
+}
+
+void dyn::lang::NodeFor::write(CodeWriter &w) const
+{
+  w.put("for ");
+  w.put(text);
+  w.put(" := ");
+  from_->write(w);
+  w.put(" to ");
+  to_->write(w);
+  if (by_) {
+    w.put(" by ");
+    by_->write(w);
+  }
+  w.put(" do");
+  write_block(w, body_, body_.size()>1);
+}
+
+dyn::lang::NodeForeach::NodeForeach(ND a_type, PC a_pc_first, PC a_pc_last, const std::string &slot, const std::string &value, bool deeply, NodeRef collection, std::vector<NodeRef> body)
+: Node(a_type, a_pc_first, a_pc_last, 0, value), slot_(slot), deeply_(deeply), collection_(collection), body_(std::move(body))
+{
+}
+
+void dyn::lang::NodeForeach::write(CodeWriter &w) const
+{
+  w.put("foreach ");
+  if (!slot_.empty()) {
+    w.put(slot_);
+    w.put(", ");
+  }
+  w.put(text);
+  if (deeply_) w.put(" deeply");
+  w.put(" in ");
+  collection_->write(w);
+  w.put(" do");
+  write_block(w, body_, body_.size()>1);
+}
+
+dyn::lang::NodeTry::NodeTry(ND a_type, PC a_pc_first, PC a_pc_last, std::vector<NodeRef> body)
+: Node(a_type, a_pc_first, a_pc_last, 0, "try"), body_(std::move(body))
+{
+}
+
+void dyn::lang::NodeTry::add_handler(const std::string &symbol, std::vector<NodeRef> body)
+{
+  handlers_.emplace_back(symbol, std::move(body));
+}
+
+void dyn::lang::NodeTry::write(CodeWriter &w) const
+{
+  w.put("try");
+  write_block(w, body_, false);
+  for (auto &h: handlers_) {
+    w.put("onexception |");
+    w.put(h.first);
+    w.put("| do");
+    write_block(w, h.second, h.second.size()>1);
   }
 }
 
-void dyn::lang::PrintStack(const std::vector<std::shared_ptr<Node>> &stack) {
+void dyn::lang::PrintStack(const std::vector<NodeRef> &stack) {
+  CodeWriter w(stdout);
+  char buf[32];
   for (auto &node: stack) {
     switch (node->type) {
-      case ND::EndOfStack:       std::cout << "------------: "; break;
-      case ND::Unknown:          std::cout << "     unknown: "; break;
-      case ND::Error:            std::cout << "       ERROR: "; break;
-      case ND::Expr:             std::cout << "        expr: "; break;
-      case ND::Statement:        std::cout << "   statement: "; break;
-      case ND::Condition:        std::cout << "   condition: "; break;
-      case ND::BranchFwd:        std::cout << "       b_fwd: "; break;
-      case ND::BranchBack:       std::cout << "      b_back: "; break;
-      case ND::BranchTrueFwd:    std::cout << "  b_true_fwd: "; break;
-      case ND::BranchTrueBack:   std::cout << " b_true_back: "; break;
-      case ND::BranchFalseFwd:   std::cout << " b_false_fwd: "; break;
-      case ND::BranchFalseBack:  std::cout << "b_false_back: "; break;
-      default:                   std::cout << "         ???: "; break;
+      case ND::EndOfStack:       w.put("------------: "); break;
+      case ND::Unknown:          w.put("     unknown: "); break;
+      case ND::Error:            w.put("       ERROR: "); break;
+      case ND::Expr:             w.put("        expr: "); break;
+      case ND::Statement:        w.put("   statement: "); break;
+      case ND::Condition:        w.put("   condition: "); break;
+      case ND::BranchFwd:        w.put("       b_fwd: "); break;
+      case ND::BranchBack:       w.put("      b_back: "); break;
+      case ND::BranchTrueFwd:    w.put("  b_true_fwd: "); break;
+      case ND::BranchTrueBack:   w.put(" b_true_back: "); break;
+      case ND::BranchFalseFwd:   w.put(" b_false_fwd: "); break;
+      case ND::BranchFalseBack:  w.put("b_false_back: "); break;
+      default:                   w.put("         ???: "); break;
     }
-    std::cout << std::setw(4) << node->arg << ": " << node->ToString() << std::endl;
+    snprintf(buf, sizeof(buf), "%4d: ", node->arg);
+    w.put(buf);
+    node->write(w);
+    w.newline();
   }
 }
 
@@ -28,6 +28,13 @@
 #include <dyn/lang/decompile.h>
 #include <dyn/ref.h>
 
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <utility>
+#include <string>
+#include <vector>
+
 namespace dyn {
 
 namespace io {
@@ -42,6 +49,42 @@ enum class ND {
   BranchFalseFwd, BranchFalseBack
 };
 
+class CodeWriter {
+public:
+  struct Mark {
+    int line;
+    PC pc_first;
+    PC pc_last;
+  };
+private:
+  std::string buf_ { };
+  std::FILE *out_ { nullptr };
+  int indent_ { 0 };
+  int line_ { 1 };
+  bool line_start_ { true };
+  std::vector<Mark> *marks_ { nullptr };
+  void start_line_();
+public:
+  static constexpr size_t kFlushSize = 64 * 1024;
+  CodeWriter() = default;
+  CodeWriter(std::FILE *out) : out_(out) { }
+  ~CodeWriter() { flush(); }
+  CodeWriter(CodeWriter const& rhs) = delete;
+  CodeWriter& operator=(CodeWriter const& rhs) = delete;
+  void put(char c);
+  void put(const char *s);
+  void put(const std::string &s) { put(s.c_str()); }
+  void newline();
+  void indent() { ++indent_; }
+  void outdent() { if (indent_ > 0) --indent_; }
+  bool at_line_start() const { return line_start_; }
+  int line() const { return line_; }
+  void set_marks(std::vector<Mark> *marks) { marks_ = marks; }
+  void mark(PC pc_first, PC pc_last) { if (marks_) marks_->push_back( { line_, pc_first, pc_last } ); }
+  void flush();
+  const std::string &str() const { return buf_; }
+};
+
 class Node {
 public:
   ND type { ND::Unknown };
@@ -53,37 +96,173 @@ public:
   Node() { }
   Node(ND a_type, PC a_pc_first, PC a_pc_last, int a_arg, const std::string &a_text, int a_info=0);
   virtual ~Node();
-  virtual std::string ToString();
-  virtual int print(dyn::io::PrintState &ps);
+  virtual void write(CodeWriter &w) const;
+  std::string ToString() const;
+  int print(dyn::io::PrintState &ps) const;
+};
+
+using NodeRef = Node*;
+
+class NodeArena {
+  static constexpr size_t kBlockSize = 16 * 1024;
+  std::vector<std::unique_ptr<char[]>> blocks_ { };
+  std::vector<Node*> nodes_ { };
+  char *cur_ { nullptr };
+  size_t left_ { 0 };
+  void *allocate_(size_t size, size_t align);
+public:
+  NodeArena() = default;
+  ~NodeArena() { clear(); }
+  NodeArena(NodeArena const& rhs) = delete;
+  NodeArena& operator=(NodeArena const& rhs) = delete;
+  template<class T, class... Args>
+  T *make(Args&&... args) {
+    T *node = new (allocate_(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    nodes_.push_back(node);
+    return node;
+  }
+  void clear();
+  size_t size() const { return nodes_.size(); }
 };
 
 class NodeImmediate : public Node {
   dyn::Ref imm { RefNIL };
 public:
   NodeImmediate(ND a_type, PC a_pc_first, PC a_pc_last, int a_arg, const std::string &a_text, int a_info, RefArg a_ref);
-  std::string ToString() override;
+  const dyn::Ref &value() const { return imm; }
+  void write(CodeWriter &w) const override;
+};
+
+class NodeUnaryOp : public Node {
+  const char *op_;
+  NodeRef operand_;
+public:
+  NodeUnaryOp(PC a_pc_first, PC a_pc_last, int precedence, const char *op, NodeRef operand, bool postfix=false);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeBinaryOp : public Node {
+  const char *op_;
+  NodeRef left_;
+  NodeRef right_;
+public:
+  NodeBinaryOp(PC a_pc_first, PC a_pc_last, int precedence, const char *op, NodeRef left, NodeRef right);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeAccess : public Node {
+  NodeRef object_;
+  NodeRef key_;
+  NodeRef value_;
+public:
+  NodeAccess(PC a_pc_first, PC a_pc_last, bool index, const std::string &name, NodeRef object, NodeRef key, NodeRef value=nullptr);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeFrame : public Node {
+  std::vector<std::string> tags_;
+  std::vector<NodeRef> values_;
+public:
+  NodeFrame(PC a_pc_first, PC a_pc_last, std::vector<std::string> tags, std::vector<NodeRef> values);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeArray : public Node {
+  std::vector<NodeRef> elements_;
+public:
+  NodeArray(PC a_pc_first, PC a_pc_last, const std::string &cls, std::vector<NodeRef> elements);
+  const std::vector<NodeRef> &elements() const { return elements_; }
+  void write(CodeWriter &w) const override;
+};
+
+class NodeCall : public Node {
+  NodeRef function_;
+  std::vector<NodeRef> args_;
+public:
+  NodeCall(PC a_pc_first, PC a_pc_last, bool invoke, NodeRef function, std::vector<NodeRef> args);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeSend : public Node {
+  const char *op_;
+  NodeRef receiver_;
+  NodeRef message_;
+  std::vector<NodeRef> args_;
+public:
+  NodeSend(PC a_pc_first, PC a_pc_last, const char *op, NodeRef receiver, NodeRef message, std::vector<NodeRef> args);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeAssign : public Node {
+  NodeRef value_;
+public:
+  NodeAssign(PC a_pc_first, PC a_pc_last, const std::string &name, NodeRef value);
+  NodeRef value() const { return value_; }
+  void write(CodeWriter &w) const override;
+};
+
+class NodeReturn : public Node {
+  NodeRef value_;
+public:
+  NodeReturn(PC a_pc_first, PC a_pc_last, NodeRef value);
+  void write(CodeWriter &w) const override;
+};
+
+class NodeBreak : public Node {
+  NodeRef value_;
+public:
+  NodeBreak(PC a_pc_first, PC a_pc_last, NodeRef value);
+  void write(CodeWriter &w) const override;
 };
 
 class NodeControlFlow : public Node {
-  std::shared_ptr<Node> condition_ { };
-  std::vector<std::shared_ptr<Node>> statements_a_ { };
-  std::vector<std::shared_ptr<Node>> statements_b_ { };
+  NodeRef condition_ { };
+  std::vector<NodeRef> statements_a_ { };
+  std::vector<NodeRef> statements_b_ { };
 public:
   NodeControlFlow(ND a_type, PC a_pc_first, PC a_pc_last, int a_arg, const std::string &a_text, int a_info);
-  void set_condition(std::shared_ptr<Node> condition);
-  void add_statement_a(std::shared_ptr<Node> stmt);
-  void add_statement_b(std::shared_ptr<Node> stmt);
-  std::string ToString() override;
+  void set_condition(NodeRef condition);
+  void add_statement_a(NodeRef stmt);
+  void add_statement_b(NodeRef stmt);
+  void write(CodeWriter &w) const override;
 };
 
-void PrintStack(const std::vector<std::shared_ptr<Node>> &stack);
+class NodeFor : public Node {
+  NodeRef from_;
+  NodeRef to_;
+  NodeRef by_;
+  std::vector<NodeRef> body_;
+public:
+  NodeFor(ND a_type, PC a_pc_first, PC a_pc_last, const std::string &var, NodeRef from, NodeRef to, NodeRef by, std::vector<NodeRef> body);
+  void write(CodeWriter &w) const override;
+};
 
-} // namespce lang
+class NodeForeach : public Node {
+  std::string slot_;
+  bool deeply_;
+  NodeRef collection_;
+  std::vector<NodeRef> body_;
+public:
+  NodeForeach(ND a_type, PC a_pc_first, PC a_pc_last, const std::string &slot, const std::string &value, bool deeply, NodeRef collection, std::vector<NodeRef> body);
+  void write(CodeWriter &w) const override;
+};
 
-} // namespace dn
+class NodeTry : public Node {
+  std::vector<NodeRef> body_;
+  std::vector<std::pair<std::string, std::vector<NodeRef>>> handlers_;
+public:
+  NodeTry(ND a_type, PC a_pc_first, PC a_pc_last, std::vector<NodeRef> body);
+  void add_handler(const std::string &symbol, std::vector<NodeRef> body);
+  void write(CodeWriter &w) const override;
+};
 
-#endif // DYN_LANG_AST_H
+void write_statements(CodeWriter &w, const std::vector<NodeRef> &list);
+
+void PrintStack(const std::vector<NodeRef> &stack);
 
+} // namespce lang
 
+} // namespace dn
 
+#endif // DYN_LANG_AST_H
 
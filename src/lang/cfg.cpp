@@ -0,0 +1,598 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Control flow graph and dominator trees for the decompiler.
+
+#include "cfg.h"
+
+#include <algorithm>
+
+using namespace dyn;
+
+using namespace dyn::lang;
+
+/** \class dyn::lang::ControlFlowGraph
+ Basic blocks of a transcoded function and the edges between them.
+
+ A new block starts at the first instruction, at every branch target, at
+ every exception handler, and after every branch or return. Dominators and
+ post-dominators are computed with the iterative algorithm by Cooper,
+ Harvey, and Kennedy, which is close to linear for the reducible graphs
+ that the NewtonScript compiler generates.
+ */
+
+static bool IsBranch(BC bc)
+{
+  return (bc == BC::Branch) || (bc == BC::BranchIfTrue)
+      || (bc == BC::BranchIfFalse) || (bc == BC::BranchLoop);
+}
+
+/**
+ Split the code into basic blocks and connect them.
+ \param[in] code transcoded function, ending in BC::EndOfFile
+ \param[in] extra_leaders PCs that are reached in other ways, for example
+    exception handlers
+ */
+void ControlFlowGraph::build(const std::vector<Bytecode> &code, const std::vector<PC> &extra_leaders)
+{
+  size_t n = code.size();
+  std::vector<bool> leader(n + 1, false);
+  if (n) leader[0] = true;
+  for (PC pc: extra_leaders)
+    if (pc < n) leader[pc] = true;
+  for (PC pc=0; pc<n; ++pc) {
+    const Bytecode &bc = code[pc];
+    if (bc.references) leader[pc] = true;
+    if (IsBranch(bc.bc)) {
+      if ((PC)bc.arg < n) leader[bc.arg] = true;
+      leader[pc+1] = true;
+    } else if ((bc.bc == BC::Return) || (bc.bc == BC::NewHandler)) {
+      leader[pc+1] = true;
+    }
+  }
+
+  blocks.clear();
+  block_of.assign(n, -1);
+  for (PC pc=0; pc<n; ++pc) {
+    if (leader[pc]) {
+      blocks.emplace_back();
+      blocks.back().first = pc;
+    }
+    blocks.back().last = pc;
+    block_of[pc] = (int)blocks.size()-1;
+  }
+
+  auto link = [this](int from, PC to) {
+    if (to >= block_of.size()) return;
+    int b = block_of[to];
+    auto &s = blocks[from].succ;
+    if (std::find(s.begin(), s.end(), b) == s.end()) {
+      s.push_back(b);
+      blocks[b].pred.push_back(from);
+    }
+  };
+  for (int i=0; i<(int)blocks.size(); ++i) {
+    const Bytecode &bc = code[blocks[i].last];
+    PC next = blocks[i].last + 1;
+    switch (bc.bc) {
+      case BC::Return:
+      case BC::EndOfFile:
+        break;
+      case BC::Branch:
+        link(i, bc.arg);
+        break;
+      case BC::BranchIfTrue:
+      case BC::BranchIfFalse:
+      case BC::BranchLoop:
+        link(i, next);
+        link(i, bc.arg);
+        break;
+      default:
+        link(i, next);
+        break;
+    }
+  }
+  // Handlers can be reached from the block that installs them.
+  for (PC pc: extra_leaders) {
+    for (int i=0; i<(int)blocks.size(); ++i) {
+      if (code[blocks[i].last].bc == BC::NewHandler && pc < n && pc > blocks[i].last)
+        link(i, pc);
+    }
+  }
+}
+
+/**
+ Compute the immediate dominator of every node of a graph.
+ \return immediate dominator per node, -1 for the entry and unreachable nodes
+ */
+std::vector<int> ControlFlowGraph::immediate_dominators_(int entry, const std::vector<std::vector<int>> &succ,
+                                                         const std::vector<std::vector<int>> &pred)
+{
+  int n = (int)succ.size();
+  // -- reverse post order, iterative depth first search
+  std::vector<int> order, rpo_ix(n, -1);
+  std::vector<uint8_t> state(n, 0);
+  std::vector<std::pair<int, size_t>> work { { entry, 0 } };
+  state[entry] = 1;
+  while (!work.empty()) {
+    auto &top = work.back();
+    if (top.second < succ[top.first].size()) {
+      int s = succ[top.first][top.second++];
+      if (!state[s]) {
+        state[s] = 1;
+        work.push_back({ s, 0 });
+      }
+    } else {
+      order.push_back(top.first);
+      work.pop_back();
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  for (int i=0; i<(int)order.size(); ++i)
+    rpo_ix[order[i]] = i;
+
+  std::vector<int> dom(n, -1);
+  dom[entry] = entry;
+  auto intersect = [&](int a, int b) {
+    while (a != b) {
+      while (rpo_ix[a] > rpo_ix[b]) a = dom[a];
+      while (rpo_ix[b] > rpo_ix[a]) b = dom[b];
+    }
+    return a;
+  };
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int b: order) {
+      if (b == entry) continue;
+      int new_idom = -1;
+      for (int p: pred[b]) {
+        if (rpo_ix[p] < 0 || dom[p] < 0) continue;
+        new_idom = (new_idom < 0) ? p : intersect(p, new_idom);
+      }
+      if (new_idom >= 0 && dom[b] != new_idom) {
+        dom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  dom[entry] = -1;
+  return dom;
+}
+
+void ControlFlowGraph::compute_dominators()
+{
+  std::vector<std::vector<int>> succ, pred;
+  for (auto &b: blocks) {
+    succ.push_back(b.succ);
+    pred.push_back(b.pred);
+  }
+  if (blocks.empty())
+    idom.clear();
+  else
+    idom = immediate_dominators_(0, succ, pred);
+}
+
+/**
+ Compute post-dominators on the reversed graph.
+ All blocks without successors lead to a virtual exit node. Blocks whose
+ immediate post-dominator is the virtual exit get -1.
+ */
+void ControlFlowGraph::compute_post_dominators()
+{
+  int n = (int)blocks.size();
+  int exit = n;
+  std::vector<std::vector<int>> succ(n+1), pred(n+1);
+  for (int i=0; i<n; ++i) {
+    succ[i] = blocks[i].pred;
+    pred[i] = blocks[i].succ;
+    if (blocks[i].succ.empty()) {
+      succ[exit].push_back(i);
+      pred[i].push_back(exit);
+    }
+  }
+  auto dom = immediate_dominators_(exit, succ, pred);
+  ipdom.assign(n, -1);
+  for (int i=0; i<n; ++i)
+    ipdom[i] = (dom[i] == exit) ? -1 : dom[i];
+}
+
+/**
+ Check if block a dominates block b.
+ */
+bool ControlFlowGraph::dominates(int a, int b) const
+{
+  for (int i = b; i >= 0; i = idom[i])
+    if (i == a) return true;
+  return false;
+}
+
+/**
+ Return the first PC of the immediate post-dominator of the block at pc.
+ \return a PC, or kInvalidPC if the block only leads to the function exit
+ */
+PC ControlFlowGraph::ipdom_pc(PC pc) const
+{
+  if (pc >= block_of.size()) return kInvalidPC;
+  int b = ipdom[block_of[pc]];
+  return (b < 0) ? kInvalidPC : blocks[b].first;
+}
+
+/** \class dyn::lang::Structurizer
+ Find the structured control flow statements in a transcoded function.
+
+ The analysis runs once per function before the stack based decoder. It
+ uses the control flow graph to find loops, which are the targets of back
+ edges to a dominating block, and the post-dominator tree to verify that
+ both branches of an 'if' meet again at its end. The instruction patterns
+ that the NewtonScript compiler generates around these blocks tell 'while',
+ 'for', and 'foreach' apart.
+
+ For every construct, the decoder finds its list index in reduce_at[] at
+ the PC where the construct ends. Branches and other helper instructions
+ that are fully described by a construct are flagged in skip[], and
+ branches to the end of a loop are flagged in is_break[].
+ */
+
+bool Structurizer::at_(PC pc, BC bc) const
+{
+  return (pc < code_->size()) && ((*code_)[pc].bc == bc);
+}
+
+bool Structurizer::at_(PC pc, BC bc, int arg) const
+{
+  return at_(pc, bc) && ((*code_)[pc].arg == arg);
+}
+
+void Structurizer::add_(Construct &&c)
+{
+  reduce_at[c.end].push_back((int)constructs.size());
+  constructs.push_back(std::move(c));
+}
+
+/**
+ Flag all unconditional branches to the end of a loop as 'break' statements.
+ */
+void Structurizer::mark_breaks_(const Construct &c)
+{
+  for (PC pc=c.begin; pc<c.end; ++pc)
+    if (!skip[pc] && at_(pc, BC::Branch, (int)c.end))
+      is_break[pc] = 1;
+}
+
+/**
+ Find 'try ... onexception ...' blocks.
+
+ \code
+    [push_lit symbol, push_const a[n]]*n
+    new_handler n
+    [statement]*
+    expr
+    pop_handlers
+    branch b
+ [label a0
+    [statement]*
+    expr
+    branch_fwd c]
+ label a0
+    [statement]*
+    expr
+ label c
+    pop_handlers
+ label b
+ \endcode
+ */
+void Structurizer::find_tries_(const std::vector<PC> &offsets)
+{
+  const auto &code = *code_;
+  for (PC n=0; n<code.size(); ++n) {
+    if (!at_(n, BC::NewHandler)) continue;
+    PC k = (PC)code[n].arg;
+    if ((k == 0) || (2*k > n)) continue;
+    Construct c;
+    c.kind = CK::Try;
+    c.begin = n - 2*k;
+    c.body = n + 1;
+    bool ok = true;
+    for (PC j=0; j<k && ok; ++j) {
+      PC sp = c.begin + 2*j;
+      if (!at_(sp, BC::Push) || !at_(sp+1, BC::PushConst) || (code[sp+1].arg & 3)) {
+        ok = false;
+        break;
+      }
+      size_t offset = (size_t)(code[sp+1].arg >> 2);
+      PC h = (offset < offsets.size()) ? offsets[offset] : kInvalidPC;
+      if (h == kInvalidPC || h <= n) ok = false;
+      c.handlers.push_back(h);
+      c.symbols.push_back(code[sp].arg);
+    }
+    if (!ok || !std::is_sorted(c.handlers.begin(), c.handlers.end())) continue;
+    PC h0 = c.handlers.front();
+    if (!at_(h0-2, BC::PopHandlers) || !at_(h0-1, BC::Branch)) continue;
+    PC b = (PC)code[h0-1].arg;
+    PC pop = b - 1;
+    if (!at_(pop, BC::PopHandlers) || (pop < c.handlers.back())) continue;
+    for (PC j=0; j<k; ++j) {
+      PC e = (j+1 < k) ? c.handlers[j+1] - 1 : pop;
+      if ((j+1 < k) && !at_(e, BC::Branch, (int)pop)) ok = false;
+      c.handlers_end.push_back(e);
+    }
+    if (!ok) continue;
+    c.body_end = h0 - 2;
+    c.end = b;
+    c.value = true;
+    for (PC pc=c.begin; pc<=n; ++pc) skip[pc] = 1;
+    skip[h0-2] = skip[h0-1] = skip[pop] = 1;
+    for (PC j=0; j+1<k; ++j) skip[c.handlers_end[j]] = 1;
+    add_(std::move(c));
+  }
+}
+
+/**
+ Find a 'for' loop that was entered by the branch at p to the header h.
+
+ \code
+    expr
+    set_var index
+    expr
+    set_var limit
+    expr
+    set_var incr
+    get_var incr
+    get_var index
+    branch_fwd a
+ label b
+    [statement]*
+    get_var incr
+    incr_var index
+ label a
+    get_var limit
+    branch_loop b
+ \endcode
+ */
+bool Structurizer::find_for_(PC p, PC h)
+{
+  const auto &code = *code_;
+  PC q = h + 1;
+  if (!at_(q, BC::BranchLoop, (int)(p+1))) return false;
+  if (!at_(h, BC::GetVar) || !at_(h-1, BC::IncrVar) || !at_(h-2, BC::GetVar)) return false;
+  int index = code[h-1].arg, incr = code[h-2].arg, limit = code[h].arg;
+  if (!at_(p-1, BC::GetVar, index) || !at_(p-2, BC::GetVar, incr)) return false;
+  Construct c;
+  c.kind = CK::For;
+  c.begin = p - 2;
+  c.body = p + 1;
+  c.body_end = h - 2;
+  c.test = q;
+  c.var[0] = index;
+  c.var[1] = limit;
+  c.var[2] = incr;
+  c.value = at_(q+1, BC::PushConst, 2);
+  c.end = q + 1 + c.value;
+  for (PC pc=p-2; pc<=p; ++pc) skip[pc] = 1;
+  for (PC pc=h-2; pc<c.end; ++pc) skip[pc] = 1;
+  mark_breaks_(c);
+  add_(std::move(c));
+  return true;
+}
+
+/**
+ Find a 'foreach' loop that was entered by the branch at p to the header h.
+
+ \code
+    expr
+    push_const deeply
+    new_iter
+    set_var iter
+    branch_fwd a
+ label b
+    [get_var iter; push_const 0; aref; set_var slot]
+    get_var iter
+    push_const 1
+    aref
+    set_var value
+    [statment]*
+    get_var iter
+    iter_next
+ label a
+    get_var iter
+    iter_done
+    branch_if_false b
+    push_const nil
+    push_const nil
+    set_var iter
+ \endcode
+ */
+bool Structurizer::find_foreach_(PC p, PC h)
+{
+  const auto &code = *code_;
+  PC q = h + 2;
+  if (!at_(h, BC::GetVar) || !at_(h+1, BC::IterDone) || !at_(q, BC::BranchIfFalse, (int)(p+1))) return false;
+  int iter = code[h].arg;
+  if (!at_(p-1, BC::SetVar, iter) || !at_(p-2, BC::NewIter)) return false;
+  if (!at_(h-1, BC::IterNext) || !at_(h-2, BC::GetVar, iter)) return false;
+  Construct c;
+  c.kind = CK::Foreach;
+  c.begin = p - 2;
+  c.body_end = h - 2;
+  c.test = q;
+  c.var[2] = iter;
+  PC pc = p + 1;
+  while (at_(pc, BC::GetVar, iter) && at_(pc+1, BC::PushConst) && at_(pc+2, BC::ARef) && at_(pc+3, BC::SetVar)) {
+    if (code[pc+1].arg == 0)
+      c.var[1] = code[pc+3].arg; // slot
+    else
+      c.var[0] = code[pc+3].arg; // value
+    pc += 4;
+  }
+  if (c.var[0] < 0) return false;
+  c.body = pc;
+  if (at_(q+1, BC::PushConst, 2) && at_(q+2, BC::PushConst, 2) && at_(q+3, BC::SetVar, iter)) {
+    c.value = true;
+    c.end = q + 4;
+  } else {
+    c.end = q + 1;
+  }
+  for (PC i=c.begin; i<c.body; ++i) skip[i] = 1;
+  for (PC i=c.body_end; i<c.end; ++i) skip[i] = 1;
+  mark_breaks_(c);
+  add_(std::move(c));
+  return true;
+}
+
+/**
+ Find all loops. A loop header is the target of a back edge, which is an
+ edge from a block that the header dominates.
+ */
+void Structurizer::find_loops_()
+{
+  const auto &code = *code_;
+  for (int hb=0; hb<(int)cfg.blocks.size(); ++hb) {
+    const BasicBlock &head = cfg.blocks[hb];
+    int latch = -1;
+    PC entry = kInvalidPC;
+    for (int p: head.pred) {
+      if (cfg.dominates(hb, p)) {
+        if ((latch < 0) || (cfg.blocks[p].last > cfg.blocks[latch].last)) latch = p;
+      } else if (at_(cfg.blocks[p].last, BC::Branch, (int)head.first) && (cfg.blocks[p].last < head.first)) {
+        entry = cfg.blocks[p].last;
+      }
+    }
+    if (latch < 0) continue;
+    PC h = head.first;
+    Construct c;
+    if (entry != kInvalidPC) {
+      if (find_for_(entry, h) || find_foreach_(entry, h)) continue;
+      PC q = h;
+      while ((q < code.size()) && !at_(q, BC::BranchIfTrue, (int)(entry+1))) ++q;
+      if (q == code.size()) continue;
+      c.kind = CK::While;
+      c.begin = entry;
+      c.body = entry + 1;
+      c.body_end = h;
+      skip[entry] = 1;
+      c.test = q;
+    } else {
+      PC l = cfg.blocks[latch].last;
+      if (at_(l, BC::BranchIfFalse, (int)h))
+        c.kind = CK::Repeat;
+      else if (at_(l, BC::Branch, (int)h))
+        c.kind = CK::Loop;
+      else
+        continue;
+      c.begin = c.body = h;
+      c.test = l;
+    }
+    c.value = at_(c.test+1, BC::PushConst, 2);
+    c.end = c.test + 1 + c.value;
+    skip[c.test] = 1;
+    if (c.value) skip[c.test+1] = 1;
+    mark_breaks_(c);
+    add_(std::move(c));
+  }
+}
+
+/**
+ Find 'if ... then ...' and 'if ... then ... else ...', including 'and'
+ and 'or', which compile into the same pattern.
+
+ \code
+    expr
+    branch_if_false_fwd a
+    [statement]*
+    [branch_fwd b
+ label a
+    [statement]*]
+ label b
+ \endcode
+ */
+void Structurizer::find_ifs_()
+{
+  const auto &code = *code_;
+  for (PC x=0; x<code.size(); ++x) {
+    if (skip[x]) continue;
+    if (!at_(x, BC::BranchIfFalse) && !at_(x, BC::BranchIfTrue)) continue;
+    PC t = (PC)code[x].arg;
+    if (t <= x) continue;
+    Construct c;
+    c.begin = c.test = x;
+    c.body = x + 1;
+    c.negate = at_(x, BC::BranchIfTrue);
+    PC e = t - 1;
+    if ((e > x) && at_(e, BC::Branch) && ((PC)code[e].arg > t) && !skip[e] && !is_break[e]) {
+      c.kind = CK::IfThenElse;
+      c.other = t;
+      c.end = (PC)code[e].arg;
+    } else {
+      c.kind = CK::IfThen;
+      c.end = t;
+    }
+    // Both paths must meet at the end of the construct, unless one of them
+    // leaves the function or the loop.
+    PC join = cfg.ipdom_pc(x);
+    if ((join != kInvalidPC) && (join < c.end)) continue;
+    skip[x] = 1;
+    if (c.kind == CK::IfThenElse) skip[e] = 1;
+    add_(std::move(c));
+  }
+}
+
+/**
+ Run the analysis.
+ \param[in] code transcoded function
+ \param[in] offsets PC of every Newton bytecode offset, used to find the
+    exception handlers
+ */
+void Structurizer::analyze(const std::vector<Bytecode> &code, const std::vector<PC> &offsets)
+{
+  code_ = &code;
+  constructs.clear();
+  reduce_at.assign(code.size() + 1, { });
+  skip.assign(code.size() + 1, 0);
+  is_break.assign(code.size() + 1, 0);
+
+  std::vector<PC> handlers;
+  for (PC n=0; n<code.size(); ++n) {
+    if (!at_(n, BC::NewHandler)) continue;
+    for (PC j=1; j<=(PC)code[n].arg && 2*j<=n; ++j) {
+      const Bytecode &bc = code[n-2*j+1];
+      size_t offset = (size_t)(bc.arg >> 2);
+      if ((bc.bc == BC::PushConst) && (offset < offsets.size()) && (offsets[offset] != kInvalidPC))
+        handlers.push_back(offsets[offset]);
+    }
+  }
+  cfg.build(code, handlers);
+  cfg.compute_dominators();
+  cfg.compute_post_dominators();
+
+  find_tries_(offsets);
+  find_loops_();
+  find_ifs_();
+
+  // Inner constructs start later and must be reduced first.
+  for (auto &list: reduce_at) {
+    std::sort(list.begin(), list.end(), [this](int a, int b) {
+      return constructs[a].begin > constructs[b].begin;
+    });
+  }
+}
@@ -0,0 +1,104 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_LANG_CFG_H
+#define DYN_LANG_CFG_H
+
+#include <dyn/lang/decompile.h>
+
+#include <vector>
+
+namespace dyn {
+
+namespace lang {
+
+class BasicBlock {
+public:
+  PC first { kInvalidPC };
+  PC last { kInvalidPC };
+  std::vector<int> succ { };
+  std::vector<int> pred { };
+};
+
+class ControlFlowGraph {
+  static std::vector<int> immediate_dominators_(int entry, const std::vector<std::vector<int>> &succ,
+                                                const std::vector<std::vector<int>> &pred);
+public:
+  std::vector<BasicBlock> blocks { };
+  std::vector<int> block_of { };
+  std::vector<int> idom { };
+  std::vector<int> ipdom { };
+  void build(const std::vector<Bytecode> &code, const std::vector<PC> &extra_leaders);
+  void compute_dominators();
+  void compute_post_dominators();
+  bool dominates(int a, int b) const;
+  PC ipdom_pc(PC pc) const;
+};
+
+enum class CK {
+  IfThen, IfThenElse, While, Repeat, Loop, For, Foreach, Try
+};
+
+class Construct {
+public:
+  CK kind { CK::IfThen };
+  PC begin { kInvalidPC };
+  PC end { kInvalidPC };
+  PC test { kInvalidPC };
+  PC body { kInvalidPC };
+  PC body_end { kInvalidPC };
+  PC other { kInvalidPC };
+  bool negate { false };
+  bool value { false };
+  int var[3] { -1, -1, -1 };
+  std::vector<PC> handlers { };
+  std::vector<PC> handlers_end { };
+  std::vector<int> symbols { };
+};
+
+class Structurizer {
+  const std::vector<Bytecode> *code_ { nullptr };
+  bool at_(PC pc, BC bc) const;
+  bool at_(PC pc, BC bc, int arg) const;
+  void add_(Construct &&c);
+  void mark_breaks_(const Construct &c);
+  void find_tries_(const std::vector<PC> &offsets);
+  void find_loops_();
+  bool find_for_(PC p, PC h);
+  bool find_foreach_(PC p, PC h);
+  void find_ifs_();
+public:
+  ControlFlowGraph cfg { };
+  std::vector<Construct> constructs { };
+  std::vector<std::vector<int>> reduce_at { };
+  std::vector<uint8_t> skip { };
+  std::vector<uint8_t> is_break { };
+  void analyze(const std::vector<Bytecode> &code, const std::vector<PC> &offsets);
+};
+
+} // namespace lang
+
+} // namespace dyn
+
+#endif // DYN_LANG_CFG_H
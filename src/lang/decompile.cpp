@@ -24,10 +24,14 @@
 
 #include <dyn/lang/decompile.h>
 #include "ast.h"
+#include "cfg.h"
 #include "transcode.h"
+#include "verify.h"
 #include <dyn/objects.h>
+#include <dyn/tools/stats.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <map>
 #include <algorithm>
@@ -56,49 +60,52 @@ using namespace dyn::lang;
        . slot access
  */
 
-// TODO: this is now part of the class Decompiler. Define it there or remove it.
-Bytecode dc_empty { BC::EndOfFile, 0, 0, 0 };
 class State {
 public:
   PC pc { 0 };
-  Bytecode &bytecode { dc_empty };
+  Bytecode bytecode { BC::EndOfFile, 0, 0 };
 };
 
+/**
+ Check if a node is the constant nil (info 1) or true (info 2).
+ */
+static bool IsConst(NodeRef node, int info)
+{
+  return (dynamic_cast<NodeImmediate*>(node) != nullptr) && (node->info == info);
+}
+
 class Decompiler;
 typedef int (Decompiler::*BytecodeHandler)();
 
 class Decompiler {
 private:
   // Control Flow helpers:
-  int CheckTryOnExpression();           // todo
-  int CheckForeach();                   // todo
-  int CheckForLoop();                   // todo
-  int CheckEndlessLoop();               // todo
-  int CheckRepeatBreakUntil();          // todo
-  int CheckRepeatUntil();               // todo
-  int CheckWhileBreakDo();              // todo
-  int CheckWhileDo();
-  int CheckLogicAnd();
-  int CheckLogicOr();
-  int CheckIfThen();
-  int CheckIfThenElse();
-  int CheckIfThenElseExpr();
-  int DoLabel();
+  bool Reduce(const Construct &c);
+  bool ReduceIf(const Construct &c);
+  bool ReduceLoop(const Construct &c);
+  bool ReduceFor(const Construct &c);
+  bool ReduceForeach(const Construct &c);
+  bool ReduceTry(const Construct &c);
+  bool TakeBlock(std::vector<NodeRef> &block, size_t first, size_t last);
+  NodeRef ExprAt(size_t ix);
+  static std::string LocalName(int ix) { return "local_" + std::to_string(ix); }
   // Bytecode helpers:
-  int DoInfixOperator(const std::string &op, int precedence);
-  int DoSend(const std::string &op, const std::string &call, bool is_resend);
-  int DoCallOrInvoke(const std::string &call, int which);
-  PC DoArgList(std::string &args, int num_args);
+  int DoInfixOperator(const char *op, int precedence);
+  int DoSend(const char *op, const char *call, bool is_resend);
+  int DoCallOrInvoke(const char *call, int which);
+  int DoBuiltin(const char *name, int num_args);
+  int DoPathAccess(bool has_value, bool keep_value);
+  bool DoArgList(std::vector<NodeRef> &args, int num_args);
   // handle all known bytecodes:
   int DoEOF();
   int DoPop();
-  int DoDup() { return -2; }            // Compiler does not emit this code
+  int DoDup();
   int DoReturn();
   int DoPushSelf();
-  int DoSetLexScope() { return -2; }    // when calling a function that is declared inside this function
-  int DoIterNext() { return -2; }       // 'foreach'
-  int DoIterDone() { return -2; }       // 'foreach'
-  int DoPopHandlers() { return -2; };   // end of 'try' and 'onException'
+  int DoSetLexScope();
+  int DoIterNext();
+  int DoIterDone();
+  int DoPopHandlers();
   int DoPush();
   int DoPushConst();
   int DoCall();
@@ -111,54 +118,59 @@ private:
   int DoBranchIfTrue();
   int DoBranchIfFalse();
   int DoFindVar();
-  int DoGetVar() { return -2; };        // read from a slot
-  int DoMakeFrame() { return -2; };     // build a frame
-  int DoMakeArray() { return -2; };     // build an array
-  int DoFillArray() { return -2; };     // fill an array with values
-  int DoGetPath() { return -2; };       // access path
-  int DoGetPathCheck() { return -2; };  // access path
-  int DoSetPath() { return -2; };       // access path
-  int DoSetPathVal() { return -2; };    // access path
-  int DoSetVar() { return -2; };        // write to a slot
+  int DoGetVar();
+  int DoMakeFrame();
+  int DoMakeArray();
+  int DoFillArray();
+  int DoGetPath();
+  int DoGetPathCheck();
+  int DoSetPath();
+  int DoSetPathVal();
+  int DoSetVar();
   int DoFindAndSetVar();
-  int DoIncrVar() { return -2; };       // 'for' loops
-  int DoBranchLoop() { return -2; };    // 'for' loops
+  int DoIncrVar();
+  int DoBranchLoop();
   int DoAdd();
   int DoSubtract();
-  int DoARef() { return -2; };          // array read access
-  int DoSetARef() { return -2; };       // array write access
+  int DoARef();
+  int DoSetARef();
   int DoEquals();
-  int DoNot() { return -2; };           // unary operator
+  int DoNot();
   int DoNotEquals();
   int DoMultiply();
   int DoDivide();
-  int DoDiv() { return -2; };           // binary operator 'div'
+  int DoDiv();
   int DoLessThan();
   int DoGreaterThan();
   int DoGreaterOrEqual();
   int DoLessOrEqual();
-  int DoBitAnd() { return -2; };        // global function call 'bAnd(ref, ref)'
-  int DoBitOr() { return -2; };         // global function call 'bOr(ref, ref)'
-  int DoBitNot() { return -2; };        // global function call 'bNot(ref)'
-  int DoNewIter() { return -2; };       // 'foreach'
-  int DoLength() { return -2; };        // global function call 'length(ref)', probably 'foreach'
-  int DoClone() { return -2; };         // global function call 'clone(ref)'
-  int DoSetClass() { return -2; };      // global function call 'SetClass(obj, symbol)'
-  int DoAddArraySlot() { return -2; };  // global function call 'AddArraySlot(array, value)'
-  int DoStringer() { return -2; };      // binary operators '&' and '&&'
-  int DoHasPath() { return -2; };       // access path
-  int DoClassOf() { return -2; };       // global function call 'ClassOf(obj)'
-  int DoNewHandler() { return -2; };    // exception handling start: 'try'
+  int DoBitAnd();
+  int DoBitOr();
+  int DoBitNot();
+  int DoNewIter();
+  int DoLength();
+  int DoClone();
+  int DoSetClass();
+  int DoAddArraySlot();
+  int DoStringer();
+  int DoHasPath();
+  int DoClassOf();
+  int DoNewHandler();
   int DoUnknown() { return -2; };
 public:
   std::vector<Bytecode> instructions { };
-  std::vector<std::shared_ptr<Node>> stack { };
+  std::vector<PC> offsets { };
+  Structurizer structure { };
+  std::vector<size_t> depth { };
+  NodeArena arena { };
+  std::vector<NodeRef> stack { };
   State state;
   Ref ns_function;
   Ref ns_literals;
+  std::ostream &log;
 public:
   static const BytecodeHandler handler[];
-  Decompiler(RefArg func);
+  Decompiler(RefArg func, std::ostream &a_log);
   int Do(BC bc) {
     assert ((bc >= BC::EndOfFile) || (bc <= BC::Unknown));
     return (*this.*handler[(size_t)bc])(); }
@@ -180,7 +192,9 @@ const BytecodeHandler Decompiler::handler[] = {
   &Decompiler::DoGreaterThan, &Decompiler::DoGreaterOrEqual, &Decompiler::DoLessOrEqual, &Decompiler::DoBitAnd,
   &Decompiler::DoBitOr, &Decompiler::DoBitNot, &Decompiler::DoNewIter, &Decompiler::DoLength,
   &Decompiler::DoClone, &Decompiler::DoSetClass, &Decompiler::DoAddArraySlot, &Decompiler::DoStringer,
-  &Decompiler::DoHasPath, &Decompiler::DoClassOf, &Decompiler::DoNewHandler, &Decompiler::DoUnknown
+  &Decompiler::DoHasPath, &Decompiler::DoClassOf, &Decompiler::DoNewHandler,
+  &Decompiler::DoUnknown, &Decompiler::DoUnknown, &Decompiler::DoUnknown, &Decompiler::DoUnknown,
+  &Decompiler::DoUnknown, &Decompiler::DoUnknown, &Decompiler::DoUnknown
 };
 
 /**
@@ -200,7 +214,7 @@ int Decompiler::DoPushConst() {
   if (state.bytecode.arg ==  2) info = 1; // push_const nil
   if (state.bytecode.arg == 26) info = 2; // push_const true
   Ref r = Ref::NSRef(state.bytecode.arg);
-  stack.push_back( std::make_shared<NodeImmediate>(ND::Expr, state.pc, state.pc, 0, "imm_" + std::to_string(state.bytecode.arg), info, r ) );
+  stack.push_back( arena.make<NodeImmediate>(ND::Expr, state.pc, state.pc, 0, "imm_" + std::to_string(state.bytecode.arg), info, r ) );
   return 1;
 }
 
@@ -211,27 +225,21 @@ int Decompiler::DoPushConst() {
     if the left or right expression need to be bracketed.
  \return number of bytecodes consumed
  */
-int Decompiler::DoInfixOperator(const std::string &op, int precedence) {
-  Node *s1 = stack[stack.size()-1].get();
+int Decompiler::DoInfixOperator(const char *op, int precedence) {
+  Node *s1 = stack[stack.size()-1];
   if (s1->type != ND::Expr) {
-    std::cout << "ERROR: " << state.pc << ": '" << op << "': expected Expression as first argument!\n" << std::endl;
+    log << "ERROR: " << state.pc << ": '" << op << "': expected Expression as first argument!\n" << std::endl;
     return -1;
   }
-  Node *s2 = stack[stack.size()-2].get();
+  Node *s2 = stack[stack.size()-2];
   if (s2->type != ND::Expr) {
-    std::cout << "ERROR: " << state.pc << ": '" << op << "': expected Expression as second argument!\n" << std::endl;
+    log << "ERROR: " << state.pc << ": '" << op << "': expected Expression as second argument!\n" << std::endl;
     return -1;
   }
-  PC pcf = s2->pc_first;
-  std::string text {
-    (precedence < s2->arg ? "(" : "") + s2->ToString()
-    + (precedence < s2->arg ? ")" : "")
-    + " " + op + " "
-    + (precedence < s1->arg ? "(" : "") + s1->ToString()
-    + (precedence < s1->arg ? ")" : "") };
+  auto node = arena.make<NodeBinaryOp>(s2->pc_first, state.pc, precedence, op, stack[stack.size()-2], stack[stack.size()-1]);
   stack.pop_back();
   stack.pop_back();
-  stack.push_back( std::make_shared<Node>( ND::Expr, pcf, state.pc, precedence, text) );
+  stack.push_back(node);
   return 1;
 }
 
@@ -247,562 +255,576 @@ int Decompiler::DoAdd() { return DoInfixOperator("+", 6); }
 int Decompiler::DoSubtract() { return DoInfixOperator("-", 6); }
 int Decompiler::DoMultiply() { return DoInfixOperator("*", 5); }
 int Decompiler::DoDivide() { return DoInfixOperator("/", 5); }
-// TODO: div mod << >>
-//   a div b
+int Decompiler::DoDiv() { return DoInfixOperator("div", 5); }
+// TODO: mod << >>
 //   mod(a, b)  // expr; expr; lit; call #2
 //   `<<(a, b)  // expr; expr; lit; call #2
 // unary operators
 // TODO: `-` not
 //    '-' -> negate(a);
 //    'not' -> expr; not;
-// string operators
-// TODO: & &&
-//    & -> expr; expr; lit:'array; make_array #2; stringer
-//    & &-> expr; lit " "; expr; lit 'array; make_array #3; stringer
 // `exists` operator
 //    -> HasVar(a);
 
+/**
+ Handle instructions that the compiler generates for calls to some global
+ functions, like 'Length(obj)'.
+ \param[in] name name of the global function
+ \param[in] num_args number of arguments on the stack
+ 
+eturn number of bytecodes consumed
+ */
+int Decompiler::DoBuiltin(const char *name, int num_args) {
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, num_args))
+    return -1;
+  auto fn = arena.make<Node>(ND::Expr, state.pc, state.pc, 0, name);
+  stack.push_back( arena.make<NodeCall>(args.front()->pc_first, state.pc, false, fn, std::move(args)) );
+  return 1;
+}
 
-int Decompiler::DoReturn() {
-  auto expr = stack.back();
-  // Handle the 'return' command at the end of the function.
-  if (instructions[state.pc+1].bc == BC::EndOfFile) {
-    // The compiler added a 'return' even though it was not needed. Don't output anything
-    if (expr->type != ND::Expr) {
-      return 1;
-    }
-    // The compiler added a 'return NIL'. This is the default if there is no
-    // return command, so don't write anything.
-    if ((state.pc > 0) && (instructions[state.pc-1].bc == BC::PushConst) && (instructions[state.pc-1].arg == 2)) {
-      stack.pop_back();
-      return 1;
-    }
-  } else {
-    // We are not at the end of the function, so check if we can generate the 'return'.
-    if (expr->type != ND::Expr) {
-      std::cout << "ERROR: " << state.pc << ": 'return': expected Expression as first argument!\n" << std::endl;
-      return -1;
-    }
+// global functions
+int Decompiler::DoBitAnd() { return DoBuiltin("BAnd", 2); }
+int Decompiler::DoBitOr() { return DoBuiltin("BOr", 2); }
+int Decompiler::DoBitNot() { return DoBuiltin("BNot", 1); }
+int Decompiler::DoLength() { return DoBuiltin("Length", 1); }
+int Decompiler::DoClone() { return DoBuiltin("Clone", 1); }
+int Decompiler::DoSetClass() { return DoBuiltin("SetClass", 2); }
+int Decompiler::DoAddArraySlot() { return DoBuiltin("AddArraySlot", 2); }
+int Decompiler::DoClassOf() { return DoBuiltin("ClassOf", 1); }
+
+/**
+ Get the source code of a path literal, which is a symbol or a 'pathExpr
+ array of symbols.
+ \param[in] node the literal
+ \param[out] name the path, like "a" or "a.b"
+ 
+eturn false if the node is not a constant path
+ */
+static bool PathName(NodeRef node, std::string &name)
+{
+  auto imm = dynamic_cast<NodeImmediate*>(node);
+  if (!imm) return false;
+  Ref path = imm->value();
+  if (path.IsSymbol()) {
+    name = static_cast<Symbol*>(path.GetObject())->Name();
+    return true;
   }
-  PC pcf = expr->pc_first;
-  stack.pop_back();
-  stack.push_back( std::make_shared<Node>(ND::Statement, pcf, state.pc, 0, "return " + expr->ToString()) );
+  if (!path.IsArray() || (SymbolCompare(path.GetObject()->GetClass(), Sym("pathExpr")) != 0))
+    return false;
+  name.clear();
+  Index n = static_cast<Array*>(path.GetObject())->Length();
+  for (Index i=0; i<n; ++i) {
+    Ref sym = GetArraySlot(path, i);
+    if (!sym.IsSymbol()) return false;
+    if (i) name += '.';
+    name += static_cast<Symbol*>(sym.GetObject())->Name();
+  }
+  return n > 0;
+}
+
+/**
+ Check if a node is the string literal " " that the compiler inserts for '&&'.
+ */
+static bool IsSpaceString(NodeRef node)
+{
+  auto imm = dynamic_cast<NodeImmediate*>(node);
+  if (!imm || !imm->value().IsBinary()) return false;
+  Ref str = imm->value();
+  Ref cls = str.GetObject()->GetClass();
+  return cls.IsSymbol() && (SymbolCompare(cls, gSymString) == 0)
+      && (::strcmp((const char*)BinaryData(str), " ") == 0);
+}
+
+/**
+ Handle 'obj.path' and 'obj.path := value'.
+ \param[in] has_value the value of an assignment is on top of the stack
+ \param[in] keep_value the assignment leaves its value on the stack
+ 
+eturn number of bytecodes consumed
+ */
+int Decompiler::DoPathAccess(bool has_value, bool keep_value) {
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, has_value ? 3 : 2))
+    return -1;
+  std::string name;
+  if (!PathName(args[1], name)) name.clear();
+  auto node = arena.make<NodeAccess>(args[0]->pc_first, state.pc, false, name, args[0], args[1], has_value ? args[2] : nullptr);
+  if (has_value && !keep_value) node->type = ND::Statement;
+  stack.push_back(node);
+  return 1;
+}
+
+int Decompiler::DoGetPath() { return DoPathAccess(false, false); }
+int Decompiler::DoGetPathCheck() { return DoPathAccess(false, false); }
+int Decompiler::DoSetPath() { return DoPathAccess(true, state.bytecode.arg != 0); }
+int Decompiler::DoSetPathVal() { return DoPathAccess(true, true); }
+
+/**
+ Handle 'obj.path exists'.
+ */
+int Decompiler::DoHasPath() {
+  if (DoPathAccess(false, false) < 0)
+    return -1;
+  auto path = stack.back();
+  stack.back() = arena.make<NodeUnaryOp>(path->pc_first, state.pc, 8, "exists", path, true);
   return 1;
 }
 
 /**
- Called by DoLabel, check if this is the end of an 'and' operation.
- \param[inout] state the current state of the decompiler
- \return 1 if this was an 'and' operation, 0 if not
+ Handle the array read access 'array[index]'.
  */
-int Decompiler::CheckLogicAnd() {
-  if (stack.size()<6) // not really needed, but makes the code faster
-    return 0;
-  size_t n = stack.size();
-  if (   ((stack[n-1]->type == ND::Expr) && (stack[n-1]->info == 1)) // 'push_const nil'
-      && ((stack[n-2]->type == ND::BranchFwd) && ((PC)stack[n-2]->arg == state.pc))
-      && (stack[n-3]->type == ND::Expr)
-      && ((stack[n-4]->type == ND::BranchFalseFwd) && ((PC)stack[n-4]->arg == stack[n-1]->pc_first))
-      && (stack[n-5]->type == ND::Expr) )
-  {
-    int precedence = 11;
-    std::string text =
-        (precedence < stack[n-5]->arg ? "(" : "") + stack[n-5]->ToString()
-      + (precedence < stack[n-5]->arg ? ")" : "")
-      + " and "
-      + (precedence < stack[n-3]->arg ? "(" : "") + stack[n-3]->ToString()
-      + (precedence < stack[n-3]->arg ? ")" : "");
-    PC pcf = stack[n-5]->pc_first;
-    for (int i=5; i>0; --i) stack.pop_back();
-    stack.push_back( std::make_shared<Node>(ND::Expr, pcf, state.pc, 11, text) );
-    return 1;
-  } else {
-    return 0;
+int Decompiler::DoARef() {
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, 2))
+    return -1;
+  stack.push_back( arena.make<NodeAccess>(args[0]->pc_first, state.pc, true, "", args[0], args[1]) );
+  return 1;
+}
+
+/**
+ Handle the array write access 'array[index] := value', which leaves the
+ value on the stack.
+ */
+int Decompiler::DoSetARef() {
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, 3))
+    return -1;
+  stack.push_back( arena.make<NodeAccess>(args[0]->pc_first, state.pc, true, "", args[0], args[1], args[2]) );
+  return 1;
+}
+
+/**
+ Build a frame literal. The map of the frame is a literal array that holds
+ the slot names after its first element.
+ */
+int Decompiler::DoMakeFrame() {
+  NodeRef map = ExprAt(stack.size()-1);
+  if (!map) {
+    log << "ERROR: " << state.pc << ": 'make_frame': expected frame map on stack!\n" << std::endl;
+    return -1;
+  }
+  stack.pop_back();
+  std::vector<NodeRef> values { };
+  if (!DoArgList(values, state.bytecode.arg))
+    return -1;
+  auto imm = dynamic_cast<NodeImmediate*>(map);
+  Ref map_ref = imm ? imm->value() : RefNIL;
+  std::vector<std::string> tags { };
+  for (int i=0; i<state.bytecode.arg; ++i) {
+    Ref tag = GetArraySlot(map_ref, i+1);
+    if (tag.IsSymbol())
+      tags.push_back(static_cast<Symbol*>(tag.GetObject())->Name());
+    else
+      tags.push_back("slot_" + std::to_string(i));
   }
+  PC first_pc = values.empty() ? map->pc_first : values.front()->pc_first;
+  stack.push_back( arena.make<NodeFrame>(first_pc, state.pc, std::move(tags), std::move(values)) );
+  return 1;
 }
 
 /**
- Called by DoLabel, check if this is the end of an 'or' operation.
- \param[inout] state the current state of the decompiler
- \return 1 if this was an 'and' operation, 0 if not
+ Build an array literal, or 'Array(size, nil)' if the size is on the stack.
  */
-int Decompiler::CheckLogicOr() {
-  if (stack.size()<6) // not really needed, but makes the code faster
-    return 0;
-  size_t n = stack.size();
-  if (   ((stack[n-1]->type == ND::Expr) && (stack[n-1]->info == 2)) // 'push_const true'
-      && ((stack[n-2]->type == ND::BranchFwd) && ((PC)stack[n-2]->arg == state.pc))
-      && (stack[n-3]->type == ND::Expr)
-      && ((stack[n-4]->type == ND::BranchTrueFwd) && ((PC)stack[n-4]->arg == stack[n-1]->pc_first))
-      && (stack[n-5]->type == ND::Expr) )
-  {
-    int precedence = 11;
-    std::string text =
-        (precedence < stack[n-5]->arg ? "(" : "") + stack[n-5]->ToString()
-      + (precedence < stack[n-5]->arg ? ")" : "")
-      + " or "
-      + (precedence < stack[n-3]->arg ? "(" : "") + stack[n-3]->ToString()
-      + (precedence < stack[n-3]->arg ? ")" : "");
-    PC pcf = stack[n-5]->pc_first;
-    for (int i=5; i>0; --i) stack.pop_back();
-    stack.push_back( std::make_shared<Node>(ND::Expr, pcf, state.pc, 11, text) );
+int Decompiler::DoMakeArray() {
+  NodeRef cls = ExprAt(stack.size()-1);
+  if (!cls) {
+    log << "ERROR: " << state.pc << ": 'make_array': expected class on stack!\n" << std::endl;
+    return -1;
+  }
+  stack.pop_back();
+  std::string cls_name;
+  if (!PathName(cls, cls_name))
+    cls_name = cls->ToString();
+  if (cls_name == "array")
+    cls_name.clear();
+  if (state.bytecode.arg == -1) {
+    auto nil = arena.make<NodeImmediate>(ND::Expr, state.pc, state.pc, 0, "imm_2", 1, RefNIL);
+    stack.push_back(nil);
+    if (DoBuiltin("Array", 2) < 0)
+      return -1;
+    if (!cls_name.empty()) {
+      stack.push_back(cls);
+      return DoBuiltin("SetClass", 2);
+    }
     return 1;
-  } else {
-    return 0;
   }
+  std::vector<NodeRef> elements { };
+  if (!DoArgList(elements, state.bytecode.arg))
+    return -1;
+  PC first_pc = elements.empty() ? cls->pc_first : elements.front()->pc_first;
+  stack.push_back( arena.make<NodeArray>(first_pc, state.pc, cls_name, std::move(elements)) );
+  return 1;
 }
 
-/**
- Test if the nodes on the stack form an 'if...then...' flow statement.
+int Decompiler::DoFillArray() { return DoMakeArray(); }
 
- An 'if...then...' flow control statement has the footprint:
- \code
-    expr
-    branch_if_false_fwd a
-    [statement]*
- label a
- \endcode
+/**
+ Handle the string operators '&' and '&&'. The compiler puts all operands
+ of a chain of string operators into an array, and '&&' adds a " " between
+ its operands.
+ */
+int Decompiler::DoStringer() {
+  auto array = dynamic_cast<NodeArray*>(stack.back());
+  if (!array || !array->text.empty() || (array->elements().size() < 2))
+    return DoBuiltin("Stringer", 1);
+  const auto &e = array->elements();
+  NodeRef node = e[0];
+  for (size_t i=1; i<e.size(); ++i) {
+    if ((i+1 < e.size()) && IsSpaceString(e[i])) {
+      node = arena.make<NodeBinaryOp>(array->pc_first, state.pc, 7, "&&", node, e[i+1]);
+      ++i;
+    } else {
+      node = arena.make<NodeBinaryOp>(array->pc_first, state.pc, 7, "&", node, e[i]);
+    }
+  }
+  stack.back() = node;
+  return 1;
+}
 
- This method is called when a label is encountered.
+/**
+ Handle 'incr_var' outside of a 'for' loop that the Structurizer found.
+ The addend stays on the stack, and the new value of the variable is pushed.
  */
-int Decompiler::CheckIfThen()
-{
-  // -- Check if this is an 'if...then...' statement:
-  size_t si = stack.size()-1; // current stack index
-  PC label_a = state.pc;
-  // The first entry must be a statement.
-  if (stack[si]->type != ND::Statement) return 0;
-  PC pcl = stack[si]->pc_last;
-  PC stat_first = si;
-  --si;
-  // Skip zero or more statements.
-  while (stack[si]->type == ND::Statement) --si;
-  // So this is where label a is in the bytecode array.
-  PC stat_last = si+1;
-  // The initial 'if' statement must be a conditional jump to label a:
-  if ((stack[si]->type != ND::BranchFalseFwd) || ((PC)stack[si]->arg != label_a)) return 0;
-  --si;
-  // And we need an expression to feed the conditional jump
-  if (stack[si]->type != ND::Expr) return 0;
-  PC condition_pc = si;
-  PC pcf = stack[si]->pc_first;
-
-  // -- Create a node on the stack, using all the information from above:
-  auto node = std::make_shared<NodeControlFlow>(ND::Statement, pcf, pcl, 0, "if ... then ...; ", 0);
-  node->set_condition(stack[condition_pc]);
-  for (PC i=stat_last; i<=stat_first; ++i)
-    node->add_statement_a(stack[i]);
-  // Replace nodes on the stack that make up the new if...then...else... node
-  while (stack.size()>condition_pc) stack.pop_back();
+int Decompiler::DoIncrVar() {
+  NodeRef addend = ExprAt(stack.size()-1);
+  if (!addend) {
+    log << "ERROR: " << state.pc << ": 'incr_var': expected expression on stack!\n" << std::endl;
+    return -1;
+  }
+  std::string name = LocalName(state.bytecode.arg);
+  auto var = arena.make<Node>(ND::Expr, state.pc, state.pc, 0, name);
+  auto sum = arena.make<NodeBinaryOp>(addend->pc_first, state.pc, 6, "+", var, addend);
+  auto node = arena.make<NodeAssign>(addend->pc_first, state.pc, name, sum);
+  node->type = ND::Expr;
   stack.push_back(node);
   return 1;
 }
 
 /**
- Test if the nodes on the stack form an 'if...then...else...' flow statement.
-
- An 'if...then...else...' flow control statement has the footprint:
- \code
-    expr
-    branch_if_false_fwd a
-    [statement]*
-    branch_fwd b
- label a
-    [statement]*
- label b
- \endcode
-
- This method is called when a label is encountered, but can only be successful
- if called from label b.
-
- \note CheckIfThenElse and CheckIfThenElseExpr are very similar. Try to bake
-    this into a single method.
+ Handle 'branch_loop' outside of a 'for' loop that the Structurizer found.
  */
-int Decompiler::CheckIfThenElse()
-{
-  // -- Check if this is an 'if...then...else...' statement:
-  size_t si = stack.size()-1; // current stack index
-  PC label_b = state.pc;
-  // The first entry must be a statement.
-  if (stack[si]->type != ND::Statement) return 0;
-  PC pcl = stack[si]->pc_last;
-  PC stat_b_first = si;
-  --si;
-  // Skip zero or more statements.
-  while (stack[si]->type == ND::Statement) --si;
-  // So this is where label a is in the bytecode array.
-  PC label_a = stack[si+1]->pc_first;
-  PC stat_b_last = si+1;
-  // The next command must be a forward jump to the current pc:
-  if ((stack[si]->type != ND::BranchFwd) || ((PC)stack[si]->arg != label_b)) return 0;
-  --si;
-  // The first half of the 'if' code must again be a statement:
-  if (stack[si]->type != ND::Statement) return 0;
-  PC stat_a_first = si;
-  --si;
-  // again, skip zero or more statements.
-  while (stack[si]->type == ND::Statement) --si;
-  PC stat_a_last = si+1;
-  // The initial 'if' statement must be a conditional jump to label a:
-  if ((stack[si]->type != ND::BranchFalseFwd) || ((PC)stack[si]->arg != label_a)) return 0;
-  --si;
-  // And we need an expression to feed the conditional jump
-  if (stack[si]->type != ND::Expr) return 0;
-  PC condition_pc = si;
-  PC pcf = stack[si]->pc_first;
-
-  // -- Create a node on the stack, using all the information from above:
-  auto node = std::make_shared<NodeControlFlow>(ND::Statement, pcf, pcl, 0, "if ... then ... else ...; ", 0);
-  node->set_condition(stack[condition_pc]);
-  for (PC i=stat_a_last; i<=stat_a_first; ++i)
-    node->add_statement_a(stack[i]);
-  for (PC i=stat_b_last; i<=stat_b_first; ++i)
-    node->add_statement_b(stack[i]);
-  // Replace nodes on the stack that make up the new if...then...else... node
-  while (stack.size()>condition_pc) stack.pop_back();
-  stack.push_back(node);
+int Decompiler::DoBranchLoop() {
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, 3))
+    return -1;
+  stack.push_back( arena.make<Node>(ND::BranchBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchBack") );
+  return 1;
+}
+
+// Iterators outside of a 'foreach' loop that the Structurizer found.
+int Decompiler::DoNewIter() { return DoBuiltin("NewIter", 2); }
+int Decompiler::DoIterDone() { return DoBuiltin("IterDone", 1); }
+
+int Decompiler::DoIterNext() {
+  if (DoBuiltin("IterNext", 1) < 0)
+    return -1;
+  stack.back()->type = ND::Statement;
   return 1;
 }
 
 /**
- Test if the nodes on the stack form an 'if...then...else...' flow and return a value.
-
- An 'if' statement can stand by itself as a flow control statement, or it
- can be used as an expression, similar to the C++ "?:" operator.
-
- If it is used as an expressions, the entire 'if...then...else...' will
- resolve into a single value on the stack and the 'else' branch is always
- implemented. If none was defined, the bytecode generates one that pushes 'nil'
- onto the stack.
- \code
-    expr
-    branch_if_false_fwd a
-    [statement]*
-    expr
-    branch_fwd b
- label a
-    [statement]*
-    expr
- label b
- \endcode
-
- This method is called when a label is encountered, but can only be successful
- if called from label b.
+ Handle 'new_handler' outside of a 'try' block that the Structurizer found.
+ The symbols and handler addresses are removed, and the unstructured
+ exception handler is marked on the stack.
  */
-int Decompiler::CheckIfThenElseExpr()
-{
-  // -- Check if this is an 'if...then...else...expr':
-  size_t si = stack.size()-1; // current stack index
-  PC label_b = state.pc;
-  // The first entry must be an expression.
-  if (stack[si]->type != ND::Expr) return 0;
-  PC pcl = stack[si]->pc_last;
-  PC stat_b_first = si;
-  --si;
-  // Skip zero or more statements.
-  while (stack[si]->type == ND::Statement) --si;
-  // So this is where label a is in the bytecode array.
-  PC label_a = stack[si+1]->pc_first;
-  PC stat_b_last = si+1;
-  // The next command must be a forward jump to the current pc:
-  if ((stack[si]->type != ND::BranchFwd) || ((PC)stack[si]->arg != label_b)) return 0;
-  --si;
-  // The first half of the 'if' code must generate a value:
-  if (stack[si]->type != ND::Expr) return 0;
-  PC stat_a_first = si;
-  --si;
-  // again, skip zero or more statements.
-  while (stack[si]->type == ND::Statement) --si;
-  PC stat_a_last = si+1;
-  // The initial 'if' statement must be a conditional jump to label a:
-  if ((stack[si]->type != ND::BranchFalseFwd) || ((PC)stack[si]->arg != label_a)) return 0;
-  --si;
-  // And we need an expression to feed the conditional jump
-  if (stack[si]->type != ND::Expr) return 0;
-  PC condition_pc = si;
-  PC pcf = stack[si]->pc_first;
-
-  // -- Create a node on the stack, using all the information from above:
-  auto node = std::make_shared<NodeControlFlow>(ND::Expr, pcf, pcl, 0, "if ... then ... else ...; ", 0);
-  node->set_condition(stack[condition_pc]);
-  for (PC i=stat_a_last; i<=stat_a_first; ++i)
-    node->add_statement_a(stack[i]);
-  // TODO: the last statement and the expr in the block may correlate, e.g.: "lit_4:=4; lit_4;"
-  // TODO: the second statement here should not appear in the source code!
-  for (PC i=stat_b_last; i<=stat_b_first; ++i)
-    node->add_statement_b(stack[i]);
-  // Replace nodes on the stack that make up the new if...then...else... node
-  while (stack.size()>condition_pc) stack.pop_back();
-  stack.push_back(node);
+int Decompiler::DoNewHandler() {
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, 2*state.bytecode.arg))
+    return -1;
+  stack.push_back( arena.make<Node>(ND::Unknown, state.pc, state.pc, state.bytecode.arg, "new_handler") );
+  return 1;
+}
+
+int Decompiler::DoPopHandlers() {
+  (void)state;
   return 1;
 }
 
 /**
- \code
-    branch_fwd a
- label b:
-    [statements]*
- label a:
-    expr
-    branch_if_true_back b
-    push_const nil  <--- note: `while-do` is an expr!
- \endcode
- \note The code changes substantially if there is a 'break' statement
- TODO: Like with 'if', the code generated differs if the result of the 'while' loop is used.
- 'while' pushes 'NIL' on the stack if it is used as an expression. If 'break'
- is called, the argument to 'break' is pushed.
+ A function that is declared inside this function gets its lexical scope
+ at run time. The source code is the function literal itself.
  */
-int Decompiler::CheckWhileDo() {
-  // This is called with branch_true_back pending before added to the stack
-  size_t si = stack.size()-1; // current stack index
-  // The first entry must be an expression.
-  if (stack[si]->type != ND::Expr) return 0;
-  PC condition_pc = si;
-  PC label_a = stack[si]->pc_first;
-  --si;
-  // Check for one expression
-  // TODO: example code has nonsensical "find_var;pop;" here.
-  if (stack[si]->type != ND::Statement) return 0;
-  PC stat_first = si;
-  --si;
-  // Check for more expressions
-  while (stack[si]->type == ND::Statement) --si;
-  PC stat_last = si+1;
-  // Now check if our current branch_true_back jumps to label b
-  PC label_b = stack[si+1]->pc_first;
-  if ((PC)instructions[state.pc].arg != label_b) return 0;
-  // Finally, check for the branch forward to label a:
-  if (stack[si]->type != ND::BranchFwd) return 0;
-  if ((PC)stack[si]->arg != label_a) return 0;
-  PC crop_pc = si;
-  PC pcf = stack[si]->pc_first;
-
-  // -- Create a node on the stack, using all the information from above:
-  auto node = std::make_shared<NodeControlFlow>(ND::Statement, pcf, state.pc+1, 0, "while ... do ...; ", 1);
-  node->set_condition(stack[condition_pc]);
-  for (PC i=stat_last; i<=stat_first; ++i)
-    node->add_statement_a(stack[i]);
-  while (stack.size()>crop_pc) stack.pop_back();
+int Decompiler::DoSetLexScope() {
+  if (!ExprAt(stack.size()-1)) {
+    log << "ERROR: " << state.pc << ": 'set_lex_scope': expected function on stack!\n" << std::endl;
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ The compiler does not emit 'dup', but the expression can still be used twice.
+ */
+int Decompiler::DoDup() {
+  NodeRef node = ExprAt(stack.size()-1);
+  if (!node) {
+    log << "ERROR: " << state.pc << ": 'dup': expected expression on stack!\n" << std::endl;
+    return -1;
+  }
   stack.push_back(node);
   return 1;
 }
 
+
+int Decompiler::DoReturn() {
+  auto expr = stack.back();
+  // Handle the 'return' command at the end of the function.
+  if (instructions[state.pc+1].bc == BC::EndOfFile) {
+    // The compiler added a 'return' even though it was not needed. Don't output anything
+    if (expr->type != ND::Expr) {
+      return 1;
+    }
+    // The compiler added a 'return NIL'. This is the default if there is no
+    // return command, so don't write anything.
+    if (IsConst(expr, 1)) {
+      stack.pop_back();
+      return 1;
+    }
+  } else {
+    // We are not at the end of the function, so check if we can generate the 'return'.
+    if (expr->type != ND::Expr) {
+      log << "ERROR: " << state.pc << ": 'return': expected Expression as first argument!\n" << std::endl;
+      return -1;
+    }
+  }
+  stack.pop_back();
+  stack.push_back( arena.make<NodeReturn>(expr->pc_first, state.pc, expr) );
+  return 1;
+}
+
 /**
- \code
-    branch_fwd a
- label b:
-    [statements]*
-    push_const nil; branch fwd c
-    [statements]*
- label a:
-    expr
-    branch_if_true_back b
-    push_const nil;   <--- note: `while-do` is an expr!
- label c:
- \endcode
- \note The code changes substantially if there is a 'break' statement
+ Return the expression at a given stack index.
+ \return the node, or nullptr if there is no expression at that index
  */
-int Decompiler::CheckWhileBreakDo() {
-  (void)state;
-  return 0;
+NodeRef Decompiler::ExprAt(size_t ix) {
+  if ((ix >= stack.size()) || (stack[ix]->type != ND::Expr))
+    return nullptr;
+  return stack[ix];
 }
 
 /**
- \code
- label a
-    [statement]*
-    expr
-    branch_if_false_back a
- \endcode
+ Copy a range of nodes from the stack into a block of statements.
+ \param[out] block the statements
+ \param[in] first stack index of the first statement
+ \param[in] last stack index after the last statement
+ \return false if the range is not valid or contains nodes that are not
+    statements or expressions
  */
-int Decompiler::CheckRepeatUntil() {
-  (void)state;
-  return 0;
+bool Decompiler::TakeBlock(std::vector<NodeRef> &block, size_t first, size_t last) {
+  if ((first > last) || (last > stack.size()))
+    return false;
+  for (size_t i=first; i<last; ++i) {
+    if ((stack[i]->type != ND::Statement) && (stack[i]->type != ND::Expr))
+      return false;
+  }
+  block.assign(stack.begin()+first, stack.begin()+last);
+  return true;
 }
 
 /**
- \code
- label a
-    [statement]*
-    push_const nil; branch fwd b
-    (pop)               <--- note: the 'break' would be inside an 'if' statement which itself is an expr
-    [statement]*
-    expr
-    branch_if_false_back a
-    push_cont nil       <--- note: `while-do` is an expr!
- label b
- \endcode
+ Replace the nodes of a control flow statement with a single node.
+
+ This is called when decoding reaches the end of a construct that was found
+ by the Structurizer. All nodes inside the construct are already on the
+ stack, and depth[] tells us where each part of the construct begins.
+
+ \param[in] c the construct
+ \return false if the nodes on the stack don't match the construct
  */
-int Decompiler::CheckRepeatBreakUntil() {
-  (void)state;
-  return 0;
+bool Decompiler::Reduce(const Construct &c) {
+  switch (c.kind) {
+    case CK::IfThen:
+    case CK::IfThenElse: return ReduceIf(c);
+    case CK::While:
+    case CK::Repeat:
+    case CK::Loop: return ReduceLoop(c);
+    case CK::For: return ReduceFor(c);
+    case CK::Foreach: return ReduceForeach(c);
+    case CK::Try: return ReduceTry(c);
+  }
+  return false;
 }
 
 /**
- \code
- label a
-    [statement]*
-    push_const nil; branch fwd b
-    (pop)               <--- note: the 'break' would be inside an 'if' statement which itself is an expr
-    [statement]*
-    branch_back a
- label b
- \endcode
+ Build 'if ... then ...', 'if ... then ... else ...', 'and', and 'or'.
+
+ 'and' and 'or' are generated as an 'if' expression that returns nil or
+ true when the first expression already decides the result.
  */
-int Decompiler::CheckEndlessLoop() {
-  (void)state;
-  return 0;
+bool Decompiler::ReduceIf(const Construct &c) {
+  size_t cond_ix = depth[c.test] - 1;
+  NodeRef cond = ExprAt(cond_ix);
+  if (!cond) return false;
+  std::vector<NodeRef> a { }, b { };
+  if (c.kind == CK::IfThenElse) {
+    if (!TakeBlock(a, depth[c.body], depth[c.other-1])) return false;
+    if (!TakeBlock(b, depth[c.other], stack.size())) return false;
+  } else {
+    if (!TakeBlock(a, depth[c.body], stack.size())) return false;
+  }
+  NodeRef node;
+  if (   (a.size() == 1) && (a[0]->type == ND::Expr)
+      && (b.size() == 1) && IsConst(b[0], c.negate ? 2 : 1) )
+  {
+    node = arena.make<NodeBinaryOp>(cond->pc_first, c.end-1, 11, c.negate ? "or" : "and", cond, a[0]);
+  } else {
+    bool is_expr = !a.empty() && (a.back()->type == ND::Expr)
+                && !b.empty() && (b.back()->type == ND::Expr);
+    if (c.negate)
+      cond = arena.make<NodeUnaryOp>(cond->pc_first, cond->pc_last, 10, "not", cond);
+    auto cf = arena.make<NodeControlFlow>(is_expr ? ND::Expr : ND::Statement, cond->pc_first, c.end-1, 0, "if ... then ...; ", 0);
+    cf->set_condition(cond);
+    for (auto &n: a) cf->add_statement_a(n);
+    for (auto &n: b) cf->add_statement_b(n);
+    node = cf;
+  }
+  stack.resize(cond_ix);
+  stack.push_back(node);
+  return true;
 }
 
 /**
- \code
-    expr
-    set_var local_3
-    expr
-    set_var local_4
-    expr
-    set_var local_5
-    get_var local_5
-    get_var local_3
-    branch_fwd a
- label b
-    [statment]*
-    get_var local_5
-    incr_var loc_3
- label a
-    get_var local_4
-    branch_loop b
- \endcode
+ Build 'while ... do ...', 'repeat ... until ...', and 'loop ...'.
  */
-int Decompiler::CheckForLoop() {
-  (void)state;
-  return 0;
+bool Decompiler::ReduceLoop(const Construct &c) {
+  std::vector<NodeRef> body { };
+  NodeRef cond { };
+  int info = 0;
+  switch (c.kind) {
+    case CK::While:
+      info = 1;
+      cond = ExprAt(depth[c.test] - 1);
+      if (!cond || (depth[c.test] - 1 != depth[c.body_end])) return false;
+      if (!TakeBlock(body, depth[c.body], depth[c.body_end])) return false;
+      break;
+    case CK::Repeat:
+      info = 2;
+      cond = ExprAt(depth[c.test] - 1);
+      if (!cond || !TakeBlock(body, depth[c.body], depth[c.test] - 1)) return false;
+      break;
+    default:
+      info = 3;
+      if (!TakeBlock(body, depth[c.body], depth[c.test])) return false;
+      break;
+  }
+  auto node = arena.make<NodeControlFlow>(c.value ? ND::Expr : ND::Statement, c.begin, c.end-1, 0, "loop ...; ", info);
+  if (cond) node->set_condition(cond);
+  for (auto &n: body) node->add_statement_a(n);
+  stack.resize(depth[c.begin]);
+  stack.push_back(node);
+  return true;
 }
 
 /**
- \code
- foreach a in b do ...
-  0:     find_var lit_0
-  1:     push_const imm_2
-  2:     new_iter
-  3:     set_var local_4
-  4:     branch pc=15
-  5: label[1]:
-  5:     get_var local_4
-  6:     push_const imm_4
-  7:     aref
-  8:     set_var local_3
-  *:     [statment]*
- 13:     get_var local_4
- 14:     iter_next
- 15: label[1]:
- 15:     get_var local_4
- 16:     iter_done
- 17:     branch_if_false pc=5
- 18:     push_const imm_2
- 19:     push_const imm_2
- 20:     set_var local_4
- \endcode
- \note foreach [slot,] value [deeply] in {frame | array} {collect | do} expression
+ Build 'for index := from to limit by incr do ...'.
+ The three assignments to the hidden loop variables are right below the
+ construct on the stack.
  */
-int Decompiler::CheckForeach() {
-  (void)state;
-  return 0;
+bool Decompiler::ReduceFor(const Construct &c) {
+  size_t base = depth[c.begin];
+  if (base < 4) return false;
+  auto index = dynamic_cast<NodeAssign*>(stack[base-3]);
+  auto limit = dynamic_cast<NodeAssign*>(stack[base-2]);
+  auto incr = dynamic_cast<NodeAssign*>(stack[base-1]);
+  if (   !index || (index->text != LocalName(c.var[0]))
+      || !limit || (limit->text != LocalName(c.var[1]))
+      || !incr || (incr->text != LocalName(c.var[2])) )
+    return false;
+  std::vector<NodeRef> body { };
+  if (!TakeBlock(body, depth[c.body], depth[c.body_end])) return false;
+  NodeRef by = incr->value();
+  auto imm = dynamic_cast<NodeImmediate*>(by);
+  if (imm && imm->value().IsInt() && (imm->value().GetInt() == 1))
+    by = nullptr;
+  auto node = arena.make<NodeFor>(c.value ? ND::Expr : ND::Statement, index->pc_first, c.end-1,
+                                  index->text, index->value(), limit->value(), by, std::move(body));
+  stack.resize(base-3);
+  stack.push_back(node);
+  return true;
 }
 
 /**
- \code
-    [push_lit symbol, push_const a[n]]*n
-    new_handler n
-    [statement]*
-    expr
-    pop_handlers
-    branch b
- [label a0
-    [statement]*
-    expr
-    branch_fwd c]
- label a0
-    [statement]*
-    expr
- label c
-    pop_handlers
- label b
-
- \endcode
+ Build 'foreach slot, value deeply in collection do ...'.
+ The collection and the 'deeply' flag are right below the construct on
+ the stack.
  */
-int Decompiler::CheckTryOnExpression() {
-  (void)state;
-  return 0;
+bool Decompiler::ReduceForeach(const Construct &c) {
+  size_t base = depth[c.begin];
+  NodeRef collection = ExprAt(base-2);
+  NodeRef deeply = ExprAt(base-1);
+  if (!collection || !deeply) return false;
+  std::vector<NodeRef> body { };
+  if (!TakeBlock(body, depth[c.body], depth[c.body_end])) return false;
+  auto node = arena.make<NodeForeach>(c.value ? ND::Expr : ND::Statement, collection->pc_first, c.end-1,
+                                      (c.var[1] < 0) ? std::string() : LocalName(c.var[1]), LocalName(c.var[0]),
+                                      IsConst(deeply, 2), collection, std::move(body));
+  stack.resize(base-2);
+  stack.push_back(node);
+  return true;
 }
 
-int Decompiler::DoLabel() {
-  // Repeat finding actions related to this label until all found.
-  int ret = 0;
-  for (;;) {
-    if (CheckLogicAnd() == 1) { ret = 1; continue; }
-    if (CheckLogicOr() == 1) { ret = 1; continue; }
-    if (CheckIfThenElseExpr() == 1) { ret = 1; continue; }
-    if (CheckIfThenElse() == 1) { ret = 1; continue; }
-    if (CheckIfThen() == 1) { ret = 1; continue; }
-    // check "while ... break ... do ... "
-    break;
+/**
+ Build 'try ... onexception |symbol| do ...'.
+ */
+bool Decompiler::ReduceTry(const Construct &c) {
+  std::vector<NodeRef> body { };
+  if (!TakeBlock(body, depth[c.body], depth[c.body_end])) return false;
+  auto node = arena.make<NodeTry>(ND::Expr, c.begin, c.end-1, std::move(body));
+  for (size_t j=0; j<c.handlers.size(); ++j) {
+    std::vector<NodeRef> handler { };
+    if (!TakeBlock(handler, depth[c.handlers[j]], depth[c.handlers_end[j]])) return false;
+    Ref sym = GetArraySlot(ns_literals, c.symbols[j]);
+    if (sym.IsSymbol())
+      node->add_handler(static_cast<Symbol*>(sym.GetObject())->Name(), std::move(handler));
+    else
+      node->add_handler("lit_" + std::to_string(c.symbols[j]), std::move(handler));
   }
-  //  if ... then ...
-  //  if ... then ... else ...
-  //  repeat ... until ...
-  //  repeat ... break ... until ...
-  //  loop ... break ...
-  //  for counter := initialValue to finalValue [by incrValue] do expression
-  //  foreach [slot,] value [deeply] in {frame | array} {collect | do} expression
-  //  try [begin] expression[s] [onException symbol do statement]* [end]
-  return ret;
+  stack.resize(depth[c.begin]);
+  stack.push_back(node);
+  return true;
 }
 
 /**
  Handle a `branch` bytecode instruction.
 
- A branch changes the the program counter to a new address. Branches can jump
- forward or back. Unconditional branches are always used in combination with
- conditional branches or within exception handling. A forward branch is used
- in 'try', 'onException', 'else', 'repeat', and 'break'. They are always
- followed by a label, so we just mark them with a node on the stack.
-
- A backward branch is created by the 'loop' statement. The loop itself will
- have one or more 'break' statements.
+ Branches that are part of a control flow statement are skipped by the
+ decoder. A branch to the end of a loop is a 'break' statement, and the value
+ of the loop is on the stack. All other branches are unstructured, so we just
+ mark them with a node on the stack.
  */
 int Decompiler::DoBranch() {
-  (void)state;
-  if ((PC)state.bytecode.arg > state.pc)
-    stack.push_back( std::make_shared<Node>(ND::BranchFwd, state.pc, state.pc, state.bytecode.arg, "ND::BranchFwd") );
-  else
-    stack.push_back( std::make_shared<Node>(ND::BranchBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchBack") );
+  if (structure.is_break[state.pc]) {
+    auto value = stack.back();
+    if (value->type != ND::Expr) {
+      log << "ERROR: " << state.pc << ": 'break': expected expression on stack!\n" << std::endl;
+      return -1;
+    }
+    stack.pop_back();
+    stack.push_back( arena.make<NodeBreak>(value->pc_first, state.pc, value) );
+  } else if ((PC)state.bytecode.arg > state.pc) {
+    stack.push_back( arena.make<Node>(ND::BranchFwd, state.pc, state.pc, state.bytecode.arg, "ND::BranchFwd") );
+  } else {
+    stack.push_back( arena.make<Node>(ND::BranchBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchBack") );
+  }
   return 1;
 }
 
 int Decompiler::DoBranchIfTrue() {
-  int ret = 0;
-  if ((PC)state.bytecode.arg > state.pc) {
-    stack.push_back( std::make_shared<Node>(ND::BranchTrueFwd, state.pc, state.pc, state.bytecode.arg, "ND::BranchTrueFwd") );
-    ret = 1;
-  } else {
-    for (;;) {
-      if (CheckWhileDo() == 1) { ret = 1; continue; }
-      break;
-    }
-    if (ret == 0) {
-      stack.push_back( std::make_shared<Node>(ND::BranchTrueBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchTrueBack") );
-    }
-  }
-  return ret;
+  (void)state;
+  if ((PC)state.bytecode.arg > state.pc)
+    stack.push_back( arena.make<Node>(ND::BranchTrueFwd, state.pc, state.pc, state.bytecode.arg, "ND::BranchTrueFwd") );
+  else
+    stack.push_back( arena.make<Node>(ND::BranchTrueBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchTrueBack") );
+  return 1;
 }
 
 int Decompiler::DoBranchIfFalse() {
   (void)state;
   if ((PC)state.bytecode.arg > state.pc)
-    stack.push_back( std::make_shared<Node>(ND::BranchFalseFwd, state.pc, state.pc, state.bytecode.arg, "ND::BranchFalseFwd") );
+    stack.push_back( arena.make<Node>(ND::BranchFalseFwd, state.pc, state.pc, state.bytecode.arg, "ND::BranchFalseFwd") );
   else
-    stack.push_back( std::make_shared<Node>(ND::BranchFalseBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchFalseBack") );
+    stack.push_back( arena.make<Node>(ND::BranchFalseBack, state.pc, state.pc, state.bytecode.arg, "ND::BranchFalseBack") );
   return 1;
 }
 
@@ -810,9 +832,12 @@ int Decompiler::DoBranchIfFalse() {
  \note check if 'pop' cancel out an expr
  */
 int Decompiler::DoPop() {
+  // The compiler emits an unreachable 'pop' after 'break'.
+  if ((state.pc > 0) && structure.is_break[state.pc-1])
+    return 1;
   auto s = stack.back();
   if (s->type != ND::Expr) {
-    std::cout << "ERROR: " << state.pc << ": 'pop': expected expression on stack!\n" << std::endl;
+    log << "ERROR: " << state.pc << ": 'pop': expected expression on stack!\n" << std::endl;
     return -1;
   }
   s->type = ND::Statement;
@@ -820,71 +845,67 @@ int Decompiler::DoPop() {
 }
 
 /**
- \return the starting PC of the top arg, or -1 if an error occurred.
+ Move the arguments of a call from the stack into a list.
+ \param[out] args the arguments, first argument first
+ \param[in] num_args number of arguments on the stack
+ \return false if an error occurred.
  */
-PC Decompiler::DoArgList(std::string &args, int num_args) {
-  PC ret = kInvalidPC;
+bool Decompiler::DoArgList(std::vector<NodeRef> &args, int num_args) {
+  if (num_args > (int)stack.size()) {
+    log << "ERROR: " << state.pc << ": expected " << num_args << " arguments on stack!\n" << std::endl;
+    return false;
+  }
   for (int i=0; i<num_args; ++i) {
-    auto arg = stack.back();
+    auto &arg = stack[stack.size()-1-i];
     if (arg->type != ND::Expr) {
-      std::cout << "ERROR: " << state.pc << ": expected argument " << i << " expr on stack!\n" << std::endl;
-      return kInvalidPC;
+      log << "ERROR: " << state.pc << ": expected argument " << i << " expr on stack!\n" << std::endl;
+      return false;
     }
-    if (i==0)
-      args = arg->ToString();
-    else
-      args = arg->ToString() + ", " + args;
-    ret = arg->pc_first;
-    stack.pop_back();
   }
-  return ret;
+  args.assign(stack.end()-num_args, stack.end());
+  stack.resize(stack.size()-num_args);
+  return true;
 }
 
-int Decompiler::DoCallOrInvoke(const std::string &call, int which) {
+int Decompiler::DoCallOrInvoke(const char *call, int which) {
   auto s = stack.back();
   if (s->type != ND::Expr) {
-    std::cout << "ERROR: " << state.pc << ": '" << call << "': expected function name on stack!\n" << std::endl;
+    log << "ERROR: " << state.pc << ": '" << call << "': expected function name on stack!\n" << std::endl;
     return -1;
   }
   stack.pop_back();
-  std::string args { };
-  PC first_pc = DoArgList(args, state.bytecode.arg);
-  if (first_pc == kInvalidPC)
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, state.bytecode.arg))
     return -1;
-  if (which == 0) // call
-    stack.push_back( std::make_shared<Node>(ND::Expr, first_pc, state.pc, 0, s->ToString() + "(" + args + ")") );
-  else // invoke
-    stack.push_back( std::make_shared<Node>(ND::Expr, first_pc, state.pc, 0, "call " + s->ToString() + " with (" + args + ")") );
+  PC first_pc = args.empty() ? s->pc_first : args.front()->pc_first;
+  stack.push_back( arena.make<NodeCall>(first_pc, state.pc, (which == 1), s, std::move(args)) );
   return 1;
 }
 
 int Decompiler::DoCall() { return DoCallOrInvoke("call", 0); }
 int Decompiler::DoInvoke() { return DoCallOrInvoke("invoke", 1); }
 
-int Decompiler::DoSend(const std::string &op, const std::string &call, bool is_resend) {
+int Decompiler::DoSend(const char *op, const char *call, bool is_resend) {
   auto name = stack.back();
   if (name->type != ND::Expr) {
-    std::cout << "ERROR: " << state.pc << ": '" << call << "': expected message name on stack!\n" << std::endl;
+    log << "ERROR: " << state.pc << ": '" << call << "': expected message name on stack!\n" << std::endl;
     return -1;
   }
   stack.pop_back();
-  auto rcvr = std::make_shared<Node>();
+  NodeRef rcvr { };
   if (!is_resend) {
     rcvr = stack.back();
     if (rcvr->type != ND::Expr) {
-      std::cout << "ERROR: " << state.pc << ": '" << call << "': expected receiver on stack!\n" << std::endl;
+      log << "ERROR: " << state.pc << ": '" << call << "': expected receiver on stack!\n" << std::endl;
       return -1;
     }
     stack.pop_back();
   }
-  std::string args { };
-  PC pcf = DoArgList(args, state.bytecode.arg);
-  if (pcf == kInvalidPC)
+  std::vector<NodeRef> args { };
+  if (!DoArgList(args, state.bytecode.arg))
     return -1;
-  if (is_resend)
-    stack.push_back( std::make_shared<Node>(ND::Expr, pcf, state.pc, 0, "inherited" + op + name->ToString() + "(" + args + ")") );
-  else
-    stack.push_back( std::make_shared<Node>(ND::Expr, pcf, state.pc, 0, rcvr->ToString() + op + name->ToString() + "(" + args + ")") );
+  PC pcf = !args.empty() ? args.front()->pc_first : (rcvr ? rcvr->pc_first : name->pc_first);
+  stack.push_back( arena.make<NodeSend>(pcf, state.pc, op, rcvr, name, std::move(args)) );
   return 1;
 }
 
@@ -895,23 +916,23 @@ int Decompiler::DoResendIfDefined() { return DoSend(":?", "resend_if_defined", t
 
 int Decompiler::DoPush() {
 #if 0
-  stack.push_back( std::make_shared<Node>(ND::Expr, state.pc, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg)) );
+  stack.push_back( arena.make<Node>(ND::Expr, state.pc, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg)) );
 #else
   // TODO: check if literal is NIL or TRUE and set 'info' accordingly
   Ref r = GetArraySlot(ns_literals, state.bytecode.arg);
-  stack.push_back( std::make_shared<NodeImmediate>(ND::Expr, state.pc, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg), 0, r) );
+  stack.push_back( arena.make<NodeImmediate>(ND::Expr, state.pc, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg), 0, r) );
 #endif
   return 1;
 }
 
 int Decompiler::DoFindVar() {
-  stack.push_back( std::make_shared<Node>(ND::Expr, state.pc, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg)) );
+  stack.push_back( arena.make<Node>(ND::Expr, state.pc, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg)) );
   return 1;
 }
 
 int Decompiler::DoPushSelf() {
   (void)state;
-  stack.push_back( std::make_shared<Node>(ND::Expr, state.pc, state.pc, 0, "self") );
+  stack.push_back( arena.make<Node>(ND::Expr, state.pc, state.pc, 0, "self") );
   return 1;
 }
 
@@ -924,15 +945,74 @@ int Decompiler::DoPushSelf() {
 int Decompiler::DoFindAndSetVar() {
   auto node = stack.back();
   if (node->type != ND::Expr) {
-    std::cout << "ERROR: " << state.pc << ": 'find_and_set_var': expected expression on stack!\n" << std::endl;
+    log << "ERROR: " << state.pc << ": 'find_and_set_var': expected expression on stack!\n" << std::endl;
     return -1;
   }
-  PC pcf = node->pc_first;
   stack.pop_back();
-  stack.push_back( std::make_shared<Node>(ND::Statement, pcf, state.pc, 0, "lit_" + std::to_string(state.bytecode.arg) + " := " + node->ToString()) );
+  stack.push_back( arena.make<NodeAssign>(node->pc_first, state.pc, "lit_" + std::to_string(state.bytecode.arg), node) );
   return 1;
 }
 
+int Decompiler::DoGetVar() {
+  stack.push_back( arena.make<Node>(ND::Expr, state.pc, state.pc, 0, LocalName(state.bytecode.arg)) );
+  return 1;
+}
+
+/**
+ Take an expression from the stack and write it into the local variable[arg].
+ \return -1 for end of func, <-1 for error, or the number of bytes consumed
+ */
+int Decompiler::DoSetVar() {
+  auto node = stack.back();
+  if (node->type != ND::Expr) {
+    log << "ERROR: " << state.pc << ": 'set_var': expected expression on stack!\n" << std::endl;
+    return -1;
+  }
+  stack.pop_back();
+  stack.push_back( arena.make<NodeAssign>(node->pc_first, state.pc, LocalName(state.bytecode.arg), node) );
+  return 1;
+}
+
+int Decompiler::DoNot() {
+  auto node = stack.back();
+  if (node->type != ND::Expr) {
+    log << "ERROR: " << state.pc << ": 'not': expected expression on stack!\n" << std::endl;
+    return -1;
+  }
+  stack.pop_back();
+  stack.push_back( arena.make<NodeUnaryOp>(node->pc_first, state.pc, 10, "not", node) );
+  return 1;
+}
+
+static const char *const kBCNames[] = {
+  "EOF",             "pop",             "dup",             "return",
+  "push_self",       "set_lex_scope",   "iter_next",       "iter_done",
+  "pop_handlers",    "push",            "push_const",      "call",
+  "invoke",          "send",            "send_if_defined", "resend",
+  "resend_if_defined", "branch",        "branch_if_true",  "branch_if_false",
+  "find_var",        "get_var",         "make_frame",      "make_array",
+  "fill_array",      "get_path",        "get_path_check",  "set_path",
+  "set_path_val",    "set_var",         "find_and_set_var", "incr_var",
+  "branch_loop",     "add",             "subtract",        "aref",
+  "set_aref",        "equals",          "not",             "not_equals",
+  "multiply",        "divide",          "div",             "less_than",
+  "greater_than",    "greater_or_equal", "less_or_equal",  "bit_and",
+  "bit_or",          "bit_not",         "new_iter",        "length",
+  "clone",           "set_class",       "add_array_slot",  "stringer",
+  "has_path",        "class_of",        "new_handler",
+  "return_const",    "return_var",      "get_var2",        "set_var_const",
+  "add_var_const",   "compare_branch",  "unknown"
+};
+static_assert(sizeof(kBCNames)/sizeof(kBCNames[0]) == (size_t)BC::Unknown + 1, "name table does not match BC");
+
+/**
+ Name of an instruction as printed by print_bytecode().
+ */
+const char *dyn::lang::bc_name(BC bc)
+{
+  return ((size_t)bc <= (size_t)BC::Unknown) ? kBCNames[(size_t)bc] : kBCNames[(size_t)BC::Unknown];
+}
+
 static void print_altcode(int ip, Bytecode &ac) {
   if (ac.references)
     std::cout << std::setw(4) << ip << ": label[refs=" << ac.references << "]:" << std::endl;
@@ -997,6 +1077,12 @@ static void print_altcode(int ip, Bytecode &ac) {
     case BC::HasPath:          std::cout << "    has_path" << std::endl; break;
     case BC::ClassOf:          std::cout << "    class_of" << std::endl; break;
     case BC::NewHandler:       std::cout << "    new_handler #exc_" << ac.arg << std::endl; break;
+    case BC::ReturnConst:      std::cout << "    return_const imm_" << ac.arg << std::endl; break;
+    case BC::ReturnVar:        std::cout << "    return_var local_" << ac.arg << std::endl; break;
+    case BC::GetVar2:          std::cout << "    get_var2 local_" << (ac.arg & 0xffff) << ", local_" << (ac.arg >> 16) << std::endl; break;
+    case BC::SetVarConst:      std::cout << "    set_var_const local_" << (ac.arg & 0xffff) << ", imm_" << (ac.arg >> 16) << std::endl; break;
+    case BC::AddVarConst:      std::cout << "    add_var_const local_" << (ac.arg & 0xffff) << ", " << (ac.arg >> 16) << std::endl; break;
+    case BC::CompareBranch:    std::cout << "    compare_branch op_" << (ac.arg >> 24) << " pc=" << (ac.arg & 0xffffff) << std::endl; break;
     default:
       std::cout << "ERROR: unknown altcode: a=" << (int)ac.bc << ", b=" << ac.arg << "." << std::endl; break;
   }
@@ -1012,11 +1098,18 @@ void dyn::lang::print_bytecode(std::vector<Bytecode> &func) {
 bool Decompiler::decode() {
   int num_altcodes_handled = 0;
   size_t i = 0;
+  structure.analyze(instructions, offsets);
+  depth.assign(instructions.size() + 1, 0);
   for ( ; i<instructions.size(); ) {
-    if (instructions[i].references) {
-      state.pc = i;
-      state.bytecode = instructions[i];
-      DoLabel();
+    for (int ix: structure.reduce_at[i]) {
+      const Construct &c = structure.constructs[ix];
+      if (!Reduce(c))
+        log << "WARNING: " << i << ": can't rebuild the control flow statement at pc " << c.begin << "." << std::endl;
+    }
+    depth[i] = stack.size();
+    if (structure.skip[i]) {
+      ++i;
+      continue;
     }
     state.pc = i;
     state.bytecode = instructions[i];
@@ -1025,38 +1118,97 @@ bool Decompiler::decode() {
     i += num_altcodes_handled;
   }
   if (num_altcodes_handled < -1) {
-    std::cout << "ERROR: can't decode bytecode at pc " << i << "." << std::endl;
+    log << "ERROR: can't decode bytecode at pc " << i << "." << std::endl;
     return false;
   }
   if (num_altcodes_handled == 0) {
-    std::cout << "ERROR: unknown bytecode found." << std::endl;
+    log << "ERROR: unknown bytecode found." << std::endl;
     return false;
   }
   return true;
 }
 
-Decompiler::Decompiler(RefArg func)
-: ns_function(func)
+Decompiler::Decompiler(RefArg func, std::ostream &a_log)
+: ns_function(func), log(a_log)
 {
   ns_literals = GetFrameSlot(func, Sym("literals"));
 }
 
-Ref dyn::lang::decompile(RefArg func)
+/**
+ Decompile a function and optionally dump the bytecode and the decoder stack.
+ \param[in] func a function frame
+ \param[in] log receives errors and warnings
+ \param[in] verbose if set, write the debug output to stdout
+ \return the source code, or NIL
+ */
+static Ref decompile_(RefArg func, std::ostream &log, bool verbose, std::vector<int> *line_of_pc = nullptr)
 {
+  tools::ScopedTimer timer(tools::Stats::kDecompile);
+  if (line_of_pc) line_of_pc->clear();
   if (!IsFrame(func)) return RefNIL;
-  Decompiler decompiler(func);
-  decompiler.instructions = transcode_from_ns(func);
+  Decompiler decompiler(func, log);
+  decompiler.instructions = transcode_from_ns(func, &decompiler.offsets);
   if (decompiler.instructions.empty())
     return RefNIL;
-  printf("--- expanded byte code\n");
-  print_bytecode(decompiler.instructions);
-  decompiler.stack.push_back( std::make_shared<Node>(ND::EndOfStack, kInvalidPC, kInvalidPC, 0, "... stack bottom ...") );
-  printf("--- decode\n");
+  // Report a broken stack up front. The decoder still tries its best, and
+  // it can print code that refers to missing literals and locals.
+  Verifier verifier;
+  verifier.check_indices = false;
+  if (!verifier.verify(decompiler.instructions, decompiler.offsets))
+    log << "WARNING: " << verifier.error_pc << ": " << verifier.error << "." << std::endl;
+  if (verbose) {
+    printf("--- expanded byte code\n");
+    print_bytecode(decompiler.instructions);
+  }
+  decompiler.stack.push_back( decompiler.arena.make<Node>(ND::EndOfStack, kInvalidPC, kInvalidPC, 0, "... stack bottom ...") );
+  if (verbose) printf("--- decode\n");
   decompiler.decode();
-  printf("--- remaining stack:\n");
-  PrintStack(decompiler.stack);
+  if (verbose) {
+    printf("--- remaining stack:\n");
+    PrintStack(decompiler.stack);
+  }
 
-//  std::cout << stack.back() << std::endl; stack.pop_back();
+  // Write the source code of all statements in a single pass.
+  std::vector<NodeRef> statements { };
+  for (auto &node: decompiler.stack) {
+    if ((node->type == ND::Statement) || (node->type == ND::Expr))
+      statements.push_back(node);
+  }
+  CodeWriter w;
+  std::vector<CodeWriter::Mark> marks;
+  if (line_of_pc)
+    w.set_marks(&marks);
+  write_statements(w, statements);
+  if (line_of_pc) {
+    // The innermost statement wins, which is the one with the fewest instructions.
+    size_t n = decompiler.instructions.size();
+    std::vector<PC> width(n, kInvalidPC);
+    line_of_pc->assign(n, 0);
+    for (const auto &m: marks) {
+      if ((m.pc_first > m.pc_last) || (m.pc_last >= n))
+        continue;
+      for (PC pc=m.pc_first; pc<=m.pc_last; ++pc) {
+        if (m.pc_last - m.pc_first < width[pc]) {
+          width[pc] = m.pc_last - m.pc_first;
+          (*line_of_pc)[pc] = m.line;
+        }
+      }
+    }
+  }
+  return MakeString(w.str());
+}
 
-  return RefNIL;
+Ref dyn::lang::decompile(RefArg func)
+{
+  return decompile_(func, std::cout, true);
+}
+
+Ref dyn::lang::decompile(RefArg func, std::ostream &log)
+{
+  return decompile_(func, log, false);
+}
+
+Ref dyn::lang::decompile(RefArg func, std::ostream &log, std::vector<int> &line_of_pc)
+{
+  return decompile_(func, log, false, &line_of_pc);
 }
@@ -0,0 +1,173 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Decompile all functions in a package on all available cores.
+
+#include <dyn/lang/decompile.h>
+#include <dyn/objects.h>
+#include <dyn/tools/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+using namespace dyn;
+
+using namespace dyn::lang;
+
+namespace {
+
+class FunctionJob {
+public:
+  size_t part { 0 };
+  std::string path { };
+  Ref func { };
+  std::string source { };
+  std::string log { };
+};
+
+} // namespace
+
+/**
+ Check if an object is a NewtonScript function with bytecode.
+ Functions have the class kPlainFuncClass, or 'CodeBlock in 1.x packages.
+ */
+static bool IsFunction(RefArg obj, RefArg sym_class, RefArg sym_instructions, RefArg sym_codeblock)
+{
+  if (!obj.IsFrame()) return false;
+  Ref cls = GetFrameSlot(obj, sym_class);
+  if (!(cls == Ref::kPlainFuncClass) && !(cls.IsSymbol() && SymbolCompare(cls, sym_codeblock)==0))
+    return false;
+  return GetFrameSlot(obj, sym_instructions).IsBinary();
+}
+
+/**
+ Find all functions in an object tree.
+ The tree is walked depth first in slot order, and every object is visited
+ once, so the order of the functions only depends on the tree.
+ \param[in] root the data of one part
+ \param[in] part index of the part
+ \param[out] jobs append one job per function
+ */
+static void FindFunctions(RefArg root, size_t part, std::vector<FunctionJob> &jobs)
+{
+  Ref sym_class = Sym("class");
+  Ref sym_instructions = Sym("instructions");
+  Ref sym_codeblock = Sym("CodeBlock");
+  std::unordered_set<const Object*> visited;
+  std::vector<std::pair<Ref, std::string>> todo { { root, "data" } };
+  while (!todo.empty()) {
+    Ref obj = todo.back().first;
+    std::string path = std::move(todo.back().second);
+    todo.pop_back();
+    if (!obj.IsPtr() || !visited.insert(obj.GetObject()).second) continue;
+    if (IsFunction(obj, sym_class, sym_instructions, sym_codeblock))
+      jobs.push_back({ part, path, obj, { }, { } });
+    size_t first = todo.size();
+    const Object *o = obj.GetObject();
+    if (o->IsFrame()) {
+      auto frame = static_cast<const Frame*>(o);
+      for (Index i=0; i<frame->Length(); ++i) {
+        Ref tag = frame->GetTag(i);
+        const char *name = tag.IsSymbol() ? static_cast<const Symbol*>(tag.GetObject())->Name() : "?";
+        todo.push_back({ frame->GetSlot(i), path + "." + name });
+      }
+    } else if (o->IsArray()) {
+      auto array = static_cast<const Array*>(o);
+      for (Index i=0; i<array->Length(); ++i)
+        todo.push_back({ array->GetSlot(i), path + "[" + std::to_string(i) + "]" });
+    }
+    // Children were pushed in slot order, but must be popped in slot order.
+    std::reverse(todo.begin() + first, todo.end());
+  }
+}
+
+/**
+ Decompile all functions in a package in parallel.
+
+ All functions in all parts are collected first, then worker threads take
+ the next function from a shared counter until none are left. The results
+ are written per part in the order in which the functions were found, so
+ the output does not depend on the number of threads.
+ */
+int dyn::lang::decompile_package(RefArg pkg, const std::string &out_dir, unsigned num_threads)
+{
+  tools::TraceSpan span("decompile_package", "decompile");
+  std::vector<FunctionJob> jobs;
+  if (!pkg.IsFrame()) return 0;
+  Ref parts = GetFrameSlot(pkg, Sym("parts"));
+  Index num_parts = parts.IsArray() ? static_cast<Array*>(parts.GetObject())->Length() : 0;
+  Ref sym_data = Sym("data");
+  for (Index i=0; i<num_parts; ++i) {
+    Ref part = GetArraySlot(parts, i);
+    if (part.IsFrame())
+      FindFunctions(GetFrameSlot(part, sym_data), (size_t)i, jobs);
+  }
+
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = (unsigned)std::min<size_t>(num_threads, std::max<size_t>(jobs.size(), 1));
+  std::atomic<size_t> next { 0 };
+  auto worker = [&jobs, &next]() {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      tools::TraceSpan fspan("decompile", "decompile");
+      fspan.arg("part", (int64_t)jobs[i].part);
+      fspan.arg("path", jobs[i].path);
+      std::ostringstream log;
+      Ref src = decompile(jobs[i].func, log);
+      if (src.IsBinary())
+        jobs[i].source = (const char*)BinaryData(src);
+      jobs[i].log = log.str();
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned i=1; i<num_threads; ++i)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &t: pool)
+    t.join();
+
+  size_t job = 0;
+  for (Index i=0; i<num_parts; ++i) {
+    std::string file_name = out_dir + "/part_" + std::to_string(i) + ".ns";
+    std::ofstream out(file_name);
+    if (!out) {
+      std::cout << "ERROR: decompile_package: can't write \"" << file_name << "\"." << std::endl;
+      return -1;
+    }
+    for ( ; job < jobs.size() && jobs[job].part == (size_t)i; ++job) {
+      const FunctionJob &f = jobs[job];
+      out << "// " << f.path << "\n";
+      std::istringstream log(f.log);
+      for (std::string line; std::getline(log, line); )
+        if (!line.empty()) out << "// " << line << "\n";
+      out << f.source << "\n";
+    }
+  }
+  return (int)jobs.size();
+}
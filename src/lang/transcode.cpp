@@ -26,7 +26,6 @@
 #include "transcode.h"
 #include <dyn/lang/decompile.h>
 #include <dyn/objects.h>
-#include <map>
 #include <iostream>
 
 using namespace dyn;
@@ -103,14 +102,18 @@ using namespace dyn::lang;
  a, b can either be a more specific command, or an argument of any type. Pairs
  are three bytes, but may be compressed into a single byte if b is less than 7.
 
+ The bytecode is read in a single pass. A dense array maps every byte offset
+ to its PC. Branch targets and exception handlers may point forward, so they
+ are collected in a fixup list and resolved after the last instruction.
+
  \param[in] ns_func a function that uses NewtonScript bytecode
+ \param[out] offsets if not null, receives the PC for every byte offset in
+    the Newton bytecode, or kInvalidPC if no instruction starts there
  \return an array of verbose Dyne bytecode
  */
-std::vector<Bytecode> dyn::lang::transcode_from_ns(dyn::RefArg ns_func)
+std::vector<Bytecode> dyn::lang::transcode_from_ns(dyn::RefArg ns_func, std::vector<PC> *offsets)
 {
-  (void)ns_func;
   std::vector<Bytecode> func;
-  std::map<size_t, PC> pc_map { };  // map Newton instructing indices to fn
 
   // Check if we have a binary object 'instructions in the function.
   if (!ns_func.IsFrame()) {
@@ -126,28 +129,34 @@ std::vector<Bytecode> dyn::lang::transcode_from_ns(dyn::RefArg ns_func)
   // Set up access to the 'instructions binary data
   dyn::BinaryObject *inst_obj = static_cast<dyn::BinaryObject*>(inst_ref.GetObject());
   size_t n_inst = inst_obj->size();
-  uint8_t *inst = static_cast<uint8_t*>(inst_obj->Data());
+  const uint8_t *inst = static_cast<const uint8_t*>(inst_obj->Data());
 
-  // Map all bytecode positions to an index in the fn vector
-  for (size_t i=0; i<n_inst; i++) {
-    PC pc = func.size();
-    pc_map[i] = pc;
-    uint8_t b = (inst[i] & 0x07);
-    if (b == 7) i += 2;
-    func.push_back( { BC::Unknown, 0, pc, 0 } );
-  }
-  func.push_back( { BC::EndOfFile, 0, func.size(), 0 } );
+  std::vector<PC> local_offsets;
+  std::vector<PC> &pc_of = offsets ? *offsets : local_offsets;
+  pc_of.assign(n_inst + 1, kInvalidPC);
+  std::vector<PC> fixups { };           // branches with a byte offset in arg
+  std::vector<PC> handlers { };         // new_handler instructions
+  func.reserve(n_inst + 1);
 
   // Generate an uncompressed byte code with some extras.
   // TODO: remove (int16_t) if argument is unsigned!
-  // TODO: find everything that generates code reference
   size_t ip = 0;
-  for (PC pc=0; pc<func.size()-1; ++pc) {
+  while (ip < n_inst) {
+    PC pc = func.size();
+    pc_of[ip] = pc;
     uint8_t cmd = inst[ip++];
     uint8_t a = (cmd & 0xf8) >> 3;
     uint16_t b = (cmd & 0x07);
-    if (b==7) { b = inst[ip]<<8 | inst[ip+1]; ip += 2; }
-    Bytecode &bc = func[pc];
+    // Simple instructions have no argument, so 'pop_handlers' is a single byte.
+    if ((b==7) && (a!=0)) {
+      if (ip+2 > n_inst) {
+        std::cout << "ERROR: Transcoding: instruction at " << ip-1 << " is truncated." << std::endl;
+        break;
+      }
+      b = inst[ip]<<8 | inst[ip+1];
+      ip += 2;
+    }
+    Bytecode bc { BC::Unknown, 0, 0 };
     switch (a) {
       case 0:
         switch (b) {
@@ -172,9 +181,9 @@ std::vector<Bytecode> dyn::lang::transcode_from_ns(dyn::RefArg ns_func)
       case 8: bc.bc = BC::SendIfDefined; bc.arg = (int16_t)b; break;
       case 9: bc.bc = BC::Resend; bc.arg = (int16_t)b; break;
       case 10: bc.bc = BC::ResendIfDefined; bc.arg = (int16_t)b; break;
-      case 11: bc.bc = BC::Branch; bc.arg = (int)pc_map[b]; func[bc.arg].references++; break;
-      case 12: bc.bc = BC::BranchIfTrue; bc.arg = (int)pc_map[b]; func[bc.arg].references++; break;
-      case 13: bc.bc = BC::BranchIfFalse; bc.arg = (int)pc_map[b]; func[bc.arg].references++; break;
+      case 11: bc.bc = BC::Branch; bc.arg = b; fixups.push_back(pc); break;
+      case 12: bc.bc = BC::BranchIfTrue; bc.arg = b; fixups.push_back(pc); break;
+      case 13: bc.bc = BC::BranchIfFalse; bc.arg = b; fixups.push_back(pc); break;
       case 14: bc.bc = BC::FindVar; bc.arg = (int16_t)b; break;
       case 15: bc.bc = BC::GetVar; bc.arg = (int16_t)b; break;
       case 16: bc.bc = BC::MakeFrame; bc.arg = (int16_t)b; break;
@@ -184,7 +193,7 @@ std::vector<Bytecode> dyn::lang::transcode_from_ns(dyn::RefArg ns_func)
       case 20: bc.bc = BC::SetVar; bc.arg = (int16_t)b; break;
       case 21: bc.bc = BC::FindAndSetVar; bc.arg = (int16_t)b; break;
       case 22: bc.bc = BC::IncrVar; bc.arg = (int16_t)b; break;
-      case 23: bc.bc = BC::BranchLoop; bc.arg = (int)pc_map[b]; func[bc.arg].references++; break;
+      case 23: bc.bc = BC::BranchLoop; bc.arg = b; fixups.push_back(pc); break;
       case 24:
         switch (b) {
           case 0: bc.bc = BC::Add; break;
@@ -217,22 +226,43 @@ std::vector<Bytecode> dyn::lang::transcode_from_ns(dyn::RefArg ns_func)
             break;
         }
         break;
-      case 25: bc.bc = BC::NewHandler; bc.arg = (int16_t)b;
-        for (int i=0; i<b; i++) {
-          auto &exc_pc_bc = func[pc-2*i-1];
-          if ((exc_pc_bc.bc == BC::PushConst) && ((exc_pc_bc.arg&3)==0)) {
-            int exc_pc = exc_pc_bc.arg >> 2;
-            func[pc_map[exc_pc]].references++;
-          } else {
-            std::cout << "ERROR: Transcoding new_handler at "<<pc<<": unexpected bytecodes.\n";
-          }
-        }
-        break;
+      case 25: bc.bc = BC::NewHandler; bc.arg = (int16_t)b; handlers.push_back(pc); break;
       default:
         std::cout << "WARNING: unknown byte code a:" << (int)a << ", b:" << (int)b << ", ip:" << (int)ip << "." << std::endl;
         break;
     }
+    func.push_back(bc);
+  }
+  PC eof = func.size();
+  pc_of[n_inst] = eof;
+  func.push_back( { BC::EndOfFile, 0, 0 } );
+
+  // Resolve branch targets from byte offsets to PCs.
+  for (PC pc: fixups) {
+    Bytecode &bc = func[pc];
+    PC target = ((size_t)bc.arg <= n_inst) ? pc_of[bc.arg] : kInvalidPC;
+    if (target == kInvalidPC) {
+      std::cout << "ERROR: Transcoding branch at " << pc << ": no instruction at offset " << bc.arg << "." << std::endl;
+      target = eof;
+    }
+    bc.arg = (int)target;
+    func[target].references++;
+  }
+  // Mark the start of exception handlers as labels.
+  for (PC pc: handlers) {
+    for (int i=0; i<func[pc].arg; i++) {
+      PC exc_pc_ix = pc-2*i-1;
+      const Bytecode &exc_pc_bc = func[exc_pc_ix < pc ? exc_pc_ix : 0];
+      size_t exc_pc = (size_t)(exc_pc_bc.arg >> 2);
+      if ((exc_pc_ix < pc) && (exc_pc_bc.bc == BC::PushConst) && ((exc_pc_bc.arg&3)==0)
+          && (exc_pc < n_inst) && (pc_of[exc_pc] != kInvalidPC)) {
+        func[pc_of[exc_pc]].references++;
+      } else {
+        std::cout << "ERROR: Transcoding new_handler at "<<pc<<": unexpected bytecodes.\n";
+      }
+    }
   }
+  if (offsets)
+    offsets->resize(n_inst);
   return func;
 }
-
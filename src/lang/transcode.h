@@ -28,11 +28,13 @@
 #include <dyn/ref.h>
 #include <dyn/lang/decompile.h>
 
+#include <vector>
+
 namespace dyn {
 
 namespace lang {
 
-std::vector<Bytecode> transcode_from_ns(RefArg ns_func);
+std::vector<Bytecode> transcode_from_ns(RefArg ns_func, std::vector<PC> *offsets = nullptr);
 
 } // namespce lang
 
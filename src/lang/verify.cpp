@@ -0,0 +1,389 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Static checks of transcoded bytecode.
+
+#include "verify.h"
+
+#include <algorithm>
+
+using namespace dyn;
+
+using namespace dyn::lang;
+
+/** \class dyn::lang::Verifier
+ Check a transcoded function before it is run or decompiled.
+
+ The verifier follows every path through the function, including the entry
+ into exception handlers, and computes the depth of the operand stack before
+ each instruction. It fails if the stack can underflow, if two paths meet
+ with different depths, if a branch leaves the function, or if an
+ instruction refers to a literal or a local that does not exist.
+
+ On the way it tracks which values are known to be integers. Locals are only
+ tracked if the function creates no closures and has no find_and_set_var,
+ because those could change a local behind the function's back.
+
+ The results are side tables indexed by PC: depth[] is the stack depth
+ before the instruction, or -1 if it is unreachable, and facts[] tells which
+ instructions only ever see integer operands. The superinstructions of the
+ interpreter are understood as well, so optimized code can be verified.
+ */
+
+static VT join(VT a, VT b)
+{
+  return (a == b) ? a : VT::Any;
+}
+
+static VT const_type(int32_t raw)
+{
+  return ((raw & 3) == 0) ? VT::Int : VT::Any;
+}
+
+bool Verifier::fail_(PC pc, const char *msg)
+{
+  error_pc = pc;
+  error = msg;
+  return false;
+}
+
+/**
+ Continue at an instruction with the given state.
+ \param[in] from the instruction that branches or falls through
+ \param[in] to the next instruction
+ \param[in] in stack and locals after the instruction at \p from
+ \return false if the states do not fit
+ */
+bool Verifier::merge_(PC from, PC to, const State &in)
+{
+  if (to >= code_->size())
+    return fail_(from, "branch target out of range");
+  State &s = states_[to];
+  if (!s.seen) {
+    s = in;
+    s.seen = true;
+    work_.push_back(to);
+    return true;
+  }
+  if (s.stack.size() != in.stack.size())
+    return fail_(to, "stack depth differs between paths");
+  bool changed = false;
+  for (size_t i=0; i<s.stack.size(); ++i) {
+    VT t = join(s.stack[i], in.stack[i]);
+    changed |= (t != s.stack[i]);
+    s.stack[i] = t;
+  }
+  for (size_t i=0; i<s.locals.size(); ++i) {
+    VT t = join(s.locals[i], in.locals[i]);
+    changed |= (t != s.locals[i]);
+    s.locals[i] = t;
+  }
+  if (changed)
+    work_.push_back(to);
+  return true;
+}
+
+/**
+ Apply one instruction to the state before it and pass the result on.
+ */
+bool Verifier::step_(PC pc)
+{
+  const Bytecode &bc = (*code_)[pc];
+  int32_t arg = bc.arg;
+  State s = states_[pc];
+  std::vector<VT> &st = s.stack;
+  PC target = kInvalidPC;
+  bool next = true;
+
+  auto literal_ok = [&](int32_t ix) { return !check_indices || ((ix >= 0) && ((size_t)ix < num_literals)); };
+  auto local_ok = [&](int32_t ix) { return !check_indices || ((ix >= 0) && ((size_t)ix < num_locals)); };
+  auto local = [&](int32_t ix) { return track_locals_ ? s.locals[ix] : VT::Any; };
+  auto set_local = [&](int32_t ix, VT t) { if (track_locals_) s.locals[ix] = t; };
+  auto both_int = [&]() { return (st[st.size()-1] == VT::Int) && (st[st.size()-2] == VT::Int); };
+
+  size_t need = 0;
+  switch (bc.bc) {
+    case BC::Pop: case BC::Dup: case BC::Return: case BC::SetLexScope:
+    case BC::IterNext: case BC::IterDone: case BC::BranchIfTrue: case BC::BranchIfFalse:
+    case BC::SetVar: case BC::FindAndSetVar: case BC::IncrVar:
+    case BC::Not: case BC::BitNot: case BC::Length: case BC::Clone:
+    case BC::Stringer: case BC::ClassOf:
+      need = 1; break;
+    case BC::Add: case BC::Subtract: case BC::ARef: case BC::Equals:
+    case BC::NotEquals: case BC::Multiply: case BC::Divide: case BC::Div:
+    case BC::LessThan: case BC::GreaterThan: case BC::GreaterOrEqual: case BC::LessOrEqual:
+    case BC::BitAnd: case BC::BitOr: case BC::NewIter: case BC::SetClass:
+    case BC::AddArraySlot: case BC::HasPath: case BC::GetPath: case BC::GetPathCheck:
+    case BC::CompareBranch:
+      need = 2; break;
+    case BC::SetARef: case BC::SetPath: case BC::SetPathVal: case BC::BranchLoop:
+      need = 3; break;
+    case BC::Call: case BC::Invoke: case BC::Resend: case BC::ResendIfDefined:
+    case BC::MakeFrame:
+      if (arg < 0) return fail_(pc, "negative argument count");
+      need = (size_t)arg + 1; break;
+    case BC::Send: case BC::SendIfDefined:
+      if (arg < 0) return fail_(pc, "negative argument count");
+      need = (size_t)arg + 2; break;
+    case BC::MakeArray: case BC::FillArray:
+      if (arg < -1) return fail_(pc, "negative argument count");
+      need = (arg == -1) ? 2 : (size_t)arg + 1; break;
+    case BC::NewHandler:
+      if (arg < 0) return fail_(pc, "negative argument count");
+      need = 2 * (size_t)arg; break;
+    default:
+      break;
+  }
+  if (st.size() < need)
+    return fail_(pc, "stack underflow");
+
+  switch (bc.bc) {
+    case BC::EndOfFile:
+    case BC::Return:
+    case BC::ReturnConst:
+      next = false;
+      break;
+    case BC::ReturnVar:
+      if (!local_ok(arg)) return fail_(pc, "no such local");
+      next = false;
+      break;
+    case BC::Pop:
+    case BC::IterNext:
+    case BC::FindAndSetVar:
+      if ((bc.bc == BC::FindAndSetVar) && !literal_ok(arg)) return fail_(pc, "no such literal");
+      st.pop_back();
+      break;
+    case BC::Dup:
+      st.push_back(st.back());
+      break;
+    case BC::PushSelf:
+      st.push_back(VT::Any);
+      break;
+    case BC::Push:
+    case BC::FindVar:
+      if (!literal_ok(arg)) return fail_(pc, "no such literal");
+      st.push_back(VT::Any);
+      break;
+    case BC::PushConst:
+      st.push_back(const_type(arg));
+      break;
+    case BC::PopHandlers:
+      break;
+    case BC::Call: case BC::Invoke: case BC::Resend: case BC::ResendIfDefined:
+    case BC::Send: case BC::SendIfDefined: case BC::MakeFrame:
+    case BC::MakeArray: case BC::FillArray: case BC::SetARef:
+    case BC::SetPathVal:
+      st.resize(st.size() - need);
+      st.push_back(VT::Any);
+      break;
+    case BC::SetPath:
+      st.resize(st.size() - need);
+      if (arg)
+        st.push_back(VT::Any);
+      break;
+    case BC::Branch:
+      target = (PC)arg;
+      next = false;
+      break;
+    case BC::BranchIfTrue: case BC::BranchIfFalse: case BC::BranchLoop: case BC::CompareBranch:
+      st.resize(st.size() - need);
+      target = (bc.bc == BC::CompareBranch) ? (PC)(arg & 0xffffff) : (PC)arg;
+      break;
+    case BC::GetVar:
+      if (!local_ok(arg)) return fail_(pc, "no such local");
+      st.push_back(local(arg));
+      break;
+    case BC::GetVar2:
+      if (!local_ok(arg & 0xffff) || !local_ok(arg >> 16)) return fail_(pc, "no such local");
+      st.push_back(local(arg & 0xffff));
+      st.push_back(local(arg >> 16));
+      break;
+    case BC::SetVar:
+      if (!local_ok(arg)) return fail_(pc, "no such local");
+      set_local(arg, st.back());
+      st.pop_back();
+      break;
+    case BC::SetVarConst:
+      if (!local_ok(arg & 0xffff)) return fail_(pc, "no such local");
+      set_local(arg & 0xffff, const_type(arg >> 16));
+      break;
+    case BC::AddVarConst:
+      if (!local_ok(arg & 0xffff)) return fail_(pc, "no such local");
+      break;
+    case BC::IncrVar: {
+      if (!local_ok(arg)) return fail_(pc, "no such local");
+      VT t = ((st.back() == VT::Int) && (local(arg) == VT::Int)) ? VT::Int : VT::Any;
+      set_local(arg, t);
+      st.push_back(t);
+      break;
+    }
+    case BC::Add: case BC::Subtract: {
+      VT t = both_int() ? VT::Int : VT::Any;
+      st.pop_back();
+      st.back() = t;
+      break;
+    }
+    case BC::Multiply:
+      // A product that does not fit into an integer is a real.
+      st.pop_back();
+      st.back() = VT::Any;
+      break;
+    case BC::Div: case BC::BitAnd: case BC::BitOr:
+      st.pop_back();
+      st.back() = VT::Int;
+      break;
+    case BC::ARef: case BC::Equals: case BC::NotEquals: case BC::Divide:
+    case BC::LessThan: case BC::GreaterThan: case BC::GreaterOrEqual: case BC::LessOrEqual:
+    case BC::NewIter: case BC::SetClass: case BC::AddArraySlot: case BC::HasPath:
+    case BC::GetPath: case BC::GetPathCheck:
+      st.pop_back();
+      st.back() = VT::Any;
+      break;
+    case BC::BitNot: case BC::Length:
+      st.back() = VT::Int;
+      break;
+    case BC::SetLexScope: case BC::IterDone: case BC::Not: case BC::Clone:
+    case BC::Stringer: case BC::ClassOf:
+      st.back() = VT::Any;
+      break;
+    case BC::NewHandler: {
+      // The handler addresses are the constants pushed right before.
+      if (pc < need) return fail_(pc, "bad handler address");
+      st.resize(st.size() - need);
+      State h;
+      h.stack.assign(st.size(), VT::Any);
+      h.locals.assign(s.locals.size(), VT::Any);
+      for (PC i=0; i<(PC)arg; ++i) {
+        PC p = pc - need + 2*i + 1;
+        const Bytecode &c = (*code_)[p];
+        if ((c.bc != BC::PushConst) || (const_type(c.arg) != VT::Int) || (c.arg < 0)
+            || ((size_t)(c.arg >> 2) >= offsets_->size()) || ((*offsets_)[c.arg >> 2] == kInvalidPC))
+          return fail_(pc, "bad handler address");
+        if (!merge_(pc, (*offsets_)[c.arg >> 2], h))
+          return false;
+      }
+      break;
+    }
+    default:
+      return fail_(pc, "unknown instruction");
+  }
+
+  if ((target != kInvalidPC) && !merge_(pc, target, s))
+    return false;
+  if (next) {
+    if (pc + 1 >= code_->size())
+      return fail_(pc, "code runs past the end");
+    if (!merge_(pc, pc + 1, s))
+      return false;
+  }
+  return true;
+}
+
+/**
+ Mark instructions whose operands are always integers.
+ */
+void Verifier::record_facts_()
+{
+  for (PC pc=0; pc<code_->size(); ++pc) {
+    const State &s = states_[pc];
+    if (!s.seen)
+      continue;
+    const Bytecode &bc = (*code_)[pc];
+    size_t d = s.stack.size();
+    auto top_int = [&](size_t k) {
+      for (size_t i=1; i<=k; ++i)
+        if ((i > d) || (s.stack[d-i] != VT::Int))
+          return false;
+      return true;
+    };
+    auto local_int = [&](int32_t ix) { return track_locals_ && (s.locals[ix] == VT::Int); };
+    bool ints = false;
+    switch (bc.bc) {
+      case BC::Add: case BC::Subtract: case BC::Multiply:
+      case BC::LessThan: case BC::GreaterThan: case BC::GreaterOrEqual: case BC::LessOrEqual:
+      case BC::CompareBranch:
+        ints = top_int(2); break;
+      case BC::BranchLoop:
+        ints = top_int(3); break;
+      case BC::IncrVar:
+        ints = top_int(1) && local_int(bc.arg); break;
+      case BC::AddVarConst:
+        ints = local_int(bc.arg & 0xffff); break;
+      default:
+        break;
+    }
+    if (ints)
+      facts[pc] |= kIntOperands;
+  }
+}
+
+/**
+ Verify a function.
+ Set num_literals and num_locals to the size of the 'literals array and of
+ the 'argFrame of the function first, or clear check_indices to only check
+ the stack and the branches.
+ \param[in] code transcoded function, ending in BC::EndOfFile
+ \param[in] offsets maps byte offsets in the original code to PCs
+ \return true if the code is safe to run; otherwise error_pc and error
+    describe the problem
+ */
+bool Verifier::verify(const std::vector<Bytecode> &code, const std::vector<PC> &offsets)
+{
+  code_ = &code;
+  offsets_ = &offsets;
+  size_t n = code.size();
+  depth.assign(n, -1);
+  facts.assign(n, 0);
+  max_depth = 0;
+  error_pc = kInvalidPC;
+  error.clear();
+  if (n == 0)
+    return fail_(0, "no code");
+
+  track_locals_ = check_indices && std::none_of(code.begin(), code.end(), [](const Bytecode &bc) {
+    return (bc.bc == BC::SetLexScope) || (bc.bc == BC::FindAndSetVar);
+  });
+  State entry;
+  entry.locals.assign(track_locals_ ? num_locals : 0, VT::Any);
+  states_.assign(n, State());
+  work_.clear();
+  bool ok = merge_(0, 0, entry);
+  while (ok && !work_.empty()) {
+    PC pc = work_.back();
+    work_.pop_back();
+    ok = step_(pc);
+  }
+  if (ok) {
+    for (PC pc=0; pc<n; ++pc) {
+      if (!states_[pc].seen)
+        continue;
+      depth[pc] = (int)states_[pc].stack.size();
+      max_depth = std::max(max_depth, states_[pc].stack.size());
+    }
+    record_facts_();
+  }
+  states_.clear();
+  work_.clear();
+  return ok;
+}
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_LANG_VERIFY_H
+#define DYN_LANG_VERIFY_H
+
+#include <dyn/lang/decompile.h>
+
+#include <string>
+#include <vector>
+
+namespace dyn {
+
+namespace lang {
+
+/**
+ What the verifier knows about a value on the stack or in a local.
+ */
+enum class VT : uint8_t {
+  Any, Int
+};
+
+class Verifier {
+  struct State {
+    bool seen { false };
+    std::vector<VT> stack { };
+    std::vector<VT> locals { };
+  };
+  const std::vector<Bytecode> *code_ { nullptr };
+  const std::vector<PC> *offsets_ { nullptr };
+  std::vector<State> states_ { };
+  std::vector<PC> work_ { };
+  bool track_locals_ { false };
+  bool fail_(PC pc, const char *msg);
+  bool merge_(PC from, PC to, const State &in);
+  bool step_(PC pc);
+  void record_facts_();
+public:
+  /// The operands of this instruction are integers.
+  static constexpr uint8_t kIntOperands = 0x01;
+  size_t num_literals { 0 };
+  size_t num_locals { 0 };
+  bool check_indices { true };
+  std::vector<int> depth { };
+  std::vector<uint8_t> facts { };
+  size_t max_depth { 0 };
+  PC error_pc { kInvalidPC };
+  std::string error { };
+  bool verify(const std::vector<Bytecode> &code, const std::vector<PC> &offsets);
+};
+
+} // namespace lang
+
+} // namespace dyn
+
+#endif // DYN_LANG_VERIFY_H
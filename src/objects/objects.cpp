@@ -25,8 +25,19 @@
 #include <dyn/objects.h>
 #include <dyn/io/print.h>
 #include <dyn/errors.h>
+#include <dyn/tools/stats.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
 
 using namespace dyn;
 
@@ -48,6 +59,8 @@ Index dyn::SlottedObject::Length() const {
 
 void dyn::SlottedObject::SetLength(Index new_length)
 {
+  if (f.compact_)
+    Widen();
   Index old_length = Length();
   Index avail = old_length + array.reserve_;
 
@@ -72,6 +85,8 @@ Ref dyn::SlottedObject::GetSlot(Index i) const {
   if ((t.tag_==Tag::array) || (t.tag_==Tag::frame)) {
     if (i<(Index)(size()/sizeof(Ref))) {
       assert((i >= 0) && (i < (Index)(size_/sizeof(Ref))));
+      if (f.compact_)
+        return CompactHeap::Decode(reinterpret_cast<const uint32_t*>(frame.slot_)[i]);
       return frame.slot_[i];
     } else {
       return RefNIL;
@@ -127,6 +142,10 @@ int dyn::SymbolCompare(Ref sym1, Ref sym2)
 
 int dyn::Object::Print(dyn::io::PrintState &ps) const
 {
+  // Do not hand out a label for a container that is cut off by the depth limit.
+  bool cut = ((t.tag_ == Tag::array) || (t.tag_ == Tag::frame)) && !ps.more_depth();
+  if (!cut && ps.label(this))
+    return 0;
   switch (t.tag_) {
     case Tag::binary: {
       // TODO: MakeBinaryFromHex("0023bf6590")...
@@ -162,11 +181,16 @@ int dyn::Object::Print(dyn::io::PrintState &ps) const
       }
       break; }
     case Tag::large_binary:
-      fprintf(ps.out_, "large_binary('");
+      fprintf(ps.out_, "large_binary(");
       ps.expect_symbol(true);
-      binary.class_.Print(ps);
+      lbo.class_.Print(ps);
       ps.expect_symbol(false);
-      fprintf(ps.out_, ": <%ld bytes>)", size());
+      fprintf(ps.out_, ": <%zu bytes", lbo.info_->size_);
+      if (lbo.info_->compander_.IsNotNIL()) {
+        fprintf(ps.out_, ", compander ");
+        lbo.info_->compander_.Print(ps);
+      }
+      fprintf(ps.out_, ">)");
       break;
     case Tag::array:
       if (ps.more_depth()) {
@@ -288,6 +312,7 @@ dyn::Frame::Frame()
 
 Ref dyn::AllocateFrame()
 {
+  tools::Stats::count(tools::Stats::kFramesAllocated);
   return Ref(new dyn::Frame());
 }
 
@@ -295,11 +320,9 @@ void dyn::SetFrameSlot(RefArg obj, RefArg tag, RefArg value)
 {
   if (!obj.IsFrame())
     throw BadTypeWithFrameData(kDyneErrNotAFrame);
-  if (obj.IsReadOnly())
-    throw FramesWithBadValue(kDyneErrObjectReadOnly);
   if (!tag.IsSymbol())
     throw BadTypeWithFrameData(kDyneErrNotASymbol);
-  Frame *frame = static_cast<Frame*>(obj.GetObject());
+  Frame *frame = static_cast<Frame*>(CopyOnWrite::Writable(obj).GetObject());
   frame->SetSlot(tag, value);
 }
 
@@ -307,18 +330,24 @@ Ref dyn::GetFrameSlot(RefArg obj, RefArg slot)
 {
   if (!obj.IsFrame())
     throw BadTypeWithFrameData(kDyneErrNotAFrame);
-  Frame *frame = static_cast<Frame*>(obj.GetObject());
+  Frame *frame = static_cast<Frame*>(CopyOnWrite::Follow(obj.GetObject()));
   return frame->GetSlot(slot);
 }
 
 dyn::Array::Array(RefArg obj_class, Index length)
-: SlottedObject( Array_{ obj_class, new Ref[length], 0 }, (uint32_t)length)
+: SlottedObject( Array_{ obj_class, new Ref[length], 0, 0 }, (uint32_t)length)
 { }
 
 dyn::Array::Array(RefArg obj_class)
-: SlottedObject( Array_{ obj_class, new Ref[4], 4 }, 0)
+: SlottedObject( Array_{ obj_class, new Ref[4], 4, 0 }, 0)
 { }
 
+/**
+ Incremented whenever a map gains a _proto or _parent tag without being copied.
+ Every other tag only changes the version of its own map, see Map::Version().
+ */
+std::atomic<uint32_t> dyn::Map::epoch_ { 0 };
+
 dyn::Map::Map(RefArg obj_class, Index length)
 : Array(obj_class, length)
 { }
@@ -327,8 +356,32 @@ dyn::Map::Map(RefArg obj_class)
 : Array(obj_class)
 { }
 
+/**
+ Create a new frame that uses an existing map.
+ This is how the interpreter creates frames from literal maps. All slots are
+ set to NIL. The map is marked shared.
+ \param[in] map_ref an array of tags, slot 0 is the super map
+ \return a new frame
+ */
+Ref dyn::AllocateFrameWithMap(RefArg map_ref)
+{
+  if (!map_ref.IsArray())
+    throw BadTypeWithFrameData(kDyneErrNotAnArray);
+  Map *map = static_cast<Map*>(map_ref.GetObject());
+  if (!map->IsReadOnly())
+    Frame::MarkMapShared(map);
+  tools::Stats::count(tools::Stats::kFramesAllocated);
+  Index n = map->Length() - 1;
+  if (n < 0) n = 0;
+  Ref *slots = (Ref*)::malloc((n ? n : 1) * sizeof(Ref));
+  for (Index i=0; i<n; ++i)
+    slots[i] = RefNIL;
+  return Ref(new Frame(map, (uint32_t)n, slots));
+}
+
 Ref dyn::AllocateArray(RefArg theClass, Index length)
 {
+  tools::Stats::count(tools::Stats::kArraysAllocated);
   return Ref(new dyn::Array(theClass, length));
 }
 
@@ -340,9 +393,36 @@ Ref dyn::AllocateArray(Index length)
 void dyn::SlottedObject::SetSlot(Index ix, RefArg value)
 {
   assert((ix >= 0) && (ix < Length()));
+  if (f.compact_) {
+    uint32_t compact;
+    if (CompactHeap::Encode(value, compact)) {
+      reinterpret_cast<uint32_t*>(array.slot_)[ix] = compact;
+      return;
+    }
+    Widen();
+  }
   array.slot_[ix] = value;
 }
 
+/**
+ Store the slots as full size refs again.
+ This is needed when a value does not fit into a compact slot, or when the
+ number of slots changes. The compact slots stay in the compact heap.
+ */
+void dyn::SlottedObject::Widen()
+{
+  if (!f.compact_)
+    return;
+  Index n = Length();
+  const uint32_t *compact = reinterpret_cast<const uint32_t*>(array.slot_);
+  Ref *slots = (Ref*)::malloc((n > 0 ? n : 1) * sizeof(Ref));
+  for (Index i=0; i<n; ++i)
+    slots[i] = CompactHeap::Decode(compact[i]);
+  array.slot_ = slots;
+  array.reserve_ = 0;
+  f.compact_ = 0;
+}
+
 Index dyn::Array::AddSlot(RefArg value)
 {
   Index len = Length();
@@ -356,13 +436,58 @@ void dyn::Frame::SetSlot(RefArg tag, RefArg value)
   // TODO: frame.map_->FindOffset(tag);
   Index i = FindOffset(frame.map_, tag);
   if (i == -1) {
-    i = frame.map_->AddSlot(tag);
-    if (i == -1)
+    // Never grow a map that other frames use, give this frame its own copy.
+    // Read-only maps can't be marked shared, but may be used by other frames.
+    Ref flags = frame.map_->GetClass();
+    if (frame.map_->IsReadOnly() || (flags.IsInt() && (flags.GetInt() & kMapShared))) {
+      Index n = frame.map_->Length();
+      Map *map = new Map(Ref(flags.IsInt() ? (int)(flags.GetInt() & ~kMapShared) : 0), n);
+      for (Index j=0; j<n; ++j)
+        map->SetSlot(j, frame.map_->GetSlot(j));
+      frame.map_ = map;
+    } else {
+      frame.map_->Changed();
+      if ((dyn::SymbolCompare(tag, gSymProto) == 0) || (dyn::SymbolCompare(tag, gSymParent) == 0))
+        Map::InheritanceChanged();
+    }
+    // Map slot 0 is the super map, so the new tag at map[n] is frame slot n-1.
+    Index n = frame.map_->AddSlot(tag);
+    if (n == -1)
       return; // TODO: throw
-    SetLength(i);
+    SetLength(n);
+    i = n - 1;
   }
-  assert((i-1 >= 0) && (i-1 < (Index)(size_/sizeof(Ref))));
-  frame.slot_[i-1] = value;
+  SlottedObject::SetSlot(i, value);
+}
+
+/**
+ Create a shallow copy of the frame.
+ The copy shares the map with the original, and the map is marked shared so
+ that the first of both frames that adds a slot gets its own map.
+ \return a new frame with the same tags and values
+ */
+Ref dyn::Frame::Clone() const
+{
+  if (!frame.map_->IsReadOnly())
+    MarkMapShared(frame.map_);
+  Index n = Length();
+  Ref *slots = (Ref*)::malloc((n > 0 ? n : 1) * sizeof(Ref));
+  for (Index i=0; i<n; ++i)
+    slots[i] = GetSlot(i);
+  return Ref(new Frame(frame.map_, (uint32_t)n, slots));
+}
+
+/**
+ Mark a map as shared, so no frame adds slots to it.
+ \param[in] map the map of a frame
+ */
+void dyn::Frame::MarkMapShared(Map *map)
+{
+  Ref flags = map->GetClass();
+  if (!flags.IsInt())
+    map->SetClass(Ref(kMapShared));
+  else if ((flags.GetInt() & kMapShared) == 0)
+    map->SetClass(Ref((int)(flags.GetInt() | kMapShared)));
 }
 
 Ref dyn::Frame::GetSlot(RefArg tag) const
@@ -371,8 +496,7 @@ Ref dyn::Frame::GetSlot(RefArg tag) const
   Index i = FindOffset(frame.map_, tag);
   if (i == -1)
     return RefNIL;
-  assert((i >= 0) && (i < (Index)(size_/sizeof(Ref))));
-  return frame.slot_[i];
+  return SlottedObject::GetSlot(i);
 }
 
 Index dyn::FindOffset(Ref map_ref, Ref tag)
@@ -408,10 +532,8 @@ Index dyn::AddArraySlot(RefArg array_ref, RefArg value)
 {
   if (!array_ref.IsArray())
     throw BadTypeWithFrameData(kDyneErrNotAnArray);
-  if (IsReadOnly(array_ref))
-    throw FramesWithBadValue(kDyneErrObjectReadOnly);
 
-  Array *array = static_cast<Array*>(array_ref.GetObject());
+  Array *array = static_cast<Array*>(CopyOnWrite::Writable(array_ref).GetObject());
   return array->AddSlot(value);
 }
 
@@ -425,7 +547,7 @@ Ref dyn::GetArraySlot(RefArg array_obj, Index slot)
 {
   // TODO: throw if anything is off
   if (array_obj.IsArray()) {
-    Array *a = static_cast<Array*>(array_obj.GetObject());
+    Array *a = static_cast<Array*>(CopyOnWrite::Follow(array_obj.GetObject()));
     return a->GetSlot(slot);
   } else {
     return RefNIL;
@@ -436,11 +558,434 @@ void dyn::SetArraySlot(RefArg array, Index slot, RefArg value)
 {
   // TODO: throw if anything is off
   if (array.IsArray()) {
-    Array *a = static_cast<Array*>(array.GetObject());
+    Array *a = static_cast<Array*>(CopyOnWrite::Writable(array).GetObject());
     a->SetSlot(slot, value);
   }
 }
 
+/**
+ Create a shallow copy of the array.
+ \return a new array with the same class and elements
+ */
+Ref dyn::Array::Clone() const
+{
+  Index n = Length();
+  Array *a = new Array(array.class_, n);
+  for (Index i=0; i<n; ++i)
+    a->SetSlot(i, GetSlot(i));
+  return Ref(a);
+}
+
+/**
+ Create a shallow copy of an object.
+ Frames and arrays share their slot values with the original, binary objects
+ copy their data. Immediates and symbols are returned unchanged.
+ \param[in] obj any reference
+ \return the copy
+ */
+Ref dyn::Clone(RefArg obj)
+{
+  Object *o = obj.GetObject();
+  if (!o || o->IsSymbol())
+    return obj;
+  if (o->IsFrame())
+    return static_cast<Frame*>(o)->Clone();
+  if (o->IsArray())
+    return static_cast<Array*>(o)->Clone();
+  if (o->IsReal())
+    return MakeReal(o->GetReal());
+  if (o->IsBinary()) {
+    Ref copy = AllocateBinary(o->GetClass(), o->size());
+    ::memcpy(BinaryData(copy), BinaryData(obj), o->size());
+    return copy;
+  }
+  return obj;
+}
+
+/** \class dyn::CopyOnWrite
+ Give read-only objects a writable copy on the first write.
+
+ Objects from snapshots and compiled object images are read-only, and
+ can be shared by many runtimes. Writing to one of them
+ creates a private copy that takes all further writes, and reads through
+ GetFrameSlot(), GetArraySlot(), and the interpreter go to the copy from
+ then on. The original stays untouched.
+
+ A frame copy gets its own slots, but keeps using the map of the original
+ until a slot is added. Arrays and binaries are copied completely.
+
+ Refs that other objects hold still point to the original. Code that
+ walks objects directly must call Follow() on every object, as the printer
+ and the exporter do.
+
+ Reads only look up the copy if the bit for the address of the object is
+ set in a table. Different objects can share a bit, so the lookup may
+ still find nothing. Bits are only ever set in the current table. Clear()
+ and Forget() build a new table and swap it in, so a read that runs at the
+ same time sees either the old or the new table, but never one that is
+ half cleared.
+ */
+
+dyn::CopyOnWrite::Filter dyn::CopyOnWrite::initial_filter_ { };
+std::atomic<dyn::CopyOnWrite::Filter*> dyn::CopyOnWrite::filter_ { &dyn::CopyOnWrite::initial_filter_ };
+
+namespace {
+std::shared_mutex gCopiesMutex;
+std::unordered_map<const Object*, Object*> gCopies;
+} // namespace
+
+/**
+ Mark that an object may have a copy.
+ Call with the mutex locked.
+ */
+void dyn::CopyOnWrite::SetFilterBit(Filter *filter, const Object *obj)
+{
+  size_t bit = FilterBit(obj);
+  filter->bits[bit / 64].fetch_or((uint64_t)1 << (bit % 64), std::memory_order_release);
+}
+
+/**
+ Build a new table from the remaining copies and make it the current one.
+ Call with the mutex locked.
+ */
+void dyn::CopyOnWrite::ReplaceFilter()
+{
+  // Readers don't lock, so a replaced table may still be in use and is never freed.
+  static std::vector<std::unique_ptr<Filter>> retired;
+  auto filter = std::make_unique<Filter>();
+  for (auto &copy: gCopies)
+    SetFilterBit(filter.get(), copy.first);
+  Filter *old = filter_.exchange(filter.release(), std::memory_order_acq_rel);
+  if (old != &initial_filter_)
+    retired.emplace_back(old);
+  num_copies_.store(gCopies.size(), std::memory_order_relaxed);
+}
+
+/**
+ Find the writable copy of a read-only object.
+ \return the copy, or nullptr if the object was never written
+ */
+Object *dyn::CopyOnWrite::Find(const Object *obj)
+{
+  std::shared_lock<std::shared_mutex> lock(gCopiesMutex);
+  auto it = gCopies.find(obj);
+  return (it == gCopies.end()) ? nullptr : it->second;
+}
+
+/**
+ Return an object that can be written.
+ \param[in] obj any frame, array, or binary
+ \return obj itself if it is writable, or its writable copy
+ \throw FramesWithBadValue if obj is read-only and can't be copied
+ */
+Ref dyn::CopyOnWrite::Writable(RefArg obj)
+{
+  Object *o = obj.GetObject();
+  if (!o || !o->IsReadOnly())
+    return obj;
+  std::unique_lock<std::shared_mutex> lock(gCopiesMutex);
+  auto it = gCopies.find(o);
+  if (it != gCopies.end())
+    return Ref(it->second);
+  if (!o->IsFrame() && !o->IsArray() && !o->IsBinary())
+    throw FramesWithBadValue(kDyneErrObjectReadOnly);
+  Ref copy = Clone(obj);
+  gCopies[o] = copy.GetObject();
+  SetFilterBit(filter_.load(std::memory_order_relaxed), o);
+  num_copies_.fetch_add(1, std::memory_order_relaxed);
+  return copy;
+}
+
+/**
+ Forget all copies. Reads go to the read-only originals again.
+ */
+void dyn::CopyOnWrite::Clear()
+{
+  std::unique_lock<std::shared_mutex> lock(gCopiesMutex);
+  gCopies.clear();
+  ReplaceFilter();
+}
+
+/**
+ Forget the copies of all objects in a range of memory.
+ Call this before the memory is released, so that other objects that are
+ later placed at the same address don't find these copies.
+ \param[in] begin, end the memory that held the read-only objects
+ */
+void dyn::CopyOnWrite::Forget(const void *begin, const void *end)
+{
+  std::unique_lock<std::shared_mutex> lock(gCopiesMutex);
+  for (auto it = gCopies.begin(); it != gCopies.end(); ) {
+    const void *o = it->first;
+    if ((o >= begin) && (o < end))
+      it = gCopies.erase(it);
+    else
+      ++it;
+  }
+  ReplaceFilter();
+}
+
+/** \class dyn::MagicPointers
+ Resolve magic pointers to the objects of the system.
+
+ Packages refer to system objects like protoApp by magic pointers, which
+ are an index into a table of objects in ROM. Each table is a flat array,
+ so resolving a magic pointer is an array access.
+
+ A table can be set directly, or from a source that is called on the first
+ access to the table, for example to map a snapshot of the system objects.
+ Magic pointers into tables that have no objects stay unresolved.
+ */
+
+dyn::MagicPointers::Table dyn::MagicPointers::tables_[dyn::MagicPointers::kNumTables];
+
+namespace {
+std::mutex gMagicPointersMutex;
+} // namespace
+
+/**
+ Copy the slots of an array into a table and publish them.
+ Call with the mutex locked.
+ */
+void dyn::MagicPointers::Fill(Table &t, RefArg array)
+{
+  t.storage.clear();
+  Ref a = CopyOnWrite::Follow(array);
+  if (a.IsArray()) {
+    auto arr = static_cast<const Array*>(a.GetObject());
+    for (Index i=0; i<arr->Length(); ++i)
+      t.storage.push_back(arr->GetSlot(i));
+  }
+  t.size.store(t.storage.size(), std::memory_order_relaxed);
+  t.slots.store(t.storage.data(), std::memory_order_relaxed);
+  t.state.store(kLoaded, std::memory_order_release);
+}
+
+/**
+ Set all objects of a table.
+ \param[in] table number of the table
+ \param[in] array the objects, magic pointer @table.i resolves to slot i
+ */
+void dyn::MagicPointers::SetTable(int table, RefArg array)
+{
+  if (table < 0 || table >= kNumTables)
+    throw FramesWithBadValue(kDyneErrOutOfRange);
+  std::lock_guard<std::mutex> lock(gMagicPointersMutex);
+  tables_[table].source = nullptr;
+  Fill(tables_[table], array);
+}
+
+/**
+ Set a function that returns the objects of a table on first access.
+ \param[in] table number of the table
+ \param[in] source returns an array of objects
+ */
+void dyn::MagicPointers::SetSource(int table, Source source)
+{
+  if (table < 0 || table >= kNumTables)
+    throw FramesWithBadValue(kDyneErrOutOfRange);
+  std::lock_guard<std::mutex> lock(gMagicPointersMutex);
+  Table &t = tables_[table];
+  t.source = std::move(source);
+  t.storage.clear();
+  t.size.store(0, std::memory_order_relaxed);
+  t.slots.store(nullptr, std::memory_order_relaxed);
+  t.state.store(t.source ? kPending : kEmpty, std::memory_order_release);
+}
+
+/**
+ Remove all tables.
+ Must not be called while other threads resolve magic pointers.
+ */
+void dyn::MagicPointers::Clear()
+{
+  for (int i=0; i<kNumTables; ++i)
+    SetSource(i, nullptr);
+}
+
+/**
+ Return the object for a table and index.
+ \return the object, or the magic pointer if the table has no such object
+ */
+Ref dyn::MagicPointers::Get(int table, int index)
+{
+  if (table < 0 || table >= kNumTables || index < 0)
+    return Ref(table, index);
+  Table &t = tables_[table];
+  uint8_t state = t.state.load(std::memory_order_acquire);
+  if (state == kPending) {
+    std::lock_guard<std::mutex> lock(gMagicPointersMutex);
+    if (t.state.load(std::memory_order_relaxed) == kPending)
+      Fill(t, t.source());
+    state = kLoaded;
+  }
+  if (state != kLoaded || (size_t)index >= t.size.load(std::memory_order_relaxed))
+    return Ref(table, index);
+  return t.slots.load(std::memory_order_relaxed)[index];
+}
+
+Ref dyn::MagicPointers::Lookup(RefArg ref)
+{
+  return Get(ref.MagicTable(), ref.MagicIndex());
+}
+
+/** \class dyn::CompactHeap
+ Keep objects in a heap where slots hold 32 bit refs.
+
+ Converted packages are mostly frames and arrays, and most of their slots
+ hold integers, immediates, and other objects of the same package. When
+ all objects live in one block of at most 4 GiB, a pointer fits into a
+ 32 bit offset from the base of the block, and the two tag bits of a Ref
+ work unchanged. This halves the memory that slots take.
+
+ The compact heap is optional. Enable() reserves the address space, and
+ Compact() copies a graph of objects into the heap. Objects outside of
+ the heap, like compiled object images, are copied too, the header refs
+ like the class of an object are not. An object uses compact slots when
+ all of its values fit. GetSlot() and SetSlot() work on both kinds of
+ slots. Writing a value that does not fit, or adding a slot, turns the
+ slots back into full size refs.
+
+ Memory in the compact heap is never given back.
+ */
+
+uint8_t *dyn::CompactHeap::base_ { nullptr };
+size_t dyn::CompactHeap::reserved_ { 0 };
+std::atomic<size_t> dyn::CompactHeap::used_ { 0 };
+
+namespace {
+std::mutex gCompactHeapMutex;
+} // namespace
+
+/**
+ Reserve the address space for the compact heap.
+ Pages are only used when objects are allocated. Calling this again after
+ the heap was created does nothing.
+ \param[in] reserve size of the heap in bytes, at most 4 GiB
+ \return true if the compact heap can be used
+ */
+bool dyn::CompactHeap::Enable(size_t reserve)
+{
+  std::lock_guard<std::mutex> lock(gCompactHeapMutex);
+  if (base_)
+    return true;
+  reserve = std::min(reserve, kMaxReserve);
+  void *mem = ::mmap(nullptr, reserve, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED)
+    return false;
+  reserved_ = reserve;
+  base_ = static_cast<uint8_t*>(mem);
+  return true;
+}
+
+/**
+ Allocate memory in the compact heap.
+ \param[in] size number of bytes, rounded up to keep refs aligned
+ \return the memory, or nullptr if the heap is not enabled or full
+ */
+void *dyn::CompactHeap::Allocate(size_t size)
+{
+  size = (size + sizeof(Ref) - 1) & ~(sizeof(Ref) - 1);
+  std::lock_guard<std::mutex> lock(gCompactHeapMutex);
+  size_t used = used_.load(std::memory_order_relaxed);
+  if (!base_ || size > reserved_ - used)
+    return nullptr;
+  used_.store(used + size, std::memory_order_relaxed);
+  return base_ + used;
+}
+
+namespace {
+// Copy data into the compact heap, or onto the heap when it is full.
+char *CompactData(const void *data, size_t size)
+{
+  void *mem = CompactHeap::Allocate(size ? size : 1);
+  if (!mem)
+    mem = ::malloc(size ? size : 1);
+  if (size)
+    ::memcpy(mem, data, size);
+  return static_cast<char*>(mem);
+}
+} // namespace
+
+/**
+ Copy all objects that can be reached from root into the compact heap.
+ Objects that are already in the compact heap are not copied again.
+ \param[in] root any reference
+ \return the copy of root, or root itself if the heap is not enabled
+ */
+Ref dyn::CompactHeap::Compact(RefArg root)
+{
+  if (!Enabled())
+    return root;
+  std::unordered_map<const Object*, Object*> copies;
+  std::vector<const Object*> todo;
+  auto place = [&copies, &todo](RefArg ref) -> Ref {
+    Object *o = ref.GetObject();
+    if (!o || Contains(o))
+      return ref;
+    auto it = copies.find(o);
+    if (it != copies.end())
+      return Ref(it->second);
+    void *mem = Allocate(sizeof(Object));
+    if (!mem)
+      return ref;
+    Object *copy = new (mem) Object(*o);
+    copies[o] = copy;
+    todo.push_back(o);
+    return Ref(copy);
+  };
+
+  Ref copy = place(root);
+  std::vector<Ref> values;
+  while (!todo.empty()) {
+    const Object *o = todo.back();
+    todo.pop_back();
+    Object *c = copies[o];
+    switch (o->t.tag_) {
+      case Object::Tag::binary:
+        c->binary.data_ = CompactData(o->binary.data_, o->size_);
+        break;
+      case Object::Tag::symbol:
+        c->symbol.string_ = CompactData(o->symbol.string_, ::strlen(o->symbol.string_) + 1);
+        break;
+      case Object::Tag::large_binary:
+        // The copy is a view of the data of the original.
+        c->lbo.info_ = new LargeBinaryInfo(*o->lbo.info_);
+        c->lbo.info_->owned_ = false;
+        break;
+      case Object::Tag::frame:
+        c->frame.map_ = static_cast<Map*>(place(Ref(o->frame.map_)).GetObject());
+        [[fallthrough]];
+      case Object::Tag::array: {
+        auto slotted = static_cast<const SlottedObject*>(o);
+        Index n = slotted->Length();
+        values.clear();
+        for (Index i=0; i<n; ++i)
+          values.push_back(place(slotted->GetSlot(i)));
+        c->array.reserve_ = 0;
+        c->f.compact_ = 0;
+        uint32_t *compact = static_cast<uint32_t*>(Allocate((n > 0 ? n : 1) * sizeof(uint32_t)));
+        Index i = 0;
+        for (; compact && i<n; ++i)
+          if (!Encode(values[i], compact[i]))
+            break;
+        if (compact && i == n) {
+          c->array.slot_ = reinterpret_cast<Ref*>(compact);
+          c->f.compact_ = 1;
+        } else {
+          c->array.slot_ = (Ref*)::malloc((n > 0 ? n : 1) * sizeof(Ref));
+          for (i=0; i<n; ++i)
+            c->array.slot_[i] = values[i];
+        }
+        break; }
+      default:
+        break;
+    }
+  }
+  return copy;
+}
+
 int dyn::Array::Print(dyn::io::PrintState &ps) const
 {
   fprintf(ps.out_, "[\n");
@@ -455,7 +1000,7 @@ int dyn::Array::Print(dyn::io::PrintState &ps) const
   int i, n = (int)(size()/sizeof(Ref));
   for (i=0; i<n; ++i) {
     ps.tab();
-    array.slot_[i].Print(ps);
+    GetSlot(i).Print(ps);
     if (i+1<n) fprintf(ps.out_, ",");
     fprintf(ps.out_, "\n");
   }
@@ -496,16 +1041,54 @@ Ref dyn::Sym(const char *name) {
   // TODO: if not, we must add it to the list
   // TODO: if list of known symbols is read-only, clone the list
   // TODO: return a Ref to the global symbol and return
+  tools::Stats::count(tools::Stats::kSymbolsCreated);
   return Ref(new Symbol(::strdup(name)));
 }
 
 Ref dyn::AllocateBinary(RefArg theClass, Index length)
 {
+  tools::Stats::count(tools::Stats::kBinariesAllocated);
   return Ref(new BinaryObject(theClass, length, ::calloc(length, 1)));
 }
 
+Ref dyn::Object::GetClass() const
+{
+  switch (t.tag_) {
+    case Tag::binary: return binary.class_;
+    case Tag::array: return array.class_;
+    case Tag::large_binary: return lbo.class_;
+    case Tag::real: return real.class_;
+    case Tag::symbol: return symbol.class_;
+    case Tag::native_ptr: return ptr.class_;
+    default: return RefNIL;
+  }
+}
+
+// Frames have no class field and are not changed.
+void dyn::Object::SetClass(RefArg theClass)
+{
+  switch (t.tag_) {
+    case Tag::binary: binary.class_ = theClass; break;
+    case Tag::array: array.class_ = theClass; break;
+    case Tag::large_binary: lbo.class_ = theClass; break;
+    case Tag::real: real.class_ = theClass; break;
+    case Tag::symbol: symbol.class_ = theClass; break;
+    case Tag::native_ptr: ptr.class_ = theClass; break;
+    default: break;
+  }
+}
+
+void dyn::SetClass(RefArg obj, RefArg theClass)
+{
+  if (!obj.IsPtr() || obj.IsFrame())
+    return;
+  CopyOnWrite::Writable(obj).GetObject()->SetClass(theClass);
+}
+
 Ptr dyn::BinaryData(Ref r)
 {
+  if (r.IsPtr() && r.GetObject()->IsLargeBinary())
+    return static_cast<LargeBinaryObject*>(r.GetObject())->Data();
   if (!r.IsBinary())
     return nullptr;
 //    throw BadTypeWithFrameData(kNSErrNotAnArray);
@@ -516,6 +1099,61 @@ Ptr dyn::BinaryData(Ref r)
   return binary->Data();
 }
 
+dyn::LargeBinaryObject::LargeBinaryObject(RefArg theClass)
+: Object( LargeBinary_{ theClass, nullptr, new LargeBinaryInfo() }, 0 )
+{ }
+
+// The data is not copied and must outlive the object, unless the owner
+// keeps it alive.
+void dyn::LargeBinaryObject::SetView(const void *data, size_t size, std::shared_ptr<const void> owner)
+{
+  if (lbo.info_->owned_)
+    ::free(lbo.data_);
+  lbo.info_->owner_ = std::move(owner);
+  lbo.data_ = (char*)const_cast<void*>(data);
+  lbo.info_->size_ = size;
+  lbo.info_->owned_ = false;
+  size_ = (uint32_t)std::min(size, (size_t)0x00ffffff);
+}
+
+void *dyn::LargeBinaryObject::Allocate(size_t size)
+{
+  if (lbo.info_->owned_)
+    ::free(lbo.data_);
+  lbo.data_ = (char*)::calloc(size ? size : 1, 1);
+  lbo.info_->owner_.reset();
+  lbo.info_->size_ = size;
+  lbo.info_->owned_ = true;
+  size_ = (uint32_t)std::min(size, (size_t)0x00ffffff);
+  return lbo.data_;
+}
+
+void dyn::LargeBinaryObject::SetCompander(RefArg name, const uint8_t *params, size_t params_size)
+{
+  lbo.info_->compander_ = name;
+  lbo.info_->params_.assign(params, params + params_size);
+}
+
+// All smallRects share one map, the first frame that adds a slot gets a copy.
+Ref dyn::MakeSmallRect(int top, int left, int bottom, int right)
+{
+  static Map *const rect_map = []() {
+    Map *map = new Map(Ref(kMapShared), 5);
+    map->SetSlot(0, RefNIL);
+    map->SetSlot(1, Sym("top"));
+    map->SetSlot(2, Sym("left"));
+    map->SetSlot(3, Sym("bottom"));
+    map->SetSlot(4, Sym("right"));
+    return map;
+  }();
+  Ref *slots = (Ref*)::malloc(4 * sizeof(Ref));
+  slots[0] = Ref(top);
+  slots[1] = Ref(left);
+  slots[2] = Ref(bottom);
+  slots[3] = Ref(right);
+  return Ref(new Frame(rect_map, 4, slots));
+}
+
 Ref dyn::MakeReal(Real d)
 {
   return Ref(new Object(d));
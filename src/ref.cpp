@@ -62,7 +62,8 @@ int Ref::Print(dyn::io::PrintState &ps) const
 {
   switch (tag_()) {
     case kTagPointer:
-      o_->Print(ps);
+      // Print what a read would see, the copy of a read-only object if it has one.
+      CopyOnWrite::Follow(o_)->Print(ps);
       break;
     case kTagInteger:
       fprintf(ps.out_, "%ld", tag_value_());
@@ -104,8 +105,8 @@ int Ref::Print(dyn::io::PrintState &ps) const
       }
       break;
     case kTagMagicPtr: {
-      int table = static_cast<int>(r_ >> 14);
-      int index = static_cast<int>((r_ >> 4) & 0x00000fff);
+      int table = MagicTable();
+      int index = MagicIndex();
       if (table) {
         std::fprintf(ps.out_, "@%d.%d", table, index);
       } else {
@@ -152,8 +153,8 @@ std::string dyn::Ref::ToString() const {
       }
       break;
     case kTagMagicPtr: {
-      int table = static_cast<int>(r_ >> 14);
-      int index = static_cast<int>((r_ >> 4) & 0x00000fff);
+      int table = MagicTable();
+      int index = MagicIndex();
       if (table) {
         return "@" + std::to_string(table) + "." + std::to_string(index);
       } else {
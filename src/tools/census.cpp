@@ -0,0 +1,287 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/tools/census.h>
+#include <dyn/objects.h>
+
+#include <cctype>
+#include <iomanip>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+using namespace dyn;
+using namespace dyn::tools;
+
+
+/** \class dyn::tools::Census
+ Count the objects and bytes that are reachable from a root object.
+
+ Every object is counted once, no matter how often it is referenced. The
+ census splits the heap by kind of object and binaries by their class
+ symbol, so 'string, 'instructions, 'bits and 'samples show up as their
+ own rows. Byte counts are the object header plus its payload; the reserve
+ of growable arrays and the allocator overhead are not included.
+
+ Two more numbers help to decide which memory optimisation pays off:
+ binaries, maps, and symbols with the same content as one that was seen
+ before could be shared by interning them, and the histogram of frame sizes
+ shows how many frames would fit into a few inline slots.
+
+ Several roots can be added to the same census; objects that are shared
+ between them are still counted once.
+ */
+
+
+static const char *const kKindNames[] = {
+  "binary", "large_binary", "array", "frame", "map", "symbol", "real", "other"
+};
+static_assert(sizeof(kKindNames)/sizeof(kKindNames[0]) == Census::kNumKinds, "kind names do not match");
+
+static const char *const kSlotBucketNames[] = {
+  "0", "1", "2", "3-4", "5-8", "9-16", "17-32", ">32"
+};
+static_assert(sizeof(kSlotBucketNames)/sizeof(kSlotBucketNames[0]) == Census::kNumSlotBuckets, "bucket names do not match");
+
+
+static std::string ClassName(Ref cls)
+{
+  if (cls.IsSymbol())
+    return static_cast<const Symbol*>(cls.GetObject())->Name();
+  return "?";
+}
+
+// Symbols compare by name without case, even when they are different objects.
+static void AppendKey(std::string &key, Ref r)
+{
+  if (r.IsSymbol()) {
+    for (const char *s = static_cast<const Symbol*>(r.GetObject())->Name(); *s; ++s)
+      key.push_back((char)std::tolower((unsigned char)*s));
+    key.push_back('\0');
+  } else {
+    Ref::Verbatim_ v = r.GetVerbatim();
+    key.append((const char*)&v, sizeof(v));
+  }
+}
+
+// Binaries are only duplicates if they have the same class and data.
+static bool SameBinary(const Object *a, const Object *b)
+{
+  if ((a->size() != b->size()) || (ClassName(a->GetClass()) != ClassName(b->GetClass())))
+    return false;
+  return (a->size() == 0) || (::memcmp(BinaryData(Ref(const_cast<Object*>(a))),
+                                       BinaryData(Ref(const_cast<Object*>(b))), a->size()) == 0);
+}
+
+static int SlotBucket(Index n)
+{
+  if (n <= 0) return 0;
+  int b = 1;
+  while (b < Census::kNumSlotBuckets-1 && ((Index)1 << (b-1)) < n)
+    ++b;
+  return b;
+}
+
+
+/**
+ Walk all objects that can be reached from a root and add them to the census.
+ \param[in] root any reference; immediates and magic pointers are ignored
+ */
+void Census::add(RefArg root)
+{
+  std::vector<std::pair<Ref, bool>> todo { { root, false } };
+  while (!todo.empty()) {
+    Ref ref = todo.back().first;
+    bool is_map = todo.back().second;
+    todo.pop_back();
+    Object *o = ref.GetObject();
+    if (!o || !visited_.insert(o).second)
+      continue;
+
+    Kind k = kOther;
+    uint64_t bytes = sizeof(Object) + o->size();
+    if (o->IsBinary()) {
+      k = kBinary;
+      std::string name = ClassName(o->GetClass());
+      Entry &c = classes_[name];
+      c.count++;
+      c.bytes += bytes;
+      size_t hash = o->size() ? std::hash<std::string_view>()(
+        std::string_view((const char*)BinaryData(ref), o->size())) : 0;
+      auto &same_hash = binary_contents_[{ (uint64_t)o->size(), hash }];
+      bool duplicate = false;
+      for (const Object *other: same_hash) {
+        if (SameBinary(o, other)) {
+          duplicate = true;
+          break;
+        }
+      }
+      if (duplicate) {
+        duplicate_binaries_.count++;
+        duplicate_binaries_.bytes += bytes;
+      } else {
+        same_hash.push_back(o);
+      }
+      todo.push_back({ o->GetClass(), false });
+    } else if (o->IsLargeBinary()) {
+      k = kLargeBinary;
+      auto lbo = static_cast<LargeBinaryObject*>(o);
+      bytes = sizeof(Object) + sizeof(LargeBinaryInfo) + (lbo->IsView() ? 0 : lbo->Length());
+      Entry &c = classes_[ClassName(o->GetClass())];
+      c.count++;
+      c.bytes += bytes;
+      todo.push_back({ o->GetClass(), false });
+    } else if (o->IsArray()) {
+      auto array = static_cast<const Array*>(o);
+      if (is_map) {
+        k = kMap;
+        std::string content;
+        for (Index i=0; i<array->Length(); ++i)
+          AppendKey(content, array->GetSlot(i));
+        if (!map_contents_.insert(std::move(content)).second) {
+          duplicate_maps_.count++;
+          duplicate_maps_.bytes += bytes;
+        }
+      } else {
+        k = kArray;
+      }
+      todo.push_back({ o->GetClass(), false });
+      // Slot 0 of a map is its super map, which is a map as well.
+      for (Index i=0; i<array->Length(); ++i)
+        todo.push_back({ array->GetSlot(i), is_map && (i == 0) });
+    } else if (o->IsFrame()) {
+      k = kFrame;
+      auto frame = static_cast<const Frame*>(o);
+      slot_buckets_[SlotBucket(frame->Length())]++;
+      todo.push_back({ Ref(static_cast<Object*>(frame->GetMap())), true });
+      for (Index i=0; i<frame->Length(); ++i)
+        todo.push_back({ frame->GetSlot(i), false });
+    } else if (o->IsSymbol()) {
+      k = kSymbol;
+      std::string name;
+      AppendKey(name, ref);
+      if (!symbol_names_.insert(std::move(name)).second) {
+        duplicate_symbols_.count++;
+        duplicate_symbols_.bytes += bytes;
+      }
+    } else if (o->IsReal()) {
+      k = kReal;
+      bytes = sizeof(Object);
+    }
+    kinds_[k].count++;
+    kinds_[k].bytes += bytes;
+  }
+}
+
+
+/**
+ Return the number of objects and bytes of all kinds together.
+ */
+Census::Entry Census::total() const
+{
+  Entry sum;
+  for (const Entry &e: kinds_) {
+    sum.count += e.count;
+    sum.bytes += e.bytes;
+  }
+  return sum;
+}
+
+
+/**
+ Write the census as a human readable table.
+ \param[in] out destination
+ */
+void Census::write_table(std::ostream &out) const
+{
+  auto row = [&out](const std::string &name, const Entry &e) {
+    out << std::left << std::setw(24) << name << std::right
+        << std::setw(12) << e.count << std::setw(14) << e.bytes << "\n";
+  };
+  out << std::left << std::setw(24) << "kind" << std::right
+      << std::setw(12) << "objects" << std::setw(14) << "bytes" << "\n";
+  for (int k=0; k<kNumKinds; ++k)
+    if (kinds_[k].count)
+      row(kKindNames[k], kinds_[k]);
+  row("total", total());
+
+  out << "\n" << std::left << std::setw(24) << "binary class" << std::right
+      << std::setw(12) << "objects" << std::setw(14) << "bytes" << "\n";
+  for (auto &c: classes_)
+    row("'" + c.first, c.second);
+
+  out << "\n" << std::left << std::setw(24) << "duplicates" << std::right
+      << std::setw(12) << "objects" << std::setw(14) << "bytes" << "\n";
+  row("binary", duplicate_binaries_);
+  row("map", duplicate_maps_);
+  row("symbol", duplicate_symbols_);
+
+  out << "\n" << std::left << std::setw(24) << "frame slots" << std::right
+      << std::setw(12) << "frames" << "\n";
+  for (int b=0; b<kNumSlotBuckets; ++b)
+    out << std::left << std::setw(24) << kSlotBucketNames[b] << std::right
+        << std::setw(12) << slot_buckets_[b] << "\n";
+}
+
+
+/**
+ Write the census as one JSON object.
+ \param[in] out destination
+ */
+void Census::write_json(std::ostream &out) const
+{
+  auto entry = [&out](const Entry &e) {
+    out << "{\"objects\":" << e.count << ",\"bytes\":" << e.bytes << "}";
+  };
+  out << "{\"kinds\":{";
+  for (int k=0; k<kNumKinds; ++k) {
+    out << (k ? "," : "") << "\"" << kKindNames[k] << "\":";
+    entry(kinds_[k]);
+  }
+  out << "},\"total\":";
+  entry(total());
+  out << ",\"classes\":{";
+  bool first = true;
+  for (auto &c: classes_) {
+    out << (first ? "" : ",") << "\"";
+    for (char ch: c.first) {
+      if (ch == '"' || ch == '\\') out << '\\';
+      if ((unsigned char)ch >= 0x20) out << ch;
+    }
+    out << "\":";
+    entry(c.second);
+    first = false;
+  }
+  out << "},\"duplicates\":{\"binary\":";
+  entry(duplicate_binaries_);
+  out << ",\"map\":";
+  entry(duplicate_maps_);
+  out << ",\"symbol\":";
+  entry(duplicate_symbols_);
+  out << "},\"frame_slots\":{";
+  for (int b=0; b<kNumSlotBuckets; ++b)
+    out << (b ? "," : "") << "\"" << kSlotBucketNames[b] << "\":" << slot_buckets_[b];
+  out << "}}\n";
+}
@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/tools/stats.h>
+
+#include <iomanip>
+#include <ostream>
+
+using namespace dyn::tools;
+
+
+/** \class dyn::tools::Stats
+ Counters and phase timers for `dynec --stats`.
+
+ Counting is off by default. While it is off, every counter and timer
+ costs a single relaxed load. All counters are atomic, so the parallel
+ decompiler can count as well; the time of a phase is the sum over all
+ threads that ran it. Phases can nest, for example comparing packages
+ loads the other package, so phase times may add up to more than the
+ total time.
+ */
+
+
+static const char *const kCounterNames[] = {
+  "bytes_read",
+  "decoded_binaries", "decoded_symbols", "decoded_arrays", "decoded_maps", "decoded_frames",
+  "allocated_frames", "allocated_arrays", "allocated_binaries", "created_symbols"
+};
+static_assert(sizeof(kCounterNames)/sizeof(kCounterNames[0]) == Stats::kNumCounters, "counter names do not match");
+
+static const char *const kPhaseNames[] = {
+  "load", "toNOS", "writeAsm", "compare", "decompile"
+};
+static_assert(sizeof(kPhaseNames)/sizeof(kPhaseNames[0]) == Stats::kNumPhases, "phase names do not match");
+
+
+/**
+ Set all counters and timers to zero.
+ */
+void Stats::reset()
+{
+  for (auto &c: counters_) c.store(0, std::memory_order_relaxed);
+  for (auto &c: calls_) c.store(0, std::memory_order_relaxed);
+  for (auto &c: nanoseconds_) c.store(0, std::memory_order_relaxed);
+}
+
+
+/**
+ Write all phases and counters as a human readable table.
+ \param[in] out destination
+ */
+void Stats::write_table(std::ostream &out)
+{
+  out << std::left << std::setw(20) << "phase" << std::right
+      << std::setw(10) << "calls" << std::setw(14) << "ms" << "\n";
+  for (int p=0; p<kNumPhases; ++p) {
+    if (!calls((Phase)p))
+      continue;
+    out << std::left << std::setw(20) << kPhaseNames[p] << std::right
+        << std::setw(10) << calls((Phase)p)
+        << std::setw(14) << std::fixed << std::setprecision(3) << nanoseconds((Phase)p) / 1e6 << "\n";
+  }
+  out << "\n" << std::left << std::setw(20) << "counter" << std::right << std::setw(24) << "value" << "\n";
+  for (int c=0; c<kNumCounters; ++c) {
+    out << std::left << std::setw(20) << kCounterNames[c] << std::right
+        << std::setw(24) << counter((Counter)c) << "\n";
+  }
+}
+
+
+/**
+ Write all phases and counters as one JSON object.
+ \param[in] out destination
+ */
+void Stats::write_json(std::ostream &out)
+{
+  out << "{\"phases\":{";
+  for (int p=0; p<kNumPhases; ++p) {
+    out << (p ? "," : "") << "\"" << kPhaseNames[p] << "\":{\"calls\":" << calls((Phase)p)
+        << ",\"ns\":" << nanoseconds((Phase)p) << "}";
+  }
+  out << "},\"counters\":{";
+  for (int c=0; c<kNumCounters; ++c)
+    out << (c ? "," : "") << "\"" << kCounterNames[c] << "\":" << counter((Counter)c);
+  out << "}}\n";
+}
@@ -32,9 +32,15 @@
 #include <codecvt>
 #include <memory>
 #include <string>
+#include <iomanip>
 
+#if defined(__clang__)
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
 
 /**
  Convert a Unicode UTF-16 string into UTF-8 byte sequence.
@@ -50,7 +56,11 @@ std::u16string utf8_to_utf16(std::string &str) {
   return std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>{}.from_bytes(str);
 }
 
+#if defined(__clang__)
 #pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
 
 int write_utf16(std::ofstream &f, std::string &u8str) {
   f << "\t@ \"" << u8str << "\"" << std::endl;
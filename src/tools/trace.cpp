@@ -0,0 +1,188 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/tools/trace.h>
+
+#include <cstdio>
+#include <iostream>
+
+using namespace dyn::tools;
+
+
+/** \class dyn::tools::Trace
+ Collect spans in Chrome trace-event format.
+
+ Between start() and stop(), every TraceSpan records a complete event with
+ its name, category, thread, start time, and duration. stop() writes all
+ events as JSON that chrome://tracing and Perfetto can open. Spans on
+ worker threads show up in their own lane, which makes stragglers in
+ parallel runs easy to see.
+
+ Span names and categories must be string literals, they are stored as
+ pointers until the trace is written. While tracing is off, a span costs a
+ single relaxed load.
+ */
+
+
+static void put_json_string(std::string &out, const std::string &s)
+{
+  out.push_back('"');
+  for (char c: s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char buf[8];
+          ::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+          out += buf;
+        } else {
+          out.push_back(c);
+        }
+    }
+  }
+  out.push_back('"');
+}
+
+
+/**
+ Start collecting events.
+ \param[in] file_name stop() writes the trace to this file
+ */
+void Trace::start(const std::string &file_name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.clear();
+  file_name_ = file_name;
+  start_ = std::chrono::steady_clock::now();
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+
+/**
+ Stop collecting events and write the trace file.
+ Spans that are still open when the trace stops are not written.
+ \return 0 if succeeded
+ */
+int Trace::stop()
+{
+  enabled_.store(false, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string out { "{\"traceEvents\":[\n" };
+  out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"dynec\"}}";
+  char buf[160];
+  for (const Event &e: events_) {
+    out += ",\n{\"name\":";
+    put_json_string(out, e.name);
+    out += ",\"cat\":";
+    put_json_string(out, e.cat);
+    ::snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+               e.tid, e.ts, e.dur);
+    out += buf;
+    if (!e.args.empty())
+      out += ",\"args\":{" + e.args + "}";
+    out += "}";
+  }
+  out += "\n]}\n";
+  events_.clear();
+
+  std::FILE *f = std::fopen(file_name_.c_str(), "wb");
+  if (!f) {
+    std::cout << "ERROR: can't create trace file \"" << file_name_ << "\"." << std::endl;
+    return -1;
+  }
+  size_t n = std::fwrite(out.data(), 1, out.size(), f);
+  if (std::fclose(f) != 0 || n != out.size()) {
+    std::cout << "ERROR: can't write trace file \"" << file_name_ << "\"." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ Microseconds since the trace started.
+ */
+double Trace::now()
+{
+  auto d = std::chrono::steady_clock::now() - start_;
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+
+/**
+ A small number for the calling thread, in the order in which threads
+ first record a span.
+ */
+uint32_t Trace::thread_id()
+{
+  thread_local uint32_t tid = next_tid_.fetch_add(1, std::memory_order_relaxed);
+  return tid;
+}
+
+
+/**
+ Record a complete event.
+ \param[in] name, cat string literals
+ \param[in] ts, dur start and duration in microseconds
+ \param[in] args JSON object members, or empty
+ */
+void Trace::add(const char *name, const char *cat, double ts, double dur, std::string args)
+{
+  uint32_t tid = thread_id();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (enabled())
+    events_.push_back( { name, cat, tid, ts, dur, std::move(args) } );
+}
+
+
+/**
+ Add an integer argument that is shown with the span.
+ */
+void TraceSpan::arg(const char *key, int64_t value)
+{
+  if (!active_)
+    return;
+  if (!args_.empty())
+    args_.push_back(',');
+  put_json_string(args_, key);
+  args_ += ":" + std::to_string(value);
+}
+
+
+/**
+ Add a text argument that is shown with the span.
+ */
+void TraceSpan::arg(const char *key, const std::string &value)
+{
+  if (!active_)
+    return;
+  if (!args_.empty())
+    args_.push_back(',');
+  put_json_string(args_, key);
+  args_.push_back(':');
+  put_json_string(args_, value);
+}
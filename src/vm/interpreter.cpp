@@ -0,0 +1,2134 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dyn/vm/interpreter.h>
+#include <dyn/vm/profile.h>
+#include <dyn/errors.h>
+#include "../lang/transcode.h"
+#include "../lang/verify.h"
+#include "jit.h"
+#include "optimize.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+using namespace dyn;
+using namespace dyn::lang;
+using namespace dyn::vm;
+
+// Direct threaded dispatch needs the "labels as values" extension.
+#if defined(__GNUC__)
+# define DYN_VM_THREADED 1
+#else
+# define DYN_VM_THREADED 0
+#endif
+
+namespace {
+
+constexpr Symbol kSymObjLiterals { "literals" };
+constexpr Ref kSymLiterals { kSymObjLiterals };
+constexpr Symbol kSymObjArgFrame { "argFrame" };
+constexpr Ref kSymArgFrame { kSymObjArgFrame };
+constexpr Symbol kSymObjNumArgs { "numArgs" };
+constexpr Ref kSymNumArgs { kSymObjNumArgs };
+constexpr Symbol kSymObjProto { "_proto" };
+constexpr Ref kSymProto { kSymObjProto };
+constexpr Symbol kSymObjParent { "_parent" };
+constexpr Ref kSymParent { kSymObjParent };
+constexpr Symbol kSymObjClass { "class" };
+constexpr Ref kSymClass { kSymObjClass };
+constexpr Symbol kSymObjForEachState { "forEachState" };
+constexpr Ref kSymForEachState { kSymObjForEachState };
+constexpr Symbol kSymObjEvtExFr { "evt.ex.fr" };
+constexpr Ref kSymEvtExFr { kSymObjEvtExFr };
+constexpr Symbol kSymObjEvtExFrIntrp { "evt.ex.fr.intrp" };
+constexpr Ref kSymEvtExFrIntrp { kSymObjEvtExFrIntrp };
+
+// Slots of the iterator array that 'foreach' reads with 'aref'.
+enum { kIterTag, kIterValue, kIterObject, kIterDeeply, kIterIndex, kIterSize };
+
+/**
+ Convert the argument of push_const into a Ref.
+ Integers are sign extended, all other immediates use the lower 16 bits.
+ */
+inline Ref ns_const(int32_t arg)
+{
+  if ((arg & 3) == 0)
+    return Ref((Integer)(arg >> 2));
+  return Ref::NSRef((uint32_t)(arg & 0xffff));
+}
+
+// Read-only frames and arrays that were written are read from their copy.
+inline Frame *as_frame(RefArg ref)
+{
+  return static_cast<Frame*>(CopyOnWrite::Follow(ref.GetObject()));
+}
+
+inline Array *as_array(RefArg ref)
+{
+  return static_cast<Array*>(CopyOnWrite::Follow(ref.GetObject()));
+}
+
+/**
+ Find a slot in a frame without inheritance.
+ */
+bool frame_slot(RefArg frame, RefArg tag, Ref &value)
+{
+  Frame *f = as_frame(frame);
+  Index i = FindOffset(Ref(f->GetMap()), tag);
+  if (i < 0)
+    return false;
+  value = f->GetSlot(i);
+  return true;
+}
+
+/**
+ Find a slot in a frame or in its _proto chain.
+ */
+bool proto_slot(Ref frame, RefArg tag, Ref &value)
+{
+  for (; frame.IsFrame(); frame = MagicPointers::Resolve(as_frame(frame)->GetSlot(kSymProto))) {
+    if (frame_slot(frame, tag, value))
+      return true;
+  }
+  return false;
+}
+
+inline Ref slot_at(RefArg frame, Index i)
+{
+  return frame.IsFrame() ? as_frame(frame)->GetSlot(i) : RefNIL;
+}
+
+bool is_real(RefArg ref)
+{
+  Object *o = ref.GetObject();
+  return o && o->IsReal();
+}
+
+Real as_real(RefArg ref)
+{
+  if (ref.IsInt())
+    return (Real)ref.GetInt();
+  Object *o = ref.GetObject();
+  if (o && o->IsReal())
+    return o->GetReal();
+  throw BadTypeWithFrameData(kDyneErrNotANumber, ref.ToString());
+}
+
+Integer as_int(RefArg ref)
+{
+  if (!ref.IsInt())
+    throw BadTypeWithFrameData(kDyneErrNotAnInteger, ref.ToString());
+  return ref.GetInt();
+}
+
+const char *as_string(RefArg ref)
+{
+  if (!ref.IsBinary())
+    return nullptr;
+  Object *o = ref.GetObject();
+  if (!(o->GetClass() == gSymString) && SymbolCompare(o->GetClass(), gSymString) != 0)
+    return nullptr;
+  return (const char*)BinaryData(ref);
+}
+
+/**
+ NewtonScript equality: identical refs, equal numbers, or symbols with the same name.
+ */
+bool equals(RefArg a, RefArg b)
+{
+  if (a == b)
+    return true;
+  if (a.IsSymbol() && b.IsSymbol())
+    return SymbolCompare(a, b) == 0;
+  if (is_real(a) || is_real(b)) {
+    if ((a.IsInt() || is_real(a)) && (b.IsInt() || is_real(b)))
+      return as_real(a) == as_real(b);
+  }
+  return false;
+}
+
+/**
+ Compare two numbers, characters, or strings.
+ \return <0, 0, or >0
+ */
+int compare(RefArg a, RefArg b)
+{
+  if (a.IsChar() && b.IsChar())
+    return (a.GetChar() < b.GetChar()) ? -1 : (a.GetChar() > b.GetChar());
+  const char *sa = as_string(a), *sb = as_string(b);
+  if (sa && sb)
+    return symcmp(sa, sb);
+  Real ra = as_real(a), rb = as_real(b);
+  return (ra < rb) ? -1 : (ra > rb);
+}
+
+enum class Arith { Add, Subtract, Multiply, Divide };
+
+// Integer refs keep two bits for the tag, so they hold 62 bit values.
+constexpr Integer kMinInteger = -((Integer)1 << 61);
+constexpr Integer kMaxInteger = ((Integer)1 << 61) - 1;
+
+/**
+ Add two integers.
+ \return false if the sum does not fit into an integer ref
+ */
+inline bool add_int(Integer x, Integer y, Integer &r)
+{
+  return !__builtin_add_overflow(x, y, &r) && (r >= kMinInteger) && (r <= kMaxInteger);
+}
+
+/**
+ Subtract two integers.
+ \return false if the difference does not fit into an integer ref
+ */
+inline bool sub_int(Integer x, Integer y, Integer &r)
+{
+  return !__builtin_sub_overflow(x, y, &r) && (r >= kMinInteger) && (r <= kMaxInteger);
+}
+
+/**
+ Multiply two integers.
+ \return false if the product does not fit into an integer ref
+ */
+inline bool mul_int(Integer x, Integer y, Integer &r)
+{
+  return !__builtin_mul_overflow(x, y, &r) && (r >= kMinInteger) && (r <= kMaxInteger);
+}
+
+/**
+ Arithmetic on any combination of integers and reals.
+ The integer cases are handled inline by the interpreter.
+ */
+Ref arith(Arith op, RefArg a, RefArg b)
+{
+  if (a.IsInt() && b.IsInt()) {
+    Integer x = a.GetInt(), y = b.GetInt(), r;
+    switch (op) {
+      case Arith::Add:
+        if (add_int(x, y, r))
+          return Ref(r);
+        break;
+      case Arith::Subtract:
+        if (sub_int(x, y, r))
+          return Ref(r);
+        break;
+      case Arith::Multiply:
+        if (mul_int(x, y, r))
+          return Ref(r);
+        break;
+      case Arith::Divide:
+        if (y == 0)
+          throw RuntimeError(kDyneErrDivideByZero);
+        if (x % y == 0)
+          return Ref(x / y);
+        return MakeReal((Real)x / (Real)y);
+    }
+  }
+  Real x = as_real(a), y = as_real(b);
+  switch (op) {
+    case Arith::Add: return MakeReal(x + y);
+    case Arith::Subtract: return MakeReal(x - y);
+    case Arith::Multiply: return MakeReal(x * y);
+    case Arith::Divide:
+      if (y == 0.0)
+        throw RuntimeError(kDyneErrDivideByZero);
+      return MakeReal(x / y);
+  }
+  return RefNIL;
+}
+
+Ref class_of(RefArg obj)
+{
+  if (obj.IsInt()) return Sym("int");
+  if (obj.IsChar()) return Sym("char");
+  if (obj.IsTrue()) return Sym("boolean");
+  if (obj.IsNIL()) return RefNIL;
+  if (obj.IsSymbol()) return Sym("symbol");
+  if (obj.IsFrame()) {
+    Ref cls;
+    if (proto_slot(obj, kSymClass, cls) && cls.IsNotNIL())
+      return cls;
+    return Sym("frame");
+  }
+  if (obj.IsPtr()) return obj.GetObject()->GetClass();
+  return Sym("weird_immediate");
+}
+
+Ref length_of(RefArg obj)
+{
+  Object *o = CopyOnWrite::Follow(obj.GetObject());
+  if (o && (o->IsArray() || o->IsFrame()))
+    return Ref((Integer)static_cast<SlottedObject*>(o)->Length());
+  if (o && o->IsBinary())
+    return Ref((Integer)o->size());
+  throw BadTypeWithFrameData(kDyneErrNotAnArray, obj.ToString());
+}
+
+Ref aref(RefArg obj, RefArg index)
+{
+  Integer i = as_int(index);
+  if (obj.IsArray()) {
+    Array *a = as_array(obj);
+    if (i < 0 || i >= a->Length())
+      throw FramesWithBadValue(kDyneErrNotAnArray, "index out of bounds");
+    return a->GetSlot(i);
+  }
+  const char *str = as_string(obj);
+  if (str) {
+    if (i < 0 || i >= (Integer)::strlen(str))
+      throw FramesWithBadValue(kDyneErrNotAnArray, "index out of bounds");
+    return Ref((UniChar)(uint8_t)str[i]);
+  }
+  throw BadTypeWithFrameData(kDyneErrNotAnArray, obj.ToString());
+}
+
+void set_aref(RefArg obj, RefArg index, RefArg value)
+{
+  Integer i = as_int(index);
+  if (!obj.IsArray())
+    throw BadTypeWithFrameData(kDyneErrNotAnArray, obj.ToString());
+  Array *a = static_cast<Array*>(CopyOnWrite::Writable(obj).GetObject());
+  if (i < 0 || i >= a->Length())
+    throw FramesWithBadValue(kDyneErrNotAnArray, "index out of bounds");
+  a->SetSlot(i, value);
+}
+
+/**
+ Follow one element of a path expression.
+ \return false if the element does not exist
+ */
+bool path_step(Ref &obj, RefArg elt)
+{
+  obj = MagicPointers::Resolve(obj);
+  if (elt.IsSymbol()) {
+    if (!obj.IsFrame())
+      return false;
+    Ref value;
+    if (!proto_slot(obj, elt, value))
+      return false;
+    obj = value;
+    return true;
+  }
+  if (elt.IsInt() && obj.IsArray()) {
+    Array *a = as_array(obj);
+    if (elt.GetInt() < 0 || elt.GetInt() >= a->Length())
+      return false;
+    obj = a->GetSlot(elt.GetInt());
+    return true;
+  }
+  return false;
+}
+
+/**
+ Resolve a path expression.
+ A path is a symbol, an integer, or an array of both.
+ \return false if any element of the path does not exist
+ */
+bool resolve_path(Ref obj, RefArg path, Ref &value)
+{
+  if (path.IsArray() && !path.IsSymbol()) {
+    Array *p = static_cast<Array*>(path.GetObject());
+    for (Index i=0; i<p->Length(); ++i) {
+      if (!path_step(obj, p->GetSlot(i)))
+        return false;
+    }
+  } else if (!path_step(obj, path)) {
+    return false;
+  }
+  value = obj;
+  return true;
+}
+
+Ref get_path(RefArg obj, RefArg path, bool check)
+{
+  Ref value = RefNIL;
+  if (resolve_path(obj, path, value))
+    return value;
+  if (check && !obj.IsFrame() && !obj.IsArray())
+    throw BadTypeWithFrameData(kDyneErrNotAFrame, obj.ToString());
+  return RefNIL;
+}
+
+void set_path(Ref obj, RefArg path, RefArg value)
+{
+  Ref last = path;
+  if (path.IsArray()) {
+    Array *p = static_cast<Array*>(path.GetObject());
+    Index n = p->Length();
+    if (n == 0)
+      throw BadTypeWithFrameData(kDyneErrNotAPathExpr);
+    for (Index i=0; i<n-1; ++i) {
+      if (!path_step(obj, p->GetSlot(i)))
+        throw BadTypeWithFrameData(kDyneErrNotAFrame, p->GetSlot(i).ToString());
+    }
+    last = p->GetSlot(n-1);
+  }
+  if (last.IsSymbol())
+    SetFrameSlot(obj, last, value);
+  else if (last.IsInt())
+    set_aref(obj, last, value);
+  else
+    throw BadTypeWithFrameData(kDyneErrNotAPathExpr, last.ToString());
+}
+
+/**
+ Load the tag and value at the current position of an iterator.
+ Walks into the _proto chain of frames if the iterator is deep.
+ */
+void iter_load(Array *it)
+{
+  for (;;) {
+    Ref obj = it->GetSlot(kIterObject);
+    Index i = it->GetSlot(kIterIndex).GetInt();
+    if (obj.IsArray()) {
+      Array *a = as_array(obj);
+      if (i < a->Length()) {
+        it->SetSlot(kIterTag, Ref((Integer)i));
+        it->SetSlot(kIterValue, a->GetSlot(i));
+        return;
+      }
+    } else if (obj.IsFrame()) {
+      Frame *f = as_frame(obj);
+      bool deeply = it->GetSlot(kIterDeeply).IsNotNIL();
+      if (i < f->Length()) {
+        Ref tag = f->GetTag(i);
+        if (deeply && tag.IsSymbol() && SymbolCompare(tag, kSymProto) == 0) {
+          it->SetSlot(kIterIndex, Ref((Integer)(i + 1)));
+          continue;
+        }
+        it->SetSlot(kIterTag, tag);
+        it->SetSlot(kIterValue, f->GetSlot(i));
+        return;
+      }
+      Ref proto = MagicPointers::Resolve(f->GetSlot(kSymProto));
+      if (deeply && proto.IsFrame()) {
+        it->SetSlot(kIterObject, proto);
+        it->SetSlot(kIterIndex, Ref(0));
+        continue;
+      }
+    }
+    it->SetSlot(kIterObject, RefNIL);
+    it->SetSlot(kIterTag, RefNIL);
+    it->SetSlot(kIterValue, RefNIL);
+    return;
+  }
+}
+
+Ref new_iter(RefArg obj, RefArg deeply)
+{
+  Ref iter = AllocateArray(kSymForEachState, kIterSize);
+  Array *it = static_cast<Array*>(iter.GetObject());
+  it->SetSlot(kIterTag, RefNIL);
+  it->SetSlot(kIterValue, RefNIL);
+  it->SetSlot(kIterObject, (obj.IsFrame() || obj.IsArray()) ? obj : RefNIL);
+  it->SetSlot(kIterDeeply, deeply);
+  it->SetSlot(kIterIndex, Ref(0));
+  iter_load(it);
+  return iter;
+}
+
+void iter_next(RefArg iter)
+{
+  if (!iter.IsArray())
+    throw BadTypeWithFrameData(kDyneErrNotAnArray, iter.ToString());
+  Array *it = static_cast<Array*>(iter.GetObject());
+  if (it->GetSlot(kIterObject).IsNIL())
+    return;
+  it->SetSlot(kIterIndex, Ref(it->GetSlot(kIterIndex).GetInt() + 1));
+  iter_load(it);
+}
+
+Ref iter_done(RefArg iter)
+{
+  if (!iter.IsArray())
+    throw BadTypeWithFrameData(kDyneErrNotAnArray, iter.ToString());
+  return Ref(GetArraySlot(iter, kIterObject).IsNIL());
+}
+
+void append_string(std::string &str, RefArg ref)
+{
+  char buf[32];
+  if (ref.IsNIL())
+    return;
+  if (ref.IsInt()) {
+    str += std::to_string(ref.GetInt());
+  } else if (ref.IsChar()) {
+    UniChar c = ref.GetChar();
+    if (c < 0x80) {
+      str += (char)c;
+    } else if (c < 0x800) {
+      str += (char)(0xC0 | (c >> 6));
+      str += (char)(0x80 | (c & 0x3F));
+    } else {
+      str += (char)(0xE0 | (c >> 12));
+      str += (char)(0x80 | ((c >> 6) & 0x3F));
+      str += (char)(0x80 | (c & 0x3F));
+    }
+  } else if (ref.IsSymbol()) {
+    str += static_cast<Symbol*>(ref.GetObject())->Name();
+  } else if (is_real(ref)) {
+    ::snprintf(buf, sizeof(buf), "%g", as_real(ref));
+    str += buf;
+  } else if (as_string(ref)) {
+    str += as_string(ref);
+  } else {
+    str += ref.ToString();
+  }
+}
+
+Ref stringer(RefArg array)
+{
+  if (!array.IsArray())
+    throw BadTypeWithFrameData(kDyneErrNotAnArray, array.ToString());
+  std::string str;
+  Array *a = as_array(array);
+  for (Index i=0; i<a->Length(); ++i)
+    append_string(str, a->GetSlot(i));
+  return MakeString(str);
+}
+
+/**
+ A polymorphic inline cache for slot lookups at one instruction.
+
+ Every entry remembers the maps of all frames that a lookup visited, the
+ indices of their _proto and _parent slots, and the index of the slot in
+ the last frame. A later lookup with the same tag replays the walk using
+ only these indices and compares maps instead of searching them. The
+ values of _proto and _parent are read again, so frames that share a map
+ but inherit from different frames are handled correctly.
+
+ Maps only change by appending tags, which increments Map::Version() of
+ the map that grew. An entry is only replayed if all maps it visited still
+ have the version it recorded. Adding _proto or _parent also increments
+ Map::Epoch() and invalidates all entries.
+ */
+} // namespace
+
+struct dyn::vm::InlineCache {
+  static constexpr int kEntries = 4;
+  static constexpr int kDepth = 8;
+  struct Entry {
+    Ref tag;
+    uint32_t epoch;
+    int lex;                  // number of lexical argFrames visited
+    int depth;                // number of frames visited, the last one holds the slot
+    Index index;              // slot index in the last frame
+    const Map *map[kDepth];
+    uint32_t version[kDepth]; // Map::Version() of each map
+    Index proto[kDepth];      // index of _proto or -1
+    Index parent[kDepth];     // index of _parent or -1
+  };
+  Entry entry[kEntries];
+  int size { 0 };
+  int next { 0 };
+};
+
+namespace {
+
+/**
+ Replay a cached lookup.
+ \return true and the value and holder, if all visited maps are unchanged
+ */
+bool replay(const InlineCache::Entry &e, Ref lex, Ref start, Ref &value, Ref &holder, Index &index)
+{
+  int k = 0;
+  for (Ref af = lex; af.IsFrame(); af = as_frame(af)->GetSlot(0)) {
+    Frame *f = as_frame(af);
+    if ((k >= e.depth) || (f->GetMap() != e.map[k]) || (f->GetMap()->Version() != e.version[k]))
+      return false;
+    if (k == e.depth - 1) {
+      value = f->GetSlot(e.index);
+      holder = af;
+      index = e.index;
+      return true;
+    }
+    ++k;
+  }
+  if (k != e.lex)
+    return false;
+  for (Ref f = start; f.IsFrame(); ) {
+    Ref parent = RefNIL;
+    bool have_parent = false;
+    for (Ref p = f; p.IsFrame(); ) {
+      Frame *fr = as_frame(p);
+      if ((k >= e.depth) || (fr->GetMap() != e.map[k]) || (fr->GetMap()->Version() != e.version[k]))
+        return false;
+      if (k == e.depth - 1) {
+        value = fr->GetSlot(e.index);
+        holder = p;
+        index = e.index;
+        return true;
+      }
+      if (!have_parent && (e.parent[k] >= 0)) {
+        parent = MagicPointers::Resolve(fr->GetSlot(e.parent[k]));
+        have_parent = true;
+      }
+      p = (e.proto[k] >= 0) ? MagicPointers::Resolve(fr->GetSlot(e.proto[k])) : RefNIL;
+      ++k;
+    }
+    f = parent;
+  }
+  return false;
+}
+
+/**
+ Look up a slot and remember the walk in an inline cache.
+
+ The lexical chain of argFrames is searched first, following slot 0
+ (_nextArgFrame) without inheritance. Then start is searched through its
+ _proto chain, and if parents is set, through its _parent chain.
+
+ \param[in] cache cache of the current instruction, or nullptr
+ \param[in] lex first argFrame, or NIL
+ \param[in] start_ref first frame for inheritance, a magic pointer, or NIL
+ \param[in] parents also follow _parent
+ \param[in] tag name of the slot
+ \param[out] value value of the slot
+ \param[out] holder frame that holds the slot
+ \param[out] index index of the slot in holder
+ \return true if the slot was found
+ */
+bool cached_lookup(InlineCache *cache, RefArg lex, RefArg start_ref, bool parents, RefArg tag,
+                   Ref &value, Ref &holder, Index &index)
+{
+  Ref start = MagicPointers::Resolve(start_ref);
+  uint32_t epoch = Map::Epoch();
+  if (cache) {
+    for (int i=0; i<cache->size; ++i) {
+      const InlineCache::Entry &e = cache->entry[i];
+      if ((e.tag == tag) && (e.epoch == epoch) && replay(e, lex, start, value, holder, index))
+        return true;
+    }
+  }
+
+  InlineCache::Entry e;
+  e.tag = tag;
+  e.epoch = epoch;
+  e.lex = 0;
+  e.depth = 0;
+  bool found = false;
+  auto visit = [&](RefArg ref, bool inherit, Index &proto, Index &parent) {
+    Frame *f = as_frame(ref);
+    Ref map(f->GetMap());
+    Index ix = FindOffset(map, tag);
+    proto = inherit ? FindOffset(map, kSymProto) : -1;
+    parent = (inherit && parents) ? FindOffset(map, kSymParent) : -1;
+    if (e.depth < InlineCache::kDepth) {
+      e.map[e.depth] = f->GetMap();
+      e.version[e.depth] = f->GetMap()->Version();
+      e.proto[e.depth] = proto;
+      e.parent[e.depth] = parent;
+    }
+    e.depth++;
+    if (ix >= 0) {
+      value = f->GetSlot(ix);
+      holder = ref;
+      index = e.index = ix;
+      found = true;
+    }
+  };
+
+  Index proto, parent;
+  for (Ref af = lex; af.IsFrame() && !found; af = as_frame(af)->GetSlot(0)) {
+    visit(af, false, proto, parent);
+    e.lex++;
+  }
+  for (Ref f = start; f.IsFrame() && !found; ) {
+    Ref next = RefNIL;
+    bool have_parent = false;
+    for (Ref p = f; p.IsFrame() && !found; ) {
+      visit(p, true, proto, parent);
+      if (!have_parent && (parent >= 0)) {
+        next = MagicPointers::Resolve(as_frame(p)->GetSlot(parent));
+        have_parent = true;
+      }
+      p = (proto >= 0) ? MagicPointers::Resolve(as_frame(p)->GetSlot(proto)) : RefNIL;
+    }
+    f = next;
+  }
+
+  if (found && cache && (e.depth <= InlineCache::kDepth)) {
+    int i = (cache->size < InlineCache::kEntries) ? cache->size++ : cache->next++ % InlineCache::kEntries;
+    cache->entry[i] = e;
+  }
+  return found;
+}
+
+/**
+ Instructions that have a variant for operands that the verifier proved to
+ be integers, in the order of the int_labels table in dispatch_().
+ */
+constexpr BC kIntVariants[] = {
+  BC::Add, BC::Subtract, BC::LessThan, BC::GreaterThan, BC::GreaterOrEqual,
+  BC::LessOrEqual, BC::IncrVar, BC::BranchLoop, BC::AddVarConst, BC::CompareBranch
+};
+
+bool compare_ints(Compare kind, Integer x, Integer y)
+{
+  switch (kind) {
+    case Compare::Less: return x < y;
+    case Compare::Greater: return x > y;
+    case Compare::LessOrEqual: return x <= y;
+    case Compare::GreaterOrEqual: return x >= y;
+    case Compare::Equal: return x == y;
+    default: return x != y;
+  }
+}
+
+bool has_cache(BC bc)
+{
+  switch (bc) {
+    case BC::Send: case BC::SendIfDefined: case BC::Resend: case BC::ResendIfDefined:
+    case BC::FindVar: case BC::GetPath: case BC::GetPathCheck: case BC::SetPath: case BC::SetPathVal:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ Check if an exception name is the handler symbol or one of its subclasses.
+ 'evt.ex catches 'evt.ex.fr.intrp, but not 'evt.exfoo.
+ */
+bool exception_matches(RefArg handler, RefArg name)
+{
+  if (!handler.IsSymbol() || !name.IsSymbol())
+    return false;
+  const char *h = static_cast<Symbol*>(handler.GetObject())->Name();
+  const char *n = static_cast<Symbol*>(name.GetObject())->Name();
+  size_t len = ::strlen(h);
+  for (size_t i=0; i<len; ++i) {
+    if (std::tolower((unsigned char)h[i]) != std::tolower((unsigned char)n[i]))
+      return false;
+  }
+  return (n[len] == 0) || (n[len] == '.');
+}
+
+Ref native_throw(Interpreter&, RefArg, const Ref *args, int num_args)
+{
+  if (num_args != 2)
+    throw RuntimeError(kDyneErrWrongNumberOfArgs, "Throw");
+  throw Exception(args[0], args[1]);
+}
+
+Ref native_current_exception(Interpreter &vm, RefArg, const Ref*, int)
+{
+  return vm.current_exception();
+}
+
+} // namespace
+
+/** \class dyn::vm::Interpreter
+ Run NewtonScript bytecode.
+
+ The interpreter executes function frames with the slots 'instructions,
+ 'literals, 'argFrame, and 'numArgs. The Newton bytecode is transcoded once
+ per function into Dyne bytecode and cached.
+
+ Message sends, variable lookups and slot paths have inline caches, see
+ InlineCache.
+
+ Functions start out in the interpreter. After kJitThreshold calls they
+ are compiled to machine code where the platform allows it, see
+ jit_compile(). Functions that can't be compiled keep being interpreted.
+
+ Calls between NewtonScript functions recurse in C++. All functions share
+ one operand stack. An interpreter instance must only be used by one thread
+ at a time.
+ */
+
+/**
+ One instruction prepared for dispatch.
+ Instructions that look up slots have an inline cache.
+ */
+struct Interpreter::Op {
+#if DYN_VM_THREADED
+  const void *label;
+#else
+  BC bc;
+#endif
+  int32_t arg;
+  InlineCache *cache;
+};
+
+/**
+ The transcoded bytecode of one function.
+ */
+struct Interpreter::Code {
+  const Object *key { nullptr };
+  size_t max_stack { 0 };
+  size_t num_locals { 0 };
+  std::vector<Bytecode> bc { };
+  std::vector<PC> offsets { };
+  std::vector<uint8_t> facts { };
+  std::vector<Op> ops { };
+  std::vector<InlineCache> caches { };
+  uint32_t calls { 0 };
+  bool jit_tried { false };
+  std::unique_ptr<JitCode> jit { };
+  std::vector<std::unique_ptr<JitCode>> retired { };   // may still be running
+  Profile::Function *profile { nullptr };
+};
+
+/**
+ The state of a running function.
+ */
+struct Interpreter::Activation {
+  Ref self;
+  Ref impl;
+  Ref locals;       // a copy of 'argFrame with the arguments filled in
+  Ref literals;
+  Code *code;
+  Ref *base;        // bottom of the operand stack of this function
+  size_t handlers;  // first exception handler of this function
+  size_t groups;    // first exception handler group of this function
+};
+
+/**
+ Connects compiled code of a running function to the interpreter.
+ */
+struct Interpreter::JitFrame {
+  Interpreter *vm;
+  Activation *act;
+  std::exception_ptr error { };
+};
+
+Interpreter::Interpreter()
+: stack_(kStackSize, RefNIL)
+{
+  top_ = stack_.data();
+  define_native("Throw", native_throw);
+  define_native("CurrentException", native_current_exception);
+}
+
+Interpreter::~Interpreter() = default;
+
+/**
+ Symbols are not unique, so globals are stored by their lower case name.
+ */
+std::string Interpreter::key_(RefArg sym)
+{
+  if (!sym.IsSymbol())
+    throw BadTypeWithFrameData(kDyneErrNotASymbol, sym.ToString());
+  std::string key = static_cast<Symbol*>(sym.GetObject())->Name();
+  for (auto &c: key)
+    c = (char)std::tolower((unsigned char)c);
+  return key;
+}
+
+/**
+ Get the bytecode that the interpreter runs for a function.
+ The code is transcoded, optimized and verified on first use, just as if the
+ function was called.
+ \param[in] func a function frame
+ \return the instructions, superinstructions included
+ */
+const std::vector<lang::Bytecode> &Interpreter::bytecode(RefArg func)
+{
+  return code_for_(func).bc;
+}
+
+/**
+ Get the transcoded bytecode of a function.
+ \param[in] func a function frame
+ \return the cached code
+ */
+Interpreter::Code &Interpreter::code_for_(RefArg func)
+{
+  Ref instructions = func.IsFrame() ? as_frame(func)->GetSlot(gSymInstructions) : RefNIL;
+  if (!instructions.IsBinary())
+    throw RuntimeError(kDyneErrNotAFunction, func.ToString());
+  auto &cached = code_cache_[instructions.GetObject()];
+  if (!cached) {
+    auto code = std::make_unique<Code>();
+    code->key = instructions.GetObject();
+    code->bc = transcode_from_ns(func, &code->offsets);
+    if (optimize_)
+      optimize(code->bc, code->offsets);
+    // Verified code cannot leave the stack or the locals, so the dispatch
+    // loop does not need to check them.
+    Ref literals = as_frame(func)->GetSlot(kSymLiterals);
+    Ref arg_frame = as_frame(func)->GetSlot(kSymArgFrame);
+    Verifier verifier;
+    verifier.num_literals = literals.IsArray() ? static_cast<Array*>(literals.GetObject())->Length() : 0;
+    verifier.num_locals = arg_frame.IsFrame() ? as_frame(arg_frame)->Length() : 0;
+    if (!verifier.verify(code->bc, code->offsets)) {
+      code_cache_.erase(instructions.GetObject());
+      throw RuntimeError(kDyneErrInvalidBytecode, std::to_string(verifier.error_pc) + ": " + verifier.error);
+    }
+    code->max_stack = verifier.max_depth;
+    code->num_locals = verifier.num_locals;
+    code->facts = std::move(verifier.facts);
+    cached = std::move(code);
+  }
+  return *cached;
+}
+
+/**
+ Call a NewtonScript function.
+ \param[in] func the function frame
+ \param[in] self the receiver
+ \param[in] impl the frame that implements the function
+ \param[in] args the arguments, on top of the operand stack
+ \param[in] num_args number of arguments
+ \return the result of the function
+ */
+Ref Interpreter::invoke_(RefArg func, RefArg self, RefArg impl, Ref *args, int num_args)
+{
+  Code &code = code_for_(func);
+  Frame *fn = as_frame(func);
+  Ref num = fn->GetSlot(kSymNumArgs);
+  if ((num.IsInt() ? (num.GetInt() & 0xffff) : 0) != num_args)
+    throw RuntimeError(kDyneErrWrongNumberOfArgs, func.ToString());
+  Ref arg_frame = fn->GetSlot(kSymArgFrame);
+  Ref locals = arg_frame.IsFrame() ? Clone(arg_frame) : AllocateFrame();
+  Frame *frame = as_frame(locals);
+  if (frame->Length() < 3 + num_args)
+    throw RuntimeError(kDyneErrWrongNumberOfArgs, func.ToString());
+  if ((size_t)frame->Length() < code.num_locals)
+    throw RuntimeError(kDyneErrInvalidBytecode, "argFrame is smaller than verified");
+  for (int i=0; i<num_args; ++i)
+    frame->SlottedObject::SetSlot(3 + i, args[i]);
+
+  // The arguments were copied, so the callee may use their stack space.
+  Activation act { self, impl, locals, fn->GetSlot(kSymLiterals), &code, args,
+                   handlers_.size(), groups_.size() };
+  struct Guard {
+    Interpreter &vm;
+    Activation &act;
+    Ref *top;
+    ~Guard() {
+      vm.handlers_.resize(act.handlers);
+      vm.groups_.resize(act.groups);
+      vm.top_ = top;
+      vm.call_depth_--;
+    }
+  } guard { *this, act, top_ };
+  if (++call_depth_ > kMaxCallDepth
+      || args + code.max_stack + 2 > stack_.data() + stack_.size())
+    throw RuntimeError(kDyneErrStackOverflow);
+  if (profile_) {
+    // Time between calls from the host is not charged to anybody.
+    if (call_depth_ == 1)
+      profile_->resume();
+    Profile::Function &f = profile_->function(code.key, func, code.bc, code.offsets);
+    f.calls++;
+    if (f.name.empty() && profile_msg_.IsSymbol())
+      f.name = static_cast<Symbol*>(profile_msg_.GetObject())->Name();
+    profile_msg_ = RefNIL;
+    code.profile = &f;
+    return run_(act);
+  }
+  if (code.jit)
+    return run_compiled_(act);
+  if (jit_ && !code.jit_tried && !code.ops.empty() && ++code.calls >= kJitThreshold) {
+    compile_(code);
+    if (code.jit)
+      return run_compiled_(act);
+  }
+  return run_(act);
+}
+
+/**
+ Call a global function by name.
+ Native functions are found first.
+ */
+Ref Interpreter::call_global_(RefArg name, Ref *args, int num_args)
+{
+  std::string key = key_(name);
+  auto native = natives_.find(key);
+  if (native != natives_.end())
+    return native->second(*this, RefNIL, args, num_args);
+  auto func = functions_.find(key);
+  if (func != functions_.end()) {
+    profile_msg_ = name;
+    return invoke_(func->second, RefNIL, RefNIL, args, num_args);
+  }
+  throw RuntimeError(kDyneErrUndefinedGlobalFunction, name.ToString());
+}
+
+/**
+ Send a message to a frame.
+ \param[in] receiver becomes 'self' in the method
+ \param[in] start the frame where the method lookup starts
+ \param[in] msg name of the method
+ \param[in] args, num_args arguments for the method
+ \param[in] if_defined return NIL instead of throwing if there is no method
+ \param[in] cache inline cache of the sending instruction, or nullptr
+ */
+Ref Interpreter::send_(RefArg receiver, RefArg start, RefArg msg, Ref *args, int num_args,
+                       bool if_defined, InlineCache *cache)
+{
+  Ref func, impl;
+  Index index;
+  if (!cached_lookup(cache, RefNIL, start, true, msg, func, impl, index)) {
+    if (if_defined)
+      return RefNIL;
+    throw RuntimeError(kDyneErrUndefinedMethod, msg.ToString());
+  }
+  profile_msg_ = msg;
+  return invoke_(func, receiver, impl, args, num_args);
+}
+
+/**
+ Run a function until it returns, and resume in exception handlers.
+ */
+Ref Interpreter::run_(Activation &act)
+{
+  Ref *sp = act.base;
+  PC pc = 0;
+  for (;;) {
+    try {
+      return dispatch_(act, sp, pc);
+    } catch (const RuntimeError &err) {
+      if (!catch_(act, err, sp, pc))
+        throw;
+    }
+  }
+}
+
+/**
+ Find a handler in the current function for an exception.
+ \param[out] sp, pc where to continue if a handler was found
+ \return true if the exception was caught
+ */
+bool Interpreter::catch_(Activation &act, const RuntimeError &err, Ref *&sp, PC &pc)
+{
+  Ref name = kSymEvtExFr, data = Ref((Integer)err.err());
+  auto ex = dynamic_cast<const Exception*>(&err);
+  if (ex) {
+    name = ex->name();
+    data = ex->data();
+  } else if (err.err() <= kDyneErrBaseInterpreter && err.err() > kDyneErrBaseInterpreter - 100) {
+    name = kSymEvtExFrIntrp;
+  }
+  for (size_t g=groups_.size(); g>act.groups; --g) {
+    size_t first = groups_[g-1];
+    size_t last = (g < groups_.size()) ? groups_[g] : handlers_.size();
+    for (size_t i=first; i<last; ++i) {
+      Handler h = handlers_[i];
+      if (!h.active || !exception_matches(h.symbol, name))
+        continue;
+      // Inner groups are gone. This group stays until its pop_handlers,
+      // but must not catch exceptions thrown by its own handlers.
+      handlers_.resize(last);
+      groups_.resize(g);
+      for (size_t j=first; j<last; ++j)
+        handlers_[j].active = false;
+      exception_ = AllocateFrame();
+      SetFrameSlot(exception_, Sym("name"), name);
+      SetFrameSlot(exception_, Sym("data"), data);
+      SetFrameSlot(exception_, Sym("error"), Ref((Integer)err.err()));
+      SetFrameSlot(exception_, Sym("message"), MakeString(err.what()));
+      sp = act.base + h.depth;
+      pc = h.pc;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ Find a variable in the lexical scope, then in self, then in the globals.
+ */
+Ref Interpreter::find_var_(Activation &act, RefArg tag, InlineCache *cache)
+{
+  Ref value, holder;
+  Index index;
+  if (cached_lookup(cache, act.locals, act.self, true, tag, value, holder, index))
+    return value;
+  auto it = globals_.find(key_(tag));
+  if (it != globals_.end())
+    return it->second;
+  throw RuntimeError(kDyneErrUndefinedVariable, tag.ToString());
+}
+
+/**
+ Set a variable where find_var_ would find it, or create a global.
+ Variables inherited through _proto are set in the frame that inherits them.
+ */
+void Interpreter::find_and_set_var_(Activation &act, RefArg tag, RefArg value)
+{
+  Ref found;
+  for (Ref af = act.locals; af.IsFrame(); af = as_frame(af)->GetSlot(0)) {
+    if (frame_slot(af, tag, found)) {
+      SetFrameSlot(af, tag, value);
+      return;
+    }
+  }
+  for (Ref f = act.self; f.IsFrame(); ) {
+    if (proto_slot(f, tag, found)) {
+      SetFrameSlot(f, tag, value);
+      return;
+    }
+    if (!proto_slot(f, kSymParent, f))
+      break;
+  }
+  globals_[key_(tag)] = value;
+}
+
+/**
+ Create a closure that remembers the current lexical scope.
+ */
+Ref Interpreter::set_lex_scope_(Activation &act, RefArg func)
+{
+  if (!func.IsFrame())
+    throw RuntimeError(kDyneErrNotAFunction, func.ToString());
+  Ref closure = Clone(func);
+  Ref arg_frame = as_frame(func)->GetSlot(kSymArgFrame);
+  if (arg_frame.IsFrame() && as_frame(arg_frame)->Length() >= 3) {
+    Ref scope = Clone(arg_frame);
+    Frame *f = as_frame(scope);
+    f->SlottedObject::SetSlot(0, act.locals);
+    f->SlottedObject::SetSlot(1, act.self);
+    f->SlottedObject::SetSlot(2, act.impl);
+    SetFrameSlot(closure, kSymArgFrame, scope);
+  }
+  return closure;
+}
+
+/**
+ Prepare the transcoded bytecode for dispatch and set up inline caches.
+ \param[in] code the function
+ \param[in] labels the address of every instruction for threaded dispatch
+ \param[in] int_labels the address of the integer variants in kIntVariants
+ \param[in] profile_label the address of the code that counts instructions
+ */
+void Interpreter::prepare_(Code &code, const void *const *labels, const void *const *int_labels,
+                           const void *profile_label)
+{
+  size_t num_caches = 0;
+  for (const Bytecode &bc: code.bc)
+    num_caches += has_cache(bc.bc);
+  code.caches.resize(num_caches);
+  code.ops.reserve(code.bc.size());
+  InlineCache *cache = code.caches.data();
+  for (PC pc=0; pc<code.bc.size(); ++pc) {
+    const Bytecode &bc = code.bc[pc];
+#if DYN_VM_THREADED
+    const void *label = labels[(int)bc.bc];
+    if (profile_) {
+      label = profile_label;
+    } else if (code.facts[pc] & Verifier::kIntOperands) {
+      auto v = std::find(std::begin(kIntVariants), std::end(kIntVariants), bc.bc);
+      if (v != std::end(kIntVariants))
+        label = int_labels[v - std::begin(kIntVariants)];
+    }
+    code.ops.push_back( { label, bc.arg, has_cache(bc.bc) ? cache++ : nullptr } );
+#else
+    (void)labels;
+    (void)int_labels;
+    (void)profile_label;
+    code.ops.push_back( { bc.bc, bc.arg, has_cache(bc.bc) ? cache++ : nullptr } );
+#endif
+  }
+}
+
+#if DYN_VM_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/**
+ The interpreter loop.
+
+ With GCC and Clang every instruction jumps directly to the code of the next
+ one through a table of label addresses. Other compilers use a switch.
+
+ Integer arithmetic and comparisons are handled inline, everything else is
+ delegated to the object system.
+
+ All code is verified before it runs. The verifier computes how deep the
+ operand stack of a function can get and makes sure that it never
+ underflows and that all locals exist, so the stack and the locals are
+ checked once per call, not per instruction. Instructions whose operands
+ are proven to be integers jump to variants without type checks; the
+ switch based dispatch does not have those. If one of them overflows, the
+ function goes back to the checked variants, see drop_int_facts_().
+
+ \param[in] act the running function
+ \param[in] sp stack pointer to start with
+ \param[in] pc first instruction
+ \return the value returned by the function
+ */
+Ref Interpreter::dispatch_(Activation &act, Ref *sp, PC pc)
+{
+  Code &code = *act.code;
+  Frame *locals = as_frame(act.locals);
+  const Array *literals = act.literals.IsArray() ? static_cast<Array*>(act.literals.GetObject()) : nullptr;
+
+#define POP()     (*--sp)
+#define PUSH(x)   (*sp++ = (x))
+#define TOP()     (sp[-1])
+#define ARG       (op->arg)
+#define LITERAL(i) (literals ? MagicPointers::Resolve(literals->GetSlot(i)) : RefNIL)
+#define BRANCH()  do { ip = ops + ARG; NEXT(); } while (0)
+
+#if DYN_VM_THREADED
+  static const void *const labels[] = {
+    &&L_EndOfFile,       &&L_Pop,             &&L_Dup,             &&L_Return,
+    &&L_PushSelf,        &&L_SetLexScope,     &&L_IterNext,        &&L_IterDone,
+    &&L_PopHandlers,     &&L_Push,            &&L_PushConst,       &&L_Call,
+    &&L_Invoke,          &&L_Send,            &&L_SendIfDefined,   &&L_Resend,
+    &&L_ResendIfDefined, &&L_Branch,          &&L_BranchIfTrue,    &&L_BranchIfFalse,
+    &&L_FindVar,         &&L_GetVar,          &&L_MakeFrame,       &&L_MakeArray,
+    &&L_FillArray,       &&L_GetPath,         &&L_GetPathCheck,    &&L_SetPath,
+    &&L_SetPathVal,      &&L_SetVar,          &&L_FindAndSetVar,   &&L_IncrVar,
+    &&L_BranchLoop,      &&L_Add,             &&L_Subtract,        &&L_ARef,
+    &&L_SetARef,         &&L_Equals,          &&L_Not,             &&L_NotEquals,
+    &&L_Multiply,        &&L_Divide,          &&L_Div,             &&L_LessThan,
+    &&L_GreaterThan,     &&L_GreaterOrEqual,  &&L_LessOrEqual,     &&L_BitAnd,
+    &&L_BitOr,           &&L_BitNot,          &&L_NewIter,         &&L_Length,
+    &&L_Clone,           &&L_SetClass,        &&L_AddArraySlot,    &&L_Stringer,
+    &&L_HasPath,         &&L_ClassOf,         &&L_NewHandler,
+    &&L_ReturnConst,     &&L_ReturnVar,       &&L_GetVar2,         &&L_SetVarConst,
+    &&L_AddVarConst,     &&L_CompareBranch,   &&L_Unknown
+  };
+  static_assert(sizeof(labels)/sizeof(labels[0]) == (size_t)BC::Unknown + 1, "label table does not match BC");
+  static const void *const int_labels[] = {
+    &&L_AddInt,          &&L_SubtractInt,     &&L_LessThanInt,     &&L_GreaterThanInt,
+    &&L_GreaterOrEqualInt, &&L_LessOrEqualInt, &&L_IncrVarInt,     &&L_BranchLoopInt,
+    &&L_AddVarConstInt,  &&L_CompareBranchInt
+  };
+  static_assert(sizeof(int_labels) == sizeof(kIntVariants) / sizeof(BC) * sizeof(void*), "int label table does not match kIntVariants");
+  if (code.ops.empty())
+    prepare_(code, labels, int_labels, &&L_Profile);
+  const Op *const ops = code.ops.data();
+  const Op *ip = ops + pc, *op = ip;
+# define OP(x)   L_##x:
+# define NEXT()  do { op = ip++; goto *op->label; } while (0)
+# define IS(x)   (code.bc[op - ops].bc == BC::x)
+  NEXT();
+  // While profiling, every instruction comes here first.
+  L_Profile: {
+    PC at = (PC)(op - ops);
+    profile_->count(*code.profile, at, code.bc[at].bc);
+    goto *labels[(int)code.bc[at].bc];
+  }
+#else
+  if (code.ops.empty())
+    prepare_(code, nullptr, nullptr, nullptr);
+  const Op *const ops = code.ops.data();
+  const Op *ip = ops + pc, *op = ip;
+# define OP(x)   case BC::x:
+# define NEXT()  continue
+# define IS(x)   (op->bc == BC::x)
+  for (;;) {
+    op = ip++;
+    if (profile_)
+      profile_->count(*code.profile, (PC)(op - ops), op->bc);
+    switch (op->bc) {
+#endif
+
+  OP(EndOfFile)
+    return (sp > act.base) ? TOP() : RefNIL;
+  OP(Pop)
+    --sp;
+    NEXT();
+  OP(Dup)
+    *sp = sp[-1];
+    ++sp;
+    NEXT();
+  OP(Return)
+    return POP();
+  OP(PushSelf)
+    PUSH(act.self);
+    NEXT();
+  OP(SetLexScope)
+    TOP() = set_lex_scope_(act, TOP());
+    NEXT();
+  OP(IterNext)
+    iter_next(POP());
+    NEXT();
+  OP(IterDone)
+    TOP() = iter_done(TOP());
+    NEXT();
+  OP(PopHandlers)
+    if (groups_.size() > act.groups) {
+      handlers_.resize(groups_.back());
+      groups_.pop_back();
+    }
+    NEXT();
+  OP(Push)
+    PUSH(LITERAL(ARG));
+    NEXT();
+  OP(PushConst)
+    PUSH(ns_const(ARG));
+    NEXT();
+  OP(Call) {
+    Ref *args = sp - 1 - ARG;
+    top_ = sp;
+    Ref r = call_global_(TOP(), args, ARG);
+    sp = args;
+    PUSH(r);
+    NEXT();
+  }
+  OP(Invoke) {
+    Ref *args = sp - 1 - ARG;
+    Ref func = TOP();
+    if (!func.IsFrame())
+      throw RuntimeError(kDyneErrNotAFunction, func.ToString());
+    Ref scope = as_frame(func)->GetSlot(kSymArgFrame);
+    top_ = sp;
+    Ref r = invoke_(func, slot_at(scope, 1), slot_at(scope, 2), args, ARG);
+    sp = args;
+    PUSH(r);
+    NEXT();
+  }
+  OP(Send)
+  OP(SendIfDefined) {
+    Ref *args = sp - 2 - ARG;
+    top_ = sp;
+    Ref r = send_(sp[-1], sp[-1], sp[-2], args, ARG, IS(SendIfDefined), op->cache);
+    sp = args;
+    PUSH(r);
+    NEXT();
+  }
+  OP(Resend)
+  OP(ResendIfDefined) {
+    Ref *args = sp - 1 - ARG;
+    top_ = sp;
+    Ref start = act.impl.IsFrame() ? MagicPointers::Resolve(as_frame(act.impl)->GetSlot(kSymProto)) : RefNIL;
+    Ref r = send_(act.self, start, TOP(), args, ARG, IS(ResendIfDefined), op->cache);
+    sp = args;
+    PUSH(r);
+    NEXT();
+  }
+  OP(Branch)
+    BRANCH();
+  OP(BranchIfTrue)
+    if (POP().IsNotNIL())
+      BRANCH();
+    NEXT();
+  OP(BranchIfFalse)
+    if (POP().IsNIL())
+      BRANCH();
+    NEXT();
+  OP(FindVar)
+    PUSH(find_var_(act, LITERAL(ARG), op->cache));
+    NEXT();
+  OP(GetVar)
+    PUSH(locals->GetSlot(ARG));
+    NEXT();
+  OP(MakeFrame) {
+    Ref frame = AllocateFrameWithMap(POP());
+    Frame *f = as_frame(frame);
+    if (f->Length() != ARG)
+      throw RuntimeError(kDyneErrInvalidBytecode, "make_frame: map does not match");
+    sp -= ARG;
+    for (int i=0; i<ARG; ++i)
+      f->SlottedObject::SetSlot(i, sp[i]);
+    PUSH(frame);
+    NEXT();
+  }
+  OP(MakeArray)
+  OP(FillArray) {
+    Ref cls = POP();
+    Ref array;
+    if (ARG == -1) {
+      Integer n = as_int(POP());
+      array = AllocateArray(cls, n);
+      for (Index i=0; i<n; ++i)
+        SetArraySlot(array, i, RefNIL);
+    } else {
+      array = AllocateArray(cls, ARG);
+      sp -= ARG;
+      for (int i=0; i<ARG; ++i)
+        SetArraySlot(array, i, sp[i]);
+    }
+    PUSH(array);
+    NEXT();
+  }
+  OP(GetPath)
+  OP(GetPathCheck) {
+    Ref path = POP(), value, holder;
+    Index index;
+    if (path.IsSymbol() && TOP().IsFrame()
+        && cached_lookup(op->cache, RefNIL, TOP(), false, path, value, holder, index))
+      TOP() = value;
+    else
+      TOP() = get_path(TOP(), path, (ARG != 0) || IS(GetPathCheck));
+    NEXT();
+  }
+  OP(SetPath)
+  OP(SetPathVal) {
+    Ref value = POP(), path = POP(), obj = POP(), found, holder;
+    Index index;
+    // Slots that the frame already has are written directly, new slots
+    // and inherited slots are added to the frame itself.
+    if (path.IsSymbol() && obj.IsFrame() && !obj.IsReadOnly()
+        && cached_lookup(op->cache, RefNIL, obj, false, path, found, holder, index)
+        && (holder == obj))
+      as_frame(obj)->SlottedObject::SetSlot(index, value);
+    else
+      set_path(obj, path, value);
+    if (ARG || IS(SetPathVal))
+      PUSH(value);
+    NEXT();
+  }
+  OP(SetVar)
+    locals->SlottedObject::SetSlot(ARG, POP());
+    NEXT();
+  OP(FindAndSetVar) {
+    Ref value = POP();
+    find_and_set_var_(act, LITERAL(ARG), value);
+    NEXT();
+  }
+  OP(IncrVar) {
+    Ref addend = TOP(), value = locals->GetSlot(ARG);
+    Integer r;
+    value = (value.IsInt() && addend.IsInt() && add_int(value.GetInt(), addend.GetInt(), r))
+          ? Ref(r) : arith(Arith::Add, value, addend);
+    locals->SlottedObject::SetSlot(ARG, value);
+    PUSH(value);
+    NEXT();
+  }
+  OP(BranchLoop) {
+    Ref limit = POP(), index = POP(), incr = POP();
+    bool more;
+    if (limit.IsInt() && index.IsInt() && incr.IsInt())
+      more = (incr.GetInt() > 0) ? (index.GetInt() <= limit.GetInt()) : (index.GetInt() >= limit.GetInt());
+    else
+      more = (as_real(incr) > 0) ? (compare(index, limit) <= 0) : (compare(index, limit) >= 0);
+    if (more)
+      BRANCH();
+    NEXT();
+  }
+  OP(Add) {
+    Ref b = POP(), a = TOP();
+    Integer r;
+    TOP() = (a.IsInt() && b.IsInt() && add_int(a.GetInt(), b.GetInt(), r)) ? Ref(r) : arith(Arith::Add, a, b);
+    NEXT();
+  }
+  OP(Subtract) {
+    Ref b = POP(), a = TOP();
+    Integer r;
+    TOP() = (a.IsInt() && b.IsInt() && sub_int(a.GetInt(), b.GetInt(), r)) ? Ref(r) : arith(Arith::Subtract, a, b);
+    NEXT();
+  }
+  OP(ARef) {
+    Ref index = POP();
+    TOP() = aref(TOP(), index);
+    NEXT();
+  }
+  OP(SetARef) {
+    Ref value = POP(), index = POP();
+    set_aref(TOP(), index, value);
+    TOP() = value;
+    NEXT();
+  }
+  OP(Equals) {
+    Ref b = POP(), a = TOP();
+    TOP() = Ref((a == b) || equals(a, b));
+    NEXT();
+  }
+  OP(Not)
+    TOP() = Ref(TOP().IsNIL());
+    NEXT();
+  OP(NotEquals) {
+    Ref b = POP(), a = TOP();
+    TOP() = Ref(!((a == b) || equals(a, b)));
+    NEXT();
+  }
+  OP(Multiply) {
+    Ref b = POP(), a = TOP();
+    Integer r;
+    TOP() = (a.IsInt() && b.IsInt() && mul_int(a.GetInt(), b.GetInt(), r)) ? Ref(r) : arith(Arith::Multiply, a, b);
+    NEXT();
+  }
+  OP(Divide) {
+    Ref b = POP();
+    TOP() = arith(Arith::Divide, TOP(), b);
+    NEXT();
+  }
+  OP(Div) {
+    Integer b = as_int(POP()), a = as_int(TOP());
+    if (b == 0)
+      throw RuntimeError(kDyneErrDivideByZero);
+    TOP() = Ref(a / b);
+    NEXT();
+  }
+  OP(LessThan) {
+    Ref b = POP(), a = TOP();
+    TOP() = Ref((a.IsInt() && b.IsInt()) ? (a.GetInt() < b.GetInt()) : (compare(a, b) < 0));
+    NEXT();
+  }
+  OP(GreaterThan) {
+    Ref b = POP(), a = TOP();
+    TOP() = Ref((a.IsInt() && b.IsInt()) ? (a.GetInt() > b.GetInt()) : (compare(a, b) > 0));
+    NEXT();
+  }
+  OP(GreaterOrEqual) {
+    Ref b = POP(), a = TOP();
+    TOP() = Ref((a.IsInt() && b.IsInt()) ? (a.GetInt() >= b.GetInt()) : (compare(a, b) >= 0));
+    NEXT();
+  }
+  OP(LessOrEqual) {
+    Ref b = POP(), a = TOP();
+    TOP() = Ref((a.IsInt() && b.IsInt()) ? (a.GetInt() <= b.GetInt()) : (compare(a, b) <= 0));
+    NEXT();
+  }
+  OP(BitAnd) {
+    Integer b = as_int(POP());
+    TOP() = Ref(as_int(TOP()) & b);
+    NEXT();
+  }
+  OP(BitOr) {
+    Integer b = as_int(POP());
+    TOP() = Ref(as_int(TOP()) | b);
+    NEXT();
+  }
+  OP(BitNot)
+    TOP() = Ref(~as_int(TOP()));
+    NEXT();
+  OP(NewIter) {
+    Ref deeply = POP();
+    TOP() = new_iter(TOP(), deeply);
+    NEXT();
+  }
+  OP(Length)
+    TOP() = length_of(TOP());
+    NEXT();
+  OP(Clone)
+    TOP() = Clone(TOP());
+    NEXT();
+  OP(SetClass) {
+    Ref cls = POP();
+    SetClass(TOP(), cls);
+    NEXT();
+  }
+  OP(AddArraySlot) {
+    Ref value = POP();
+    AddArraySlot(TOP(), value);
+    TOP() = value;
+    NEXT();
+  }
+  OP(Stringer)
+    TOP() = stringer(TOP());
+    NEXT();
+  OP(HasPath) {
+    Ref path = POP(), value;
+    TOP() = Ref(resolve_path(TOP(), path, value));
+    NEXT();
+  }
+  OP(ClassOf)
+    TOP() = class_of(TOP());
+    NEXT();
+  OP(NewHandler) {
+    sp -= 2 * ARG;
+    groups_.push_back(handlers_.size());
+    for (int i=0; i<ARG; ++i) {
+      Ref offset = sp[2*i+1];
+      if (!offset.IsInt() || offset.GetInt() < 0 || (size_t)offset.GetInt() >= code.offsets.size()
+          || code.offsets[offset.GetInt()] == kInvalidPC)
+        throw RuntimeError(kDyneErrInvalidBytecode, "new_handler: bad handler address");
+      handlers_.push_back( { sp[2*i], code.offsets[offset.GetInt()], (size_t)(sp - act.base), true } );
+    }
+    NEXT();
+  }
+  OP(ReturnConst)
+    return ns_const(ARG);
+  OP(ReturnVar)
+    return locals->GetSlot(ARG);
+  OP(GetVar2)
+    PUSH(locals->GetSlot(ARG & 0xffff));
+    PUSH(locals->GetSlot(ARG >> 16));
+    NEXT();
+  OP(SetVarConst)
+    locals->SlottedObject::SetSlot(ARG & 0xffff, ns_const(ARG >> 16));
+    NEXT();
+  OP(AddVarConst) {
+    Index ix = ARG & 0xffff;
+    Ref value = locals->GetSlot(ix);
+    Integer r;
+    value = (value.IsInt() && add_int(value.GetInt(), ARG >> 16, r)) ? Ref(r) : arith(Arith::Add, value, Ref((Integer)(ARG >> 16)));
+    locals->SlottedObject::SetSlot(ix, value);
+    NEXT();
+  }
+  OP(CompareBranch) {
+    Ref b = POP(), a = POP();
+    bool result;
+    Compare kind = (Compare)(ARG >> 24);
+    if (a.IsInt() && b.IsInt()) {
+      result = compare_ints(kind, a.GetInt(), b.GetInt());
+    } else {
+      switch (kind) {
+        case Compare::Less: result = (compare(a, b) < 0); break;
+        case Compare::Greater: result = (compare(a, b) > 0); break;
+        case Compare::LessOrEqual: result = (compare(a, b) <= 0); break;
+        case Compare::GreaterOrEqual: result = (compare(a, b) >= 0); break;
+        case Compare::Equal: result = (a == b) || equals(a, b); break;
+        default: result = !((a == b) || equals(a, b)); break;
+      }
+    }
+    if (!result) {
+      ip = ops + (ARG & 0xffffff);
+    }
+    NEXT();
+  }
+  OP(Unknown)
+    throw RuntimeError(kDyneErrInvalidBytecode, std::to_string(ip - ops - 1));
+
+#if DYN_VM_THREADED
+  // Variants for operands that the verifier proved to be integers.
+  L_AddInt: {
+    Integer r;
+    if (!add_int(sp[-2].GetInt(), sp[-1].GetInt(), r))
+      goto L_IntOverflow;
+    --sp;
+    TOP() = Ref(r);
+    NEXT();
+  }
+  L_SubtractInt: {
+    Integer r;
+    if (!sub_int(sp[-2].GetInt(), sp[-1].GetInt(), r))
+      goto L_IntOverflow;
+    --sp;
+    TOP() = Ref(r);
+    NEXT();
+  }
+  L_LessThanInt:
+    --sp;
+    TOP() = Ref(TOP().GetInt() < sp->GetInt());
+    NEXT();
+  L_GreaterThanInt:
+    --sp;
+    TOP() = Ref(TOP().GetInt() > sp->GetInt());
+    NEXT();
+  L_GreaterOrEqualInt:
+    --sp;
+    TOP() = Ref(TOP().GetInt() >= sp->GetInt());
+    NEXT();
+  L_LessOrEqualInt:
+    --sp;
+    TOP() = Ref(TOP().GetInt() <= sp->GetInt());
+    NEXT();
+  L_IncrVarInt: {
+    Integer r;
+    if (!add_int(locals->GetSlot(ARG).GetInt(), TOP().GetInt(), r))
+      goto L_IntOverflow;
+    locals->SlottedObject::SetSlot(ARG, Ref(r));
+    PUSH(Ref(r));
+    NEXT();
+  }
+  L_BranchLoopInt: {
+    Integer limit = POP().GetInt(), index = POP().GetInt(), incr = POP().GetInt();
+    if ((incr > 0) ? (index <= limit) : (index >= limit))
+      BRANCH();
+    NEXT();
+  }
+  L_AddVarConstInt: {
+    Integer r;
+    if (!add_int(locals->GetSlot(ARG & 0xffff).GetInt(), ARG >> 16, r))
+      goto L_IntOverflow;
+    locals->SlottedObject::SetSlot(ARG & 0xffff, Ref(r));
+    NEXT();
+  }
+  L_CompareBranchInt: {
+    Integer y = POP().GetInt(), x = POP().GetInt();
+    if (!compare_ints((Compare)(ARG >> 24), x, y))
+      ip = ops + (ARG & 0xffffff);
+    NEXT();
+  }
+  // The result did not fit into an integer, so it becomes a real, and the
+  // verifier's integer facts no longer hold for this function. Go back to
+  // the checked variants and run the instruction again.
+  L_IntOverflow:
+    for (PC i=0; i<code.ops.size(); ++i)
+      code.ops[i].label = labels[(int)code.bc[i].bc];
+    drop_int_facts_(code);
+    goto *labels[(int)code.bc[op - ops].bc];
+#endif
+
+#if !DYN_VM_THREADED
+    }
+  }
+#endif
+
+#undef OP
+#undef IS
+#undef NEXT
+#undef BRANCH
+#undef LITERAL
+#undef ARG
+#undef TOP
+#undef PUSH
+#undef POP
+}
+
+#if DYN_VM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+/**
+ Compile a function that has been called often enough.
+ */
+void Interpreter::compile_(Code &code)
+{
+  code.jit_tried = true;
+  std::vector<JitOp> ops;
+  ops.reserve(code.bc.size());
+  for (PC pc=0; pc<code.bc.size(); ++pc) {
+    const Bytecode &bc = code.bc[pc];
+    Ref value = RefNIL;
+    if ((bc.bc == BC::PushConst) || (bc.bc == BC::ReturnConst))
+      value = ns_const(bc.arg);
+    else if (bc.bc == BC::SetVarConst)
+      value = ns_const(bc.arg >> 16);
+    ops.push_back( { bc.bc, bc.arg, value, code.ops[pc].cache, (code.facts[pc] & Verifier::kIntOperands) != 0 } );
+  }
+  code.jit = jit_compile(ops, jit_helper_);
+  if (code.jit)
+    num_compiled_++;
+}
+
+/**
+ Run the machine code of a function.
+ Exceptions are caught in the helper and thrown again here, so they never
+ unwind through compiled code.
+ */
+Ref Interpreter::run_compiled_(Activation &act)
+{
+  JitFrame frame { this, &act };
+  JitContext ctx { &frame, act.self, act.base, as_frame(act.locals)->Slots(), RefNIL, 0, nullptr, 0 };
+  switch (act.code->jit->run(&ctx, act.base)) {
+    case 0:
+      return ctx.result;
+    case 2:
+      // An integer overflowed where the verifier promised integers.
+      drop_int_facts_(*act.code);
+      return dispatch_(act, ctx.sp, (PC)ctx.pc);
+    default:
+      std::rethrow_exception(frame.error);
+  }
+}
+
+/**
+ Stop trusting the verifier's integer facts for a function.
+
+ Integer operations whose result does not fit into an integer ref return a
+ real, so instructions further down the function can see reals where the
+ verifier proved integers. The compiled code is retired, because other
+ activations may still run it, and the function is compiled again later
+ with type checks.
+ */
+void Interpreter::drop_int_facts_(Code &code)
+{
+  for (uint8_t &f: code.facts)
+    f &= (uint8_t)~Verifier::kIntOperands;
+  if (code.jit) {
+    code.retired.push_back(std::move(code.jit));
+    code.jit_tried = false;
+    code.calls = 0;
+  }
+}
+
+/**
+ Called by compiled code for instructions that it does not handle inline.
+ \return the new stack pointer, or nullptr if the instruction threw
+ */
+Ref *Interpreter::jit_helper_(JitContext *ctx, Ref *sp, int bc, int32_t arg, InlineCache *cache)
+{
+  JitFrame &frame = *static_cast<JitFrame*>(ctx->frame);
+  try {
+    sp = frame.vm->jit_op_(*frame.act, (BC)bc, sp, arg, cache, ctx->taken);
+    ctx->locals = as_frame(frame.act->locals)->Slots();
+    return sp;
+  } catch (...) {
+    frame.error = std::current_exception();
+    return nullptr;
+  }
+}
+
+/**
+ Run a single instruction for compiled code.
+ This mirrors the slow paths of dispatch_().
+ \param[in] act the running function
+ \param[in] bc, arg, cache the instruction
+ \param[in] sp the stack pointer
+ \param[out] taken set for conditional branches
+ \return the new stack pointer
+ */
+Ref *Interpreter::jit_op_(Activation &act, BC bc, Ref *sp, int32_t arg, InlineCache *cache, int &taken)
+{
+  Frame *locals = as_frame(act.locals);
+  const Array *literals = act.literals.IsArray() ? static_cast<Array*>(act.literals.GetObject()) : nullptr;
+  switch (bc) {
+    case BC::Push:
+      *sp++ = literals ? MagicPointers::Resolve(literals->GetSlot(arg)) : RefNIL;
+      break;
+    case BC::SetLexScope:
+      sp[-1] = set_lex_scope_(act, sp[-1]);
+      break;
+    case BC::IterNext:
+      iter_next(*--sp);
+      break;
+    case BC::IterDone:
+      sp[-1] = iter_done(sp[-1]);
+      break;
+    case BC::Call: {
+      Ref *args = sp - 1 - arg;
+      top_ = sp;
+      Ref r = call_global_(sp[-1], args, arg);
+      sp = args;
+      *sp++ = r;
+      break;
+    }
+    case BC::Invoke: {
+      Ref *args = sp - 1 - arg;
+      Ref func = sp[-1];
+      if (!func.IsFrame())
+        throw RuntimeError(kDyneErrNotAFunction, func.ToString());
+      Ref scope = as_frame(func)->GetSlot(kSymArgFrame);
+      top_ = sp;
+      Ref r = invoke_(func, slot_at(scope, 1), slot_at(scope, 2), args, arg);
+      sp = args;
+      *sp++ = r;
+      break;
+    }
+    case BC::Send:
+    case BC::SendIfDefined: {
+      Ref *args = sp - 2 - arg;
+      top_ = sp;
+      Ref r = send_(sp[-1], sp[-1], sp[-2], args, arg, bc == BC::SendIfDefined, cache);
+      sp = args;
+      *sp++ = r;
+      break;
+    }
+    case BC::Resend:
+    case BC::ResendIfDefined: {
+      Ref *args = sp - 1 - arg;
+      top_ = sp;
+      Ref start = act.impl.IsFrame() ? MagicPointers::Resolve(as_frame(act.impl)->GetSlot(kSymProto)) : RefNIL;
+      Ref r = send_(act.self, start, sp[-1], args, arg, bc == BC::ResendIfDefined, cache);
+      sp = args;
+      *sp++ = r;
+      break;
+    }
+    case BC::FindVar:
+      *sp++ = find_var_(act, literals ? literals->GetSlot(arg) : RefNIL, cache);
+      break;
+    case BC::MakeFrame: {
+      Ref frame = AllocateFrameWithMap(*--sp);
+      Frame *f = as_frame(frame);
+      if (f->Length() != arg)
+        throw RuntimeError(kDyneErrInvalidBytecode, "make_frame: map does not match");
+      sp -= arg;
+      for (int i=0; i<arg; ++i)
+        f->SlottedObject::SetSlot(i, sp[i]);
+      *sp++ = frame;
+      break;
+    }
+    case BC::MakeArray:
+    case BC::FillArray: {
+      Ref cls = *--sp;
+      Ref array;
+      if (arg == -1) {
+        Integer n = as_int(*--sp);
+        array = AllocateArray(cls, n);
+        for (Index i=0; i<n; ++i)
+          SetArraySlot(array, i, RefNIL);
+      } else {
+        array = AllocateArray(cls, arg);
+        sp -= arg;
+        for (int i=0; i<arg; ++i)
+          SetArraySlot(array, i, sp[i]);
+      }
+      *sp++ = array;
+      break;
+    }
+    case BC::GetPath:
+    case BC::GetPathCheck: {
+      Ref path = *--sp, value, holder;
+      Index index;
+      if (path.IsSymbol() && sp[-1].IsFrame()
+          && cached_lookup(cache, RefNIL, sp[-1], false, path, value, holder, index))
+        sp[-1] = value;
+      else
+        sp[-1] = get_path(sp[-1], path, (arg != 0) || (bc == BC::GetPathCheck));
+      break;
+    }
+    case BC::SetPath:
+    case BC::SetPathVal: {
+      Ref value = *--sp, path = *--sp, obj = *--sp, found, holder;
+      Index index;
+      if (path.IsSymbol() && obj.IsFrame() && !obj.IsReadOnly()
+          && cached_lookup(cache, RefNIL, obj, false, path, found, holder, index)
+          && (holder == obj))
+        as_frame(obj)->SlottedObject::SetSlot(index, value);
+      else
+        set_path(obj, path, value);
+      if (arg || (bc == BC::SetPathVal))
+        *sp++ = value;
+      break;
+    }
+    case BC::FindAndSetVar: {
+      Ref value = *--sp;
+      find_and_set_var_(act, literals ? literals->GetSlot(arg) : RefNIL, value);
+      break;
+    }
+    case BC::IncrVar: {
+      Ref value = arith(Arith::Add, locals->GetSlot(arg), sp[-1]);
+      locals->SlottedObject::SetSlot(arg, value);
+      *sp++ = value;
+      break;
+    }
+    case BC::AddVarConst: {
+      Index ix = arg & 0xffff;
+      locals->SlottedObject::SetSlot(ix, arith(Arith::Add, locals->GetSlot(ix), Ref((Integer)(arg >> 16))));
+      break;
+    }
+    case BC::BranchLoop: {
+      Ref limit = *--sp, index = *--sp, incr = *--sp;
+      taken = (as_real(incr) > 0) ? (compare(index, limit) <= 0) : (compare(index, limit) >= 0);
+      break;
+    }
+    case BC::CompareBranch: {
+      Ref b = *--sp, a = *--sp;
+      bool result;
+      switch ((Compare)(arg >> 24)) {
+        case Compare::Less: result = (compare(a, b) < 0); break;
+        case Compare::Greater: result = (compare(a, b) > 0); break;
+        case Compare::LessOrEqual: result = (compare(a, b) <= 0); break;
+        case Compare::GreaterOrEqual: result = (compare(a, b) >= 0); break;
+        case Compare::Equal: result = (a == b) || equals(a, b); break;
+        default: result = !((a == b) || equals(a, b)); break;
+      }
+      taken = !result;
+      break;
+    }
+    case BC::Add:
+    case BC::Subtract:
+    case BC::Multiply:
+    case BC::Divide: {
+      Ref b = *--sp;
+      Arith op = (bc == BC::Add) ? Arith::Add : (bc == BC::Subtract) ? Arith::Subtract
+               : (bc == BC::Multiply) ? Arith::Multiply : Arith::Divide;
+      sp[-1] = arith(op, sp[-1], b);
+      break;
+    }
+    case BC::ARef: {
+      Ref index = *--sp;
+      sp[-1] = aref(sp[-1], index);
+      break;
+    }
+    case BC::SetARef: {
+      Ref value = *--sp, index = *--sp;
+      set_aref(sp[-1], index, value);
+      sp[-1] = value;
+      break;
+    }
+    case BC::Equals:
+    case BC::NotEquals: {
+      Ref b = *--sp, a = sp[-1];
+      sp[-1] = Ref(((a == b) || equals(a, b)) == (bc == BC::Equals));
+      break;
+    }
+    case BC::Not:
+      sp[-1] = Ref(sp[-1].IsNIL());
+      break;
+    case BC::Div: {
+      Integer b = as_int(*--sp), a = as_int(sp[-1]);
+      if (b == 0)
+        throw RuntimeError(kDyneErrDivideByZero);
+      sp[-1] = Ref(a / b);
+      break;
+    }
+    case BC::LessThan:
+    case BC::GreaterThan:
+    case BC::GreaterOrEqual:
+    case BC::LessOrEqual: {
+      Ref b = *--sp;
+      int c = compare(sp[-1], b);
+      sp[-1] = Ref((bc == BC::LessThan) ? (c < 0) : (bc == BC::GreaterThan) ? (c > 0)
+                   : (bc == BC::GreaterOrEqual) ? (c >= 0) : (c <= 0));
+      break;
+    }
+    case BC::BitAnd: {
+      Integer b = as_int(*--sp);
+      sp[-1] = Ref(as_int(sp[-1]) & b);
+      break;
+    }
+    case BC::BitOr: {
+      Integer b = as_int(*--sp);
+      sp[-1] = Ref(as_int(sp[-1]) | b);
+      break;
+    }
+    case BC::BitNot:
+      sp[-1] = Ref(~as_int(sp[-1]));
+      break;
+    case BC::NewIter: {
+      Ref deeply = *--sp;
+      sp[-1] = new_iter(sp[-1], deeply);
+      break;
+    }
+    case BC::Length:
+      sp[-1] = length_of(sp[-1]);
+      break;
+    case BC::Clone:
+      sp[-1] = Clone(sp[-1]);
+      break;
+    case BC::SetClass: {
+      Ref cls = *--sp;
+      SetClass(sp[-1], cls);
+      break;
+    }
+    case BC::AddArraySlot: {
+      Ref value = *--sp;
+      AddArraySlot(sp[-1], value);
+      sp[-1] = value;
+      break;
+    }
+    case BC::Stringer:
+      sp[-1] = stringer(sp[-1]);
+      break;
+    case BC::HasPath: {
+      Ref path = *--sp, value;
+      sp[-1] = Ref(resolve_path(sp[-1], path, value));
+      break;
+    }
+    case BC::ClassOf:
+      sp[-1] = class_of(sp[-1]);
+      break;
+    default:
+      throw RuntimeError(kDyneErrInvalidBytecode, "not supported by compiled code");
+  }
+  return sp;
+}
+
+/**
+ Call a NewtonScript function.
+ \param[in] func a function frame
+ \param[in] args arguments, must match 'numArgs
+ \param[in] self the receiver, used by find_var and push_self
+ \return the result of the function
+ */
+Ref Interpreter::call(RefArg func, const std::vector<Ref> &args, RefArg self)
+{
+  if (top_ + args.size() > stack_.data() + stack_.size())
+    throw RuntimeError(kDyneErrStackOverflow);
+  Ref *base = top_;
+  std::copy(args.begin(), args.end(), base);
+  return invoke_(func, self, self, base, (int)args.size());
+}
+
+/**
+ Call a global or native function by name.
+ */
+Ref Interpreter::call_global(RefArg name, const std::vector<Ref> &args)
+{
+  if (top_ + args.size() > stack_.data() + stack_.size())
+    throw RuntimeError(kDyneErrStackOverflow);
+  Ref *base = top_;
+  std::copy(args.begin(), args.end(), base);
+  Ref *top = top_;
+  top_ = base + args.size();
+  try {
+    Ref r = call_global_(name, base, (int)args.size());
+    top_ = top;
+    return r;
+  } catch (...) {
+    top_ = top;
+    throw;
+  }
+}
+
+/**
+ Send a message to a frame, using _proto and _parent inheritance.
+ */
+Ref Interpreter::send(RefArg receiver, RefArg message, const std::vector<Ref> &args)
+{
+  if (top_ + args.size() > stack_.data() + stack_.size())
+    throw RuntimeError(kDyneErrStackOverflow);
+  Ref *base = top_;
+  std::copy(args.begin(), args.end(), base);
+  return send_(receiver, receiver, message, base, (int)args.size(), false);
+}
+
+void Interpreter::define_global(RefArg name, RefArg value)
+{
+  globals_[key_(name)] = value;
+}
+
+Ref Interpreter::global(RefArg name) const
+{
+  auto it = globals_.find(key_(name));
+  return (it != globals_.end()) ? it->second : RefNIL;
+}
+
+void Interpreter::define_function(RefArg name, RefArg func)
+{
+  functions_[key_(name)] = func;
+}
+
+void Interpreter::define_native(const std::string &name, NativeFunction func)
+{
+  std::string key = name;
+  for (auto &c: key)
+    c = (char)std::tolower((unsigned char)c);
+  natives_[key] = func;
+}
+
+/**
+ Count instructions and sample time into a profile.
+ Compiled code is not used while profiling, and the interpreter does not
+ use its integer variants, so all instructions are seen. Only call this
+ while no NewtonScript code is running.
+ \param[in] profile collect into this profile, or nullptr to stop profiling
+ */
+void Interpreter::set_profile(Profile *profile)
+{
+  profile_ = profile;
+  profile_msg_ = RefNIL;
+  // Prepare all functions again with or without counting. The inline
+  // caches stay, compiled code may point to them.
+  for (auto &it: code_cache_) {
+    it.second->ops.clear();
+    it.second->profile = nullptr;
+  }
+}
+
+/**
+ Look up a slot with NewtonScript inheritance.
+ The _proto chain of a frame is searched first, then the _parent chain.
+ \param[in] frame start here
+ \param[in] tag the slot name
+ \param[out] value the value of the slot
+ \param[out] where if not null, the frame that holds the slot
+ \return true if the slot was found
+ */
+bool Interpreter::lookup(RefArg frame, RefArg tag, Ref &value, Ref *where)
+{
+  Ref holder;
+  Index index;
+  if (!cached_lookup(nullptr, RefNIL, frame, true, tag, value, holder, index))
+    return false;
+  if (where)
+    *where = holder;
+  return true;
+}
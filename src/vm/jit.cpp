@@ -0,0 +1,577 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Baseline compiler from transcoded bytecode to x86-64 machine code.
+
+#include "jit.h"
+#include "optimize.h"
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#if DYN_VM_JIT
+# include <sys/mman.h>
+#endif
+
+using namespace dyn;
+using namespace dyn::lang;
+using namespace dyn::vm;
+
+/** \class dyn::vm::JitCode
+ Executable machine code of one compiled function.
+
+ The code is called as `int code(JitContext *ctx, Ref *sp)` and returns 0
+ with the result in ctx->result, or 1 if a runtime helper caught an
+ exception that the caller has to rethrow. C++ exceptions never unwind
+ through compiled code. It returns 2 if an integer operation without type
+ checks overflowed; the interpreter then continues at ctx->pc with the
+ stack pointer ctx->sp.
+ */
+
+JitCode::JitCode(const std::vector<uint8_t> &bytes)
+{
+#if DYN_VM_JIT
+  size_t size = (bytes.size() + 4095) & ~(size_t)4095;
+  void *mem = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return;
+  ::memcpy(mem, bytes.data(), bytes.size());
+  if (::mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    ::munmap(mem, size);
+    return;
+  }
+  code_ = mem;
+  size_ = size;
+#else
+  (void)bytes;
+#endif
+}
+
+JitCode::~JitCode()
+{
+#if DYN_VM_JIT
+  if (code_)
+    ::munmap(code_, size_);
+#endif
+}
+
+int JitCode::run(JitContext *ctx, Ref *sp) const
+{
+  int (*entry)(JitContext*, Ref*);
+  static_assert(sizeof(entry) == sizeof(code_), "code pointers must fit a data pointer");
+  ::memcpy(&entry, &code_, sizeof(entry));
+  return entry(ctx, sp);
+}
+
+#if DYN_VM_JIT
+
+namespace {
+
+enum Reg : uint8_t {
+  rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+// Condition codes as used by jcc and cmovcc.
+enum Cond : uint8_t {
+  kOverflow = 0x0, kEqual = 0x4, kNotEqual = 0x5, kBelowOrEqual = 0x6,
+  kLess = 0xC, kGreaterOrEqual = 0xD, kLessOrEqual = 0xE, kGreater = 0xF
+};
+
+// Extensions of the 0x81/0x83 group of instructions.
+enum Alu : uint8_t {
+  kAdd = 0, kOr = 1, kAnd = 4, kSub = 5, kXor = 6, kCmp = 7
+};
+
+constexpr Reg kCtx = rbx;     // JitContext
+constexpr Reg kSp = r12;      // operand stack pointer
+constexpr Reg kLocals = r13;  // slots of the locals frame
+
+constexpr int32_t kRefTrue = 0x1a;
+constexpr int32_t kRefNil = 0x02;
+
+struct Label {
+  int pos { -1 };
+  std::vector<size_t> fixups { };
+};
+
+/**
+ Just enough of an x86-64 assembler for the compiler below.
+ */
+class Assembler {
+public:
+  std::vector<uint8_t> buf { };
+
+  void u8(uint8_t v) { buf.push_back(v); }
+  void u32(uint32_t v) { for (int i=0; i<4; ++i) u8((uint8_t)(v >> (8*i))); }
+  void u64(uint64_t v) { for (int i=0; i<8; ++i) u8((uint8_t)(v >> (8*i))); }
+
+  void rex(bool w, Reg reg, Reg rm) {
+    uint8_t r = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0));
+    if (r != 0x40) u8(r);
+  }
+  void mem(Reg reg, Reg base, int32_t disp) {
+    u8((uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == rsp) u8(0x24);
+    u32((uint32_t)disp);
+  }
+  void load(Reg dst, Reg base, int32_t disp) { rex(true, dst, base); u8(0x8B); mem(dst, base, disp); }
+  void store(Reg base, int32_t disp, Reg src) { rex(true, src, base); u8(0x89); mem(src, base, disp); }
+  void cmp_mem(Reg reg, Reg base, int32_t disp) { rex(true, reg, base); u8(0x3B); mem(reg, base, disp); }
+  void cmp_mem32(Reg base, int32_t disp, int8_t imm) { rex(false, rax, base); u8(0x83); mem((Reg)kCmp, base, disp); u8((uint8_t)imm); }
+  void mov_imm(Reg dst, uint64_t imm) { rex(true, rax, dst); u8((uint8_t)(0xB8 + (dst & 7))); u64(imm); }
+  void mov_imm32(Reg dst, uint32_t imm) { rex(false, rax, dst); u8((uint8_t)(0xB8 + (dst & 7))); u32(imm); }
+  void rr(uint8_t opcode, Reg dst, Reg src) { rex(true, src, dst); u8(opcode); u8((uint8_t)(0xC0 | ((src & 7) << 3) | (dst & 7))); }
+  void mov(Reg dst, Reg src) { rr(0x89, dst, src); }
+  void add(Reg dst, Reg src) { rr(0x01, dst, src); }
+  void sub(Reg dst, Reg src) { rr(0x29, dst, src); }
+  void or_(Reg dst, Reg src) { rr(0x09, dst, src); }
+  void cmp(Reg dst, Reg src) { rr(0x39, dst, src); }
+  void test(Reg dst, Reg src) { rr(0x85, dst, src); }
+  void alu(Alu op, Reg dst, int32_t imm) {
+    rex(true, rax, dst);
+    if ((imm >= -128) && (imm <= 127)) {
+      u8(0x83); u8((uint8_t)(0xC0 | (op << 3) | (dst & 7))); u8((uint8_t)imm);
+    } else {
+      u8(0x81); u8((uint8_t)(0xC0 | (op << 3) | (dst & 7))); u32((uint32_t)imm);
+    }
+  }
+  void test_imm(Reg dst, uint32_t imm) { rex(true, rax, dst); u8(0xF7); u8((uint8_t)(0xC0 | (dst & 7))); u32(imm); }
+  void cmov(Cond cc, Reg dst, Reg src) { rex(true, dst, src); u8(0x0F); u8((uint8_t)(0x40 | cc)); u8((uint8_t)(0xC0 | ((dst & 7) << 3) | (src & 7))); }
+  void push(Reg r) { rex(false, rax, r); u8((uint8_t)(0x50 + (r & 7))); }
+  void pop(Reg r) { rex(false, rax, r); u8((uint8_t)(0x58 + (r & 7))); }
+  void call(Reg r) { rex(false, rax, r); u8(0xFF); u8((uint8_t)(0xD0 | (r & 7))); }
+  void ret() { u8(0xC3); }
+
+  void bind(Label &l) { l.pos = (int)buf.size(); }
+  void rel32(Label &l) { l.fixups.push_back(buf.size()); u32(0); }
+  void jmp(Label &l) { u8(0xE9); rel32(l); }
+  void jcc(Cond cc, Label &l) { u8(0x0F); u8((uint8_t)(0x80 | cc)); rel32(l); }
+  bool resolve(const Label &l) {
+    if (l.pos < 0)
+      return l.fixups.empty();
+    for (size_t at: l.fixups) {
+      int32_t rel = l.pos - (int32_t)(at + 4);
+      ::memcpy(&buf[at], &rel, 4);
+    }
+    return true;
+  }
+};
+
+/**
+ Translate one function.
+ */
+class Compiler {
+  Assembler a_ { };
+  const std::vector<JitOp> &ops_;
+  JitHelper helper_;
+  std::vector<Label> pcs_;
+  Label error_ { };
+  Label exit_ { };
+  PC pc_ { 0 };
+
+  static int32_t slot_(int32_t ix) { return ix * (int32_t)sizeof(Ref); }
+  static int32_t ctx_(size_t offset) { return (int32_t)offset; }
+
+  void push_(Reg r) { a_.store(kSp, 0, r); a_.alu(kAdd, kSp, 8); }
+  void pop_(Reg r) { a_.alu(kSub, kSp, 8); a_.load(r, kSp, 0); }
+  void return_(Reg r) {
+    a_.store(kCtx, ctx_(offsetof(JitContext, result)), r);
+    a_.mov_imm32(rax, 0);
+    a_.jmp(exit_);
+  }
+  void call_helper_(const JitOp &op);
+  void leave_(const JitOp &op);
+  void guard_ints_(std::initializer_list<Reg> regs, Label &slow);
+  bool emit_(const JitOp &op);
+public:
+  Compiler(const std::vector<JitOp> &ops, JitHelper helper)
+  : ops_(ops), helper_(helper), pcs_(ops.size()) { }
+  bool compile();
+  std::vector<uint8_t> &code() { return a_.buf; }
+};
+
+/**
+ Let the runtime run an instruction, and take over its stack pointer.
+ */
+void Compiler::call_helper_(const JitOp &op)
+{
+  a_.mov(rdi, kCtx);
+  a_.mov(rsi, kSp);
+  a_.mov_imm32(rdx, (uint32_t)op.bc);
+  a_.mov_imm32(rcx, (uint32_t)op.arg);
+  a_.mov_imm(r8, (uint64_t)(uintptr_t)op.cache);
+  a_.mov_imm(rax, (uint64_t)(uintptr_t)helper_);
+  a_.call(rax);
+  a_.test(rax, rax);
+  a_.jcc(kEqual, error_);
+  a_.mov(kSp, rax);
+  a_.load(kLocals, kCtx, ctx_(offsetof(JitContext, locals)));
+}
+
+/**
+ Slow path of an integer operation that overflowed.
+
+ The helper returns a real, which is fine if the operands were checked. If
+ the verifier proved them to be integers, the code further down does not
+ check for reals, so the interpreter takes over and runs the instruction
+ again. The operands are still on the stack.
+ */
+void Compiler::leave_(const JitOp &op)
+{
+  if (!op.ints) {
+    call_helper_(op);
+    return;
+  }
+  a_.store(kCtx, ctx_(offsetof(JitContext, sp)), kSp);
+  a_.mov_imm(rax, pc_);
+  a_.store(kCtx, ctx_(offsetof(JitContext, pc)), rax);
+  a_.mov_imm32(rax, 2);
+  a_.jmp(exit_);
+}
+
+/**
+ Jump to \p slow unless all registers hold integers.
+ */
+void Compiler::guard_ints_(std::initializer_list<Reg> regs, Label &slow)
+{
+  // An integer has the tag bits 01, so x^1 has 00.
+  bool first = true;
+  for (Reg r: regs) {
+    Reg t = first ? rdx : rsi;
+    a_.mov(t, r);
+    a_.alu(kXor, t, 1);
+    if (!first)
+      a_.or_(rdx, rsi);
+    first = false;
+  }
+  a_.test_imm(rdx, 3);
+  a_.jcc(kNotEqual, slow);
+}
+
+static Cond compare_cond(BC bc)
+{
+  switch (bc) {
+    case BC::LessThan: return kLess;
+    case BC::GreaterThan: return kGreater;
+    case BC::GreaterOrEqual: return kGreaterOrEqual;
+    default: return kLessOrEqual;
+  }
+}
+
+static Cond compare_cond(Compare kind)
+{
+  switch (kind) {
+    case Compare::Less: return kLess;
+    case Compare::Greater: return kGreater;
+    case Compare::LessOrEqual: return kLessOrEqual;
+    case Compare::GreaterOrEqual: return kGreaterOrEqual;
+    case Compare::Equal: return kEqual;
+    default: return kNotEqual;
+  }
+}
+
+static Cond negate(Cond cc)
+{
+  return (Cond)(cc ^ 1);
+}
+
+/**
+ Emit one instruction.
+ \return false if the instruction can not be compiled
+ */
+bool Compiler::emit_(const JitOp &op)
+{
+  int32_t arg = op.arg;
+  switch (op.bc) {
+    case BC::Pop:
+      a_.alu(kSub, kSp, 8);
+      return true;
+    case BC::Dup:
+      a_.load(rax, kSp, -8);
+      push_(rax);
+      return true;
+    case BC::PushConst:
+      a_.mov_imm(rax, op.value.GetVerbatim());
+      push_(rax);
+      return true;
+    case BC::PushSelf:
+      a_.load(rax, kCtx, ctx_(offsetof(JitContext, self)));
+      push_(rax);
+      return true;
+    case BC::GetVar:
+      a_.load(rax, kLocals, slot_(arg));
+      push_(rax);
+      return true;
+    case BC::GetVar2:
+      a_.load(rax, kLocals, slot_(arg & 0xffff));
+      push_(rax);
+      a_.load(rax, kLocals, slot_(arg >> 16));
+      push_(rax);
+      return true;
+    case BC::SetVar:
+      pop_(rax);
+      a_.store(kLocals, slot_(arg), rax);
+      return true;
+    case BC::SetVarConst:
+      a_.mov_imm(rax, op.value.GetVerbatim());
+      a_.store(kLocals, slot_(arg & 0xffff), rax);
+      return true;
+    case BC::Branch:
+      a_.jmp(pcs_[arg]);
+      return true;
+    case BC::BranchIfTrue:
+    case BC::BranchIfFalse:
+      pop_(rax);
+      a_.alu(kCmp, rax, kRefNil);
+      a_.jcc((op.bc == BC::BranchIfTrue) ? kNotEqual : kEqual, pcs_[arg]);
+      return true;
+    case BC::Return:
+      a_.load(rax, kSp, -8);
+      return_(rax);
+      return true;
+    case BC::ReturnConst:
+      a_.mov_imm(rax, op.value.GetVerbatim());
+      return_(rax);
+      return true;
+    case BC::ReturnVar:
+      a_.load(rax, kLocals, slot_(arg));
+      return_(rax);
+      return true;
+    case BC::EndOfFile: {
+      Label empty;
+      a_.mov_imm(rax, kRefNil);
+      a_.cmp_mem(kSp, kCtx, ctx_(offsetof(JitContext, base)));
+      a_.jcc(kBelowOrEqual, empty);
+      a_.load(rax, kSp, -8);
+      a_.bind(empty);
+      return_(rax);
+      return a_.resolve(empty);
+    }
+    case BC::Add:
+    case BC::Subtract: {
+      Label slow, done;
+      a_.load(rax, kSp, -16);
+      a_.load(rcx, kSp, -8);
+      if (!op.ints)
+        guard_ints_({ rax, rcx }, slow);
+      // Tagged integers: ((a<<2|1) - 1) + (b<<2|1), ((a<<2|1) - (b<<2|1)) + 1
+      // The 64 bit operation overflows exactly if the 62 bit result does.
+      if (op.bc == BC::Add) {
+        a_.alu(kSub, rax, 1);
+        a_.add(rax, rcx);
+        a_.jcc(kOverflow, slow);
+      } else {
+        a_.sub(rax, rcx);
+        a_.jcc(kOverflow, slow);
+        a_.alu(kAdd, rax, 1);
+      }
+      a_.store(kSp, -16, rax);
+      a_.alu(kSub, kSp, 8);
+      a_.jmp(done);
+      a_.bind(slow);
+      leave_(op);
+      a_.bind(done);
+      return a_.resolve(slow) && a_.resolve(done);
+    }
+    case BC::LessThan:
+    case BC::GreaterThan:
+    case BC::GreaterOrEqual:
+    case BC::LessOrEqual: {
+      Label slow, done;
+      a_.load(rax, kSp, -16);
+      a_.load(rcx, kSp, -8);
+      if (!op.ints)
+        guard_ints_({ rax, rcx }, slow);
+      a_.mov_imm32(rdx, kRefNil);
+      a_.mov_imm32(rsi, kRefTrue);
+      a_.cmp(rax, rcx);
+      a_.cmov(compare_cond(op.bc), rdx, rsi);
+      a_.store(kSp, -16, rdx);
+      a_.alu(kSub, kSp, 8);
+      if (!op.ints) {
+        a_.jmp(done);
+        a_.bind(slow);
+        call_helper_(op);
+        a_.bind(done);
+      }
+      return a_.resolve(slow) && a_.resolve(done);
+    }
+    case BC::CompareBranch: {
+      Label slow, done;
+      Cond cc = compare_cond((Compare)(arg >> 24));
+      Label &target = pcs_[arg & 0xffffff];
+      a_.load(rax, kSp, -16);
+      a_.load(rcx, kSp, -8);
+      if (!op.ints)
+        guard_ints_({ rax, rcx }, slow);
+      a_.alu(kSub, kSp, 16);
+      a_.cmp(rax, rcx);
+      a_.jcc(negate(cc), target);
+      if (!op.ints) {
+        a_.jmp(done);
+        a_.bind(slow);
+        call_helper_(op);
+        a_.cmp_mem32(kCtx, ctx_(offsetof(JitContext, taken)), 0);
+        a_.jcc(kNotEqual, target);
+        a_.bind(done);
+      }
+      return a_.resolve(slow) && a_.resolve(done);
+    }
+    case BC::IncrVar: {
+      Label slow, done;
+      a_.load(rax, kLocals, slot_(arg));
+      a_.load(rcx, kSp, -8);
+      if (!op.ints)
+        guard_ints_({ rax, rcx }, slow);
+      a_.alu(kSub, rax, 1);
+      a_.add(rax, rcx);
+      a_.jcc(kOverflow, slow);
+      a_.store(kLocals, slot_(arg), rax);
+      push_(rax);
+      a_.jmp(done);
+      a_.bind(slow);
+      leave_(op);
+      a_.bind(done);
+      return a_.resolve(slow) && a_.resolve(done);
+    }
+    case BC::AddVarConst: {
+      Label slow, done;
+      a_.load(rax, kLocals, slot_(arg & 0xffff));
+      if (!op.ints)
+        guard_ints_({ rax }, slow);
+      a_.alu(kAdd, rax, (arg >> 16) * 4);
+      a_.jcc(kOverflow, slow);
+      a_.store(kLocals, slot_(arg & 0xffff), rax);
+      a_.jmp(done);
+      a_.bind(slow);
+      leave_(op);
+      a_.bind(done);
+      return a_.resolve(slow) && a_.resolve(done);
+    }
+    case BC::BranchLoop: {
+      Label slow, down, done;
+      Label &target = pcs_[arg];
+      a_.load(rdi, kSp, -24);   // increment
+      a_.load(rax, kSp, -16);   // index
+      a_.load(rcx, kSp, -8);    // limit
+      if (!op.ints) {
+        guard_ints_({ rax, rcx }, slow);
+        a_.mov(rdx, rdi);
+        a_.alu(kXor, rdx, 1);
+        a_.test_imm(rdx, 3);
+        a_.jcc(kNotEqual, slow);
+      }
+      a_.alu(kSub, kSp, 24);
+      a_.alu(kCmp, rdi, 1);     // tagged zero
+      a_.jcc(kLessOrEqual, down);
+      a_.cmp(rax, rcx);
+      a_.jcc(kLessOrEqual, target);
+      a_.jmp(done);
+      a_.bind(down);
+      a_.cmp(rax, rcx);
+      a_.jcc(kGreaterOrEqual, target);
+      if (!op.ints) {
+        a_.jmp(done);
+        a_.bind(slow);
+        call_helper_(op);
+        a_.cmp_mem32(kCtx, ctx_(offsetof(JitContext, taken)), 0);
+        a_.jcc(kNotEqual, target);
+      }
+      a_.bind(done);
+      return a_.resolve(slow) && a_.resolve(down) && a_.resolve(done);
+    }
+    case BC::NewHandler:
+    case BC::PopHandlers:
+    case BC::Unknown:
+      // Exception handlers stay in the interpreter.
+      return false;
+    default:
+      call_helper_(op);
+      return true;
+  }
+}
+
+bool Compiler::compile()
+{
+  // int code(JitContext *ctx, Ref *sp); three pushes keep the stack aligned
+  a_.push(rbx);
+  a_.push(r12);
+  a_.push(r13);
+  a_.mov(kCtx, rdi);
+  a_.mov(kSp, rsi);
+  a_.load(kLocals, kCtx, ctx_(offsetof(JitContext, locals)));
+  for (pc_=0; pc_<ops_.size(); ++pc_) {
+    a_.bind(pcs_[pc_]);
+    if (!emit_(ops_[pc_]))
+      return false;
+  }
+  a_.bind(error_);
+  a_.mov_imm32(rax, 1);
+  a_.bind(exit_);
+  a_.pop(r13);
+  a_.pop(r12);
+  a_.pop(rbx);
+  a_.ret();
+  for (const Label &l: pcs_)
+    if (!a_.resolve(l))
+      return false;
+  return a_.resolve(error_) && a_.resolve(exit_);
+}
+
+} // anonymous namespace
+
+#endif // DYN_VM_JIT
+
+/**
+ Compile a verified function to machine code.
+
+ Stack manipulation, locals, constants, branches, and integer arithmetic
+ and compares are compiled inline. Integer operations that the verifier
+ could not prove check the tags and call the helper for everything else,
+ just like all other instructions do. Additions and subtractions that
+ overflow do the same, or hand the function back to the interpreter if
+ the verifier proved their operands to be integers. Functions with exception handlers
+ are not compiled.
+
+ \param[in] ops the instructions of the function
+ \param[in] helper runs instructions that are not compiled inline
+ \return the machine code, or nullptr if the function can't be compiled
+ */
+std::unique_ptr<JitCode> dyn::vm::jit_compile(const std::vector<JitOp> &ops, JitHelper helper)
+{
+#if DYN_VM_JIT
+  Compiler compiler(ops, helper);
+  if (!compiler.compile())
+    return nullptr;
+  auto code = std::make_unique<JitCode>(compiler.code());
+  if (!code->valid())
+    return nullptr;
+  return code;
+#else
+  (void)ops;
+  (void)helper;
+  return nullptr;
+#endif
+}
@@ -0,0 +1,99 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_VM_JIT_H
+#define DYN_VM_JIT_H
+
+#include <dyn/lang/decompile.h>
+#include <dyn/ref.h>
+
+#include <memory>
+#include <vector>
+
+// The compiler emits x86-64 code for the System V calling convention.
+#if defined(__x86_64__) && defined(__linux__)
+# define DYN_VM_JIT 1
+#else
+# define DYN_VM_JIT 0
+#endif
+
+namespace dyn {
+
+namespace vm {
+
+struct InlineCache;
+class Interpreter;
+
+/**
+ State that compiled code shares with the runtime helper.
+ Compiled code keeps a pointer to it in a register.
+ */
+struct JitContext {
+  void *frame;      // owned by the interpreter
+  Ref self;
+  Ref *base;        // bottom of the operand stack of the function
+  Ref *locals;      // slots of the locals frame, reloaded after every helper call
+  Ref result;
+  int taken;        // set by the helper for conditional branches
+  Ref *sp;          // where the interpreter takes over if compiled code returns 2
+  size_t pc;
+};
+
+/**
+ Run one instruction that compiled code does not handle inline.
+ \return the new stack pointer, or nullptr if the instruction threw
+ */
+using JitHelper = Ref *(*)(JitContext *ctx, Ref *sp, int bc, int32_t arg, InlineCache *cache);
+
+/**
+ One instruction as the compiler sees it.
+ */
+struct JitOp {
+  lang::BC bc;
+  int32_t arg;
+  Ref value;            // constant of push_const, return_const, set_var_const
+  InlineCache *cache;
+  bool ints;            // the verifier proved that the operands are integers
+};
+
+class JitCode {
+  void *code_ { nullptr };
+  size_t size_ { 0 };
+public:
+  JitCode(const std::vector<uint8_t> &bytes);
+  ~JitCode();
+  JitCode(JitCode const&) = delete;
+  JitCode& operator=(JitCode const&) = delete;
+  bool valid() const { return code_ != nullptr; }
+  size_t size() const { return size_; }
+  int run(JitContext *ctx, Ref *sp) const;
+};
+
+std::unique_ptr<JitCode> jit_compile(const std::vector<JitOp> &ops, JitHelper helper);
+
+} // namespace vm
+
+} // namespace dyn
+
+#endif // DYN_VM_JIT_H
@@ -0,0 +1,412 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "optimize.h"
+
+using namespace dyn;
+using namespace dyn::lang;
+using namespace dyn::vm;
+
+namespace {
+
+constexpr int32_t kNSRefNIL = 0x02;
+constexpr int kMaxPasses = 8;
+
+bool is_branch(BC bc)
+{
+  return (bc == BC::Branch) || (bc == BC::BranchIfTrue) || (bc == BC::BranchIfFalse)
+      || (bc == BC::BranchLoop) || (bc == BC::CompareBranch);
+}
+
+PC target_of(const Bytecode &bc)
+{
+  return (bc.bc == BC::CompareBranch) ? (PC)(bc.arg & 0xffffff) : (PC)bc.arg;
+}
+
+void set_target(Bytecode &bc, PC target)
+{
+  if (bc.bc == BC::CompareBranch)
+    bc.arg = (bc.arg & ~0xffffff) | (int32_t)target;
+  else
+    bc.arg = (int32_t)target;
+}
+
+bool ends_block(BC bc)
+{
+  return (bc == BC::Branch) || (bc == BC::Return) || (bc == BC::ReturnConst) || (bc == BC::ReturnVar);
+}
+
+bool is_int_const(const Bytecode &bc)
+{
+  return (bc.bc == BC::PushConst) && ((bc.arg & 3) == 0);
+}
+
+bool fits16(int32_t v)
+{
+  return (v >= -0x8000) && (v <= 0x7fff);
+}
+
+/**
+ Pack two 16 bit operands into one argument.
+ The high half may be negative, so it is shifted as an unsigned value.
+ */
+int32_t pack16(int32_t lo, int32_t hi)
+{
+  return (int32_t)(((uint32_t)hi << 16) | ((uint32_t)lo & 0xffff));
+}
+
+bool is_compare(BC bc, Compare &kind)
+{
+  switch (bc) {
+    case BC::LessThan: kind = Compare::Less; return true;
+    case BC::GreaterThan: kind = Compare::Greater; return true;
+    case BC::LessOrEqual: kind = Compare::LessOrEqual; return true;
+    case BC::GreaterOrEqual: kind = Compare::GreaterOrEqual; return true;
+    case BC::Equals: kind = Compare::Equal; return true;
+    case BC::NotEquals: kind = Compare::NotEqual; return true;
+    default: return false;
+  }
+}
+
+/**
+ The peephole optimizer state for one pass.
+ Instructions are marked as removed, and the code is compacted at the end
+ of every pass.
+ */
+class Peephole
+{
+  std::vector<Bytecode> &code_;
+  std::vector<PC> &offsets_;
+  std::vector<bool> removed_;
+  bool changed_ { false };
+
+  // The instruction at pc can be merged into the previous one.
+  bool mergeable_(PC pc) const {
+    return (pc < code_.size()) && !removed_[pc] && (code_[pc].references == 0)
+        && (code_[pc].bc != BC::EndOfFile);
+  }
+  bool at_(PC pc, BC bc) const { return mergeable_(pc) && (code_[pc].bc == bc); }
+  void remove_(PC pc);
+  void retarget_(PC pc, PC target);
+  bool fold_(PC pc);
+  bool fuse_(PC pc);
+  bool branches_(PC pc);
+  void compact_();
+
+public:
+  Peephole(std::vector<Bytecode> &code, std::vector<PC> &offsets)
+  : code_(code), offsets_(offsets), removed_(code.size(), false) { }
+  bool pass();
+};
+
+void Peephole::remove_(PC pc)
+{
+  Bytecode &bc = code_[pc];
+  if (is_branch(bc.bc))
+    code_[target_of(bc)].references--;
+  removed_[pc] = true;
+  changed_ = true;
+}
+
+void Peephole::retarget_(PC pc, PC target)
+{
+  Bytecode &bc = code_[pc];
+  code_[target_of(bc)].references--;
+  set_target(bc, target);
+  code_[target].references++;
+  changed_ = true;
+}
+
+/**
+ Fold constant expressions and remove values that are pushed and popped.
+ */
+bool Peephole::fold_(PC pc)
+{
+  Bytecode &a = code_[pc];
+  switch (a.bc) {
+    case BC::PushConst:
+    case BC::Push:
+    case BC::GetVar:
+    case BC::PushSelf:
+    case BC::Dup:
+      if (at_(pc+1, BC::Pop)) {
+        remove_(pc);
+        remove_(pc+1);
+        return true;
+      }
+      break;
+    case BC::SetPath:
+      // set_path with a result that is popped right away
+      if ((a.arg == 1) && at_(pc+1, BC::Pop)) {
+        a.arg = 0;
+        remove_(pc+1);
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+  if (is_int_const(a) && mergeable_(pc+1) && is_int_const(code_[pc+1]) && mergeable_(pc+2)) {
+    int64_t x = a.arg >> 2, y = code_[pc+1].arg >> 2, r;
+    switch (code_[pc+2].bc) {
+      case BC::Add: r = x + y; break;
+      case BC::Subtract: r = x - y; break;
+      case BC::Multiply: r = x * y; break;
+      default: return false;
+    }
+    if ((r < -(1 << 29)) || (r >= (1 << 29)))
+      return false;
+    a.arg = (int32_t)(r * 4);
+    remove_(pc+1);
+    remove_(pc+2);
+    return true;
+  }
+  if ((a.bc == BC::PushConst) && at_(pc+1, BC::Not)) {
+    a.arg = (a.arg == kNSRefNIL) ? 0x1a : kNSRefNIL;
+    remove_(pc+1);
+    return true;
+  }
+  return false;
+}
+
+/**
+ Replace common sequences with superinstructions.
+ */
+bool Peephole::fuse_(PC pc)
+{
+  Bytecode &a = code_[pc];
+  Compare kind;
+  switch (a.bc) {
+    case BC::PushConst:
+      if (at_(pc+1, BC::Return)) {
+        a.bc = BC::ReturnConst;
+        remove_(pc+1);
+        return true;
+      }
+      if (at_(pc+1, BC::SetVar) && fits16(a.arg) && (code_[pc+1].arg < 0x8000)) {
+        a.bc = BC::SetVarConst;
+        a.arg = pack16(code_[pc+1].arg, a.arg);
+        remove_(pc+1);
+        return true;
+      }
+      break;
+    case BC::GetVar:
+      // x := x + k
+      if (   mergeable_(pc+1) && is_int_const(code_[pc+1]) && fits16(code_[pc+1].arg >> 2)
+          && at_(pc+2, BC::Add) && at_(pc+3, BC::SetVar) && (code_[pc+3].arg == a.arg)
+          && (a.arg < 0x8000)) {
+        a.bc = BC::AddVarConst;
+        a.arg = pack16(a.arg, code_[pc+1].arg >> 2);
+        remove_(pc+1);
+        remove_(pc+2);
+        remove_(pc+3);
+        return true;
+      }
+      if (at_(pc+1, BC::Return)) {
+        a.bc = BC::ReturnVar;
+        remove_(pc+1);
+        return true;
+      }
+      if (at_(pc+1, BC::GetVar) && (a.arg < 0x8000) && (code_[pc+1].arg < 0x8000)) {
+        a.bc = BC::GetVar2;
+        a.arg = pack16(a.arg, code_[pc+1].arg);
+        remove_(pc+1);
+        return true;
+      }
+      break;
+    default:
+      if (is_compare(a.bc, kind) && mergeable_(pc+1) && (target_of(code_[pc+1]) < 0x1000000)) {
+        Bytecode &b = code_[pc+1];
+        if ((b.bc == BC::BranchIfTrue) && (kind == Compare::Equal || kind == Compare::NotEqual))
+          kind = (kind == Compare::Equal) ? Compare::NotEqual : Compare::Equal;
+        else if (b.bc != BC::BranchIfFalse)
+          break;
+        a.bc = BC::CompareBranch;
+        a.arg = (int32_t)b.arg | ((int32_t)kind << 24);
+        code_[b.arg].references++;
+        remove_(pc+1);
+        return true;
+      }
+      break;
+  }
+  return false;
+}
+
+/**
+ Simplify branches.
+ Inverts branches after 'not', resolves branches on constants, follows
+ chains of branches, and removes code that can not be reached.
+ */
+bool Peephole::branches_(PC pc)
+{
+  Bytecode &a = code_[pc];
+  if ((a.bc == BC::Not) && mergeable_(pc+1)
+      && ((code_[pc+1].bc == BC::BranchIfTrue) || (code_[pc+1].bc == BC::BranchIfFalse))) {
+    Bytecode &b = code_[pc+1];
+    a.bc = (b.bc == BC::BranchIfTrue) ? BC::BranchIfFalse : BC::BranchIfTrue;
+    a.arg = b.arg;
+    code_[b.arg].references++;
+    remove_(pc+1);
+    return true;
+  }
+  if ((a.bc == BC::PushConst) && mergeable_(pc+1)
+      && ((code_[pc+1].bc == BC::BranchIfTrue) || (code_[pc+1].bc == BC::BranchIfFalse))) {
+    Bytecode &b = code_[pc+1];
+    bool taken = (a.arg != kNSRefNIL) == (b.bc == BC::BranchIfTrue);
+    if (taken) {
+      a.bc = BC::Branch;
+      a.arg = b.arg;
+      code_[b.arg].references++;
+    } else {
+      remove_(pc);
+    }
+    remove_(pc+1);
+    return true;
+  }
+  bool changed = false;
+  if (is_branch(a.bc) && (a.bc != BC::BranchLoop)) {
+    // Follow branches to branches. Stop after a few steps in case of loops.
+    for (int i=0; i<8; ++i) {
+      PC t = target_of(a);
+      if ((t < code_.size()) && !removed_[t] && (code_[t].bc == BC::Branch) && (code_[t].arg != (int32_t)t)
+          && ((a.bc != BC::CompareBranch) || (code_[t].arg < 0x1000000))) {
+        retarget_(pc, (PC)code_[t].arg);
+        changed = true;
+      } else {
+        break;
+      }
+    }
+    // A branch to the next instruction does nothing.
+    PC next = pc + 1;
+    while (next < code_.size() && removed_[next])
+      ++next;
+    if ((a.bc == BC::Branch) && (target_of(a) == next)) {
+      remove_(pc);
+      return true;
+    }
+  }
+  if (ends_block(a.bc)) {
+    for (PC i=pc+1; mergeable_(i); ++i) {
+      remove_(i);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/**
+ Remove all marked instructions and update branch targets and offsets.
+ Branches to a removed instruction continue at the next remaining one.
+ */
+void Peephole::compact_()
+{
+  std::vector<PC> new_pc(code_.size() + 1);
+  PC n = 0;
+  for (PC pc=0; pc<code_.size(); ++pc) {
+    new_pc[pc] = n;
+    if (!removed_[pc])
+      ++n;
+  }
+  new_pc[code_.size()] = n;
+  for (PC pc=0; pc<code_.size(); ++pc) {
+    if (removed_[pc] && code_[pc].references) {
+      PC t = pc + 1;
+      while (t < code_.size() && removed_[t])
+        ++t;
+      if (t < code_.size())
+        code_[t].references += code_[pc].references;
+    }
+  }
+  PC j = 0;
+  for (PC pc=0; pc<code_.size(); ++pc) {
+    if (removed_[pc])
+      continue;
+    Bytecode bc = code_[pc];
+    if (is_branch(bc.bc))
+      set_target(bc, new_pc[target_of(bc)]);
+    code_[j++] = bc;
+  }
+  code_.resize(j);
+  for (PC &pc: offsets_) {
+    if (pc != kInvalidPC)
+      pc = new_pc[pc];
+  }
+  removed_.assign(code_.size(), false);
+}
+
+/**
+ Run one pass over all instructions.
+ \return true if anything changed
+ */
+bool Peephole::pass()
+{
+  changed_ = false;
+  for (PC pc=0; pc<code_.size(); ++pc) {
+    if (removed_[pc])
+      continue;
+    if (!fold_(pc) && !branches_(pc))
+      fuse_(pc);
+  }
+  if (changed_)
+    compact_();
+  return changed_;
+}
+
+} // namespace
+
+/**
+ Optimize transcoded bytecode for the interpreter.
+
+ Constant expressions are folded, values that are pushed and popped right
+ away are removed, branches on constants and branches to branches are
+ resolved, and unreachable code is dropped. Common sequences are replaced
+ with superinstructions:
+
+ \code
+    push_const k; return                       -> return_const k
+    get_var a; return                          -> return_var a
+    get_var a; get_var b                       -> get_var2 a, b
+    push_const k; set_var a                    -> set_var_const a, k
+    get_var a; push_const k; add; set_var a    -> add_var_const a, k
+    less_than; branch_if_false t               -> compare_branch <, t
+ \endcode
+
+ Instructions that are a branch target are never merged into the previous
+ instruction. The result can no longer be decompiled.
+
+ \param[inout] code transcoded bytecode
+ \param[inout] offsets PC for every byte offset in the Newton bytecode,
+    updated to the new PCs
+ \return the number of instructions that were removed
+ */
+size_t dyn::vm::optimize(std::vector<Bytecode> &code, std::vector<PC> &offsets)
+{
+  size_t size = code.size();
+  Peephole peephole(code, offsets);
+  for (int i=0; i<kMaxPasses; ++i) {
+    if (!peephole.pass())
+      break;
+  }
+  return size - code.size();
+}
@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DYN_VM_OPTIMIZE_H
+#define DYN_VM_OPTIMIZE_H
+
+#include <dyn/lang/decompile.h>
+
+#include <vector>
+
+namespace dyn {
+
+namespace vm {
+
+/**
+ Conditions of BC::CompareBranch, stored in the upper 8 bits of the argument.
+ The instruction branches if the comparison is false.
+ */
+enum class Compare : int32_t {
+  Less, Greater, LessOrEqual, GreaterOrEqual, Equal, NotEqual
+};
+
+size_t optimize(std::vector<lang::Bytecode> &code, std::vector<lang::PC> &offsets);
+
+} // namespace vm
+
+} // namespace dyn
+
+#endif // DYN_VM_OPTIMIZE_H
+
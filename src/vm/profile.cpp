@@ -0,0 +1,250 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Execution profile of NewtonScript code.
+
+#include <dyn/vm/profile.h>
+#include <dyn/objects.h>
+#include "../lang/transcode.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+using namespace dyn;
+using namespace dyn::lang;
+using namespace dyn::vm;
+
+/** \class dyn::vm::Profile
+ Instruction counts and time per function, collected by the interpreter.
+
+ Pass a profile to Interpreter::set_profile() to start profiling. The
+ interpreter then counts every instruction it executes, per opcode and per
+ function and PC. Compiled code is not used while profiling.
+
+ Reading the clock for every instruction would cost more than most
+ instructions do, so time is sampled instead: every kSampleInterval
+ instructions, the time since the last sample is charged to the function
+ that runs at that moment. Over many samples this converges to the time
+ spent in each function itself, without its callees.
+
+ write_report() lists the most frequent opcodes and the hottest functions.
+ The hot functions are decompiled, and every source line shows how many
+ instructions were executed for it.
+ */
+
+Profile::Profile()
+{
+  clear();
+}
+
+/**
+ Forget everything and restart the clock.
+ */
+void Profile::clear()
+{
+  std::fill(std::begin(op_counts_), std::end(op_counts_), 0);
+  functions_.clear();
+  countdown_ = kSampleInterval;
+  last_ = std::chrono::steady_clock::now();
+}
+
+/**
+ Get the counters of a function.
+ \param[in] key identifies the function, the interpreter uses its instructions
+ \param[in] func the function frame
+ \param[in] code, offsets the code that the interpreter runs, and where
+    the byte offsets of the original instructions went
+ */
+Profile::Function &Profile::function(const Object *key, RefArg func, const std::vector<Bytecode> &code,
+                                     const std::vector<PC> &offsets)
+{
+  Function &f = functions_[key];
+  if (f.counts.size() != code.size()) {
+    f.func = func;
+    f.counts.assign(code.size(), 0);
+    f.code.resize(code.size());
+    for (size_t i=0; i<code.size(); ++i)
+      f.code[i] = code[i].bc;
+    f.offsets = offsets;
+  }
+  return f;
+}
+
+void Profile::sample_(Function &f)
+{
+  auto now = std::chrono::steady_clock::now();
+  f.seconds += std::chrono::duration<double>(now - last_).count();
+  f.samples++;
+  last_ = now;
+  countdown_ = kSampleInterval;
+}
+
+uint64_t Profile::total() const
+{
+  uint64_t n = 0;
+  for (uint64_t c: op_counts_)
+    n += c;
+  return n;
+}
+
+uint64_t Profile::Function::executed() const
+{
+  uint64_t n = 0;
+  for (uint64_t c: counts)
+    n += c;
+  return n;
+}
+
+static double percent(double part, double whole)
+{
+  return (whole > 0) ? 100.0 * part / whole : 0.0;
+}
+
+/**
+ Print the decompiled source of a function with instruction counts per line.
+ The interpreter runs optimized code, so its PCs are first mapped back to
+ the plain transcoded code through the byte offsets of the Newton
+ instructions. Superinstructions count for the first line they came from.
+ */
+static void write_annotated(std::ostream &out, const Profile::Function &f)
+{
+  std::ostringstream log;
+  std::vector<int> line_of_pc;
+  Ref src = decompile(f.func, log, line_of_pc);
+  std::vector<PC> raw_offsets;
+  transcode_from_ns(f.func, &raw_offsets);
+  std::vector<PC> raw_pc(f.counts.size(), kInvalidPC);
+  for (size_t b=0; (b<f.offsets.size()) && (b<raw_offsets.size()); ++b) {
+    PC p = f.offsets[b], q = raw_offsets[b];
+    if ((p < raw_pc.size()) && (q < raw_pc[p]))
+      raw_pc[p] = q;
+  }
+  std::vector<uint64_t> per_line;
+  uint64_t other = 0;
+  for (PC pc=0; pc<f.counts.size(); ++pc) {
+    if (!f.counts[pc])
+      continue;
+    PC q = raw_pc[pc];
+    int line = (q < line_of_pc.size()) ? line_of_pc[q] : 0;
+    if (line > 0) {
+      if ((size_t)line >= per_line.size())
+        per_line.resize(line + 1, 0);
+      per_line[line] += f.counts[pc];
+    } else {
+      other += f.counts[pc];
+    }
+  }
+
+  if (src.IsBinary()) {
+    std::istringstream text((const char*)BinaryData(src));
+    std::string line;
+    for (size_t n=1; std::getline(text, line); ++n) {
+      out << std::setw(14);
+      if ((n < per_line.size()) && per_line[n])
+        out << per_line[n];
+      else
+        out << "";
+      out << " | " << line << "\n";
+    }
+  } else {
+    out << std::setw(14) << "" << " | (can't decompile)\n";
+  }
+  if (other)
+    out << std::setw(14) << other << " | (not mapped to a line)\n";
+
+  std::vector<PC> hot;
+  for (PC pc=0; pc<f.counts.size(); ++pc)
+    if (f.counts[pc])
+      hot.push_back(pc);
+  std::sort(hot.begin(), hot.end(), [&f](PC a, PC b) { return f.counts[a] > f.counts[b]; });
+  if (hot.size() > 5)
+    hot.resize(5);
+  out << "  hot instructions:\n";
+  for (PC pc: hot) {
+    PC q = raw_pc[pc];
+    int line = (q < line_of_pc.size()) ? line_of_pc[q] : 0;
+    out << "    pc " << std::setw(5) << pc << "  " << std::left << std::setw(18) << bc_name(f.code[pc])
+        << std::right << std::setw(14) << f.counts[pc];
+    if (line > 0)
+      out << "  line " << line;
+    out << "\n";
+  }
+}
+
+/**
+ Write a human readable report.
+ The report is formatted in a string stream first, so the flags and the
+ precision of the destination stay as they are.
+ \param[in] dest destination
+ \param[in] max_functions list and annotate this many of the hottest functions
+ */
+void Profile::write_report(std::ostream &dest, size_t max_functions) const
+{
+  std::ostringstream out;
+  uint64_t num_ops = total();
+  double seconds = 0.0;
+  for (const auto &it: functions_)
+    seconds += it.second.seconds;
+  out << "Instructions executed: " << num_ops << "\n";
+  out << "Sampled time: " << std::fixed << std::setprecision(3) << seconds * 1000.0 << " ms\n";
+
+  std::vector<std::pair<uint64_t, BC>> ops;
+  for (size_t i=0; i<=(size_t)BC::Unknown; ++i)
+    if (op_counts_[i])
+      ops.emplace_back(op_counts_[i], (BC)i);
+  std::sort(ops.begin(), ops.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+  out << "\nOpcodes:\n";
+  for (const auto &op: ops) {
+    out << "  " << std::left << std::setw(20) << bc_name(op.second) << std::right
+        << std::setw(14) << op.first << std::setw(8) << std::setprecision(1)
+        << percent((double)op.first, (double)num_ops) << "%\n";
+  }
+
+  std::vector<const Function*> funcs;
+  for (const auto &it: functions_)
+    funcs.push_back(&it.second);
+  std::sort(funcs.begin(), funcs.end(), [](const Function *a, const Function *b) {
+    if (a->seconds != b->seconds)
+      return a->seconds > b->seconds;
+    return a->executed() > b->executed();
+  });
+  if (funcs.size() > max_functions)
+    funcs.resize(max_functions);
+  out << "\nFunctions:\n";
+  for (size_t i=0; i<funcs.size(); ++i) {
+    const Function &f = *funcs[i];
+    out << "  #" << (i + 1) << " " << (f.name.empty() ? "<anonymous>" : f.name) << ": "
+        << f.calls << " calls, " << f.executed() << " instructions, "
+        << std::setprecision(3) << f.seconds * 1000.0 << " ms ("
+        << std::setprecision(1) << percent(f.seconds, seconds) << "%)\n";
+  }
+  for (size_t i=0; i<funcs.size(); ++i) {
+    const Function &f = *funcs[i];
+    out << "\n--- #" << (i + 1) << " " << (f.name.empty() ? "<anonymous>" : f.name) << "\n";
+    write_annotated(out, f);
+  }
+  dest << out.str();
+}
@@ -0,0 +1,260 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 The Dyne Language Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmarks for the hot paths of package loading, decoding, decompiling,
+// and the object system. Build a Release configuration for useful numbers.
+//
+// Package benchmarks use a generated package, or any other package file:
+//   DYNE_BENCH_PACKAGE=/path/to/app.pkg ./dynebench
+
+#include <dyn/ref.h>
+#include <dyn/objects.h>
+#include <dyn/io/generate.h>
+#include <dyn/io/package.h>
+#include <dyn/io/snapshot.h>
+#include <dyn/io/stream.h>
+#include <dyn/lang/decompile.h>
+#include "../src/lang/transcode.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const char *BenchPackage(benchmark::State &state)
+{
+  static std::string path;
+  if (path.empty()) {
+    const char *env = std::getenv("DYNE_BENCH_PACKAGE");
+    if (env) {
+      path = env;
+    } else {
+      // About the size of a large Newton application.
+      dyn::io::Generator::Options opt;
+      opt.num_objects = 5000;
+      path = (std::filesystem::temp_directory_path() / "dynebench.pkg").string();
+      if (dyn::io::Generator(opt).write_package(path) < 0)
+        path.clear();
+    }
+  }
+  if (path.empty()) {
+    state.SkipWithError("can't create a package");
+    return nullptr;
+  }
+  return path.c_str();
+}
+
+static void BM_PackageLoad(benchmark::State &state) {
+  const char *path = BenchPackage(state);
+  if (!path) return;
+  for (auto _: state) {
+    dyn::io::Package pkg;
+    benchmark::DoNotOptimize(pkg.load(path));
+  }
+}
+BENCHMARK(BM_PackageLoad)->Unit(benchmark::kMillisecond);
+
+// Objects remember their Dyne counterpart, so every iteration needs a fresh
+// package.
+static void BM_PackageToNOS(benchmark::State &state) {
+  const char *path = BenchPackage(state);
+  if (!path) return;
+  for (auto _: state) {
+    state.PauseTiming();
+    auto pkg = std::make_unique<dyn::io::Package>();
+    pkg->load(path);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(pkg->toNOS());
+  }
+}
+BENCHMARK(BM_PackageToNOS)->Unit(benchmark::kMillisecond);
+
+// Compare with BM_PackageLoad plus BM_PackageToNOS.
+static void BM_SnapshotLoad(benchmark::State &state) {
+  const char *path = BenchPackage(state);
+  if (!path) return;
+  std::string snap_path = (std::filesystem::temp_directory_path() / "dynebench.snap").string();
+  dyn::io::Package pkg;
+  pkg.load(path);
+  if (dyn::io::Snapshot::write(pkg.toNOS(), snap_path) < 0) {
+    state.SkipWithError("can't write a snapshot");
+    return;
+  }
+  for (auto _: state) {
+    dyn::io::Snapshot snap;
+    benchmark::DoNotOptimize(snap.load(snap_path));
+  }
+}
+BENCHMARK(BM_SnapshotLoad)->Unit(benchmark::kMillisecond);
+
+static void BM_PackageWriteAsm(benchmark::State &state) {
+  const char *path = BenchPackage(state);
+  if (!path) return;
+  dyn::io::Package pkg;
+  pkg.load(path);
+  for (auto _: state)
+    benchmark::DoNotOptimize(pkg.writeAsm("/dev/null"));
+}
+BENCHMARK(BM_PackageWriteAsm)->Unit(benchmark::kMillisecond);
+
+static void BM_StreamReaderRead(benchmark::State &state) {
+  dyn::io::Generator::Options opt;
+  opt.num_objects = (uint32_t)state.range(0);
+  std::vector<uint8_t> nsof = dyn::io::Generator(opt).nsof();
+  for (auto _: state) {
+    dyn::io::StreamReader in;
+    in.open(nsof.data(), nsof.size());
+    benchmark::DoNotOptimize(in.read());
+  }
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)nsof.size());
+}
+BENCHMARK(BM_StreamReaderRead)->RangeMultiplier(10)->Range(100, 100000);
+
+static dyn::Ref MakeFunction(const std::vector<uint8_t> &code, int num_literals)
+{
+  dyn::Ref instructions = dyn::AllocateBinary(dyn::Sym("instructions"), (dyn::Index)code.size());
+  ::memcpy(dyn::BinaryData(instructions), code.data(), code.size());
+  dyn::Ref literals = dyn::AllocateArray(0);
+  for (int i=0; i<num_literals; ++i)
+    dyn::AddArraySlot(literals, dyn::Sym("lit" + std::to_string(i)));
+  dyn::Ref func = dyn::AllocateFrame();
+  dyn::SetFrameSlot(func, dyn::Sym("class"), dyn::Sym("CodeBlock"));
+  dyn::SetFrameSlot(func, dyn::Sym("instructions"), instructions);
+  dyn::SetFrameSlot(func, dyn::Sym("literals"), literals);
+  return func;
+}
+
+// A function with n statements of the form
+//   if lit_0 then lit_1 := 1 else lit_1 := 2;
+static dyn::Ref MakeLongFunction(int n)
+{
+  static const uint8_t kStatement[] = {
+    0x70, 0x6F, 0x00, 0x00, 0x24, 0xA9, 0x5F, 0x00, 0x00, 0x28, 0xA9
+  };
+  std::vector<uint8_t> code;
+  for (int i=0; i<n; ++i) {
+    size_t at = code.size();
+    code.insert(code.end(), std::begin(kStatement), std::end(kStatement));
+    size_t else_pc = at + 9, end_pc = at + 11;
+    code[at + 2] = (uint8_t)(else_pc >> 8);
+    code[at + 3] = (uint8_t)else_pc;
+    code[at + 7] = (uint8_t)(end_pc >> 8);
+    code[at + 8] = (uint8_t)end_pc;
+  }
+  code.push_back(0x22);
+  code.push_back(0x02);
+  return MakeFunction(code, 2);
+}
+
+static void BM_Transcode(benchmark::State &state) {
+  dyn::Ref func = MakeLongFunction((int)state.range(0));
+  for (auto _: state)
+    benchmark::DoNotOptimize(dyn::lang::transcode_from_ns(func));
+}
+BENCHMARK(BM_Transcode)->Range(8, 1024);
+
+static void BM_Decompile(benchmark::State &state) {
+  dyn::Ref func = MakeLongFunction((int)state.range(0));
+  for (auto _: state) {
+    std::ostringstream log;
+    benchmark::DoNotOptimize(dyn::lang::decompile(func, log));
+  }
+}
+BENCHMARK(BM_Decompile)->Range(8, 1024);
+
+static dyn::Ref MakeFrame(int num_slots, std::vector<dyn::Ref> &tags)
+{
+  dyn::Ref frame = dyn::AllocateFrame();
+  for (int i=0; i<num_slots; ++i) {
+    tags.push_back(dyn::Sym("slot" + std::to_string(i)));
+    dyn::SetFrameSlot(frame, tags.back(), dyn::Ref(i));
+  }
+  return frame;
+}
+
+static void BM_FrameGetSlot(benchmark::State &state) {
+  std::vector<dyn::Ref> tags;
+  dyn::Ref frame = MakeFrame((int)state.range(0), tags);
+  auto f = static_cast<dyn::Frame*>(frame.GetObject());
+  size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(f->GetSlot(tags[i]));
+    if (++i == tags.size()) i = 0;
+  }
+}
+BENCHMARK(BM_FrameGetSlot)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_CompactFrameGetSlot(benchmark::State &state) {
+  std::vector<dyn::Ref> tags;
+  dyn::CompactHeap::Enable();
+  dyn::Ref frame = dyn::CompactHeap::Compact(MakeFrame((int)state.range(0), tags));
+  auto f = static_cast<dyn::Frame*>(frame.GetObject());
+  for (size_t j=0; j<tags.size(); ++j)
+    tags[j] = f->GetTag((dyn::Index)j);
+  size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(f->GetSlot(tags[i]));
+    if (++i == tags.size()) i = 0;
+  }
+}
+BENCHMARK(BM_CompactFrameGetSlot)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_FrameSetSlot(benchmark::State &state) {
+  std::vector<dyn::Ref> tags;
+  dyn::Ref frame = MakeFrame((int)state.range(0), tags);
+  auto f = static_cast<dyn::Frame*>(frame.GetObject());
+  size_t i = 0;
+  for (auto _: state) {
+    f->SetSlot(tags[i], dyn::Ref((dyn::Integer)i));
+    if (++i == tags.size()) i = 0;
+  }
+}
+BENCHMARK(BM_FrameSetSlot)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_Sym(benchmark::State &state) {
+  std::vector<std::string> names;
+  for (int i=0; i<state.range(0); ++i)
+    names.push_back("symbol" + std::to_string(i));
+  size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(dyn::Sym(names[i]));
+    if (++i == names.size()) i = 0;
+  }
+}
+BENCHMARK(BM_Sym)->RangeMultiplier(8)->Range(1, 4096);
+
+static void BM_SymbolCompare(benchmark::State &state) {
+  // Worst case: equal except for case, so every character is compared.
+  dyn::Ref a = dyn::Sym("viewSetupFormScript");
+  dyn::Ref b = dyn::Sym("VIEWSETUPFORMSCRIPT");
+  for (auto _: state)
+    benchmark::DoNotOptimize(dyn::SymbolCompare(a, b));
+}
+BENCHMARK(BM_SymbolCompare);
+
+BENCHMARK_MAIN();
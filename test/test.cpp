@@ -24,12 +24,34 @@
 
 #include <dyn/ref.h>
 #include <dyn/objects.h>
+#include <dyn/io/cxx.h>
+#include <dyn/io/export.h>
+#include <dyn/io/generate.h>
 #include <dyn/io/package.h>
+#include <dyn/io/print.h>
+#include <dyn/io/snapshot.h>
+#include <dyn/io/stream.h>
+#include <dyn/io/stream/stream_parser.h>
+#include <dyn/io/stream/stream_source.h>
+#include <dyn/tools/census.h>
+#include <dyn/tools/stats.h>
 #include <dyn/tools/tools.h>
+#include <dyn/tools/trace.h>
 #include <dyn/lang/decompile.h>
+#include <dyn/vm/interpreter.h>
+#include <dyn/vm/profile.h>
+
+#include "gen_image.h"
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
 
 int main(int argc, char **argv)
 {
@@ -102,3 +124,951 @@ TEST(DyneRefs, BasicTypes) {
 TEST(DyneRefs, GetSet) {
 }
 
+TEST(DyneRefs, SetExistingSlot) {
+  // Setting an existing slot must not touch its neighbour.
+  dyn::Ref frame = dyn::AllocateFrame();
+  dyn::SetFrameSlot(frame, dyn::Sym("a"), 1);
+  dyn::SetFrameSlot(frame, dyn::Sym("b"), 2);
+  dyn::SetFrameSlot(frame, dyn::Sym("b"), 3);
+  ASSERT_EQ( dyn::GetFrameSlot(frame, dyn::Sym("a")).GetInt(), 1 );
+  ASSERT_EQ( dyn::GetFrameSlot(frame, dyn::Sym("b")).GetInt(), 3 );
+}
+
+// A read-only frame that refers to itself, as written by CxxWriter.
+namespace {
+extern const dyn::Symbol cx_sym_self;
+extern const dyn::Map cx_map;
+extern const dyn::Frame cx_frame;
+constexpr dyn::Symbol cx_sym_self { "self", true };
+constexpr dyn::Ref cx_map_slots[] = { dyn::RefNIL, dyn::Ref(cx_sym_self) };
+constexpr dyn::Map cx_map { dyn::Ref(0), 2, cx_map_slots, true };
+constexpr dyn::Ref cx_frame_slots[] = { dyn::Ref(cx_frame) };
+constexpr dyn::Frame cx_frame { cx_map, 1, cx_frame_slots, true };
+constexpr dyn::BinaryObject cx_string { dyn::gSymString, 3, "hi", true };
+} // namespace
+
+TEST(DyneRefs, ConstexprObjects) {
+  dyn::Ref frame { cx_frame };
+  ASSERT_TRUE( frame.IsFrame() );
+  ASSERT_TRUE( frame.IsReadOnly() );
+  ASSERT_TRUE( dyn::GetFrameSlot(frame, dyn::Sym("self")) == frame );
+  ASSERT_FALSE( dyn::Sym("self").IsReadOnly() );
+  // -- frames built from a compiled map never write to it
+  dyn::Ref built = dyn::AllocateFrameWithMap(dyn::Ref(cx_map));
+  ASSERT_FALSE( built.IsReadOnly() );
+  dyn::SetFrameSlot(built, dyn::Sym("self"), 3);
+  dyn::SetFrameSlot(built, dyn::Sym("more"), 4);
+  ASSERT_TRUE( dyn::GetFrameSlot(built, dyn::Sym("self")) == dyn::Ref(3) );
+  ASSERT_TRUE( dyn::GetFrameSlot(built, dyn::Sym("more")) == dyn::Ref(4) );
+  ASSERT_EQ( cx_map.Length(), 2 );
+  ASSERT_TRUE( cx_map.GetClass() == dyn::Ref(0) );
+}
+
+TEST(DyneRefs, CopyOnWrite) {
+  dyn::Ref frame { cx_frame };
+  // -- the first write creates a copy that shares the read-only map
+  dyn::SetFrameSlot(frame, dyn::Sym("self"), 1);
+  ASSERT_EQ( dyn::CopyOnWrite::Count(), 1u );
+  dyn::Ref copy = dyn::CopyOnWrite::Writable(frame);
+  ASSERT_FALSE( copy == frame );
+  ASSERT_FALSE( copy.IsReadOnly() );
+  ASSERT_EQ( static_cast<dyn::Frame*>(copy.GetObject())->GetMap(), &cx_map );
+  ASSERT_TRUE( dyn::GetFrameSlot(frame, dyn::Sym("self")) == dyn::Ref(1) );
+  ASSERT_TRUE( cx_frame.GetSlot(0) == frame );
+  // -- adding a slot gives the copy its own map
+  dyn::SetFrameSlot(frame, dyn::Sym("more"), 2);
+  ASSERT_EQ( dyn::CopyOnWrite::Count(), 1u );
+  ASSERT_NE( static_cast<dyn::Frame*>(copy.GetObject())->GetMap(), &cx_map );
+  ASSERT_TRUE( dyn::GetFrameSlot(frame, dyn::Sym("more")) == dyn::Ref(2) );
+  ASSERT_EQ( cx_map.Length(), 2 );
+  // -- changing the class of a compiled object goes to a copy as well
+  dyn::Ref str { cx_string };
+  dyn::SetClass(str, dyn::Sym("name"));
+  ASSERT_TRUE( cx_string.GetClass() == dyn::gSymString );
+  ASSERT_EQ( dyn::SymbolCompare(dyn::CopyOnWrite::Follow(str).GetObject()->GetClass(), dyn::Sym("name")), 0 );
+  // -- forgetting other copies never hides this one from a reader
+  std::atomic<bool> done { false };
+  std::atomic<int> misses { 0 };
+  std::thread reader([&] {
+    while (!done.load())
+      if (!(dyn::GetFrameSlot(frame, dyn::Sym("self")) == dyn::Ref(1)))
+        misses++;
+  });
+  char other[64];
+  for (int i=0; i<2000; ++i)
+    dyn::CopyOnWrite::Forget(other, other + sizeof(other));
+  done = true;
+  reader.join();
+  ASSERT_EQ( misses.load(), 0 );
+  dyn::CopyOnWrite::Clear();
+  ASSERT_TRUE( dyn::GetFrameSlot(frame, dyn::Sym("self")) == frame );
+}
+
+TEST(DyneRefs, CompactHeap) {
+  ASSERT_TRUE( dyn::CompactHeap::Enable() );
+  for (dyn::Ref r : { dyn::Ref(-1), dyn::Ref((1<<29)-1), dyn::RefNIL, dyn::RefTRUE,
+                      dyn::Ref((dyn::UniChar)0x20AC), dyn::Ref(2, 7) }) {
+    uint32_t c = 0;
+    ASSERT_TRUE( dyn::CompactHeap::Encode(r, c) );
+    ASSERT_TRUE( dyn::CompactHeap::Decode(c) == r );
+  }
+  uint32_t c = 0;
+  ASSERT_FALSE( dyn::CompactHeap::Encode(dyn::Ref((dyn::Integer)1<<40), c) );
+  // -- all slots fit, so the copies use 32 bit slots
+  dyn::Ref list = dyn::AllocateArray(2);
+  dyn::SetArraySlot(list, 0, dyn::MakeString("str"));
+  dyn::SetArraySlot(list, 1, -5);
+  dyn::Ref frame = dyn::AllocateFrame();
+  dyn::SetFrameSlot(frame, dyn::Sym("list"), list);
+  dyn::SetFrameSlot(frame, dyn::Sym("self"), frame);
+  dyn::Ref big = dyn::AllocateArray(1);
+  dyn::SetArraySlot(big, 0, dyn::Ref((dyn::Integer)1<<40));
+  dyn::SetFrameSlot(frame, dyn::Sym("big"), big);
+  dyn::Ref compact = dyn::CompactHeap::Compact(frame);
+  ASSERT_TRUE( dyn::CompactHeap::Contains(compact.GetObject()) );
+  ASSERT_TRUE( compact.GetObject()->IsCompact() );
+  ASSERT_TRUE( dyn::GetFrameSlot(compact, dyn::Sym("self")) == compact );
+  dyn::Ref list2 = dyn::GetFrameSlot(compact, dyn::Sym("list"));
+  ASSERT_TRUE( list2.GetObject()->IsCompact() );
+  ASSERT_EQ( dyn::GetArraySlot(list2, 1).GetInt(), -5 );
+  ASSERT_STREQ( (const char*)dyn::BinaryData(dyn::GetArraySlot(list2, 0)), "str" );
+  dyn::Ref big2 = dyn::GetFrameSlot(compact, dyn::Sym("big"));
+  ASSERT_FALSE( big2.GetObject()->IsCompact() );
+  ASSERT_EQ( dyn::GetArraySlot(big2, 0).GetInt(), (dyn::Integer)1<<40 );
+  ASSERT_TRUE( dyn::CompactHeap::Compact(compact) == compact );
+  // -- values from outside of the compact heap widen the slots
+  dyn::SetFrameSlot(compact, dyn::Sym("self"), frame);
+  ASSERT_FALSE( compact.GetObject()->IsCompact() );
+  ASSERT_TRUE( dyn::GetFrameSlot(compact, dyn::Sym("self")) == frame );
+  ASSERT_TRUE( dyn::GetFrameSlot(compact, dyn::Sym("list")) == list2 );
+  dyn::AddArraySlot(list2, 7);
+  ASSERT_EQ( dyn::GetArraySlot(list2, 2).GetInt(), 7 );
+  ASSERT_EQ( dyn::GetArraySlot(list2, 1).GetInt(), -5 );
+}
+
+TEST(DyneCxxWriter, SharedObjects) {
+  dyn::Ref shared = dyn::MakeString("hi");
+  dyn::Ref root = dyn::AllocateFrame();
+  dyn::SetFrameSlot(root, dyn::Sym("a"), shared);
+  dyn::SetFrameSlot(root, dyn::Sym("b"), shared);
+  dyn::SetFrameSlot(root, dyn::Sym("self"), root);
+  dyn::SetFrameSlot(root, dyn::Sym("pi"), dyn::MakeReal(0.5));
+  dyn::Ref when = dyn::MakeReal(2.0);
+  dyn::SetClass(when, dyn::Sym("time"));
+  dyn::SetFrameSlot(root, dyn::Sym("when"), when);
+  std::ostringstream header, source;
+  ASSERT_EQ( dyn::io::CxxWriter("test_root").write(root, header, source, "test.h"), 0 );
+  ASSERT_NE( header.str().find("extern const dyn::Ref test_root;"), std::string::npos );
+  std::string src = source.str();
+  ASSERT_NE( src.find("extern const dyn::Frame o0;"), std::string::npos );
+  ASSERT_NE( src.find("extern const dyn::Map "), std::string::npos );
+  ASSERT_NE( src.find("constexpr dyn::Object o"), std::string::npos );
+  ASSERT_NE( src.find(" { 0x1p-1, true };"), std::string::npos );
+  // -- reals keep a class other than 'real
+  ASSERT_NE( src.find("), 0x1p+1, true };"), std::string::npos );
+  static constexpr dyn::Object time { dyn::gSymString, 2.0, true };
+  ASSERT_TRUE( time.GetClass() == dyn::gSymString );
+  ASSERT_EQ( time.GetReal(), 2.0 );
+  ASSERT_NE( src.find("constexpr dyn::Ref test_root { dyn::Ref(o0) };"), std::string::npos );
+  // -- the string is written once, and the frame refers to itself
+  ASSERT_EQ( src.find("_data[]"), src.rfind("_data[]") );
+  ASSERT_NE( src.find("  dyn::Ref(o0)"), std::string::npos );
+}
+
+// Compare two object trees slot by slot. Symbols compare by name, and large
+// binaries compare equal to binaries with the same class and data.
+static bool SameTree(dyn::Ref a, dyn::Ref b, std::map<const dyn::Object*, const dyn::Object*> &seen)
+{
+  if (!a.IsPtr() || !b.IsPtr() || !a.GetObject() || !b.GetObject())
+    return a == b;
+  const dyn::Object *x = a.GetObject(), *y = b.GetObject();
+  if (x->IsSymbol() || y->IsSymbol())
+    return x->IsSymbol() && y->IsSymbol() && (dyn::SymbolCompare(a, b) == 0);
+  auto it = seen.find(x);
+  if (it != seen.end())
+    return it->second == y;
+  seen[x] = y;
+  if (x->IsFrame()) {
+    auto fx = static_cast<const dyn::Frame*>(x), fy = static_cast<const dyn::Frame*>(y);
+    if (!y->IsFrame() || (fx->Length() != fy->Length()))
+      return false;
+    for (dyn::Index i=0; i<fx->Length(); ++i)
+      if (!SameTree(fx->GetTag(i), fy->GetTag(i), seen) || !SameTree(fx->GetSlot(i), fy->GetSlot(i), seen))
+        return false;
+    return true;
+  }
+  if (!SameTree(x->GetClass(), y->GetClass(), seen))
+    return false;
+  if (x->IsArray()) {
+    auto ax = static_cast<const dyn::Array*>(x), ay = static_cast<const dyn::Array*>(y);
+    if (!y->IsArray() || (ax->Length() != ay->Length()))
+      return false;
+    for (dyn::Index i=0; i<ax->Length(); ++i)
+      if (!SameTree(ax->GetSlot(i), ay->GetSlot(i), seen))
+        return false;
+    return true;
+  }
+  if (x->IsReal())
+    return y->IsReal() && (x->GetReal() == y->GetReal());
+  auto length = [](const dyn::Object *o) -> size_t {
+    if (o->IsLargeBinary())
+      return static_cast<const dyn::LargeBinaryObject*>(o)->Length();
+    return o->IsBinary() ? (size_t)o->size() : (size_t)-1;
+  };
+  size_t n = length(x);
+  if ((n == (size_t)-1) || (n != length(y)))
+    return false;
+  return (n == 0) || (::memcmp(dyn::BinaryData(a), dyn::BinaryData(b), n) == 0);
+}
+
+TEST(DyneCxxWriter, GeneratedImage) {
+  // gen_image.cpp was written by dynec cxx from gen_image.pkg at build time.
+  using dyn::tools::Census;
+  dyn::io::Package pkg;
+  ASSERT_EQ( pkg.load(DYN_GEN_IMAGE_PKG), 0 );
+  dyn::Ref loaded = pkg.toNOS();
+  ASSERT_TRUE( gen_image_root.IsFrame() );
+  ASSERT_TRUE( dyn::IsReadOnly(gen_image_root) );
+  Census image, package;
+  image.add(gen_image_root);
+  package.add(loaded);
+  for (Census::Kind k: { Census::kFrame, Census::kArray, Census::kMap, Census::kReal })
+    ASSERT_EQ( image.kind(k).count, package.kind(k).count );
+  ASSERT_EQ( image.kind(Census::kBinary).count + image.kind(Census::kLargeBinary).count,
+             package.kind(Census::kBinary).count + package.kind(Census::kLargeBinary).count );
+  std::map<const dyn::Object*, const dyn::Object*> seen;
+  ASSERT_TRUE( SameTree(gen_image_root, loaded, seen) );
+  ASSERT_GT( seen.size(), 100u );
+}
+
+
+// { a: 5, b: [ 'a, nil ] } with a precedent back to the symbol 'a
+static const uint8_t kNSOFFrame[] = {
+  0x02, 0x06, 0x02, 0x07, 0x01, 'a', 0x07, 0x01, 'b',
+  0x00, 0x14, 0x05, 0x02, 0x09, 0x01, 0x0A
+};
+
+TEST(DyneStream, PullParser) {
+  // -- feed the stream one byte at a time
+  dyn::io::MemorySource src;
+  for (size_t i=0; i<sizeof(kNSOFFrame); ++i)
+    src.append(kNSOFFrame+i, 1);
+  dyn::io::StreamParser parser(src);
+  dyn::io::StreamEvent ev;
+  std::vector<dyn::io::StreamEvent::Type> types;
+  size_t max_depth = 0;
+  while (parser.next(ev)) {
+    types.push_back(ev.type);
+    max_depth = std::max(max_depth, parser.depth());
+  }
+  using T = dyn::io::StreamEvent::Type;
+  std::vector<T> expected = {
+    T::BeginFrame, T::Symbol, T::Symbol, T::Immediate, T::BeginArray,
+    T::Precedent, T::Immediate, T::EndArray, T::EndFrame, T::EndOfStream
+  };
+  ASSERT_EQ( types, expected );
+  ASSERT_EQ( ev.type, T::EndOfStream );
+  ASSERT_EQ( max_depth, 3u );
+  ASSERT_EQ( parser.tell(), sizeof(kNSOFFrame) );
+}
+
+TEST(DyneStream, Reader) {
+  dyn::io::StreamReader in;
+  in.open(kNSOFFrame, sizeof(kNSOFFrame));
+  dyn::Ref frame = in.read();
+  ASSERT_TRUE( frame.IsFrame() );
+  ASSERT_EQ( dyn::GetFrameSlot(frame, dyn::Sym("a")), dyn::Ref(5) );
+  dyn::Ref array = dyn::GetFrameSlot(frame, dyn::Sym("b"));
+  ASSERT_TRUE( array.IsArray() );
+  ASSERT_TRUE( dyn::GetArraySlot(array, 0).IsSymbol() );
+  ASSERT_EQ( dyn::SymbolCompare(dyn::GetArraySlot(array, 0), dyn::Sym("a")), 0 );
+  ASSERT_TRUE( dyn::GetArraySlot(array, 1).IsNIL() );
+}
+
+// [ smallRect(1, 2, 3, 4), largeBinary('pix, <DE AD BE EF>) ]
+static const uint8_t kNSOFRectAndLargeBinary[] = {
+  0x02, 0x05, 0x02, 0x0B, 1, 2, 3, 4,
+  0x0C, 0x07, 0x03, 'p', 'i', 'x', 0x00,
+  0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0xDE, 0xAD, 0xBE, 0xEF
+};
+
+TEST(DyneStream, SmallRectAndLargeBinary) {
+  dyn::io::StreamReader in;
+  in.open(std::make_unique<dyn::io::MemorySource>(kNSOFRectAndLargeBinary, sizeof(kNSOFRectAndLargeBinary), true));
+  dyn::Ref array = in.read();
+  ASSERT_TRUE( array.IsArray() );
+  dyn::Ref rect = dyn::GetArraySlot(array, 0);
+  ASSERT_TRUE( rect.IsFrame() );
+  ASSERT_EQ( dyn::GetFrameSlot(rect, dyn::Sym("left")), dyn::Ref(2) );
+  ASSERT_EQ( dyn::GetFrameSlot(rect, dyn::Sym("right")), dyn::Ref(4) );
+  // -- adding a slot must not change the map that all smallRects share
+  dyn::SetFrameSlot(rect, dyn::Sym("extra"), dyn::Ref(5));
+  dyn::Ref rect2 = dyn::MakeSmallRect(5, 6, 7, 8);
+  ASSERT_TRUE( dyn::GetFrameSlot(rect2, dyn::Sym("extra")).IsNIL() );
+  ASSERT_EQ( dyn::GetFrameSlot(rect, dyn::Sym("extra")), dyn::Ref(5) );
+  // -- the payload of the large binary is used in place
+  dyn::Ref lbo_ref = dyn::GetArraySlot(array, 1);
+  ASSERT_TRUE( lbo_ref.GetObject()->IsLargeBinary() );
+  auto lbo = static_cast<dyn::LargeBinaryObject*>(lbo_ref.GetObject());
+  ASSERT_EQ( lbo->Length(), 4u );
+  ASSERT_TRUE( lbo->IsView() );
+  ASSERT_EQ( dyn::BinaryData(lbo_ref), (void*)(kNSOFRectAndLargeBinary + sizeof(kNSOFRectAndLargeBinary) - 4) );
+  ASSERT_FALSE( lbo->IsCompressed() );
+}
+
+TEST(DynePrint, SharedAndCyclic) {
+  dyn::Ref shared = dyn::AllocateArray(2);
+  dyn::SetArraySlot(shared, 0, dyn::Ref(1));
+  dyn::SetArraySlot(shared, 1, dyn::Ref(2));
+  dyn::Ref frame = dyn::AllocateFrame();
+  dyn::SetFrameSlot(frame, dyn::Sym("a"), shared);
+  dyn::SetFrameSlot(frame, dyn::Sym("b"), shared);
+  dyn::SetFrameSlot(frame, dyn::Sym("self"), frame);
+  std::FILE *f = std::tmpfile();
+  dyn::io::PrintState ps(f);
+  ps.scan(frame);
+  frame.Print(ps);
+  std::string out(std::ftell(f), 0);
+  std::rewind(f);
+  ASSERT_EQ( std::fread(&out[0], 1, out.size(), f), out.size() );
+  std::fclose(f);
+  // -- the frame and the array are both expanded exactly once
+  ASSERT_EQ( out.find("#1={"), 0u );
+  ASSERT_NE( out.find("a: #2=["), std::string::npos );
+  ASSERT_NE( out.find("b: #2#"), std::string::npos );
+  ASSERT_NE( out.find("self: #1#"), std::string::npos );
+}
+
+TEST(DyneExport, JsonLines) {
+  dyn::Ref shared = dyn::AllocateArray(1);
+  dyn::SetArraySlot(shared, 0, dyn::MakeString("x\"y"));
+  dyn::Ref frame = dyn::AllocateFrame();
+  dyn::SetFrameSlot(frame, dyn::Sym("a"), shared);
+  dyn::SetFrameSlot(frame, dyn::Sym("b"), shared);
+  dyn::SetFrameSlot(frame, dyn::Sym("c"), dyn::Sym("sym"));
+  std::FILE *f = std::tmpfile();
+  dyn::io::Exporter exporter(f);
+  exporter.write(frame);
+  ASSERT_EQ( exporter.records(), 2u );
+  std::string out(std::ftell(f), 0);
+  std::rewind(f);
+  ASSERT_EQ( std::fread(&out[0], 1, out.size(), f), out.size() );
+  std::fclose(f);
+  ASSERT_EQ( out,
+    "{\"format\":\"dyne\",\"version\":1,\"root\":{\"ref\":0}}\n"
+    "{\"id\":0,\"type\":\"frame\",\"slots\":{\"a\":{\"ref\":1},\"b\":{\"ref\":1},\"c\":{\"sym\":\"sym\"}}}\n"
+    "{\"id\":1,\"type\":\"array\",\"class\":{\"sym\":\"array\"},\"slots\":[\"x\\\"y\"]}\n" );
+}
+
+static std::string ExportTestObject(const dyn::Ref &root)
+{
+  std::FILE *f = std::tmpfile();
+  dyn::io::Exporter exporter(f);
+  exporter.write(root);
+  exporter.flush();
+  std::string out(std::ftell(f), 0);
+  std::rewind(f);
+  size_t n = std::fread(&out[0], 1, out.size(), f);
+  std::fclose(f);
+  out.resize(n);
+  return out;
+}
+
+TEST(DyneExport, CopiesOfReadOnlyObjects) {
+  // -- the printer and the exporter see the writable copy, not the original
+  dyn::Ref frame { cx_frame };
+  dyn::SetFrameSlot(frame, dyn::Sym("self"), 7);
+  ASSERT_NE( ExportTestObject(frame).find("\"self\":7"), std::string::npos );
+  std::FILE *f = std::tmpfile();
+  dyn::io::PrintState ps(f);
+  ps.scan(frame);
+  frame.Print(ps);
+  std::string out(std::ftell(f), 0);
+  std::rewind(f);
+  ASSERT_EQ( std::fread(&out[0], 1, out.size(), f), out.size() );
+  std::fclose(f);
+  ASSERT_NE( out.find("self: 7"), std::string::npos );
+  dyn::CopyOnWrite::Clear();
+  ASSERT_EQ( ExportTestObject(frame).find("\"self\":7"), std::string::npos );
+}
+
+TEST(DyneStream, MappedWindows) {
+  std::string path = testing::TempDir() + "/windows.nsof";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)kNSOFRectAndLargeBinary, sizeof(kNSOFRectAndLargeBinary));
+  }
+  // -- a view keeps its window mapped after the reader is closed
+  dyn::Ref array = dyn::io::StreamReader::read(path);
+  auto lbo = static_cast<dyn::LargeBinaryObject*>(dyn::GetArraySlot(array, 1).GetObject());
+  ASSERT_TRUE( lbo->IsView() );
+  ASSERT_EQ( ::memcmp(lbo->Data(), "\xDE\xAD\xBE\xEF", 4), 0 );
+  // -- objects that span windows are read the same as from one chunk
+  dyn::io::Generator::Options opt;
+  opt.num_objects = 500;
+  opt.binary_size = 6000;
+  std::vector<uint8_t> nsof = dyn::io::Generator(opt).nsof();
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)nsof.data(), (std::streamsize)nsof.size());
+  }
+  dyn::io::StreamReader in;
+  auto source = std::make_unique<dyn::io::MappedSource>(path, 4096);
+  ASSERT_TRUE( source->is_mapped() );
+  in.open(std::move(source));
+  dyn::io::StreamReader whole;
+  whole.open(nsof.data(), nsof.size());
+  ASSERT_EQ( ExportTestObject(in.read()), ExportTestObject(whole.read()) );
+}
+
+TEST(DyneGenerator, PackageAndStream) {
+  dyn::io::Generator::Options opt;
+  opt.num_objects = 200;
+  opt.num_parts = 2;
+  opt.package1 = false;
+  opt.relocation = true;
+  // -- the same options generate the same bytes
+  std::vector<uint8_t> bytes = dyn::io::Generator(opt).package();
+  ASSERT_EQ( bytes, dyn::io::Generator(opt).package() );
+  std::string path = testing::TempDir() + "/generated.pkg";
+  ASSERT_EQ( dyn::io::Generator(opt).write_package(path), 0 );
+  dyn::io::Package pkg;
+  testing::internal::CaptureStdout();
+  ASSERT_EQ( pkg.load(path), 0 );
+  dyn::Ref nos = pkg.toNOS();
+  // -- the loader has nothing to complain about
+  ASSERT_EQ( testing::internal::GetCapturedStdout(), "" );
+  dyn::Ref parts = dyn::GetFrameSlot(nos, dyn::Sym("parts"));
+  dyn::Ref data = dyn::GetFrameSlot(dyn::GetArraySlot(parts, 0), dyn::Sym("data"));
+  ASSERT_TRUE( data.IsArray() );
+  // -- the stream holds the same objects as the first part
+  std::vector<uint8_t> nsof = dyn::io::Generator(opt).nsof();
+  dyn::io::StreamReader in;
+  in.open(nsof.data(), nsof.size());
+  ASSERT_EQ( ExportTestObject(in.read()), ExportTestObject(data) );
+}
+
+TEST(DyneSnapshot, RoundTrip) {
+  dyn::io::Generator::Options opt;
+  opt.num_objects = 200;
+  opt.num_parts = 2;
+  std::string pkg_path = testing::TempDir() + "/snapshot.pkg";
+  ASSERT_EQ( dyn::io::Generator(opt).write_package(pkg_path), 0 );
+  dyn::io::Package pkg;
+  ASSERT_EQ( pkg.load(pkg_path), 0 );
+  dyn::Ref root = pkg.toNOS();
+  // -- a cycle must survive
+  dyn::SetFrameSlot(root, dyn::Sym("self"), root);
+  auto lbo = new dyn::LargeBinaryObject(dyn::Sym("samples"));
+  ::memcpy(lbo->Allocate(5), "audio", 5);
+  const uint8_t params[] = { 1, 2, 3 };
+  lbo->SetCompander(dyn::Sym("TLZStoreCompander"), params, sizeof(params));
+  dyn::SetFrameSlot(root, dyn::Sym("sound"), dyn::Ref(lbo));
+  std::string path = testing::TempDir() + "/test.snap";
+  ASSERT_EQ( dyn::io::Snapshot::write(root, path), 0 );
+  dyn::io::Snapshot snap;
+  ASSERT_EQ( snap.load(path), 0 );
+  dyn::Ref copy = snap.root();
+  ASSERT_TRUE( copy.IsFrame() );
+  ASSERT_TRUE( copy.IsReadOnly() );
+  ASSERT_TRUE( dyn::GetFrameSlot(copy, dyn::Sym("self")) == copy );
+  ASSERT_EQ( ExportTestObject(copy), ExportTestObject(root) );
+  auto lbo_copy = static_cast<dyn::LargeBinaryObject*>(dyn::GetFrameSlot(copy, dyn::Sym("sound")).GetObject());
+  ASSERT_EQ( ::memcmp(lbo_copy->Data(), "audio", 5), 0 );
+  ASSERT_EQ( lbo_copy->CompanderParams().size(), 3u );
+  ASSERT_TRUE( lbo_copy->IsView() );
+  size_t num_copies = dyn::CopyOnWrite::Count();
+  dyn::SetFrameSlot(copy, dyn::Sym("x"), 1);
+  ASSERT_TRUE( dyn::GetFrameSlot(copy, dyn::Sym("x")) == dyn::Ref(1) );
+  ASSERT_EQ( dyn::CopyOnWrite::Count(), num_copies + 1 );
+  ASSERT_TRUE( dyn::CopyOnWrite::HasCopy(copy.GetObject()) );
+  // -- closing the snapshot forgets the copies of its objects
+  snap.close();
+  ASSERT_TRUE( snap.root().IsNIL() );
+  ASSERT_EQ( dyn::CopyOnWrite::Count(), num_copies );
+}
+
+TEST(DyneStats, Counters) {
+  using dyn::tools::Stats;
+  dyn::io::Generator::Options opt;
+  opt.num_objects = 50;
+  std::vector<uint8_t> bytes = dyn::io::Generator(opt).package();
+  std::string path = testing::TempDir() + "/stats.pkg";
+  ASSERT_EQ( dyn::io::Generator(opt).write_package(path), 0 );
+  Stats::reset();
+  Stats::enable();
+  dyn::io::Package pkg;
+  ASSERT_EQ( pkg.load(path), 0 );
+  pkg.toNOS();
+  Stats::enable(false);
+  ASSERT_EQ( Stats::counter(Stats::kBytesRead), bytes.size() );
+  ASSERT_EQ( Stats::calls(Stats::kLoad), 1u );
+  ASSERT_EQ( Stats::calls(Stats::kToNOS), 1u );
+  // -- every decoded frame becomes a frame, plus the package and the part
+  ASSERT_EQ( Stats::counter(Stats::kFramesAllocated), Stats::counter(Stats::kFramesDecoded) + 2 );
+  // -- nothing is counted while disabled
+  uint64_t symbols = Stats::counter(Stats::kSymbolsCreated);
+  ASSERT_GT( symbols, 0u );
+  dyn::Sym("notCounted");
+  ASSERT_EQ( Stats::counter(Stats::kSymbolsCreated), symbols );
+  Stats::reset();
+}
+
+TEST(DyneCensus, Counts) {
+  using dyn::tools::Census;
+  dyn::Ref root = dyn::AllocateFrame();
+  dyn::SetFrameSlot(root, dyn::Sym("a"), dyn::MakeString("hello"));
+  dyn::SetFrameSlot(root, dyn::Sym("b"), dyn::MakeString("hello"));
+  for (const char *tag: { "c", "d" }) {
+    dyn::Ref inner = dyn::AllocateFrame();
+    dyn::SetFrameSlot(inner, dyn::Sym("x"), 1);
+    dyn::SetFrameSlot(root, dyn::Sym(tag), inner);
+  }
+  dyn::SetFrameSlot(root, dyn::Sym("e"), dyn::MakeReal(1.5));
+  dyn::SetFrameSlot(root, dyn::Sym("f"), dyn::AllocateBinary(dyn::Sym("instructions"), 4));
+  Census census;
+  census.add(root);
+  // -- shared objects are counted once
+  census.add(root);
+  ASSERT_EQ( census.kind(Census::kFrame).count, 3u );
+  ASSERT_EQ( census.kind(Census::kMap).count, 3u );
+  ASSERT_EQ( census.kind(Census::kBinary).count, 3u );
+  ASSERT_EQ( census.kind(Census::kReal).count, 1u );
+  ASSERT_EQ( census.classes().at("string").count, 2u );
+  ASSERT_EQ( census.classes().at("instructions").count, 1u );
+  ASSERT_EQ( census.duplicate_binaries().count, 1u );
+  ASSERT_EQ( census.duplicate_maps().count, 1u );
+  ASSERT_GE( census.duplicate_symbols().count, 1u );
+  ASSERT_EQ( census.frames_with_slots(1), 2u );
+  ASSERT_EQ( census.frames_with_slots(4), 1u );
+  std::ostringstream json;
+  census.write_json(json);
+  ASSERT_NE( json.str().find("\"instructions\":{\"objects\":1"), std::string::npos );
+}
+
+TEST(DyneCensus, SuperMapsAndBinaries) {
+  using dyn::tools::Census;
+  // A map whose slot 0 is a super map, both must count as maps.
+  dyn::Ref super_map = dyn::AllocateArray(dyn::Ref(0), 2);
+  dyn::SetArraySlot(super_map, 1, dyn::Sym("x"));
+  dyn::Ref map = dyn::AllocateArray(dyn::Ref(0), 2);
+  dyn::SetArraySlot(map, 0, super_map);
+  dyn::SetArraySlot(map, 1, dyn::Sym("y"));
+  dyn::Ref root = dyn::AllocateFrameWithMap(map);
+  // Binaries of the same size but with different data are not duplicates.
+  dyn::Ref a = dyn::AllocateBinary(dyn::Sym("bits"), 4);
+  dyn::Ref b = dyn::AllocateBinary(dyn::Sym("bits"), 4);
+  dyn::Ref c = dyn::AllocateBinary(dyn::Sym("bits"), 4);
+  ::memcpy(dyn::BinaryData(a), "abcd", 4);
+  ::memcpy(dyn::BinaryData(b), "abce", 4);
+  ::memcpy(dyn::BinaryData(c), "abcd", 4);
+  dyn::SetFrameSlot(root, dyn::Sym("y"), a);
+  Census census;
+  census.add(root);
+  census.add(b);
+  census.add(c);
+  ASSERT_EQ( census.kind(Census::kMap).count, 2u );
+  ASSERT_EQ( census.kind(Census::kArray).count, 0u );
+  ASSERT_EQ( census.duplicate_binaries().count, 1u );
+}
+
+TEST(DyneTrace, Spans) {
+  using dyn::tools::Trace;
+  dyn::io::Generator::Options opt;
+  opt.num_objects = 20;
+  opt.num_parts = 2;
+  std::string path = testing::TempDir() + "/trace.pkg";
+  std::string trace_path = testing::TempDir() + "/trace.json";
+  ASSERT_EQ( dyn::io::Generator(opt).write_package(path), 0 );
+  Trace::start(trace_path);
+  dyn::io::Package pkg;
+  ASSERT_EQ( pkg.load(path), 0 );
+  pkg.toNOS();
+  ASSERT_EQ( Trace::stop(), 0 );
+  ASSERT_FALSE( Trace::enabled() );
+  std::ifstream f(trace_path);
+  std::string json { std::istreambuf_iterator<char>{f}, {} };
+  ASSERT_EQ( json.rfind("{\"traceEvents\":[", 0), 0u );
+  ASSERT_NE( json.find("\"Package::load\""), std::string::npos );
+  ASSERT_NE( json.find("\"PartEntry::loadPartData\""), std::string::npos );
+  ASSERT_NE( json.find("\"PartDataNOS::toNOS\""), std::string::npos );
+  ASSERT_NE( json.find("\"part\":1"), std::string::npos );
+}
+
+static dyn::Ref MakeTestFunction(const std::vector<uint8_t> &code, const std::vector<dyn::Ref> &literals = { })
+{
+  dyn::Ref instructions = dyn::AllocateBinary(dyn::Sym("instructions"), (dyn::Index)code.size());
+  ::memcpy(dyn::BinaryData(instructions), code.data(), code.size());
+  dyn::Ref func = dyn::AllocateFrame();
+  dyn::SetFrameSlot(func, dyn::Sym("class"), dyn::Sym("CodeBlock"));
+  dyn::SetFrameSlot(func, dyn::Sym("instructions"), instructions);
+  dyn::Ref lits = dyn::AllocateArray(0);
+  for (auto &lit: literals)
+    dyn::AddArraySlot(lits, lit);
+  dyn::SetFrameSlot(func, dyn::Sym("literals"), lits);
+  return func;
+}
+
+TEST(DyneDecompiler, Precedence) {
+  // return lit_0 - (lit_1 - lit_2) * lit_0
+  dyn::Ref func = MakeTestFunction({ 0x70, 0x71, 0x72, 0xC1, 0x70, 0xC7, 0x00, 0x07, 0xC1, 0x02 });
+  testing::internal::CaptureStdout();
+  dyn::Ref src = dyn::lang::decompile(func);
+  testing::internal::GetCapturedStdout();
+  ASSERT_TRUE( src.IsBinary() );
+  ASSERT_STREQ( (const char*)dyn::BinaryData(src), "return lit_0 - (lit_1 - lit_2) * lit_0;\n" );
+}
+
+static std::string DecompileTestFunction(const std::vector<uint8_t> &code, const std::vector<dyn::Ref> &literals = { })
+{
+  dyn::Ref func = MakeTestFunction(code, literals);
+  testing::internal::CaptureStdout();
+  dyn::Ref src = dyn::lang::decompile(func);
+  testing::internal::GetCapturedStdout();
+  return src.IsBinary() ? (const char*)dyn::BinaryData(src) : "";
+}
+
+TEST(DyneDecompiler, ControlFlow) {
+  // if lit_0 then lit_1 := 1 else lit_1 := 2
+  ASSERT_EQ( DecompileTestFunction({ 0x70, 0x6F, 0x00, 0x09, 0x24, 0xA9, 0x5F, 0x00, 0x0D,
+                                     0x27, 0x00, 0x08, 0xA9, 0x22, 0x02 }),
+             "if lit_0 then\n  lit_1 := 1;\nelse\n  lit_1 := 2;\n" );
+  // while lit_0 do lit_1 := 1
+  ASSERT_EQ( DecompileTestFunction({ 0x5F, 0x00, 0x05, 0x24, 0xA9, 0x70, 0x67, 0x00, 0x03,
+                                     0x22, 0x00, 0x22, 0x02 }),
+             "while lit_0 do\n  lit_1 := 1;\n" );
+  // return lit_0 and lit_1
+  ASSERT_EQ( DecompileTestFunction({ 0x70, 0x6F, 0x00, 0x08, 0x71, 0x5F, 0x00, 0x09, 0x22, 0x02 }),
+             "return lit_0 and lit_1;\n" );
+}
+
+TEST(DyneDecompiler, Loops) {
+  // for local_0 := 1 to 10 do local_3 := local_3 + local_0
+  ASSERT_EQ( DecompileTestFunction({ 0x24, 0xA0, 0x27, 0x00, 0x28, 0xA1, 0x24, 0xA2, 0x7A, 0x78,
+                                     0x5F, 0x00, 0x13, 0x7B, 0x78, 0xC0, 0xA3, 0x7A, 0xB0, 0x79,
+                                     0xBF, 0x00, 0x0D, 0x22, 0x00, 0x22, 0x02 }),
+             "for local_0 := 1 to 10 do\n  local_3 := local_3 + local_0;\n" );
+  // foreach local_1 in local_0 do local_3 := local_1.x
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x22, 0xC7, 0x00, 0x11, 0xA2, 0x5F, 0x00, 0x13,
+                                     0x7A, 0x24, 0xC2, 0xA1, 0x79, 0x18, 0x90, 0xA3, 0x7A, 0x05,
+                                     0x7A, 0x06, 0x6F, 0x00, 0x09, 0x22, 0x22, 0xA2, 0x00, 0x22, 0x02 },
+                                   { dyn::Sym("x") }),
+             "foreach local_1 in local_0 do\n  local_3 := local_1.x;\n" );
+  // try local_1[0] onexception |evt.ex| do 1
+  ASSERT_EQ( DecompileTestFunction({ 0x18, 0x27, 0x00, 0x30, 0xC9, 0x79, 0x20, 0xC2, 0x07,
+                                     0x5F, 0x00, 0x0E, 0x24, 0x07, 0x00, 0x22, 0x02 },
+                                   { dyn::Sym("evt.ex") }),
+             "try\n  local_1[0];\nonexception |evt.ex| do\n  1;\n" );
+  // repeat local_3 := local_3 + 1 until local_3 > 10
+  ASSERT_EQ( DecompileTestFunction({ 0x7B, 0x24, 0xC0, 0xA3, 0x7B, 0x27, 0x00, 0x28, 0xC7, 0x00, 0x0B,
+                                     0x6F, 0x00, 0x00, 0x22, 0x00, 0x22, 0x02 }),
+             "repeat\n  local_3 := local_3 + 1;\nuntil local_3 > 10;\n" );
+}
+
+TEST(DyneDecompiler, Expressions) {
+  dyn::Ref map = dyn::AllocateArray(0);
+  dyn::AddArraySlot(map, dyn::Ref(0));
+  dyn::AddArraySlot(map, dyn::Sym("a"));
+  dyn::AddArraySlot(map, dyn::Sym("b"));
+  std::vector<dyn::Ref> lits { dyn::Sym("x"), dyn::Sym("array"), map, dyn::Sym("point") };
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x18, 0x91, 0x02 }, lits), "return local_0.x;\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x18, 0x24, 0x99, 0x02 }, lits), "return local_0.x := 1;\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x18, 0xC7, 0x00, 0x17, 0x02 }, lits), "return local_0.x exists;\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x24, 0x79, 0xC3, 0x00, 0x22, 0x02 }, lits), "local_0[1] := local_1;\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x24, 0x19, 0x8A, 0x02 }, lits), "return [local_0, 1];\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x1B, 0x89, 0x02 }, lits), "return [point: local_0];\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x24, 0x79, 0x1A, 0x82, 0x02 }, lits), "return { a: 1, b: local_1 };\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x79, 0x19, 0x8A, 0xC7, 0x00, 0x16, 0x02 }, lits), "return local_0 & local_1;\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0xC7, 0x00, 0x12, 0x27, 0x00, 0x08, 0xC7, 0x00, 0x09, 0x02 }, lits),
+             "return Length(local_0) div 2;\n" );
+  ASSERT_EQ( DecompileTestFunction({ 0x78, 0x79, 0xC7, 0x00, 0x0E, 0xC7, 0x00, 0x10, 0x02 }, lits),
+             "return BNot(BAnd(local_0, local_1));\n" );
+}
+
+TEST(DyneDecompiler, Package) {
+  // { parts: [ { data: { a: func, b: [ func, func ] } } ] }, func used twice
+  dyn::Ref f1 = MakeTestFunction({ 0x70, 0x02 });
+  dyn::Ref f2 = MakeTestFunction({ 0x71, 0x02 });
+  dyn::Ref list = dyn::AllocateArray(0);
+  dyn::AddArraySlot(list, f2);
+  dyn::AddArraySlot(list, f1);
+  dyn::Ref data = dyn::AllocateFrame();
+  dyn::SetFrameSlot(data, dyn::Sym("a"), f1);
+  dyn::SetFrameSlot(data, dyn::Sym("b"), list);
+  dyn::Ref part = dyn::AllocateFrame();
+  dyn::SetFrameSlot(part, dyn::Sym("data"), data);
+  dyn::Ref parts = dyn::AllocateArray(0);
+  dyn::AddArraySlot(parts, part);
+  dyn::Ref pkg = dyn::AllocateFrame();
+  dyn::SetFrameSlot(pkg, dyn::Sym("parts"), parts);
+
+  std::string dir = testing::TempDir();
+  ASSERT_EQ( dyn::lang::decompile_package(pkg, dir, 4), 2 );
+  std::ifstream in(dir + "/part_0.ns");
+  std::stringstream text;
+  text << in.rdbuf();
+  ASSERT_EQ( text.str(), "// data.a\nreturn lit_0;\n\n// data.b[0]\nreturn lit_1;\n\n" );
+}
+
+static dyn::Ref MakeTestMethod(const std::vector<uint8_t> &code, int num_args, int num_locals)
+{
+  dyn::Ref func = MakeTestFunction(code);
+  dyn::Ref arg_frame = dyn::AllocateFrame();
+  dyn::SetFrameSlot(arg_frame, dyn::Sym("_nextArgFrame"), dyn::RefNIL);
+  dyn::SetFrameSlot(arg_frame, dyn::Sym("_parent"), dyn::RefNIL);
+  dyn::SetFrameSlot(arg_frame, dyn::Sym("_implementor"), dyn::RefNIL);
+  for (int i=0; i<num_args+num_locals; ++i)
+    dyn::SetFrameSlot(arg_frame, dyn::Sym("v" + std::to_string(i)), dyn::RefNIL);
+  dyn::SetFrameSlot(func, dyn::Sym("argFrame"), arg_frame);
+  dyn::SetFrameSlot(func, dyn::Sym("numArgs"), num_args);
+  return func;
+}
+
+TEST(DyneInterpreter, Run) {
+  dyn::vm::Interpreter vm;
+  // return 3 + 4
+  dyn::Ref add = MakeTestMethod({ 0x27, 0x00, 0x0C, 0x27, 0x00, 0x10, 0xC0, 0x02 }, 0, 0);
+  ASSERT_EQ( vm.call(add, { }).GetInt(), 7 );
+  // sum := 0; for i := 1 to 10 do sum := sum + i; return sum
+  dyn::Ref loop = MakeTestMethod({ 0x20, 0xA3, 0x24, 0xA4, 0x27, 0x00, 0x28, 0xA5, 0x24, 0xA6,
+                                   0x7E, 0x7C, 0x5F, 0x00, 0x15, 0x7B, 0x7C, 0xC0, 0xA3, 0x7E,
+                                   0xB4, 0x7D, 0xBF, 0x00, 0x0F, 0x7B, 0x02 }, 0, 4);
+  ASSERT_EQ( vm.call(loop, { }).GetInt(), 55 );
+  // receiver:Twice(21) with Twice: func(x) x + x
+  dyn::Ref receiver = dyn::AllocateFrame();
+  dyn::SetFrameSlot(receiver, dyn::Sym("Twice"), MakeTestMethod({ 0x7B, 0x7B, 0xC0, 0x02 }, 1, 0));
+  ASSERT_EQ( vm.send(receiver, dyn::Sym("twice"), { dyn::Ref(21) }).GetInt(), 42 );
+  // func(x) x * x, products that don't fit into an integer become reals
+  dyn::Ref square = MakeTestMethod({ 0x7B, 0x7B, 0xC7, 0x00, 0x07, 0x02 }, 1, 0);
+  ASSERT_EQ( vm.call(square, { dyn::Ref(3) }).GetInt(), 9 );
+  ASSERT_EQ( vm.call(square, { dyn::Ref((dyn::Integer)1<<20) }).GetInt(), (dyn::Integer)1<<40 );
+  dyn::Ref big = vm.call(square, { dyn::Ref((dyn::Integer)1<<40) });
+  ASSERT_TRUE( big.IsPtr() && big.GetObject()->IsReal() );
+  ASSERT_EQ( big.GetObject()->GetReal(), 0x1p80 );
+}
+
+TEST(DyneInterpreter, MagicPointers) {
+  // -- the index is stored above the tag bits
+  ASSERT_EQ( dyn::Ref(0, 42).MagicIndex(), 42 );
+  ASSERT_EQ( dyn::Ref(2, 7).MagicTable(), 2 );
+  ASSERT_EQ( dyn::Ref(2, 7).ToString(), "@2.7" );
+  // -- the table is filled on first access
+  dyn::Ref proto = dyn::AllocateFrame();
+  dyn::SetFrameSlot(proto, dyn::Sym("x"), 5);
+  dyn::SetFrameSlot(proto, dyn::Sym("Twice"), MakeTestMethod({ 0x7B, 0x7B, 0xC0, 0x02 }, 1, 0));
+  int loads = 0;
+  dyn::MagicPointers::SetSource(0, [&loads, proto]() {
+    loads++;
+    dyn::Ref table = dyn::AllocateArray(2);
+    dyn::SetArraySlot(table, 1, proto);
+    return table;
+  });
+  ASSERT_EQ( loads, 0 );
+  ASSERT_TRUE( dyn::MagicPointers::Resolve(dyn::Ref(0, 1)) == proto );
+  ASSERT_TRUE( dyn::MagicPointers::Resolve(dyn::Ref(0, 2)) == dyn::Ref(0, 2) );
+  ASSERT_TRUE( dyn::MagicPointers::Resolve(dyn::Ref(3, 1)) == dyn::Ref(3, 1) );
+  // -- inheritance follows a magic pointer in _proto
+  dyn::Ref child = dyn::AllocateFrame();
+  dyn::SetFrameSlot(child, dyn::Sym("_proto"), dyn::Ref(0, 1));
+  dyn::Ref value, where;
+  ASSERT_TRUE( dyn::vm::Interpreter::lookup(child, dyn::Sym("x"), value, &where) );
+  ASSERT_EQ( value.GetInt(), 5 );
+  ASSERT_TRUE( where == proto );
+  dyn::vm::Interpreter vm;
+  ASSERT_EQ( vm.send(child, dyn::Sym("twice"), { dyn::Ref(4) }).GetInt(), 8 );
+  ASSERT_EQ( loads, 1 );
+  dyn::MagicPointers::Clear();
+  ASSERT_TRUE( dyn::MagicPointers::Resolve(dyn::Ref(0, 1)) == dyn::Ref(0, 1) );
+}
+
+TEST(DyneInterpreter, Optimize) {
+  dyn::vm::Interpreter fast, slow;
+  slow.set_optimize(false);
+  // func(x) if x < 10 then 1 else 2
+  dyn::Ref func = MakeTestMethod({ 0x7B, 0x27, 0x00, 0x28, 0xC7, 0x00, 0x0A, 0x6F, 0x00, 0x0E,
+                                   0x27, 0x00, 0x04, 0x02, 0x27, 0x00, 0x08, 0x02 }, 1, 0);
+  for (int x : { 3, 9, 10, 30, -5 })
+    ASSERT_EQ( fast.call(func, { dyn::Ref(x) }).GetInt(), slow.call(func, { dyn::Ref(x) }).GetInt() );
+  ASSERT_EQ( fast.call(func, { dyn::Ref(3) }).GetInt(), 1 );
+  ASSERT_EQ( fast.call(func, { dyn::Ref(30) }).GetInt(), 2 );
+  // get_var; push_const; less_than; branch_if_false fuse into compare_branch,
+  // and both push_const; return pairs become return_const.
+  using dyn::lang::BC;
+  const std::vector<dyn::lang::Bytecode> &code = fast.bytecode(func);
+  ASSERT_GE( code.size(), 5u );
+  ASSERT_EQ( code[2].bc, BC::CompareBranch );
+  ASSERT_EQ( code[3].bc, BC::ReturnConst );
+  ASSERT_EQ( code[3].arg, 4 );
+  ASSERT_EQ( code[4].bc, BC::ReturnConst );
+  ASSERT_EQ( code[4].arg, 8 );
+  // The branch must land on the new PC of the else branch.
+  ASSERT_EQ( code[2].arg & 0xffffff, 4 );
+}
+
+TEST(DyneInterpreter, Superinstructions) {
+  using dyn::lang::BC;
+  dyn::vm::Interpreter vm;
+  auto has = [&vm](dyn::RefArg func, BC bc, int32_t arg) {
+    for (const dyn::lang::Bytecode &b: vm.bytecode(func))
+      if ((b.bc == bc) && (b.arg == arg))
+        return true;
+    return false;
+  };
+  // func(x, y) x + y
+  dyn::Ref func = MakeTestMethod({ 0x7B, 0x7C, 0xC0, 0x02 }, 2, 0);
+  ASSERT_TRUE( has(func, BC::GetVar2, 3 | (4 << 16)) );
+  ASSERT_EQ( vm.call(func, { dyn::Ref(3), dyn::Ref(4) }).GetInt(), 7 );
+  // func(x) begin x := -1; x end
+  func = MakeTestMethod({ 0x27, 0xFF, 0xFC, 0xA3, 0x7B, 0x02 }, 1, 0);
+  ASSERT_TRUE( has(func, BC::SetVarConst, (int32_t)(0xFFFC0000u | 3)) );
+  ASSERT_TRUE( has(func, BC::ReturnVar, 3) );
+  ASSERT_EQ( vm.call(func, { dyn::Ref(5) }).GetInt(), -1 );
+  // func(x) begin x := x + -2; x end
+  func = MakeTestMethod({ 0x7B, 0x27, 0xFF, 0xF8, 0xC0, 0xA3, 0x7B, 0x02 }, 1, 0);
+  ASSERT_TRUE( has(func, BC::AddVarConst, (int32_t)(0xFFFE0000u | 3)) );
+  ASSERT_EQ( vm.call(func, { dyn::Ref(5) }).GetInt(), 3 );
+}
+
+TEST(DyneInterpreter, Verify) {
+  dyn::vm::Interpreter vm;
+  // add with an empty stack
+  ASSERT_THROW( vm.call(MakeTestMethod({ 0xC0, 0x02 }, 0, 0), { }), dyn::RuntimeError );
+  // paths that meet with different stack depths
+  ASSERT_THROW( vm.call(MakeTestMethod({ 0x03, 0x6F, 0x00, 0x05, 0x24, 0x02 }, 0, 0), { }), dyn::RuntimeError );
+  // set_var of a local that the argFrame does not have
+  ASSERT_THROW( vm.call(MakeTestMethod({ 0x22, 0xA7, 0x22, 0x02 }, 0, 0), { }), dyn::RuntimeError );
+}
+
+TEST(DyneInterpreter, Jit) {
+  dyn::vm::Interpreter vm;
+  // sum := 0; for i := 1 to 10 do sum := sum + i; return sum
+  dyn::Ref loop = MakeTestMethod({ 0x20, 0xA3, 0x24, 0xA4, 0x27, 0x00, 0x28, 0xA5, 0x24, 0xA6,
+                                   0x7E, 0x7C, 0x5F, 0x00, 0x15, 0x7B, 0x7C, 0xC0, 0xA3, 0x7E,
+                                   0xB4, 0x7D, 0xBF, 0x00, 0x0F, 0x7B, 0x02 }, 0, 4);
+  // func(x) if x < 10 then 1 else 2
+  dyn::Ref test = MakeTestMethod({ 0x7B, 0x27, 0x00, 0x28, 0xC7, 0x00, 0x0A, 0x6F, 0x00, 0x0E,
+                                   0x27, 0x00, 0x04, 0x02, 0x27, 0x00, 0x08, 0x02 }, 1, 0);
+  // receiver:Twice(x) with Twice: func(x) x + x
+  dyn::Ref receiver = dyn::AllocateFrame();
+  dyn::SetFrameSlot(receiver, dyn::Sym("Twice"), MakeTestMethod({ 0x7B, 0x7B, 0xC0, 0x02 }, 1, 0));
+  for (int i=0; i<20; ++i) {
+    ASSERT_EQ( vm.call(loop, { }).GetInt(), 55 );
+    ASSERT_EQ( vm.call(test, { dyn::Ref(i) }).GetInt(), (i < 10) ? 1 : 2 );
+    ASSERT_EQ( vm.send(receiver, dyn::Sym("twice"), { dyn::Ref(i - 10) }).GetInt(), 2 * (i - 10) );
+  }
+  ASSERT_EQ( vm.compiled_functions(), 3u );
+  // Compiled code falls back to the runtime for other types, and errors
+  // become exceptions again.
+  dyn::Ref twice = vm.send(receiver, dyn::Sym("twice"), { dyn::MakeReal(1.25) });
+  ASSERT_EQ( twice.ToString(), dyn::MakeReal(2.5).ToString() );
+  ASSERT_THROW( vm.send(receiver, dyn::Sym("twice"), { dyn::Sym("x") }), dyn::RuntimeError );
+  ASSERT_EQ( vm.send(receiver, dyn::Sym("twice"), { dyn::Ref(4) }).GetInt(), 8 );
+}
+
+TEST(DyneInterpreter, IntegerOverflow) {
+  const dyn::Integer max = ((dyn::Integer)1 << 61) - 1, min = -((dyn::Integer)1 << 61);
+  const std::string big = dyn::MakeReal((dyn::Real)max + 1.0).ToString();
+  // BOr(x, 0) is proven to be an integer, so the verifier picks the
+  // unchecked variants of the instructions below.
+  // func(x) BOr(x, 0) + BOr(x, 0)
+  dyn::Ref add = MakeTestMethod({ 0x7B, 0x20, 0xC7, 0x00, 0x0F, 0x7B, 0x20, 0xC7, 0x00, 0x0F, 0xC0, 0x02 }, 1, 0);
+  // func(x) BOr(x, 0) - 1
+  dyn::Ref sub = MakeTestMethod({ 0x7B, 0x20, 0xC7, 0x00, 0x0F, 0x24, 0xC1, 0x02 }, 1, 0);
+  // func(x) begin v := BOr(x, 0); v := v + 1; return v - 1 end
+  dyn::Ref add_const = MakeTestMethod({ 0x7B, 0x20, 0xC7, 0x00, 0x0F, 0xA4, 0x7C, 0x24, 0xC0, 0xA4,
+                                        0x7C, 0x24, 0xC1, 0x02 }, 1, 1);
+  // func(x) begin n := 0; for i := BOr(x, 0) to BOr(x, 0) by 1000 do n := n + 1; return n end
+  dyn::Ref loop = MakeTestMethod({ 0x20, 0xA4, 0x7B, 0x20, 0xC7, 0x00, 0x0F, 0xA5, 0x7B, 0x20,
+                                   0xC7, 0x00, 0x0F, 0xA6, 0x27, 0x0F, 0xA0, 0xA7, 0x00, 0x07,
+                                   0x7F, 0x00, 0x07, 0x7D, 0x5F, 0x00, 0x23, 0x7C, 0x24, 0xC0,
+                                   0xA4, 0x7F, 0x00, 0x07, 0xB5, 0x7E, 0xBF, 0x00, 0x1B, 0x7C,
+                                   0x02 }, 1, 4);
+  for (bool jit: { false, true }) {
+    dyn::vm::Interpreter vm;
+    vm.set_jit(jit);
+    // Compile all functions first, then overflow in compiled code.
+    for (int i=0; i<30; ++i) {
+      bool overflow = (i >= 10) && (i % 5 == 4);
+      dyn::Ref r = vm.call(add, { dyn::Ref(overflow ? (dyn::Integer)1 << 60 : (dyn::Integer)i) });
+      if (overflow)
+        ASSERT_EQ( r.ToString(), big );
+      else
+        ASSERT_EQ( r.GetInt(), 2 * i );
+      r = vm.call(sub, { dyn::Ref(overflow ? min : (dyn::Integer)i) });
+      if (overflow)
+        ASSERT_EQ( r.ToString(), dyn::MakeReal((dyn::Real)min - 1.0).ToString() );
+      else
+        ASSERT_EQ( r.GetInt(), i - 1 );
+      r = vm.call(add_const, { dyn::Ref(overflow ? max : (dyn::Integer)i) });
+      if (overflow)
+        ASSERT_EQ( r.ToString(), dyn::MakeReal((dyn::Real)max + 1.0 - 1.0).ToString() );
+      else
+        ASSERT_EQ( r.GetInt(), i );
+      ASSERT_EQ( vm.call(loop, { dyn::Ref(overflow ? max : (dyn::Integer)i) }).GetInt(), 1 );
+    }
+    ASSERT_EQ( vm.call(add, { dyn::Ref(max / 2) }).GetInt(), max - 1 );
+    ASSERT_EQ( vm.call(sub, { dyn::Ref(min + 1) }).GetInt(), min );
+    ASSERT_EQ( vm.compiled_functions() > 0, jit );
+  }
+}
+
+TEST(DyneInterpreter, Profile) {
+  dyn::vm::Interpreter vm;
+  dyn::vm::Profile profile;
+  // receiver:Twice(x) with Twice: func(x) x + x
+  dyn::Ref receiver = dyn::AllocateFrame();
+  dyn::SetFrameSlot(receiver, dyn::Sym("Twice"), MakeTestMethod({ 0x7B, 0x7B, 0xC0, 0x02 }, 1, 0));
+  ASSERT_EQ( vm.send(receiver, dyn::Sym("twice"), { dyn::Ref(1) }).GetInt(), 2 );
+  vm.set_profile(&profile);
+  for (int i=0; i<20; ++i)
+    ASSERT_EQ( vm.send(receiver, dyn::Sym("twice"), { dyn::Ref(i) }).GetInt(), 2 * i );
+  vm.set_profile(nullptr);
+  ASSERT_EQ( vm.send(receiver, dyn::Sym("twice"), { dyn::Ref(2) }).GetInt(), 4 );
+  ASSERT_EQ( profile.op_count(dyn::lang::BC::Add), 20u );
+  ASSERT_EQ( profile.functions().size(), 1u );
+  const auto &f = profile.functions().begin()->second;
+  ASSERT_EQ( f.calls, 20u );
+  ASSERT_EQ( f.executed(), profile.total() );
+  std::ostringstream report;
+  profile.write_report(report);
+  ASSERT_NE( report.str().find("twice: 20 calls"), std::string::npos );
+  // The report must not change the formatting of the caller's stream.
+  ASSERT_EQ( report.flags(), std::ostringstream().flags() );
+  ASSERT_EQ( report.precision(), std::ostringstream().precision() );
+}
+
+TEST(DyneInterpreter, InlineCache) {
+  dyn::vm::Interpreter vm;
+  // return x, with x inherited through _proto
+  dyn::Ref func = MakeTestMethod({ 0x70, 0x02 }, 0, 0);
+  dyn::Ref literals = dyn::AllocateArray(0);
+  dyn::AddArraySlot(literals, dyn::Sym("x"));
+  dyn::SetFrameSlot(func, dyn::Sym("literals"), literals);
+  dyn::Ref a = dyn::AllocateFrame(), b = dyn::AllocateFrame();
+  dyn::SetFrameSlot(a, dyn::Sym("x"), 1);
+  dyn::SetFrameSlot(b, dyn::Sym("x"), 2);
+  dyn::Ref r1 = dyn::AllocateFrame();
+  dyn::SetFrameSlot(r1, dyn::Sym("_proto"), a);
+  // r2 shares the map of r1, but inherits from b
+  dyn::Ref r2 = dyn::Clone(r1);
+  dyn::SetFrameSlot(r2, dyn::Sym("_proto"), b);
+  ASSERT_EQ( vm.call(func, { }, r1).GetInt(), 1 );
+  ASSERT_EQ( vm.call(func, { }, r2).GetInt(), 2 );
+  ASSERT_EQ( vm.call(func, { }, r1).GetInt(), 1 );
+  // Shadowing the inherited slot must invalidate the cache.
+  dyn::SetFrameSlot(r1, dyn::Sym("x"), 5);
+  ASSERT_EQ( vm.call(func, { }, r1).GetInt(), 5 );
+  dyn::Ref r3 = dyn::AllocateFrame();
+  dyn::SetFrameSlot(r3, dyn::Sym("_proto"), a);
+  ASSERT_EQ( vm.call(func, { }, r3).GetInt(), 1 );
+  // Only the map that grows gets a new version.
+  dyn::Map *map3 = static_cast<dyn::Frame*>(r3.GetObject())->GetMap();
+  uint32_t version = map3->Version(), epoch = dyn::Map::Epoch();
+  dyn::SetFrameSlot(b, dyn::Sym("y"), 3);
+  ASSERT_EQ( map3->Version(), version );
+  dyn::SetFrameSlot(r3, dyn::Sym("x"), 7);
+  ASSERT_EQ( vm.call(func, { }, r3).GetInt(), 7 );
+  ASSERT_EQ( map3->Version(), version + 1 );
+  ASSERT_EQ( dyn::Map::Epoch(), epoch );
+}